@@ -0,0 +1,252 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+/*
+ * bench-csparse.c - multi-threaded churn benchmarks, for tscsparse and for
+ * a tssparse behind a mutex
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <tscsparse.h>
+#include <tssparse.h>
+
+#include "bench.h"
+
+
+TSCSPARSE_TYPEDEF(intcsparse, int);
+TSSPARSE_TYPEDEF(intsparse, int);
+
+
+/* operations done by each thread, and most objects each thread holds */
+#define OPS_PER_THREAD 1000000
+#define LIVE_PER_THREAD 1024
+
+#define MAX_THREADS 256
+
+
+static intcsparse shared_csparse;
+
+static intsparse shared_sparse;
+static pthread_mutex_t sparse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Pick the next pseudo-random number from a thread's state (xorshift).
+ */
+static inline unsigned int next_random(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+
+/*
+ * Churn thread for the tscsparse: add and remove at random, keeping up to
+ * LIVE_PER_THREAD objects at a time.
+ */
+static void *churn_csparse(void *arg)
+{
+    struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+    long live[LIVE_PER_THREAD];
+    int live_count = 0;
+    unsigned int state = *(unsigned int *)arg;
+    int i;
+
+    for (i=0; i<OPS_PER_THREAD; i++)
+    {
+        const unsigned int r = next_random(&state);
+
+        if (live_count == 0 || (live_count < LIVE_PER_THREAD && r % 2 == 0))
+        {
+            const long index = intcsparse_add(&shared_csparse, &cache, &i);
+
+            if (index < 0)
+            {
+                fprintf(stderr, "add failed: %ld\n", index);
+                exit(EXIT_FAILURE);
+            }
+
+            live[live_count++] = index;
+        }
+        else
+        {
+            const int pick = (int)((r >> 1) % (unsigned int)live_count);
+
+            intcsparse_remove(&shared_csparse, &cache, live[pick]);
+            live[pick] = live[--live_count];
+        }
+    }
+
+    while (live_count > 0)
+        intcsparse_remove(&shared_csparse, &cache, live[--live_count]);
+
+    intcsparse_flush(&shared_csparse, &cache);
+
+    return NULL;
+}
+
+
+/*
+ * Same as churn_csparse, but for a tssparse shared behind a mutex.
+ */
+static void *churn_sparse(void *arg)
+{
+    long live[LIVE_PER_THREAD];
+    int live_count = 0;
+    unsigned int state = *(unsigned int *)arg;
+    int i;
+
+    for (i=0; i<OPS_PER_THREAD; i++)
+    {
+        const unsigned int r = next_random(&state);
+
+        if (live_count == 0 || (live_count < LIVE_PER_THREAD && r % 2 == 0))
+        {
+            long index;
+
+            pthread_mutex_lock(&sparse_lock);
+            index = intsparse_add(&shared_sparse, &i);
+            pthread_mutex_unlock(&sparse_lock);
+
+            if (index < 0)
+            {
+                fprintf(stderr, "add failed: %ld\n", index);
+                exit(EXIT_FAILURE);
+            }
+
+            live[live_count++] = index;
+        }
+        else
+        {
+            const int pick = (int)((r >> 1) % (unsigned int)live_count);
+
+            pthread_mutex_lock(&sparse_lock);
+            intsparse_remove(&shared_sparse, live[pick]);
+            pthread_mutex_unlock(&sparse_lock);
+
+            live[pick] = live[--live_count];
+        }
+    }
+
+    pthread_mutex_lock(&sparse_lock);
+    while (live_count > 0)
+        intsparse_remove(&shared_sparse, live[--live_count]);
+    pthread_mutex_unlock(&sparse_lock);
+
+    return NULL;
+}
+
+
+/*
+ * Run a churn function on a number of threads at once, and report the
+ * total time.
+ */
+static int bench_churn(const char *name, void *(*churn)(void *),
+        int thread_count)
+{
+    pthread_t threads[MAX_THREADS];
+    unsigned int seeds[MAX_THREADS];
+    char label[64];
+    double start;
+    int i;
+
+    if (thread_count < 1 || thread_count > MAX_THREADS)
+    {
+        fprintf(stderr, "thread count must be 1 to %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    start = bench_now();
+
+    for (i=0; i<thread_count; i++)
+    {
+        seeds[i] = 2654435761u * (unsigned int)(i + 1);
+
+        if (pthread_create(&threads[i], NULL, churn, &seeds[i]) != 0)
+        {
+            fprintf(stderr, "can't create thread %d\n", i);
+            return 1;
+        }
+    }
+
+    for (i=0; i<thread_count; i++)
+        pthread_join(threads[i], NULL);
+
+    snprintf(label, sizeof(label), "%s x%d", name, thread_count);
+    bench_report(label, (double)thread_count * OPS_PER_THREAD,
+                 bench_now() - start);
+
+    return 0;
+}
+
+
+/*
+ * Run both churn benchmarks with the given number of threads.
+ */
+static int bench_threads(int thread_count)
+{
+    int retval;
+
+    retval = bench_churn("churn tscsparse", churn_csparse, thread_count);
+    intcsparse_clear(&shared_csparse);
+    if (retval != 0)
+        return retval;
+
+    retval = bench_churn("churn tssparse+mutex", churn_sparse, thread_count);
+    intsparse_truncate(&shared_sparse, 0);
+
+    return retval;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    if (argc > 1)
+    {
+        for (i=1; i<argc; i++)
+            if (bench_threads(atoi(argv[i])) != 0)
+                return EXIT_FAILURE;
+    }
+    else if (bench_threads(1) != 0 || bench_threads(4) != 0
+            || bench_threads(16) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,270 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-extsort.c - external sort of a file of ints four times larger
+ * than the sort's memory budget, against sorting it all in memory
+ *
+ * Usage: bench-extsort [count [run_len]]
+ *
+ * To measure a file four times the size of RAM, give a count of four
+ * times RAM over sizeof(int), and a run_len of somewhat under RAM over
+ * sizeof(int). The in-memory sort is only run for up to MAX_IN_MEMORY
+ * ints.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <tsarray.h>
+#include <tsextsort.h>
+
+#include "bench.h"
+
+
+TSARRAY_TYPEDEF(intarray, int);
+
+
+/* ints per write when creating the input */
+#define WRITE_LEN 65536
+
+/* the in-memory sort is only run for up to this many ints */
+#define MAX_IN_MEMORY 64000000L
+
+
+static int intcmp(const int *a, const int *b, void *arg)
+{
+    (void)arg;
+    return *a > *b ? 1 : (*a == *b ? 0 : -1);
+}
+
+
+/*
+ * Create an unlinked temporary file, with count pseudo-random ints if
+ * count is positive.
+ *
+ * Returns the file descriptor, or -1 in case of error.
+ */
+static int make_file(long count, unsigned int seed)
+{
+    char path[] = "bench-extsort.XXXXXX";
+    int *buf = malloc(WRITE_LEN * sizeof(int));
+    long i;
+    int fd;
+
+    if (buf == NULL)
+        return -1;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        free(buf);
+        return -1;
+    }
+    unlink(path);
+
+    for (i=0; i<count; )
+    {
+        long n = 0;
+
+        while (n < WRITE_LEN && i < count)
+        {
+            seed = seed * 1103515245 + 12345;
+            buf[n++] = (int)(seed >> 1);
+            i++;
+        }
+
+        if (write(fd, buf, n * sizeof(int)) != (ssize_t)(n * sizeof(int)))
+        {
+            close(fd);
+            free(buf);
+            return -1;
+        }
+    }
+
+    free(buf);
+
+    if (lseek(fd, 0, SEEK_SET) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Check that a file holds count ints in ascending order.
+ */
+static int check_sorted(int fd, long count)
+{
+    intarray *chunk = intarray_new();
+    long total = 0;
+    int last = 0;
+    long got;
+    long i;
+
+    if (chunk == NULL || lseek(fd, 0, SEEK_SET) != 0)
+        return 1;
+
+    while ((got = intarray_read(chunk, fd, WRITE_LEN)) > 0)
+    {
+        for (i=0; i<got; i++)
+        {
+            if ((total > 0 || i > 0) && chunk->items[i] < last)
+            {
+                intarray_free(chunk);
+                return 1;
+            }
+            last = chunk->items[i];
+        }
+
+        total += got;
+    }
+
+    intarray_free(chunk);
+
+    return got != 0 || total != count;
+}
+
+
+/*
+ * Sort count ints from a file into another, in runs of run_len.
+ */
+static int bench_external(long count, unsigned long run_len)
+{
+    const int in_fd = make_file(count, 1);
+    const int out_fd = make_file(0, 0);
+    struct tsextsort sort;
+    double start;
+    int failed;
+
+    if (in_fd < 0 || out_fd < 0)
+    {
+        perror("bench-extsort");
+        return 1;
+    }
+
+    start = bench_now();
+
+    failed = tsextsort_init(&sort, sizeof(int), run_len,
+            (int (*)(const void *, const void *, void *))intcmp, NULL,
+            ".") != 0;
+
+    if (!failed)
+    {
+        failed = tsextsort_add_fd(&sort, in_fd) != 0
+            || tsextsort_finish(&sort) != 0
+            || tsextsort_write(&sort, out_fd) != 0;
+
+        tsextsort_free(&sort);
+    }
+
+    if (!failed)
+        bench_report("tsextsort", (double)count, bench_now() - start);
+
+    failed = failed || check_sorted(out_fd, count);
+
+    close(in_fd);
+    close(out_fd);
+
+    if (failed)
+        fprintf(stderr, "external sort failed\n");
+
+    return failed;
+}
+
+
+/*
+ * Sort count ints from a file into another, all at once in memory.
+ */
+static int bench_in_memory(long count)
+{
+    const int in_fd = make_file(count, 1);
+    const int out_fd = make_file(0, 0);
+    intarray *array = intarray_new();
+    double start;
+    int failed;
+
+    if (in_fd < 0 || out_fd < 0 || array == NULL)
+    {
+        perror("bench-extsort");
+        return 1;
+    }
+
+    start = bench_now();
+
+    failed = intarray_read(array, in_fd, (unsigned long)count) != count
+        || intarray_sort(array, intcmp, NULL) != 0
+        || write(out_fd, array->items, count * sizeof(int))
+            != (ssize_t)(count * sizeof(int));
+
+    if (!failed)
+        bench_report("tsarray_sort", (double)count, bench_now() - start);
+
+    intarray_free(array);
+
+    failed = failed || check_sorted(out_fd, count);
+
+    close(in_fd);
+    close(out_fd);
+
+    if (failed)
+        fprintf(stderr, "in-memory sort failed\n");
+
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const long count = argc > 1 ? atol(argv[1]) : 16000000;
+    const long run_len = argc > 2 ? atol(argv[2]) : count / 4;
+
+    if (count <= 0 || run_len <= 0)
+    {
+        fprintf(stderr, "usage: %s [count [run_len]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld ints, runs of %ld\n", count, run_len);
+
+    if (bench_external(count, (unsigned long)run_len) != 0)
+        return EXIT_FAILURE;
+
+    if (count <= MAX_IN_MEMORY && bench_in_memory(count) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,218 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-log.c - appending to a logged tsarray, one event at a time, with
+ * different sync thresholds, against writing the same bytes to a file
+ * in large blocks and syncing once
+ *
+ * Usage: bench-log [count]
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tsarray.h>
+
+#include "bench.h"
+
+
+/* a typical small event record */
+struct event {
+    long long time;
+    int kind;
+    int value;
+};
+
+TSARRAY_TYPEDEF(eventarray, struct event);
+
+
+/* events per write in the sequential baseline */
+#define WRITE_LEN 65536
+
+
+static char path[] = "bench-log.XXXXXX";
+
+
+/*
+ * Create an empty file, leaving its name in path.
+ */
+static int make_file(void)
+{
+    int fd;
+
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+    fd = mkstemp(path);
+
+    return fd;
+}
+
+
+/*
+ * Report a run as both events per second and MB/s.
+ */
+static void report(const char *name, long count, double elapsed)
+{
+    bench_report(name, (double)count, elapsed);
+    printf("%-24s %10.1f MB/s\n", "",
+           count * sizeof(struct event) / elapsed / 1e6);
+}
+
+
+/*
+ * Append count events to a logged array, syncing every sync_bytes.
+ */
+static int bench_logged(long count, size_t sync_bytes)
+{
+    eventarray *array = eventarray_new();
+    struct event ev = { 0, 1, 0 };
+    char name[64];
+    double start;
+    int failed;
+    long i;
+    int fd;
+
+    if (array == NULL || (fd = make_file()) < 0)
+    {
+        perror("bench-log");
+        return 1;
+    }
+    close(fd);
+
+    start = bench_now();
+
+    failed = eventarray_log_open(array, path, sync_bytes, 0) != 0;
+
+    for (i=0; i<count && !failed; i++)
+    {
+        ev.time = i;
+        ev.value = (int)i;
+        failed = eventarray_append(array, &ev) != 0;
+    }
+
+    failed = failed || eventarray_log_close(array) != 0;
+
+    if (!failed)
+    {
+        snprintf(name, sizeof(name), "log, sync %zu KiB",
+                 sync_bytes / 1024);
+        report(name, count, bench_now() - start);
+    }
+    else
+        fprintf(stderr, "logged append failed\n");
+
+    eventarray_free(array);
+    unlink(path);
+
+    return failed;
+}
+
+
+/*
+ * Write count events to a file in large blocks, syncing once at the end.
+ */
+static int bench_sequential(long count)
+{
+    struct event *buf = malloc(WRITE_LEN * sizeof(struct event));
+    double start;
+    int failed = 0;
+    long i;
+    int fd;
+
+    if (buf == NULL || (fd = make_file()) < 0)
+    {
+        perror("bench-log");
+        free(buf);
+        return 1;
+    }
+
+    start = bench_now();
+
+    for (i=0; i<count && !failed; )
+    {
+        long n = 0;
+
+        while (n < WRITE_LEN && i < count)
+        {
+            buf[n].time = i;
+            buf[n].kind = 1;
+            buf[n].value = (int)i;
+            n++;
+            i++;
+        }
+
+        failed = write(fd, buf, n * sizeof(struct event))
+            != (ssize_t)(n * sizeof(struct event));
+    }
+
+    failed = failed || fsync(fd) != 0;
+
+    if (!failed)
+        report("sequential write", count, bench_now() - start);
+    else
+        fprintf(stderr, "sequential write failed\n");
+
+    close(fd);
+    unlink(path);
+    free(buf);
+
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const long count = argc > 1 ? atol(argv[1]) : 8000000;
+    static const size_t thresholds[] = {
+        64 * 1024, 1024 * 1024, 16 * 1024 * 1024
+    };
+    unsigned int i;
+
+    if (count <= 0)
+    {
+        fprintf(stderr, "usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld events of %zu bytes\n", count, sizeof(struct event));
+
+    if (bench_sequential(count) != 0)
+        return EXIT_FAILURE;
+
+    for (i=0; i<sizeof(thresholds)/sizeof(thresholds[0]); i++)
+        if (bench_logged(count, thresholds[i]) != 0)
+            return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
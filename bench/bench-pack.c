@@ -0,0 +1,204 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-pack.c - size and speed of compressed arrays of 64-bit integers,
+ * against the plain tsarray they were built from
+ *
+ * Usage: bench-pack [count]
+ *
+ * For each kind of data, prints the compressed size, then the time to
+ * sum every value (decoding a run at a time, against reading the plain
+ * array), and to get values at random indices.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tsarray.h>
+#include <tspack.h>
+
+#include "bench.h"
+
+
+TSARRAY_TYPEDEF(u64array, uint64_t);
+
+
+/* values decoded at a time, when summing */
+#define RUN_LEN 4096
+
+/* number of random gets */
+#define GET_COUNT 4000000
+
+
+enum data_kind {
+    DATA_IDS,           /* sorted, with gaps of 1 to 16 */
+    DATA_STAMPS,        /* nanosecond timestamps, a few microseconds apart */
+    DATA_NARROW,        /* unsorted, within a range of 2^20 */
+};
+
+static const char *const data_names[] = { "ids", "timestamps", "narrow" };
+
+
+static uint64_t next_random(uint64_t *seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *seed ^ (*seed >> 29);
+}
+
+
+/*
+ * Fill an array with count values of the given kind.
+ */
+static int fill(u64array *array, enum data_kind kind, long count)
+{
+    uint64_t seed = 42;
+    uint64_t value = 1500000000000000000ULL;
+    long i;
+
+    for (i=0; i<count; i++)
+    {
+        const uint64_t r = next_random(&seed);
+
+        switch (kind)
+        {
+            case DATA_IDS:
+                value += 1 + r % 16;
+                break;
+            case DATA_STAMPS:
+                value += r % 5000;
+                break;
+            case DATA_NARROW:
+                value = 7000000000ULL + (r >> 44);
+                break;
+        }
+
+        if (u64array_append(array, &value) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+static int bench_kind(enum data_kind kind, long count)
+{
+    u64array *array = u64array_new();
+    uint64_t *run = malloc(RUN_LEN * sizeof(uint64_t));
+    struct tspack *pack;
+    uint64_t seed = 7;
+    uint64_t plain_sum = 0, pack_sum = 0;
+    char name[64];
+    double start;
+    long done, n;
+    long i;
+
+    if (array == NULL || run == NULL || fill(array, kind, count) != 0)
+    {
+        fprintf(stderr, "bench-pack: out of memory\n");
+        return 1;
+    }
+
+    start = bench_now();
+    pack = TSPACK_NEW(array);
+    if (pack == NULL)
+    {
+        perror("bench-pack");
+        return 1;
+    }
+    snprintf(name, sizeof(name), "%s: build", data_names[kind]);
+    bench_report(name, (double)count, bench_now() - start);
+
+    printf("%-24s %12.3f bytes/value %8.2fx smaller\n", "",
+           (double)tspack_size(pack) / count,
+           (double)count * sizeof(uint64_t) / tspack_size(pack));
+
+    start = bench_now();
+    for (i=0; i<count; i++)
+        plain_sum += array->items[i];
+    snprintf(name, sizeof(name), "%s: sum plain", data_names[kind]);
+    bench_report(name, (double)count, bench_now() - start);
+
+    start = bench_now();
+    for (done=0; (n = tspack_decode(pack, done, run, RUN_LEN)) > 0; done+=n)
+        for (i=0; i<n; i++)
+            pack_sum += run[i];
+    snprintf(name, sizeof(name), "%s: sum decoded", data_names[kind]);
+    bench_report(name, (double)count, bench_now() - start);
+
+    start = bench_now();
+    for (i=0; i<GET_COUNT; i++)
+        plain_sum += array->items[next_random(&seed) % count];
+    snprintf(name, sizeof(name), "%s: get plain", data_names[kind]);
+    bench_report(name, GET_COUNT, bench_now() - start);
+
+    seed = 7;
+    start = bench_now();
+    for (i=0; i<GET_COUNT; i++)
+        pack_sum += tspack_get(pack, next_random(&seed) % count);
+    snprintf(name, sizeof(name), "%s: get packed", data_names[kind]);
+    bench_report(name, GET_COUNT, bench_now() - start);
+
+    tspack_free(pack);
+    u64array_free(array);
+    free(run);
+
+    if (plain_sum != pack_sum)
+    {
+        fprintf(stderr, "bench-pack: %s decoded wrong\n", data_names[kind]);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const long count = argc > 1 ? atol(argv[1]) : 16000000;
+
+    if (count <= 0)
+    {
+        fprintf(stderr, "usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld values\n", count);
+
+    if (bench_kind(DATA_IDS, count) != 0
+            || bench_kind(DATA_STAMPS, count) != 0
+            || bench_kind(DATA_NARROW, count) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,242 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-shm.c - handing an array of ints from a child process to its
+ * parent through a pipe, against through a shared array
+ *
+ * Usage: bench-shm [count]
+ *
+ * The child produces the ints in batches of BATCH_LEN. Through the pipe,
+ * the parent gathers them into a tsarray of its own, as a receiver
+ * deserializing the array would; through the shared array, it has them
+ * in place. Either way it sums them as they arrive. Times run from the
+ * fork until the parent has summed the last one.
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <tsarray.h>
+#include <tsshm.h>
+
+#include "bench.h"
+
+
+TSARRAY_TYPEDEF(intarray, int);
+TSSHM_TYPEDEF(intshm, int);
+
+
+/* ints produced at a time */
+#define BATCH_LEN 4096
+
+
+/*
+ * Fill a batch with the ints from start on, up to count.
+ *
+ * Returns how many were filled in.
+ */
+static long fill_batch(int *batch, long start, long count)
+{
+    long n;
+
+    for (n=0; n<BATCH_LEN && start+n<count; n++)
+        batch[n] = (int)(start + n);
+
+    return n;
+}
+
+
+/*
+ * Wait for the child, and report the run if all went well.
+ */
+static int finish(const char *name, pid_t pid, long count, long long sum,
+        double start)
+{
+    const double elapsed = bench_now() - start;
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0
+            || sum != (long long)count * (count - 1) / 2)
+    {
+        fprintf(stderr, "%s failed\n", name);
+        return 1;
+    }
+
+    bench_report(name, (double)count, elapsed);
+    return 0;
+}
+
+
+/*
+ * Hand count ints through a pipe.
+ */
+static int bench_pipe(long count)
+{
+    intarray *array = intarray_new();
+    intarray *chunk = intarray_new();
+    long long sum = 0;
+    double start;
+    long done = 0;
+    long got;
+    int fds[2];
+    pid_t pid;
+
+    if (array == NULL || chunk == NULL || pipe(fds) != 0)
+    {
+        perror("bench-shm");
+        return 1;
+    }
+
+    start = bench_now();
+
+    pid = fork();
+    if (pid == 0)
+    {
+        int batch[BATCH_LEN];
+        long i;
+
+        close(fds[0]);
+
+        for (i=0; i<count; )
+        {
+            const long n = fill_batch(batch, i, count);
+
+            if (write(fds[1], batch, n * sizeof(int))
+                    != (ssize_t)(n * sizeof(int)))
+                _exit(1);
+            i += n;
+        }
+
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    while ((got = intarray_read(chunk, fds[0], BATCH_LEN)) > 0)
+    {
+        if (intarray_extend(array, chunk) != 0)
+            break;
+
+        for (; done<(long)intarray_len(array); done++)
+            sum += array->items[done];
+    }
+
+    close(fds[0]);
+    intarray_free(chunk);
+    intarray_free(array);
+
+    return finish("pipe", pid, count, sum, start);
+}
+
+
+/*
+ * Hand count ints through a shared array.
+ */
+static int bench_shm(long count)
+{
+    intshm *writer = intshm_create(NULL, 0);
+    intshm *reader;
+    long long sum = 0;
+    double start;
+    long done = 0;
+    long len;
+    pid_t pid;
+
+    if (writer == NULL
+            || (reader = intshm_from_fd(intshm_fd(writer))) == NULL)
+    {
+        perror("bench-shm");
+        return 1;
+    }
+
+    start = bench_now();
+
+    pid = fork();
+    if (pid == 0)
+    {
+        int batch[BATCH_LEN];
+        long i;
+
+        for (i=0; i<count; )
+        {
+            const long n = fill_batch(batch, i, count);
+
+            if (intshm_extend(writer, batch, (unsigned long)n) != 0)
+                _exit(1);
+            i += n;
+        }
+
+        _exit(0);
+    }
+
+    do
+    {
+        len = intshm_refresh(reader);
+        if (len < 0)
+            break;
+
+        if (len == done)
+            sched_yield();
+
+        for (; done<len; done++)
+            sum += reader->items[done];
+    } while (done < count);
+
+    intshm_free(writer);
+    intshm_free(reader);
+
+    return finish("tsshm", pid, count, sum, start);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const long count = argc > 1 ? atol(argv[1]) : 64000000;
+
+    if (count <= 0 || count > 0x7fffffffL)
+    {
+        fprintf(stderr, "usage: %s [count]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%ld ints, in batches of %d\n", count, BATCH_LEN);
+
+    if (bench_pipe(count) != 0 || bench_shm(count) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,378 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-sparse.c - tssparse and tsdense benchmarks
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tssparse.h>
+#include <tsdense.h>
+
+#include "bench.h"
+
+
+TSSPARSE_TYPEDEF(intsparse, int);
+TSDENSE_TYPEDEF(intdense, int);
+
+
+/*
+ * Fill an empty tssparse with count items, and report the time it took.
+ * The array is paged if page_shift is non-zero.
+ */
+static int bench_fill(int count, int page_shift)
+{
+    intsparse s = TSSPARSE_INITIALIZER;
+    double start, elapsed;
+    int i;
+
+    intsparse_set_paged(&s, page_shift);
+
+    start = bench_now();
+
+    for (i=0; i<count; i++)
+    {
+        if (intsparse_add(&s, &i) < 0)
+        {
+            fprintf(stderr, "add failed at %d\n", i);
+            return 1;
+        }
+    }
+
+    elapsed = bench_now() - start;
+
+    bench_report(page_shift != 0 ? "fill paged" : "fill", count, elapsed);
+    printf("    len=%ld capacity=%ld\n", s.len, s.capacity);
+
+    intsparse_truncate(&s, 0);
+
+    return 0;
+}
+
+
+/*
+ * Iterate over a tssparse with only 1 in every 10 items used, comparing
+ * a plain loop over all indices with the used-item iteration API.
+ */
+static int bench_iterate(int count)
+{
+    intsparse s = TSSPARSE_INITIALIZER;
+    long indices[256];
+    double start;
+    long sum_get = 0, sum_next = 0, sum_batch = 0;
+    int found;
+    int i;
+
+    for (i=0; i<count; i++)
+    {
+        if (intsparse_add(&s, &i) < 0)
+        {
+            fprintf(stderr, "add failed at %d\n", i);
+            return 1;
+        }
+    }
+
+    for (i=0; i<count; i++)
+        if (i % 10 != 0)
+            intsparse_remove(&s, i);
+
+    start = bench_now();
+    for (i=0; i<s.len; i++)
+    {
+        const int *obj = intsparse_get_nth(&s, i);
+
+        if (obj != NULL)
+            sum_get += *obj;
+    }
+    bench_report("iterate get_nth", s.used_count, bench_now() - start);
+
+    start = bench_now();
+    TSSPARSE_FOREACH(intsparse, &s, i)
+        sum_next += s.items[i];
+    bench_report("iterate foreach", s.used_count, bench_now() - start);
+
+    start = bench_now();
+    i = 0;
+    while ((found = intsparse_next_batch(&s, i, indices, 256)) > 0)
+    {
+        int j;
+
+        for (j=0; j<found; j++)
+            sum_batch += s.items[indices[j]];
+
+        i = indices[found-1] + 1;
+    }
+    bench_report("iterate next_batch", s.used_count, bench_now() - start);
+
+    intsparse_truncate(&s, 0);
+
+    if (sum_get != sum_next || sum_get != sum_batch)
+    {
+        fprintf(stderr, "iteration mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Fill a tssparse with count items, and remove every other one.
+ */
+static int fill_half(intsparse *s, int count)
+{
+    int i;
+
+    for (i=0; i<count; i++)
+    {
+        if (intsparse_add(s, &i) < 0)
+        {
+            fprintf(stderr, "add failed at %d\n", i);
+            return 1;
+        }
+    }
+
+    for (i=0; i<count; i+=2)
+        intsparse_remove(s, i);
+
+    return 0;
+}
+
+
+/*
+ * Fill the holes of a half empty tssparse, and report the time it took.
+ */
+static int bench_reuse(int count)
+{
+    intsparse s = TSSPARSE_INITIALIZER;
+    double start;
+    int i;
+
+    if (fill_half(&s, count) != 0)
+        return 1;
+
+    start = bench_now();
+
+    for (i=0; i<count; i+=2)
+    {
+        if (intsparse_add(&s, &i) < 0)
+        {
+            fprintf(stderr, "add failed at %d\n", i);
+            return 1;
+        }
+    }
+
+    bench_report("reuse", count / 2, bench_now() - start);
+
+    intsparse_truncate(&s, 0);
+
+    return 0;
+}
+
+
+/*
+ * Same as bench_fill and bench_reuse, but adding all the objects with a
+ * single call; then remove them all with a single call.
+ */
+static int bench_batch(int count)
+{
+    intsparse s = TSSPARSE_INITIALIZER;
+    int *objects = malloc((size_t)count * sizeof(int));
+    long *indices = malloc((size_t)count * sizeof(long));
+    double start;
+    int retval = 1;
+    int i;
+
+    if (objects == NULL || indices == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        goto out;
+    }
+
+    for (i=0; i<count; i++)
+        objects[i] = i;
+
+    start = bench_now();
+    if (intsparse_add_n(&s, objects, count, indices) != 0)
+    {
+        fprintf(stderr, "add_n failed\n");
+        goto out;
+    }
+    bench_report("fill add_n", count, bench_now() - start);
+
+    start = bench_now();
+    intsparse_remove_n(&s, indices, count);
+    bench_report("remove_n", count, bench_now() - start);
+
+    intsparse_truncate(&s, 0);
+    if (fill_half(&s, count) != 0)
+        goto out;
+
+    start = bench_now();
+    if (intsparse_add_n(&s, objects, count / 2, indices) != 0)
+    {
+        fprintf(stderr, "add_n failed\n");
+        goto out;
+    }
+    bench_report("reuse add_n", count / 2, bench_now() - start);
+
+    retval = 0;
+
+out:
+    intsparse_truncate(&s, 0);
+    free(indices);
+    free(objects);
+
+    return retval;
+}
+
+
+/*
+ * Compact a half empty tssparse all at once, then a few steps at a time,
+ * reporting the longest pause of the latter.
+ */
+static int bench_compact(int count)
+{
+    const int max_moves = 4096;
+    intsparse s = TSSPARSE_INITIALIZER;
+    double start, worst = 0;
+    int calls = 0;
+    int retval;
+
+    if (fill_half(&s, count) != 0)
+        return 1;
+
+    start = bench_now();
+    intsparse_compact(&s, 0);
+    bench_report("compact", count, bench_now() - start);
+
+    intsparse_truncate(&s, 0);
+    if (fill_half(&s, count) != 0)
+        return 1;
+
+    do
+    {
+        double elapsed;
+
+        start = bench_now();
+        retval = intsparse_compact_step(&s, max_moves, NULL);
+        elapsed = bench_now() - start;
+
+        if (elapsed > worst)
+            worst = elapsed;
+
+        calls++;
+    } while (retval == 1);
+
+    printf("compact_step: %d calls of %d moves, longest %.3f ms\n",
+           calls, max_moves, worst * 1e3);
+
+    intsparse_truncate(&s, 0);
+
+    return retval < 0;
+}
+
+
+/*
+ * Same as bench_iterate, but with a tsdense, where the used items are
+ * packed together.
+ */
+static int bench_iterate_dense(int count)
+{
+    intdense d = TSDENSE_INITIALIZER;
+    double start;
+    long sum = 0, expected = 0;
+    int i;
+
+    for (i=0; i<count; i++)
+    {
+        if (intdense_add(&d, &i) < 0)
+        {
+            fprintf(stderr, "add failed at %d\n", i);
+            return 1;
+        }
+    }
+
+    for (i=0; i<count; i++)
+    {
+        if (i % 10 != 0)
+            intdense_remove(&d, i);
+        else
+            expected += i;
+    }
+
+    start = bench_now();
+    for (i=0; i<d.count; i++)
+        sum += d.objects->items[i];
+    bench_report("iterate dense", d.count, bench_now() - start);
+
+    intdense_clear(&d);
+
+    if (sum != expected)
+    {
+        fprintf(stderr, "iteration mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    if (argc > 1)
+    {
+        for (i=1; i<argc; i++)
+            if (bench_fill(atoi(argv[i]), 0) != 0
+                    || bench_fill(atoi(argv[i]), 12) != 0
+                    || bench_iterate(atoi(argv[i])) != 0
+                    || bench_iterate_dense(atoi(argv[i])) != 0
+                    || bench_reuse(atoi(argv[i])) != 0
+                    || bench_batch(atoi(argv[i])) != 0
+                    || bench_compact(atoi(argv[i])) != 0)
+                return EXIT_FAILURE;
+    }
+    else if (bench_fill(1000000, 0) != 0 || bench_fill(10000000, 0) != 0
+            || bench_fill(10000000, 12) != 0
+            || bench_iterate(10000000) != 0
+            || bench_iterate_dense(10000000) != 0
+            || bench_reuse(10000000) != 0
+            || bench_batch(10000000) != 0
+            || bench_compact(10000000) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,271 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench-stream.c - streaming a file of ints, with a plain read loop and
+ * with tsreader's read-ahead
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <tsarray.h>
+#include <tsreader.h>
+
+#include "bench.h"
+
+
+TSARRAY_TYPEDEF(intarray, int);
+
+
+/* items per chunk read */
+#define CHUNK_LEN 65536
+
+
+/*
+ * Create an unlinked temporary file holding the ints 0 to count-1.
+ *
+ * Returns the file descriptor, or -1 in case of error.
+ */
+static int make_file(long count)
+{
+    char path[] = "bench-stream.XXXXXX";
+    int *buf = malloc(CHUNK_LEN * sizeof(int));
+    long i;
+    int fd;
+
+    if (buf == NULL)
+        return -1;
+
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        free(buf);
+        return -1;
+    }
+    unlink(path);
+
+    for (i=0; i<count; )
+    {
+        long n = 0;
+
+        while (n < CHUNK_LEN && i < count)
+            buf[n++] = (int)i++;
+
+        if (write(fd, buf, n * sizeof(int)) != (ssize_t)(n * sizeof(int)))
+        {
+            close(fd);
+            free(buf);
+            return -1;
+        }
+    }
+
+    free(buf);
+
+    return fd;
+}
+
+
+/*
+ * Sum the items of a chunk. Stands for whatever work the caller would do
+ * with each chunk, which read-ahead overlaps with the reading.
+ */
+static long long consume(const int *items, long len)
+{
+    long long sum = 0;
+    long i;
+
+    for (i=0; i<len; i++)
+        sum += items[i];
+
+    return sum;
+}
+
+
+/*
+ * Stream the file with read(2) into a fixed buffer.
+ */
+static int bench_plain(int fd, long count, long long expected)
+{
+    int *buf = malloc(CHUNK_LEN * sizeof(int));
+    long long sum = 0;
+    double start;
+    ssize_t got;
+
+    if (buf == NULL || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        free(buf);
+        return 1;
+    }
+
+    start = bench_now();
+
+    while ((got = read(fd, buf, CHUNK_LEN * sizeof(int))) > 0)
+        sum += consume(buf, (long)(got / (ssize_t)sizeof(int)));
+
+    bench_report("read loop", (double)count, bench_now() - start);
+
+    free(buf);
+
+    if (got < 0 || sum != expected)
+    {
+        fprintf(stderr, "plain read mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Stream the file with tsarray_read, reusing a single array.
+ */
+static int bench_array(int fd, long count, long long expected)
+{
+    intarray *chunk = intarray_new();
+    long long sum = 0;
+    double start;
+    long got;
+
+    if (chunk == NULL || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        if (chunk != NULL)
+            intarray_free(chunk);
+        return 1;
+    }
+
+    start = bench_now();
+
+    while ((got = intarray_read(chunk, fd, CHUNK_LEN)) > 0)
+        sum += consume(chunk->items, (long)intarray_len(chunk));
+
+    bench_report("tsarray_read loop", (double)count, bench_now() - start);
+
+    intarray_free(chunk);
+
+    if (got < 0 || sum != expected)
+    {
+        fprintf(stderr, "tsarray_read mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Stream the file with a tsreader, reading the next chunk in the
+ * background while the current one is consumed.
+ */
+static int bench_reader(int fd, long count, long long expected)
+{
+    intarray *chunk = intarray_new();
+    struct tsreader reader;
+    long long sum = 0;
+    double start;
+    long got;
+
+    if (chunk == NULL || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        if (chunk != NULL)
+            intarray_free(chunk);
+        return 1;
+    }
+
+    start = bench_now();
+
+    if (TSREADER_START(&reader, fd, chunk, CHUNK_LEN) != 0)
+    {
+        intarray_free(chunk);
+        return 1;
+    }
+
+    while ((got = TSREADER_NEXT(&reader, chunk)) > 0)
+        sum += consume(chunk->items, (long)intarray_len(chunk));
+
+    tsreader_stop(&reader);
+
+    bench_report("tsreader", (double)count, bench_now() - start);
+
+    intarray_free(chunk);
+
+    if (got < 0 || sum != expected)
+    {
+        fprintf(stderr, "tsreader mismatch\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Run every benchmark over a file of count ints.
+ */
+static int bench_stream(long count)
+{
+    const long long expected = (long long)count * (count - 1) / 2;
+    int fd = make_file(count);
+    int ret;
+
+    if (fd < 0)
+    {
+        perror("bench-stream");
+        return 1;
+    }
+
+    ret = bench_plain(fd, count, expected)
+            || bench_array(fd, count, expected)
+            || bench_reader(fd, count, expected);
+
+    close(fd);
+
+    return ret;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+
+    if (argc > 1)
+    {
+        for (i=1; i<argc; i++)
+            if (bench_stream(atol(argv[i])) != 0)
+                return EXIT_FAILURE;
+    }
+    else if (bench_stream(1000000) != 0 || bench_stream(16000000) != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,72 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * bench.h - common definitions for the benchmarks
+ */
+
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+
+/* get clock_gettime */
+#include <time.h>
+
+
+/*
+ * Get the current time, in seconds, from a monotonic clock.
+ */
+static inline double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Print the result of a benchmark run.
+ *
+ * Receives a name for the benchmark, the number of operations performed,
+ * and the elapsed time in seconds.
+ */
+static inline void bench_report(const char *name, double ops, double elapsed)
+{
+    printf("%-24s %12.0f ops %10.3f ms %10.2f ns/op\n", name, ops,
+           elapsed * 1e3, elapsed * 1e9 / ops);
+}
+
+
+#endif  /* _BENCH_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
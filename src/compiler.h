@@ -47,6 +47,14 @@
 #endif  /* not gcc */
 
 
+/* Hint the CPU to start loading the cache line at addr, for reading */
+#ifdef __GNUC__
+#  define prefetch(addr)    __builtin_prefetch(addr)
+#else   /* not gcc */
+#  define prefetch(addr)    ((void)(addr))
+#endif  /* not gcc */
+
+
 
 /*
  * Functions marked with __ATTR_CONST do not examine any values except
@@ -104,12 +112,116 @@
 
 
 
+/* get uint64_t */
+#include <stdint.h>
+
+
+/*
+ * Bit scanning on 64-bit words. ctz64 returns the number of trailing zero
+ * bits (i.e. the index of the lowest set bit), and clz64 the number of
+ * leading zero bits; x MUST be non-zero. popcount64 returns the number of
+ * set bits.
+ */
+#ifdef __GNUC__
+#  define ctz64(x)      __builtin_ctzll(x)
+#  define clz64(x)      __builtin_clzll(x)
+#  define popcount64(x) __builtin_popcountll(x)
+#else   /* not gcc */
+static inline int ctz64(uint64_t x)
+{
+    int n = 0;
+
+    while (!(x & 1))
+    {
+        x >>= 1;
+        n++;
+    }
+
+    return n;
+}
+
+static inline int clz64(uint64_t x)
+{
+    int n = 0;
+
+    while (!(x & ((uint64_t)1 << 63)))
+    {
+        x <<= 1;
+        n++;
+    }
+
+    return n;
+}
+
+static inline int popcount64(uint64_t x)
+{
+    int n = 0;
+
+    for (; x != 0; x &= x - 1)
+        n++;
+
+    return n;
+}
+#endif  /* not gcc */
+
+
+
 #ifdef __GNUC__
 #  define __ATTR_PACKED __attribute__((packed))
 #else
 #  define __ATTR_PACKED
 #endif
 
+
+/*
+ * Functions marked with __ALWAYS_INLINE are inlined even without
+ * optimization. Meant for generic kernels that are instantiated with
+ * constant arguments, for the compiler to specialize.
+ */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#  define __ALWAYS_INLINE   __attribute__((__always_inline__))
+#else
+#  define __ALWAYS_INLINE
+#endif
+
+
+/*
+ * __UNROLL_FULLY, placed right before a loop with a constant number of
+ * iterations (up to 128), asks for it to be unrolled completely, so that
+ * whatever depends on the loop counter becomes a constant.
+ */
+#if defined(__clang__)
+#  define __UNROLL_FULLY    _Pragma("clang loop unroll(full)")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#  define __UNROLL_FULLY    _Pragma("GCC unroll 128")
+#else
+#  define __UNROLL_FULLY
+#endif
+
+
+/*
+ * Functions marked with __NO_SANITIZE_THREAD aren't instrumented by
+ * ThreadSanitizer. Only meant for reads which race with writers on
+ * purpose, and whose result is detected as torn and thrown away (as with
+ * a sequence counter).
+ */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 8)
+#  define __NO_SANITIZE_THREAD  __attribute__((__no_sanitize__("thread")))
+#else
+#  define __NO_SANITIZE_THREAD
+#endif
+
+
+/*
+ * HAVE_VECTOR_EXT tells whether GCC's generic vector extensions are
+ * available (types declared with __attribute__((vector_size(n))), with
+ * the usual arithmetic and bitwise operators working lane by lane). They
+ * compile to SSE2 on x86-64, NEON on ARM, and plain scalar code elsewhere.
+ */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#  define HAVE_VECTOR_EXT 1
+#endif
+
 #endif  /* _COMPILER_H */
 
 
@@ -0,0 +1,156 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * fileio.h - reading and writing of saved arrays, internal header
+ */
+
+
+#ifndef _FILEIO_H
+#define _FILEIO_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get errno, for retrying interrupted reads and writes */
+#include <errno.h>
+
+/* get uint64_t */
+#include <stdint.h>
+
+/* get read and write */
+#include <unistd.h>
+
+
+#include "common.h"
+
+
+/*
+ * Most bytes to read or write in a single system call. Keeps within
+ * ssize_t, as read and write may not do more than that at once.
+ */
+#define FILEIO_MAX_CHUNK ((size_t)1 << 30)
+
+/* Byte order mark of saved arrays, written in the machine's own order */
+#define FILEIO_BYTE_ORDER 0x01020304
+
+/* Initial value for fileio_hash (the 64-bit FNV offset basis) */
+#define FILEIO_HASH_INIT 0xcbf29ce484222325ULL
+
+
+/*
+ * Add data to the checksum of a saved array.
+ *
+ * Receives the checksum so far (FILEIO_HASH_INIT to start with), the data
+ * and its size in bytes. Returns the 64-bit FNV-1a hash of everything
+ * added so far.
+ */
+static inline uint64_t fileio_hash(uint64_t hash, const void *data,
+        size_t size)
+{
+    const unsigned char *bytes = data;
+    size_t i;
+
+    for (i=0; i<size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;       /* FNV prime */
+    }
+
+    return hash;
+}
+
+
+/*
+ * Write a whole buffer to a file.
+ *
+ * Receives a file descriptor, the buffer and its size. Carries on after
+ * short writes and interruptions by signals. Returns 0 in case of
+ * success, or -1 otherwise (errno tells what went wrong).
+ */
+static inline int fileio_write_all(int fd, const void *buf, size_t size)
+{
+    const char *pos = buf;
+
+    while (size > 0)
+    {
+        const ssize_t written = write(fd, pos, min(size, FILEIO_MAX_CHUNK));
+
+        if (unlikely(written < 0))
+        {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        pos += written;
+        size -= (size_t)written;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Read a whole buffer from a file.
+ *
+ * Receives a file descriptor, the buffer and its size. Carries on after
+ * short reads and interruptions by signals. Returns 0 in case of success,
+ * or -1 otherwise (errno tells what went wrong; reaching the end of the
+ * file early sets it to EIO).
+ */
+static inline int fileio_read_all(int fd, void *buf, size_t size)
+{
+    char *pos = buf;
+
+    while (size > 0)
+    {
+        const ssize_t got = read(fd, pos, min(size, FILEIO_MAX_CHUNK));
+
+        if (unlikely(got <= 0))
+        {
+            if (got < 0 && errno == EINTR)
+                continue;
+
+            if (got == 0)
+                errno = EIO;
+
+            return -1;
+        }
+
+        pos += got;
+        size -= (size_t)got;
+    }
+
+    return 0;
+}
+
+
+#endif      /* not _FILEIO_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
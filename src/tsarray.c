@@ -40,8 +40,31 @@
 /* get memcpy and memmove */
 #include <string.h>
 
+/* get uint32_t and uint64_t, for the file header */
+#include <stdint.h>
+
+/* get writev and readv */
+#include <sys/uio.h>
+
+/* get clock_gettime, for the sync interval of logs */
+#include <time.h>
+
+/* get open and fstat, to map saved arrays and to open logs */
+#if HAVE_FCNTL_H && HAVE_SYS_STAT_H
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  define CAN_OPEN 1
+#endif
+
+/* get mmap, to map saved arrays and to recover logs */
+#if CAN_OPEN && HAVE_SYS_MMAN_H && HAVE_MMAP
+#  include <sys/mman.h>
+#  define CAN_MAP 1
+#endif
+
 #include "tsarray.h"
 #include "common.h"
+#include "fileio.h"
 
 
 /*
@@ -66,8 +89,75 @@ struct _tsarray_priv {
     unsigned long len;          /* likewise */
     unsigned long len_hint;    /* likewise */
     bool has_len_hint;
+    void *map_base;             /* start of the mapping, if mapped */
+    size_t map_size;            /* size of the mapping; 0 if not mapped */
+    struct append_log *log;     /* log of appends; NULL if not logged */
+};
+
+
+/*
+ * Header of a saved tsarray. Written in the machine's own byte order, and
+ * followed by the len items, exactly as they are in memory.
+ *
+ * The header's size is a multiple of any sane object alignment, so that
+ * the items of a mapped array are as aligned as the mapping itself (i.e.
+ * page aligned).
+ */
+struct file_header {
+    char magic[8];              /* FILE_MAGIC */
+    uint32_t version;           /* FILE_VERSION */
+    uint32_t byte_order;        /* FILEIO_BYTE_ORDER, as written */
+    uint64_t obj_size;
+    uint64_t len;
+    uint64_t checksum;          /* of the items; see fileio_hash */
+    char reserved[24];          /* zero; pads the header to 64 bytes */
+};
+
+#define FILE_MAGIC "TSARRAY"
+#define FILE_VERSION 1
+
+
+/*
+ * Log of the appends to a tsarray (see tsarray_log_open).
+ *
+ * The log file starts with a struct file_header (with LOG_MAGIC, and len
+ * and checksum left at zero), followed by every item ever appended, in
+ * order. Items are gathered in buf and written LOG_BUFFER bytes at a time;
+ * the file is synced once sync_bytes have been written or sync_ms have
+ * passed since the last sync, whichever comes first, so that many appends
+ * share each sync.
+ */
+struct append_log {
+    int fd;
+    int error;                  /* errno of the first failure, or 0 */
+    size_t sync_bytes;          /* 0 for no limit */
+    long sync_ms;               /* likewise */
+    long long last_sync_ms;
+    size_t unsynced;            /* bytes appended since the last sync */
+    size_t buf_used;
+    char buf[];
 };
 
+#define LOG_MAGIC "TSALOG"
+
+/* Size of a log's write buffer, in bytes */
+#define LOG_BUFFER ((size_t)256 << 10)
+
+/* Failures of log_put: whether the data may have reached the log or not */
+#define LOG_UNWRITTEN (-1)
+#define LOG_UNSYNCED (-2)
+
+
+/*
+ * Most buffers to pass to a single writev or readv. Stays within IOV_MAX,
+ * where that is known.
+ */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#  define IOV_BATCH IOV_MAX
+#else
+#  define IOV_BATCH 1024
+#endif
+
 
 
 /*
@@ -98,6 +188,13 @@ struct _tsarray_priv {
 #define HINT_STDDEV_RATIO 3
 
 
+/*
+ * Partitions of up to this many items are left to insertion sort, which
+ * beats quicksort on them.
+ */
+#define SORT_INSERTION_LEN 16
+
+
 static bool same_sign(int a, int b) __ATTR_CONST;
 
 static inline void *get_nth_item(const void *items, long index,
@@ -115,6 +212,39 @@ static int tsarray_resize(struct _tsarray_priv *priv, unsigned long new_len) __N
 static void set_items(void *items, long index, const void *objects,
         size_t obj_size, unsigned long count);
 
+static inline void swap_items(char *a, char *b, size_t obj_size)
+    __NON_NULL;
+
+static void sort_items(char *items, unsigned long len, size_t obj_size,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+    __attribute__((nonnull (1, 4)));
+
+static void insertion_sort(char *items, unsigned long len, size_t obj_size,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+    __attribute__((nonnull (1, 4)));
+
+static int check_header(const struct file_header *header, size_t obj_size)
+    __ATTR_PURE __NON_NULL;
+
+static int transfer_iov(int fd, struct iovec *iov, int count, size_t *done,
+        bool writing);
+
+static long long log_now_ms(void);
+
+static int log_put(struct append_log *log, const void *data, size_t size)
+    __NON_NULL;
+
+static int log_flush(struct append_log *log) __NON_NULL;
+
+static int log_sync(struct append_log *log) __NON_NULL;
+
+#if CAN_OPEN
+static int log_recover(struct _tsarray_priv *priv, int fd, size_t size)
+    __NON_NULL;
+#endif
+
+static void log_free(struct append_log *log) __NON_NULL;
+
 
 
 /*
@@ -155,7 +285,11 @@ struct _tsarray_pub *tsarray_new(size_t obj_size)
     priv->obj_size = obj_size;
     priv->capacity = 0;
     priv->len = 0;
-    priv->len_hint = false;
+    priv->len_hint = 0;
+    priv->has_len_hint = false;
+    priv->map_base = NULL;
+    priv->map_size = 0;
+    priv->log = NULL;
 
     return &priv->pub;
 }
@@ -360,6 +494,10 @@ static int tsarray_resize(struct _tsarray_priv *priv, unsigned long new_len)
     const unsigned long old_capacity = priv->capacity;
     unsigned long new_capacity;
 
+    /* mapped arrays are read-only */
+    if (unlikely(priv->map_size != 0))
+        return TSARRAY_EROFS;
+
     assert(ulong_fits_in_long(new_len));    /* must fit in signed long indices */
     assert(ulong_fits_in_long(old_len));
     assert(ulong_fits_in_long(old_capacity));
@@ -608,14 +746,50 @@ void *tsarray_max(const struct _tsarray_pub *tsarray,
 }
 
 
+/*
+ * Sort a tsarray in place.
+ *
+ * Receives the tsarray, a comparison function, and a generic argument that
+ * will be passed to the comparison function for context.
+ *
+ * The comparison function should return a number less than, equal to, or
+ * greater than zero if the first argument is, respectively, less than,
+ * equal to, or greater than the second. The sort is not stable: the order
+ * of equal items is unspecified.
+ *
+ * Returns zero in case of success, or TSARRAY_EROFS if the array is mapped
+ * from a file.
+ */
+int tsarray_sort(struct _tsarray_pub *tsarray,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+{
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+
+    if (unlikely(priv->map_size != 0))
+        return TSARRAY_EROFS;
+
+    if (unlikely(priv->log != NULL))
+        return TSARRAY_EPERM;
+
+    if (priv->len > 1)
+        sort_items(tsarray->items, priv->len, priv->obj_size, cmp, arg);
+
+    return 0;
+}
+
+
 /*
  * Append an object to the end of a tsarray.
  *
  * Receives the tsarray, and a pointer to an object. Will grow the array if
- * necessary.
+ * necessary. If the array is logged (see tsarray_log_open), the object is
+ * written to the log as well.
  *
  * Returns zero in case of success, or a negative error value in case of
- * error.
+ * error. In case of TSARRAY_EIO, the log couldn't be written (errno tells
+ * why), and the array is left as it was. In case of TSARRAY_ENOSYNC, the
+ * object was appended and handed to the log, but writing or syncing the
+ * log failed (errno tells why), so it may or may not be recovered.
  */
 int tsarray_append(struct _tsarray_pub *tsarray, const void *object)
 {
@@ -638,6 +812,20 @@ int tsarray_append(struct _tsarray_pub *tsarray, const void *object)
 
     set_items(tsarray->items, (long)old_len, object, priv->obj_size, 1);
 
+    if (priv->log != NULL)
+    {
+        retval = log_put(priv->log, object, priv->obj_size);
+
+        if (unlikely(retval == LOG_UNWRITTEN))
+        {
+            priv->len = old_len;
+            return TSARRAY_EIO;
+        }
+
+        if (unlikely(retval == LOG_UNSYNCED))
+            return TSARRAY_ENOSYNC;
+    }
+
     return 0;
 }
 
@@ -650,10 +838,12 @@ int tsarray_append(struct _tsarray_pub *tsarray, const void *object)
  * source tsarray is not altered in any way.
  *
  * The source and destination tsarrays may be the same; the tsarray will be
- * extended with a copy of its own values.
+ * extended with a copy of its own values. If the destination is logged,
+ * the objects are written to its log as well, as with tsarray_append.
  *
  * Returns zero in case of success, or a negative error value in case of
- * error.
+ * error. TSARRAY_EIO and TSARRAY_ENOSYNC mean the same as for
+ * tsarray_append.
  */
 int tsarray_extend(struct _tsarray_pub *tsarray_dest,
         struct _tsarray_pub *tsarray_src)
@@ -696,6 +886,23 @@ int tsarray_extend(struct _tsarray_pub *tsarray_dest,
      * src->items : dest->items. */
     set_items(tsarray_dest->items, (long)dest_len, tsarray_src->items, obj_size, src_len);
 
+    if (priv_dest->log != NULL)
+    {
+        retval = log_put(priv_dest->log,
+                         get_nth_item(tsarray_dest->items, (long)dest_len,
+                                      obj_size),
+                         src_len * obj_size);
+
+        if (unlikely(retval == LOG_UNWRITTEN))
+        {
+            priv_dest->len = dest_len;
+            return TSARRAY_EIO;
+        }
+
+        if (unlikely(retval == LOG_UNSYNCED))
+            return TSARRAY_ENOSYNC;
+    }
+
     return 0;
 }
 
@@ -724,6 +931,12 @@ int tsarray_remove(struct _tsarray_pub *tsarray, long index)
     if (unlikely(index >= (long)old_len))
         return TSARRAY_ENOENT;
 
+    if (unlikely(priv->map_size != 0))
+        return TSARRAY_EROFS;
+
+    if (unlikely(priv->log != NULL))
+        return TSARRAY_EPERM;
+
     assert(old_len > 0);
     assert(old_len <= priv->capacity);
     assert(old_len <= SIZE_MAX / obj_size);
@@ -741,75 +954,1109 @@ int tsarray_remove(struct _tsarray_pub *tsarray, long index)
 
 
 /*
- * Free the memory occupied by a tsarray.
+ * Save a tsarray to a file.
  *
- * This operation must be performed on a tsarray once it is no longer
- * necessary. Failure to do so will result in memory leaks.
+ * Receives a tsarray and a file descriptor open for writing. Writes a
+ * header (with the object size, length, byte order and a checksum of the
+ * items) followed by the items themselves, starting at the file's current
+ * position. Several arrays may be saved to the same file one after the
+ * other, and loaded back in the same order with tsarray_load.
  *
- * After this operation, the tsarray will be deallocated and invalid. It
- * may not be used for anything.
+ * The items are saved as they are in memory; pointers inside them won't
+ * mean anything once loaded, and the file can only be loaded on machines
+ * with the same byte order.
+ *
+ * Returns zero in case of success, or a negative error value otherwise.
+ * In case of TSARRAY_EIO, errno tells what went wrong; part of the array
+ * may have been written.
  */
-void tsarray_free(struct _tsarray_pub *tsarray)
+int tsarray_save(const struct _tsarray_pub *tsarray, int fd)
 {
-    /* items == NULL if and only if capacity == 0 */
-    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+    const struct _tsarray_priv *priv = (const struct _tsarray_priv *)tsarray;
+    const size_t bytes = priv->len * priv->obj_size;
+    struct file_header header;
 
-    assert((tsarray->items == NULL) == (priv->capacity == 0));
     assert(priv->len <= priv->capacity);
+    assert(can_size_mult(priv->len, priv->obj_size));
 
-    if (tsarray->items != NULL)
-        free(tsarray->items);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.byte_order = FILEIO_BYTE_ORDER;
+    header.obj_size = priv->obj_size;
+    header.len = priv->len;
+    header.checksum = fileio_hash(FILEIO_HASH_INIT, tsarray->items, bytes);
 
-    free(priv);
+    if (unlikely(fileio_write_all(fd, &header, sizeof(header)) != 0)
+            || unlikely(fileio_write_all(fd, tsarray->items, bytes) != 0))
+        return TSARRAY_EIO;
+
+    return 0;
 }
 
 
 /*
- * Get the address of an item in a tsarray.
+ * Load a tsarray from a file.
  *
- * Get the Nth object from a tsarray's abstract item array, given its
- * index and the size of the array's objects. index MUST be positive.
+ * Receives a file descriptor open for reading, positioned at an array
+ * saved with tsarray_save, and the size of the array's items. Reads the
+ * array (leaving the file positioned right after it), and checks it
+ * against the header's checksum.
+ *
+ * Returns a pointer to a newly created tsarray with the loaded items, or
+ * NULL in case of error (unable to read, not a saved tsarray, saved with
+ * a different object size or byte order, corrupt, or out of memory).
  */
-static inline void *get_nth_item(const void *items, long index,
-        size_t obj_size)
+struct _tsarray_pub *tsarray_load(int fd, size_t obj_size)
 {
-    /* TODO: Implement negative indices, a la Python */
-    assert(index >= 0);
+    struct _tsarray_priv *priv;
+    struct file_header header;
 
-    /* can't use void for pointer arithmetic, it's an incomplete type
-     * (also, char can alias anything; it's meant for this) */
-    return ((char *)items + ((unsigned long)index * obj_size));
+    if (unlikely(fileio_read_all(fd, &header, sizeof(header)) != 0))
+        return NULL;
+
+    if (unlikely(check_header(&header, obj_size) != 0))
+        return NULL;
+
+    priv = _tsarray_new_of_len(obj_size, (unsigned long)header.len);
+    if (unlikely(priv == NULL))
+        return NULL;
+
+    if (unlikely(fileio_read_all(fd, priv->pub.items,
+                                 priv->len*obj_size) != 0)
+            || unlikely(fileio_hash(FILEIO_HASH_INIT, priv->pub.items,
+                                    priv->len*obj_size) != header.checksum))
+    {
+        tsarray_free(&priv->pub);
+        return NULL;
+    }
+
+    return &priv->pub;
 }
 
 
 /*
- * Set the contents of item(s) in a tsarray.
+ * Map a saved tsarray into memory.
  *
- * Receives the tsarray's abstract item array, the index of the first item
- * to set, the array of objects, the object size, and the count of objects
- * to set.
+ * Receives the path of a file which starts with an array saved by
+ * tsarray_save, and the size of the array's items. Maps the file
+ * read-only, and returns a tsarray whose items are the file's own pages:
+ * nothing is copied, and pages are only read from the file as the items
+ * are accessed. Processes mapping the same file share its pages.
  *
- * The count is not checked for validity. It MUST be within appropriate
- * bounds for writing to the items array (i.e. within array capacity) and
- * for reading from the source objects array.
+ * Since that would mean reading the whole file, the checksum is NOT
+ * verified; use tsarray_load for files which can't be trusted. The file
+ * must not be truncated or written to while it is mapped.
  *
- * The memory area holding the source object MUST NOT overlap with the
- * destination memory area.
+ * The returned tsarray may be read from, copied and sliced as usual, but
+ * not changed; appending, extending and removing fail with TSARRAY_EROFS.
+ * tsarray_free unmaps it.
+ *
+ * Returns a pointer to the mapped tsarray, or NULL in case of error
+ * (unable to open or map the file, not a saved tsarray, saved with a
+ * different object size or byte order, too short, or out of memory).
+ * Always fails on systems without mmap.
  */
-static void set_items(void *items, long index, const void *objects,
-        size_t obj_size, unsigned long count)
+struct _tsarray_pub *tsarray_map(const char *path, size_t obj_size)
 {
-    char *dest = get_nth_item(items, index, obj_size);
-    assert(count <= SIZE_MAX && can_size_mult(obj_size, count));
-    const size_t bytes = obj_size*count;
+#if CAN_MAP
+    struct _tsarray_priv *priv;
+    const struct file_header *header;
+    struct stat st;
+    void *base;
+    size_t map_size;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (unlikely(fd < 0))
+        return NULL;
 
-    /* memory ranges don't overlap */
-    assert(((char *)objects < dest && (char *)objects+bytes <= dest)
-           || (dest < (char *)objects && dest+bytes <= (char *)objects));
+    if (unlikely(fstat(fd, &st) != 0)
+            || unlikely((uintmax_t)st.st_size < sizeof(*header))
+            || unlikely((uintmax_t)st.st_size > SIZE_MAX))
+    {
+        close(fd);
+        return NULL;
+    }
 
-    memcpy(dest, objects, bytes);
+    map_size = (size_t)st.st_size;
+    base = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    /* the mapping holds its own reference to the file */
+    close(fd);
+
+    if (unlikely(base == MAP_FAILED))
+        return NULL;
+
+    header = base;
+
+    if (unlikely(check_header(header, obj_size) != 0)
+            || unlikely((map_size - sizeof(*header)) / obj_size < header->len))
+    {
+        munmap(base, map_size);
+        return NULL;
+    }
+
+    priv = (struct _tsarray_priv *)tsarray_new(obj_size);
+    if (unlikely(priv == NULL))
+    {
+        munmap(base, map_size);
+        return NULL;
+    }
+
+    /* keep items == NULL if and only if capacity == 0 */
+    priv->pub.items = header->len != 0 ? (char *)base + sizeof(*header) : NULL;
+    priv->capacity = (unsigned long)header->len;
+    priv->len = (unsigned long)header->len;
+    priv->map_base = base;
+    priv->map_size = map_size;
+
+    return &priv->pub;
+#else
+    (void)path;
+    (void)obj_size;
+
+    return NULL;
+#endif
+}
+
+
+/*
+ * Write the items of several tsarrays to a file, with no copying.
+ *
+ * Receives a file descriptor open for writing, an array of n tsarrays, and
+ * an optional count of bytes already written, for resuming. Writes the
+ * items of every tsarray back to back, as they are in memory, straight
+ * from each array's items with writev (no headers are written; see
+ * tsarray_save for that). Short writes are carried on from where they
+ * stopped.
+ *
+ * If done is non-NULL, it must be 0 to start with; it is kept up to date
+ * with the number of bytes written. If fd is non-blocking and would
+ * block, TSARRAY_EAGAIN is returned: call again with the same arrays and
+ * done once fd is writable, to carry on. The arrays must not change until
+ * everything has been written.
+ *
+ * Returns zero in case of success, or a negative error value otherwise.
+ * In case of TSARRAY_EIO, errno tells what went wrong.
+ */
+int tsarray_writev(int fd, const struct _tsarray_pub *const *arrays, int n,
+        size_t *done)
+{
+    struct iovec *iov;
+    int retval;
+    int i;
+
+    if (unlikely(n < 0))
+        return TSARRAY_EINVAL;
+
+    iov = malloc((size_t)n * sizeof(*iov));
+    if (unlikely(iov == NULL && n != 0))
+        return TSARRAY_ENOMEM;
+
+    for (i=0; i<n; i++)
+    {
+        const struct _tsarray_priv *priv =
+            (const struct _tsarray_priv *)arrays[i];
+
+        iov[i].iov_base = arrays[i]->items;
+        iov[i].iov_len = priv->len * priv->obj_size;
+    }
+
+    retval = transfer_iov(fd, iov, n, done, true);
+    free(iov);
+
+    return retval;
+}
+
+
+/*
+ * Read items from a file into several tsarrays, with no copying.
+ *
+ * Receives a file descriptor open for reading, an array of n distinct
+ * tsarrays, how many items to read into each one, and an optional count
+ * of bytes already read, for resuming. Reserves room after the end of
+ * each array, then reads straight into it with readv, back to back, in
+ * the same layout tsarray_writev writes. Short reads are carried on from
+ * where they stopped.
+ *
+ * The items are only appended (i.e. the arrays' lengths only change) once
+ * they have all been read. If done is non-NULL, it must be 0 to start
+ * with; it is kept up to date with the number of bytes read. If fd is
+ * non-blocking and would block, TSARRAY_EAGAIN is returned: call again
+ * with the same arguments once fd is readable, to carry on. The arrays
+ * must not change meanwhile; if the read is given up, they are as they
+ * were, apart from their capacity.
+ *
+ * Returns zero in case of success, or a negative error value otherwise.
+ * In case of TSARRAY_EIO, errno tells what went wrong (EIO if the file
+ * ended early).
+ */
+int tsarray_readv(int fd, struct _tsarray_pub *const *arrays,
+        const unsigned long *counts, int n, size_t *done)
+{
+    struct iovec *iov;
+    int retval = 0;
+    int i;
+
+    if (unlikely(n < 0))
+        return TSARRAY_EINVAL;
+
+    iov = malloc((size_t)n * sizeof(*iov));
+    if (unlikely(iov == NULL && n != 0))
+        return TSARRAY_ENOMEM;
+
+    for (i=0; i<n; i++)
+    {
+        struct _tsarray_priv *priv = (struct _tsarray_priv *)arrays[i];
+        const unsigned long len = priv->len;
+
+        if (unlikely(!can_add_within_long(len, counts[i])))
+        {
+            retval = TSARRAY_EOVERFLOW;
+            break;
+        }
+
+        if (unlikely(priv->log != NULL))
+        {
+            retval = TSARRAY_EPERM;
+            break;
+        }
+
+        /* reserve the room, but leave the length as it was; when resuming,
+         * the room is already there, and keeps what was read into it */
+        retval = tsarray_resize(priv, len + counts[i]);
+        priv->len = len;
+
+        if (unlikely(retval != 0))
+            break;
+
+        /* nothing reserved for an empty array with no items */
+        iov[i].iov_base = arrays[i]->items == NULL ? NULL
+            : get_nth_item(arrays[i]->items, (long)len, priv->obj_size);
+        iov[i].iov_len = counts[i] * priv->obj_size;
+    }
+
+    if (likely(retval == 0))
+        retval = transfer_iov(fd, iov, n, done, false);
+
+    free(iov);
+
+    if (unlikely(retval != 0))
+        return retval;
+
+    for (i=0; i<n; i++)
+        ((struct _tsarray_priv *)arrays[i])->len += counts[i];
+
+    return 0;
+}
+
+
+/*
+ * Replace the contents of a tsarray with items read from a file.
+ *
+ * Receives a tsarray, a file descriptor open for reading, and the most
+ * items to read. Reads up to count items from the file's current position
+ * straight into the array, which ends up holding exactly the items read.
+ * The array's memory is reused when it is already large enough, so
+ * reading a file in chunks of the same size only allocates once.
+ *
+ * Returns the number of items read, which is less than count only at the
+ * end of the file (0 once there is nothing left), or a negative error
+ * value. In case of TSARRAY_EIO, errno tells what went wrong (EIO if the
+ * file ends in the middle of an item); the array is left empty.
+ */
+long tsarray_read(struct _tsarray_pub *tsarray, int fd, unsigned long count)
+{
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+    const size_t obj_size = priv->obj_size;
+    size_t bytes, got = 0;
+    int retval;
+
+    if (unlikely(!ulong_fits_in_long(count)))
+        return TSARRAY_EINVAL;
+
+    if (unlikely(priv->log != NULL))
+        return TSARRAY_EPERM;
+
+    retval = tsarray_resize(priv, count);
+    if (unlikely(retval != 0))
+        return retval;
+
+    bytes = count * obj_size;
+
+    while (got < bytes)
+    {
+        const ssize_t n = read(fd, tsarray->items + got,
+                               min(bytes - got, FILEIO_MAX_CHUNK));
+
+        if (n == 0)
+            break;              /* end of file */
+
+        if (unlikely(n < 0))
+        {
+            if (errno == EINTR)
+                continue;
+
+            priv->len = 0;
+            return TSARRAY_EIO;
+        }
+
+        got += (size_t)n;
+    }
+
+    if (unlikely(got % obj_size != 0))
+    {
+        priv->len = 0;
+        errno = EIO;
+        return TSARRAY_EIO;
+    }
+
+    /* keep the memory for the next read */
+    priv->len = got / obj_size;
+
+    return (long)priv->len;
 }
 
 
+/*
+ * Swap the contents of two tsarrays.
+ *
+ * Receives two tsarrays of the same object size. Exchanges their items
+ * (and everything else about them), without copying any item; pointers
+ * to items follow the items to the other array.
+ *
+ * Returns zero in case of success, or TSARRAY_EINVAL if the object sizes
+ * differ.
+ */
+int tsarray_swap(struct _tsarray_pub *tsarray_a, struct _tsarray_pub *tsarray_b)
+{
+    struct _tsarray_priv *priv_a = (struct _tsarray_priv *)tsarray_a;
+    struct _tsarray_priv *priv_b = (struct _tsarray_priv *)tsarray_b;
+    struct _tsarray_priv tmp;
+
+    if (unlikely(priv_a->obj_size != priv_b->obj_size))
+        return TSARRAY_EINVAL;
+
+    tmp = *priv_a;
+    *priv_a = *priv_b;
+    *priv_b = tmp;
+
+    return 0;
+}
+
+
+/*
+ * Replace the contents of a tsarray with a copy of a C array.
+ *
+ * Receives a tsarray, a pointer to a source memory area (C array) and the
+ * number of items in the source. The array ends up holding a copy of
+ * exactly those items. Its memory is reused when it is already large
+ * enough, so refilling an array with chunks of the same size only
+ * allocates once.
+ *
+ * The source must not overlap the array's own items. If src_len is zero,
+ * the source will not be read, and in particular it may be NULL.
+ *
+ * Returns zero in case of success, or a negative error value otherwise;
+ * the array is left as it was in case of error.
+ */
+int tsarray_assign(struct _tsarray_pub *tsarray, const void *src,
+        unsigned long src_len)
+{
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+    int retval;
+
+    if (unlikely(!ulong_fits_in_long(src_len)))
+        return TSARRAY_EINVAL;
+
+    if (unlikely(priv->log != NULL))
+        return TSARRAY_EPERM;
+
+    retval = tsarray_resize(priv, src_len);
+    if (unlikely(retval != 0))
+        return retval;
+
+    if (src_len > 0)
+        set_items(tsarray->items, 0, src, priv->obj_size, src_len);
+
+    return 0;
+}
+
+
+/*
+ * Log every append to a tsarray to a file, durably.
+ *
+ * Receives an empty tsarray, the path of its log, and when to sync the
+ * log: once sync_bytes have been appended, or once sync_ms milliseconds
+ * have passed since the last sync, whichever comes first (0 for no limit
+ * on either). From then on, tsarray_append and tsarray_extend also write
+ * the new items to the end of the log, buffering them and writing large
+ * blocks, so that appending stays close to sequential disk speed; every
+ * item appended before a sync survives a crash. The time limit is only
+ * checked when appending, so the last items appended before the array
+ * goes idle wait for tsarray_log_sync (which syncs right away, and costs
+ * nothing with nothing new to sync), tsarray_log_close or tsarray_free.
+ *
+ * If the log already exists, the array is first recovered from it: the
+ * log is mapped, and its items copied into the array. Items cut short by
+ * a crash are dropped from the end of the log.
+ *
+ * The log only records appends, so removing, sorting, assigning and
+ * reading into a logged array fail with TSARRAY_EPERM. Changing items
+ * through the items pointer isn't logged either. tsarray_log_close stops
+ * logging; tsarray_free syncs and closes the log as well.
+ *
+ * Returns zero in case of success, or a negative error value otherwise:
+ * TSARRAY_EINVAL if the array isn't empty, is already logged, or the file
+ * isn't the log of an array of the same object size and byte order;
+ * TSARRAY_EIO if the file can't be opened, read or written (errno tells
+ * why). Always fails with TSARRAY_EIO on systems without open.
+ */
+int tsarray_log_open(struct _tsarray_pub *tsarray, const char *path,
+        size_t sync_bytes, long sync_ms)
+{
+#if CAN_OPEN
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+    struct append_log *log;
+    struct stat st;
+    int retval;
+    int fd;
+
+    if (unlikely(priv->len != 0 || priv->log != NULL || sync_ms < 0))
+        return TSARRAY_EINVAL;
+
+    if (unlikely(priv->map_size != 0))
+        return TSARRAY_EROFS;
+
+    log = malloc(sizeof(*log) + LOG_BUFFER);
+    if (unlikely(log == NULL))
+        return TSARRAY_ENOMEM;
+
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0666);
+    if (unlikely(fd < 0))
+    {
+        free(log);
+        return TSARRAY_EIO;
+    }
+
+    if (unlikely(fstat(fd, &st) != 0)
+            || unlikely((uintmax_t)st.st_size > SIZE_MAX))
+        retval = TSARRAY_EIO;
+    else
+        retval = log_recover(priv, fd, (size_t)st.st_size);
+
+    if (unlikely(retval != 0))
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        free(log);
+        errno = saved_errno;
+        return retval;
+    }
+
+    log->fd = fd;
+    log->error = 0;
+    log->sync_bytes = sync_bytes;
+    log->sync_ms = sync_ms;
+    log->last_sync_ms = log_now_ms();
+    log->unsynced = 0;
+    log->buf_used = 0;
+
+    priv->log = log;
+
+    return 0;
+#else
+    (void)tsarray;
+    (void)path;
+    (void)sync_bytes;
+    (void)sync_ms;
+
+    errno = ENOSYS;
+    return TSARRAY_EIO;
+#endif
+}
+
+
+/*
+ * Sync the log of a tsarray now, without waiting for its limits. Meant to
+ * be called from time to time (e.g. from a timer) on an array that may go
+ * idle, since the time limit is only checked when appending. Does nothing
+ * if every item appended is already synced.
+ *
+ * Returns zero once every item appended so far is safely on disk,
+ * TSARRAY_EINVAL if the array isn't logged, or TSARRAY_EIO if writing or
+ * syncing the log failed (errno tells why).
+ */
+int tsarray_log_sync(struct _tsarray_pub *tsarray)
+{
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+
+    if (unlikely(priv->log == NULL))
+        return TSARRAY_EINVAL;
+
+    return likely(log_sync(priv->log) == 0) ? 0 : TSARRAY_EIO;
+}
+
+
+/*
+ * Stop logging a tsarray. Syncs the log and closes it; the array itself is
+ * left as it is, and may be changed freely again.
+ *
+ * Returns zero in case of success, TSARRAY_EINVAL if the array isn't
+ * logged, or TSARRAY_EIO if the last items couldn't be written or synced
+ * (errno tells why); the log is closed anyway.
+ */
+int tsarray_log_close(struct _tsarray_pub *tsarray)
+{
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+    struct append_log *log = priv->log;
+    int retval;
+
+    if (unlikely(log == NULL))
+        return TSARRAY_EINVAL;
+
+    retval = log_sync(log);
+    log_free(log);
+    priv->log = NULL;
+
+    return likely(retval == 0) ? 0 : TSARRAY_EIO;
+}
+
+
+/*
+ * Free the memory occupied by a tsarray.
+ *
+ * This operation must be performed on a tsarray once it is no longer
+ * necessary. Failure to do so will result in memory leaks. A logged
+ * array's log is synced and closed (use tsarray_log_close first, to find
+ * out whether that worked).
+ *
+ * After this operation, the tsarray will be deallocated and invalid. It
+ * may not be used for anything.
+ */
+void tsarray_free(struct _tsarray_pub *tsarray)
+{
+    /* items == NULL if and only if capacity == 0 */
+    struct _tsarray_priv *priv = (struct _tsarray_priv *)tsarray;
+
+    assert((tsarray->items == NULL) == (priv->capacity == 0));
+    assert(priv->len <= priv->capacity);
+
+    if (priv->log != NULL)
+        log_free(priv->log);
+
+#if CAN_MAP
+    if (priv->map_size != 0)
+        munmap(priv->map_base, priv->map_size);
+    else
+#endif
+    if (tsarray->items != NULL)
+        free(tsarray->items);
+
+    free(priv);
+}
+
+
+/*
+ * Get the address of an item in a tsarray.
+ *
+ * Get the Nth object from a tsarray's abstract item array, given its
+ * index and the size of the array's objects. index MUST be positive.
+ */
+static inline void *get_nth_item(const void *items, long index,
+        size_t obj_size)
+{
+    /* TODO: Implement negative indices, a la Python */
+    assert(index >= 0);
+
+    /* can't use void for pointer arithmetic, it's an incomplete type
+     * (also, char can alias anything; it's meant for this) */
+    return ((char *)items + ((unsigned long)index * obj_size));
+}
+
+
+/*
+ * Set the contents of item(s) in a tsarray.
+ *
+ * Receives the tsarray's abstract item array, the index of the first item
+ * to set, the array of objects, the object size, and the count of objects
+ * to set.
+ *
+ * The count is not checked for validity. It MUST be within appropriate
+ * bounds for writing to the items array (i.e. within array capacity) and
+ * for reading from the source objects array.
+ *
+ * The memory area holding the source object MUST NOT overlap with the
+ * destination memory area.
+ */
+static void set_items(void *items, long index, const void *objects,
+        size_t obj_size, unsigned long count)
+{
+    char *dest = get_nth_item(items, index, obj_size);
+    assert(count <= SIZE_MAX && can_size_mult(obj_size, count));
+    const size_t bytes = obj_size*count;
+
+    /* memory ranges don't overlap */
+    assert(((char *)objects < dest && (char *)objects+bytes <= dest)
+           || (dest < (char *)objects && dest+bytes <= (char *)objects));
+
+    memcpy(dest, objects, bytes);
+}
+
+
+/*
+ * Swap two items of a tsarray, given their addresses and the object size.
+ */
+static inline void swap_items(char *a, char *b, size_t obj_size)
+{
+    char tmp[64];
+
+    /* constant sizes let the compiler swap in registers */
+    if (obj_size == 4)
+    {
+        memcpy(tmp, a, 4);
+        memcpy(a, b, 4);
+        memcpy(b, tmp, 4);
+        return;
+    }
+
+    if (obj_size == 8)
+    {
+        memcpy(tmp, a, 8);
+        memcpy(a, b, 8);
+        memcpy(b, tmp, 8);
+        return;
+    }
+
+    while (obj_size > 0)
+    {
+        const size_t n = min(obj_size, sizeof(tmp));
+
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+
+        a += n;
+        b += n;
+        obj_size -= n;
+    }
+}
+
+
+/*
+ * Sort len items, of obj_size bytes each, with a quicksort.
+ *
+ * The pivot is the median of the first, middle and last items, which
+ * keeps sorted and reverse-sorted input from going quadratic. Items equal
+ * to the pivot stop the scans on both sides, so that runs of equal items
+ * are split evenly. Recurses on the smaller partition only and loops on
+ * the larger one, so the stack depth stays logarithmic.
+ */
+static void sort_items(char *items, unsigned long len, size_t obj_size,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+{
+    while (len > SORT_INSERTION_LEN)
+    {
+        char *const mid = items + (len / 2) * obj_size;
+        char *const last = items + (len - 1) * obj_size;
+        unsigned long i = 0, j = len;
+
+        /* order first, middle and last; then move the median to the front,
+         * leaving the last item as a sentinel no smaller than it */
+        if (cmp(mid, items, arg) < 0)
+            swap_items(mid, items, obj_size);
+        if (cmp(last, mid, arg) < 0)
+        {
+            swap_items(last, mid, obj_size);
+            if (cmp(mid, items, arg) < 0)
+                swap_items(mid, items, obj_size);
+        }
+        swap_items(items, mid, obj_size);
+
+        for (;;)
+        {
+            do
+                i++;
+            while (cmp(items + i*obj_size, items, arg) < 0);
+
+            do
+                j--;
+            while (cmp(items, items + j*obj_size, arg) < 0);
+
+            if (i >= j)
+                break;
+
+            swap_items(items + i*obj_size, items + j*obj_size, obj_size);
+        }
+
+        /* pivot goes to its final place, j */
+        swap_items(items, items + j*obj_size, obj_size);
+
+        if (j < len - j - 1)
+        {
+            sort_items(items, j, obj_size, cmp, arg);
+            items += (j + 1) * obj_size;
+            len -= j + 1;
+        }
+        else
+        {
+            sort_items(items + (j + 1) * obj_size, len - j - 1, obj_size,
+                       cmp, arg);
+            len = j;
+        }
+    }
+
+    insertion_sort(items, len, obj_size, cmp, arg);
+}
+
+
+/*
+ * Sort a few items, of obj_size bytes each, with an insertion sort.
+ */
+static void insertion_sort(char *items, unsigned long len, size_t obj_size,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+{
+    unsigned long i, j;
+
+    for (i=1; i<len; i++)
+    {
+        for (j=i; j>0; j--)
+        {
+            char *const item = items + j*obj_size;
+
+            if (cmp(item, item - obj_size, arg) >= 0)
+                break;
+
+            swap_items(item - obj_size, item, obj_size);
+        }
+    }
+}
+
+
+/*
+ * Check the header of a saved tsarray.
+ *
+ * Receives the header and the expected object size. Returns zero if the
+ * header is one we can load, i.e. it is from the same version, byte order
+ * and object size, and the length is a valid index. Returns a negative
+ * error value otherwise.
+ */
+static int check_header(const struct file_header *header, size_t obj_size)
+{
+    if (unlikely(memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+            || unlikely(header->version != FILE_VERSION)
+            || unlikely(header->byte_order != FILEIO_BYTE_ORDER)
+            || unlikely(header->obj_size != obj_size)
+            || unlikely(obj_size == 0))
+        return TSARRAY_EINVAL;
+
+    if (unlikely(header->len > LONG_MAX)
+            || unlikely(!is_valid_index((unsigned long)header->len, obj_size)))
+        return TSARRAY_EOVERFLOW;
+
+    return 0;
+}
+
+
+/*
+ * Carry out a scatter-gather read or write.
+ *
+ * Receives a file descriptor, count buffers, and the optional number of
+ * bytes already transferred, which is kept up to date; and whether to
+ * write (or read). Skips what was already transferred, then calls writev
+ * (or readv) until everything is done, up to IOV_BATCH buffers at a time.
+ * The buffers are changed in the process.
+ *
+ * Returns zero in case of success, TSARRAY_EAGAIN if fd is non-blocking
+ * and would block, or TSARRAY_EIO otherwise (errno tells what went wrong;
+ * reaching the end of the file early sets it to EIO).
+ */
+static int transfer_iov(int fd, struct iovec *iov, int count, size_t *done,
+        bool writing)
+{
+    size_t skip = done != NULL ? *done : 0;
+    int k = 0;
+
+    for (;;)
+    {
+        ssize_t moved;
+
+        /* skip the buffers (or part of one) that are done */
+        while (k < count && skip >= iov[k].iov_len)
+            skip -= iov[k++].iov_len;
+
+        if (k == count)
+            return 0;
+
+        iov[k].iov_base = (char *)iov[k].iov_base + skip;
+        iov[k].iov_len -= skip;
+
+        moved = writing ? writev(fd, iov + k, min(count - k, IOV_BATCH))
+                        : readv(fd, iov + k, min(count - k, IOV_BATCH));
+
+        if (unlikely(moved <= 0))
+        {
+            if (moved < 0 && errno == EINTR)
+            {
+                skip = 0;
+                continue;
+            }
+
+            if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return TSARRAY_EAGAIN;
+
+            if (moved == 0)
+                errno = EIO;
+
+            return TSARRAY_EIO;
+        }
+
+        if (done != NULL)
+            *done += (size_t)moved;
+
+        skip = (size_t)moved;
+    }
+}
+
+
+
+/*
+ * Get the time, in milliseconds, for a log's sync interval. Uses the
+ * cheapest monotonic clock there is, as it's read on every append.
+ */
+static long long log_now_ms(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * Append data to a log: buffer it, writing the buffer out whenever it
+ * fills up, and sync the log if one of its limits has been reached.
+ *
+ * Once writing fails, the log is left alone, and every later call fails
+ * as well. Returns 0 in case of success, or otherwise (errno tells why)
+ * LOG_UNWRITTEN if none of the data was written, or LOG_UNSYNCED if it
+ * was taken in, but writing or syncing it failed, so that it may or may
+ * not be in the log when recovering.
+ */
+static int log_put(struct append_log *log, const void *data, size_t size)
+{
+    if (unlikely(log->error != 0))
+    {
+        errno = log->error;
+        return LOG_UNWRITTEN;
+    }
+
+    if (size > LOG_BUFFER - log->buf_used
+            && unlikely(log_flush(log) != 0))
+        return LOG_UNWRITTEN;
+
+    if (size > LOG_BUFFER)
+    {   /* too large to be worth buffering; may be written in part */
+        if (unlikely(fileio_write_all(log->fd, data, size) != 0))
+        {
+            log->error = errno;
+            return LOG_UNSYNCED;
+        }
+    }
+    else
+    {
+        memcpy(log->buf + log->buf_used, data, size);
+        log->buf_used += size;
+    }
+
+    log->unsynced += size;
+
+    if ((log->sync_bytes != 0 && log->unsynced >= log->sync_bytes)
+            || (log->sync_ms != 0
+                && log_now_ms() - log->last_sync_ms >= log->sync_ms))
+        return likely(log_sync(log) == 0) ? 0 : LOG_UNSYNCED;
+
+    return 0;
+}
+
+
+/*
+ * Write out a log's buffer. Returns 0 in case of success, or -1 otherwise
+ * (errno tells why).
+ */
+static int log_flush(struct append_log *log)
+{
+    if (unlikely(log->error != 0))
+    {
+        errno = log->error;
+        return -1;
+    }
+
+    if (unlikely(fileio_write_all(log->fd, log->buf, log->buf_used) != 0))
+    {
+        log->error = errno;
+        return -1;
+    }
+
+    log->buf_used = 0;
+
+    return 0;
+}
+
+
+/*
+ * Write out a log's buffer, and sync the log file, unless there's nothing
+ * new to sync. Returns 0 in case of success, or -1 otherwise (errno tells
+ * why).
+ */
+static int log_sync(struct append_log *log)
+{
+    if (unlikely(log->error != 0))
+    {
+        errno = log->error;
+        return -1;
+    }
+
+    if (log->unsynced == 0)
+        return 0;
+
+    if (unlikely(log_flush(log) != 0))
+        return -1;
+
+#if HAVE_FDATASYNC
+    if (unlikely(fdatasync(log->fd) != 0))
+#else
+    if (unlikely(fsync(log->fd) != 0))
+#endif
+    {
+        log->error = errno;
+        return -1;
+    }
+
+    log->unsynced = 0;
+    log->last_sync_ms = log_now_ms();
+
+    return 0;
+}
+
+
+/*
+ * Recover a tsarray from its log, or start a new log.
+ *
+ * Receives the empty array, the log file, open for reading and appending,
+ * and its size. A log too short to even hold its header was cut short
+ * while being created, and is started over. Otherwise, copies the log's
+ * items into the array (through a mapping of the file, where possible),
+ * and drops any partial item from the end of the log.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise (in
+ * case of TSARRAY_EIO, errno tells why).
+ */
+#if CAN_OPEN
+static int log_recover(struct _tsarray_priv *priv, int fd, size_t size)
+{
+    const size_t obj_size = priv->obj_size;
+    struct file_header header;
+    unsigned long count;
+    int retval;
+
+    if (size < sizeof(header))
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+        header.version = FILE_VERSION;
+        header.byte_order = FILEIO_BYTE_ORDER;
+        header.obj_size = obj_size;
+
+        if (unlikely(ftruncate(fd, 0) != 0)
+                || unlikely(fileio_write_all(fd, &header, sizeof(header)) != 0)
+                || unlikely(fsync(fd) != 0))
+            return TSARRAY_EIO;
+
+        return 0;
+    }
+
+    count = (unsigned long)((size - sizeof(header)) / obj_size);
+
+    if (unlikely(!is_valid_index(count, obj_size)))
+        return TSARRAY_ENOMEM;
+
+#if CAN_MAP
+    {
+        const char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (unlikely(base == MAP_FAILED))
+            return TSARRAY_EIO;
+
+        memcpy(&header, base, sizeof(header));
+
+        retval = TSARRAY_EINVAL;
+        if (likely(memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) == 0
+                   && header.version == FILE_VERSION
+                   && header.byte_order == FILEIO_BYTE_ORDER
+                   && header.obj_size == obj_size))
+            retval = tsarray_resize(priv, count);
+
+        if (likely(retval == 0) && count > 0)
+            set_items(priv->pub.items, 0, base + sizeof(header), obj_size,
+                      count);
+
+        munmap((void *)base, size);
+    }
+#else
+    if (unlikely(lseek(fd, 0, SEEK_SET) != 0)
+            || unlikely(fileio_read_all(fd, &header, sizeof(header)) != 0))
+        return TSARRAY_EIO;
+
+    retval = TSARRAY_EINVAL;
+    if (likely(memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) == 0
+               && header.version == FILE_VERSION
+               && header.byte_order == FILEIO_BYTE_ORDER
+               && header.obj_size == obj_size))
+        retval = tsarray_resize(priv, count);
+
+    if (likely(retval == 0)
+            && unlikely(fileio_read_all(fd, priv->pub.items,
+                                        count * obj_size) != 0))
+        retval = TSARRAY_EIO;
+#endif
+
+    if (unlikely(retval != 0))
+    {
+        priv->len = 0;
+        return retval;
+    }
+
+    /* drop an item cut short by a crash */
+    if (unlikely((size - sizeof(header)) % obj_size != 0)
+            && unlikely(ftruncate(fd, (off_t)(sizeof(header)
+                                              + count * obj_size)) != 0))
+    {
+        priv->len = 0;
+        return TSARRAY_EIO;
+    }
+
+    return 0;
+}
+#endif
+
+
+/*
+ * Sync and close a log, and free it. Errors are ignored.
+ */
+static void log_free(struct append_log *log)
+{
+    log_sync(log);
+    close(log->fd);
+    free(log);
+}
+
 
 /* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -54,6 +54,11 @@ enum tsarray_errno {
     TSARRAY_ENOENT = -2,    /* No such entry */
     TSARRAY_ENOMEM = -3,    /* Out of memory */
     TSARRAY_EOVERFLOW = -4, /* Operation would overflow */
+    TSARRAY_EROFS = -5,     /* Array is read-only (mapped from a file) */
+    TSARRAY_EIO = -6,       /* Error reading or writing a file */
+    TSARRAY_EAGAIN = -7,    /* File would block; try again later */
+    TSARRAY_EPERM = -8,     /* Not allowed on a logged (append-only) array */
+    TSARRAY_ENOSYNC = -9,   /* Appended, but the log couldn't be synced */
 };
 
 
@@ -76,7 +81,7 @@ struct _tsarray_pub *tsarray_copy(const struct _tsarray_pub *tsarray_src)
     __NON_NULL __ATTR_MALLOC;
 
 unsigned long tsarray_len(const struct _tsarray_pub *tsarray)
-    __ATTR_CONST __NON_NULL;
+    __ATTR_PURE __NON_NULL;
 
 int tsarray_append(struct _tsarray_pub *tsarray, const void *object) __NON_NULL;
 
@@ -92,8 +97,48 @@ void *tsarray_min(const struct _tsarray_pub *tsarray,
 void *tsarray_max(const struct _tsarray_pub *tsarray,
         int (*cmp)(const void *a, const void *b, void *arg), void *arg);
 
+int tsarray_sort(struct _tsarray_pub *tsarray,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg)
+    __attribute__((nonnull (1, 2)));
+
 int tsarray_remove(struct _tsarray_pub *p_tsarray, long index) __NON_NULL;
 
+int tsarray_save(const struct _tsarray_pub *tsarray, int fd) __NON_NULL;
+
+struct _tsarray_pub *tsarray_load(int fd, size_t obj_size) __ATTR_MALLOC;
+
+struct _tsarray_pub *tsarray_map(const char *path, size_t obj_size)
+    __NON_NULL __ATTR_MALLOC;
+
+int tsarray_writev(int fd, const struct _tsarray_pub *const *arrays, int n,
+        size_t *done) __attribute__((nonnull (2)));
+
+int tsarray_readv(int fd, struct _tsarray_pub *const *arrays,
+        const unsigned long *counts, int n, size_t *done)
+    __attribute__((nonnull (2, 3)));
+
+long tsarray_read(struct _tsarray_pub *tsarray, int fd, unsigned long count)
+    __NON_NULL;
+
+int tsarray_swap(struct _tsarray_pub *tsarray_a, struct _tsarray_pub *tsarray_b)
+    __NON_NULL;
+
+int tsarray_assign(struct _tsarray_pub *tsarray, const void *src,
+        unsigned long src_len) __attribute__((nonnull (1)));
+
+/*
+ * A logged array syncs its log as it's appended to, once sync_bytes or
+ * sync_ms are reached; nothing syncs an idle array's last appends, short
+ * of tsarray_log_sync (call it from time to time to bound the loss, e.g.
+ * every sync_ms), tsarray_log_close or tsarray_free.
+ */
+int tsarray_log_open(struct _tsarray_pub *tsarray, const char *path,
+        size_t sync_bytes, long sync_ms) __NON_NULL;
+
+int tsarray_log_sync(struct _tsarray_pub *tsarray) __NON_NULL;
+
+int tsarray_log_close(struct _tsarray_pub *tsarray) __NON_NULL;
+
 void tsarray_free(struct _tsarray_pub *p_tsarray) __NON_NULL;
 
 
@@ -108,7 +153,8 @@ void tsarray_free(struct _tsarray_pub *p_tsarray) __NON_NULL;
  *      TSARRAY_TYPEDEF(intarray, int);
  *
  * XXX: Special care was taken in defining the type-specific declaration for
- * the comparison function in arraytype##_min and arraytype##_max.
+ * the comparison function in arraytype##_min, arraytype##_max and
+ * arraytype##_sort.
  *
  * We want to receive two pointers to constant objtype. We cannot use,
  * however, const objtype *. That will break if objtype is a pointer type
@@ -162,6 +208,12 @@ void tsarray_free(struct _tsarray_pub *p_tsarray) __NON_NULL;
                 (const struct _tsarray_pub *)array, \
                 (int (*)(const void *, const void *, void *))cmp, arg); \
     } \
+    static inline int arraytype##_sort(arraytype *array, \
+            int (*cmp)(objtype const *a, objtype const *b, void *arg), \
+            void *arg) { \
+        return tsarray_sort((struct _tsarray_pub *)array, \
+                (int (*)(const void *, const void *, void *))cmp, arg); \
+    } \
     static inline int arraytype##_remove(arraytype *array, long index) { \
         return tsarray_remove((struct _tsarray_pub *)array, index); \
     } \
@@ -170,6 +222,38 @@ void tsarray_free(struct _tsarray_pub *p_tsarray) __NON_NULL;
         return (arraytype *)tsarray_slice((const struct _tsarray_pub *)array, \
                 start, stop, step); \
     } \
+    static inline int arraytype##_save(const arraytype *array, int fd) { \
+        return tsarray_save((const struct _tsarray_pub *)array, fd); \
+    } \
+    static inline arraytype *arraytype##_load(int fd) { \
+        return (arraytype *)tsarray_load(fd, sizeof(objtype)); \
+    } \
+    static inline arraytype *arraytype##_map(const char *path) { \
+        return (arraytype *)tsarray_map(path, sizeof(objtype)); \
+    } \
+    static inline long arraytype##_read(arraytype *array, int fd, \
+            unsigned long count) { \
+        return tsarray_read((struct _tsarray_pub *)array, fd, count); \
+    } \
+    static inline int arraytype##_swap(arraytype *a, arraytype *b) { \
+        return tsarray_swap((struct _tsarray_pub *)a, \
+                (struct _tsarray_pub *)b); \
+    } \
+    static inline int arraytype##_assign(arraytype *array, \
+            objtype const *src, unsigned long src_len) { \
+        return tsarray_assign((struct _tsarray_pub *)array, src, src_len); \
+    } \
+    static inline int arraytype##_log_open(arraytype *array, \
+            const char *path, size_t sync_bytes, long sync_ms) { \
+        return tsarray_log_open((struct _tsarray_pub *)array, path, \
+                sync_bytes, sync_ms); \
+    } \
+    static inline int arraytype##_log_sync(arraytype *array) { \
+        return tsarray_log_sync((struct _tsarray_pub *)array); \
+    } \
+    static inline int arraytype##_log_close(arraytype *array) { \
+        return tsarray_log_close((struct _tsarray_pub *)array); \
+    } \
     static inline void arraytype##_free(arraytype *array) { \
         tsarray_free((struct _tsarray_pub *)array); \
     }
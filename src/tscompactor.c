@@ -0,0 +1,774 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tscompactor.c - background compaction of a tssparse
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get sched_yield */
+#include <sched.h>
+
+/* get memcpy and memset */
+#include <string.h>
+
+/* get clock_gettime */
+#include <time.h>
+
+#include "tscompactor.h"
+#include "common.h"
+
+
+
+static void *compactor_main(void *arg) __NON_NULL;
+
+static int compact_step(struct tscompactor *compactor) __NON_NULL;
+
+static void wait_for_work(struct tscompactor *compactor) __NON_NULL;
+
+static int step_should_compact(long len, long used_count, void *arg);
+
+static void step_will_move(long from, long to, void *arg);
+
+static void step_moved(long from, long to, void *arg);
+
+static int read_item(const struct _tscompactor_view *view, long index,
+        size_t obj_size, void *object) __NON_NULL __NO_SANITIZE_THREAD;
+
+static int copy_object(const struct _tscompactor_view *view, long index,
+        size_t obj_size, void *object) __NON_NULL __NO_SANITIZE_THREAD;
+
+static int take_copy(struct tscompactor *compactor) __NON_NULL;
+
+static void set_live(struct tscompactor *compactor) __NON_NULL;
+
+static void publish(struct tscompactor *compactor,
+        struct _tscompactor_view *view) __NON_NULL;
+
+static void wait_for_readers(struct tscompactor *compactor) __NON_NULL;
+
+static void begin_write(struct tscompactor *compactor, long index)
+    __NON_NULL __NO_SANITIZE_THREAD;
+
+static void end_write(struct tscompactor *compactor, long index)
+    __NON_NULL;
+
+
+/*
+ * Start a background compactor for a tssparse.
+ *
+ * Receives the compactor to start, the tssparse and its object size, the
+ * mutex which guards the array, the most moves to make while holding it,
+ * how many milliseconds to sleep while there's nothing to compact, and
+ * optional hooks for deciding when to compact and for reporting moves
+ * (see struct tssparse_compact_ops; they are copied).
+ *
+ * Returns 0 in case of success, non-zero otherwise. The compactor must be
+ * stopped with tscompactor_stop before the array is freed. Until then,
+ * the array must only be changed through the compactor (see struct
+ * tscompactor).
+ */
+int tscompactor_start(struct tscompactor *compactor,
+        struct _tssparse_abs *p_tssparse, size_t obj_size,
+        pthread_mutex_t *lock, int max_moves, long interval_ms,
+        const struct tssparse_compact_ops *ops)
+{
+    if (unlikely(max_moves <= 0 || interval_ms <= 0))
+        return TSCOMPACTOR_EINVAL;
+
+    compactor->array = p_tssparse;
+    compactor->obj_size = obj_size;
+    compactor->lock = lock;
+    compactor->max_moves = max_moves;
+    compactor->interval_ms = interval_ms;
+    compactor->woken = 0;
+    compactor->stopping = 0;
+    compactor->copy = NULL;
+    compactor->old_seqs = NULL;
+    compactor->seq_count = max(p_tssparse->len, 1L);
+    compactor->epoch = 0;
+    compactor->active[0] = 0;
+    compactor->active[1] = 0;
+
+    if (ops != NULL)
+        compactor->ops = *ops;
+    else
+    {
+        compactor->ops.should_compact = NULL;
+        compactor->ops.moved = NULL;
+        compactor->ops.arg = NULL;
+        compactor->ops.will_move = NULL;
+    }
+
+    compactor->step_ops.should_compact = step_should_compact;
+    compactor->step_ops.moved = step_moved;
+    compactor->step_ops.arg = compactor;
+    compactor->step_ops.will_move = step_will_move;
+
+    compactor->seqs = calloc((size_t)compactor->seq_count,
+                             sizeof(*compactor->seqs));
+    if (unlikely(compactor->seqs == NULL))
+        return TSCOMPACTOR_ENOMEM;
+
+    set_live(compactor);
+    compactor->view = &compactor->live;
+
+    if (unlikely(pthread_mutex_init(&compactor->wake_lock, NULL) != 0))
+        goto fail_mutex;
+
+    if (unlikely(pthread_cond_init(&compactor->wake_cond, NULL) != 0))
+        goto fail_cond;
+
+    if (unlikely(pthread_create(&compactor->thread, NULL, compactor_main,
+                                compactor) != 0))
+        goto fail_thread;
+
+    return 0;
+
+fail_thread:
+    pthread_cond_destroy(&compactor->wake_cond);
+fail_cond:
+    pthread_mutex_destroy(&compactor->wake_lock);
+fail_mutex:
+    free(compactor->seqs);
+
+    return TSCOMPACTOR_EAGAIN;
+}
+
+
+
+/*
+ * Wake a background compactor, so it checks for work right away instead of
+ * at the end of its interval. Useful after removing many objects.
+ */
+void tscompactor_wake(struct tscompactor *compactor)
+{
+    pthread_mutex_lock(&compactor->wake_lock);
+    compactor->woken = 1;
+    pthread_cond_signal(&compactor->wake_cond);
+    pthread_mutex_unlock(&compactor->wake_lock);
+}
+
+
+
+/*
+ * Stop a background compactor, and wait for its thread to finish.
+ *
+ * Must not be called with the array's lock held, nor while any thread may
+ * still call tscompactor_get. A compaction in progress is left where it
+ * is; a later tssparse_compact_step, tssparse_compact or compactor
+ * carries on from there.
+ */
+void tscompactor_stop(struct tscompactor *compactor)
+{
+    pthread_mutex_lock(&compactor->wake_lock);
+    __atomic_store_n(&compactor->stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&compactor->wake_cond);
+    pthread_mutex_unlock(&compactor->wake_lock);
+
+    pthread_join(compactor->thread, NULL);
+
+    pthread_cond_destroy(&compactor->wake_cond);
+    pthread_mutex_destroy(&compactor->wake_lock);
+
+    free(compactor->seqs);
+}
+
+
+
+/*
+ * Read an object from an array being compacted, without taking its lock.
+ *
+ * Receives the compactor, the object's index, and where to copy the
+ * object to. May be called by any number of threads at once, while other
+ * threads add, remove, or move objects, or reallocate the array; never
+ * waits for them, nor loops. If the item was written to while it was
+ * being copied, it was emptied at some point meanwhile, and is reported
+ * as such.
+ *
+ * Returns 0 in case of success, or TSCOMPACTOR_ENOENT if the item is out
+ * of range or empty (in which case object is left undefined).
+ */
+int tscompactor_get(struct tscompactor *compactor, long index, void *object)
+{
+    /* any parity will do; the flip only keeps new readers from holding
+     * back a grace period */
+    unsigned long *active = &compactor->active[
+        __atomic_load_n(&compactor->epoch, __ATOMIC_RELAXED) & 1];
+    const struct _tscompactor_view *view;
+    int found = 0;
+
+    if (unlikely(index < 0))
+        return TSCOMPACTOR_ENOENT;
+
+    /* counted in before getting the view, so a writer replacing the view
+     * either sees this reader, or is seen to have replaced it */
+    __atomic_fetch_add(active, 1, __ATOMIC_SEQ_CST);
+    view = __atomic_load_n(&compactor->view, __ATOMIC_SEQ_CST);
+
+    if (index < view->len)
+        found = read_item(view, index, compactor->obj_size, object);
+
+    __atomic_fetch_sub(active, 1, __ATOMIC_RELEASE);
+
+    return found ? 0 : TSCOMPACTOR_ENOENT;
+}
+
+
+
+/*
+ * Add an object to an array being compacted.
+ *
+ * Receives the compactor, and the object to copy in. MUST be called with
+ * the array's lock held. If the array must grow, readers are sent to a
+ * copy of it meanwhile (see tscompactor_begin_change).
+ *
+ * Returns the object's index in case of success, or a negative error
+ * value (see tssparse_add) in case of error.
+ */
+long tscompactor_add(struct tscompactor *compactor, const void *object)
+{
+    int resizes;
+    const long index = tssparse_next_free(compactor->array, &resizes);
+    long added;
+
+    if (resizes || index >= compactor->seq_count)
+    {
+        if (unlikely(tscompactor_begin_change(compactor, index + 1) != 0))
+            return TSSPARSE_ENOMEM;
+
+        added = tssparse_add(compactor->array, object, compactor->obj_size);
+        tscompactor_end_change(compactor);
+    }
+    else
+    {
+        begin_write(compactor, index);
+        added = tssparse_add(compactor->array, object, compactor->obj_size);
+        end_write(compactor, index);
+    }
+
+    assert(added < 0 || added == index);
+
+    return added;
+}
+
+
+
+/*
+ * Remove an object from an array being compacted.
+ *
+ * Receives the compactor and the object's index. MUST be called with the
+ * array's lock held. Returns 0 in case of success, or a negative error
+ * value (see tssparse_remove) in case of error.
+ */
+int tscompactor_remove(struct tscompactor *compactor, long index)
+{
+    int retval;
+
+    if (unlikely(index < 0 || index >= compactor->array->len))
+        return TSSPARSE_EINVAL;
+
+    begin_write(compactor, index);
+    retval = tssparse_remove(compactor->array, index);
+    end_write(compactor, index);
+
+    return retval;
+}
+
+
+
+/*
+ * Get ready to change an array being compacted in any way (e.g. truncate
+ * or reallocate it).
+ *
+ * Receives the compactor, and the largest length the array will have
+ * during the change. MUST be called with the array's lock held, which
+ * must be kept until tscompactor_end_change. Sends readers to a copy of
+ * the array, and waits for those still in the array itself to leave.
+ * Changes can't be nested.
+ *
+ * Returns 0 in case of success, or TSCOMPACTOR_ENOMEM if the copy
+ * couldn't be made (the array mustn't be changed, then).
+ */
+int tscompactor_begin_change(struct tscompactor *compactor, long len)
+{
+    unsigned int *seqs = NULL;
+    long seq_count = compactor->seq_count;
+
+    assert(compactor->copy == NULL && compactor->old_seqs == NULL);
+
+    if (len > seq_count)
+    {   /* grow the counters along with the array */
+        seq_count = len > LONG_MAX / 2 ? len : max(len, 2*seq_count);
+
+        if (unlikely(!is_valid_index((unsigned long)seq_count,
+                                     sizeof(*seqs))))
+            return TSCOMPACTOR_ENOMEM;
+
+        seqs = malloc((size_t)seq_count * sizeof(*seqs));
+        if (unlikely(seqs == NULL))
+            return TSCOMPACTOR_ENOMEM;
+
+        memcpy(seqs, compactor->seqs,
+               (size_t)compactor->seq_count * sizeof(*seqs));
+        memset(seqs + compactor->seq_count, 0,
+               (size_t)(seq_count - compactor->seq_count) * sizeof(*seqs));
+    }
+
+    if (unlikely(take_copy(compactor) != 0))
+    {
+        free(seqs);
+        return TSCOMPACTOR_ENOMEM;
+    }
+
+    publish(compactor, &compactor->frozen);
+
+    if (seqs != NULL)
+    {   /* the copy keeps the old counters, which no longer change */
+        compactor->old_seqs = compactor->seqs;
+        compactor->seqs = seqs;
+        compactor->seq_count = seq_count;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Let readers back into an array being compacted, once it has been
+ * changed (see tscompactor_begin_change). MUST be called with the array's
+ * lock held. Waits for the readers of the copy to leave, and frees it.
+ */
+void tscompactor_end_change(struct tscompactor *compactor)
+{
+    /* the array may not have shrunk after all */
+    assert(compactor->array->len <= compactor->seq_count);
+
+    set_live(compactor);
+    publish(compactor, &compactor->live);
+
+    free(compactor->copy);
+    free(compactor->old_seqs);
+    compactor->copy = NULL;
+    compactor->old_seqs = NULL;
+}
+
+
+
+/*
+ * Main loop of a compactor's thread.
+ *
+ * Compacts a step at a time, taking the array's lock for each step only,
+ * and giving other threads a chance to take it in between. Once there's
+ * nothing left to do, waits for more.
+ */
+static void *compactor_main(void *arg)
+{
+    struct tscompactor *compactor = arg;
+
+    while (!__atomic_load_n(&compactor->stopping, __ATOMIC_RELAXED))
+    {
+        int more;
+
+        do
+        {
+            pthread_mutex_lock(compactor->lock);
+            more = compact_step(compactor);
+            pthread_mutex_unlock(compactor->lock);
+
+            /* mutexes aren't fair; let a waiting thread in first */
+            sched_yield();
+        } while (more > 0
+                 && !__atomic_load_n(&compactor->stopping, __ATOMIC_RELAXED));
+
+        wait_for_work(compactor);
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Take one compaction step, of up to max_moves moves. MUST be called with
+ * the array's lock held.
+ *
+ * The moves are made in the array itself, under the readers' eyes. A step
+ * that would also finish compacting is split, as finishing reallocates
+ * the array: the moves go first, and then the finishing, with readers
+ * sent to a copy.
+ *
+ * Returns as tssparse_compact_step.
+ */
+static int compact_step(struct tscompactor *compactor)
+{
+    struct _tssparse_abs *array = compactor->array;
+    const long stop_len = max(array->used_count, array->min_len);
+    int more;
+
+    /* each move cuts an item off the end, until the length gets down to
+     * where compaction stops */
+    if (array->len > stop_len)
+    {
+        const long left = array->len - stop_len;
+
+        if (left > compactor->max_moves)
+            return tssparse_compact_step(array, compactor->max_moves,
+                                         &compactor->step_ops,
+                                         compactor->obj_size);
+
+        /* exactly as many moves as are left: doesn't finish */
+        more = tssparse_compact_step(array, (int)left, &compactor->step_ops,
+                                     compactor->obj_size);
+        if (more <= 0)
+            return more;        /* didn't want to start */
+    }
+
+    if (!array->compacting)
+        return 0;
+
+    if (unlikely(tscompactor_begin_change(compactor, array->len) != 0))
+        return TSSPARSE_ENOMEM;
+
+    more = tssparse_compact_step(array, 1, &compactor->step_ops,
+                                 compactor->obj_size);
+    tscompactor_end_change(compactor);
+
+    return more;
+}
+
+
+
+/*
+ * Sleep until a compactor's interval is over, or it is woken or stopped.
+ */
+static void wait_for_work(struct tscompactor *compactor)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += compactor->interval_ms / 1000;
+    deadline.tv_nsec += (compactor->interval_ms % 1000) * 1000000;
+
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&compactor->wake_lock);
+
+    while (!compactor->woken && !compactor->stopping)
+    {
+        if (pthread_cond_timedwait(&compactor->wake_cond,
+                                   &compactor->wake_lock, &deadline) != 0)
+            break;      /* timed out */
+    }
+
+    compactor->woken = 0;
+    pthread_mutex_unlock(&compactor->wake_lock);
+}
+
+
+
+/*
+ * should_compact hook of the compaction steps: asks the user's hook, if
+ * any, or the default policy.
+ */
+static int step_should_compact(long len, long used_count, void *arg)
+{
+    const struct tscompactor *compactor = arg;
+
+    if (compactor->ops.should_compact != NULL)
+        return compactor->ops.should_compact(len, used_count,
+                                             compactor->ops.arg);
+
+    return tssparse_compact_default_policy(len, used_count, NULL);
+}
+
+
+
+/*
+ * will_move hook of the compaction steps: marks both items as being
+ * written to. The object at from isn't changed by the move, but its item
+ * is emptied, and its memory may be given back to the system.
+ */
+static void step_will_move(long from, long to, void *arg)
+{
+    struct tscompactor *compactor = arg;
+
+    begin_write(compactor, to);
+    begin_write(compactor, from);
+
+    if (compactor->ops.will_move != NULL)
+        compactor->ops.will_move(from, to, compactor->ops.arg);
+}
+
+
+
+/*
+ * moved hook of the compaction steps: done writing to both items; tell
+ * the user's hook, if any.
+ */
+static void step_moved(long from, long to, void *arg)
+{
+    struct tscompactor *compactor = arg;
+
+    end_write(compactor, to);
+    end_write(compactor, from);
+
+    if (compactor->ops.moved != NULL)
+        compactor->ops.moved(from, to, compactor->ops.arg);
+}
+
+
+
+/*
+ * Read an item of a view, which must be within its length, checking its
+ * sequence counter around the copy. An odd counter means the item is
+ * being filled, and counts as empty until that's over, or being emptied,
+ * and counts as empty from the start; a counter which changed meanwhile
+ * means it was emptied at some point.
+ *
+ * Returns whether the item was used, and copied out whole.
+ */
+static int read_item(const struct _tscompactor_view *view, long index,
+        size_t obj_size, void *object)
+{
+    const unsigned int *seq = &view->seqs[index];
+    const unsigned int before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    int found;
+
+    if (unlikely(before & 1))
+        return 0;
+
+    found = copy_object(view, index, obj_size, object);
+
+    /* the copy is done before the counter is checked again */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return found && __atomic_load_n(seq, __ATOMIC_RELAXED) == before;
+}
+
+
+
+/*
+ * Copy an object out of a view, if its item is used.
+ *
+ * Writers may be storing into the item meanwhile, which read_item finds
+ * out from its sequence counter, and then throws the copy away. So the
+ * bitmap and the object are read with relaxed atomic loads (a word at a
+ * time, where aligned), so the compiler can't assume they stay put. Like
+ * read_item, it isn't instrumented by ThreadSanitizer, as the writers'
+ * plain stores would make this a data race.
+ *
+ * Returns whether the item was used.
+ */
+static int copy_object(const struct _tscompactor_view *view, long index,
+        size_t obj_size, void *object)
+{
+    const uint64_t word = __atomic_load_n(
+            &view->used_map[TSSPARSE_MAP_WORD(index)], __ATOMIC_RELAXED);
+    const int shift = view->page_shift;
+    const char *src;
+    char *dest = object;
+
+    if (!(word & TSSPARSE_MAP_MASK(index)))
+        return 0;
+
+    if (shift != 0)
+        src = view->pages[(unsigned long)index >> shift]
+            + ((size_t)index & (((size_t)1 << shift) - 1)) * obj_size;
+    else
+        src = view->items + (size_t)index * obj_size;
+
+    if ((uintptr_t)src % sizeof(unsigned long) == 0)
+    {
+        for (; obj_size >= sizeof(unsigned long);
+               obj_size -= sizeof(unsigned long))
+        {
+            const unsigned long w = __atomic_load_n(
+                    (const unsigned long *)src, __ATOMIC_RELAXED);
+
+            memcpy(dest, &w, sizeof(w));
+            src += sizeof(w);
+            dest += sizeof(w);
+        }
+    }
+
+    for (; obj_size > 0; obj_size--)
+        *dest++ = __atomic_load_n(src++, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+
+
+/*
+ * Copy the used part of an array being compacted (its items up to len,
+ * and their bitmap), for readers to read while it changes. Sets up
+ * frozen to read from the copy, with the current counters, which don't
+ * change while readers are in the copy.
+ *
+ * Returns 0 in case of success, or -1 if out of memory.
+ */
+static int take_copy(struct tscompactor *compactor)
+{
+    const struct _tssparse_abs *array = compactor->array;
+    const size_t obj_size = compactor->obj_size;
+    const long len = array->len;
+    const size_t map_size = ((size_t)len + TSSPARSE_MAP_BITS - 1)
+                            / TSSPARSE_MAP_BITS * sizeof(uint64_t);
+    char *copy;
+
+    /* the array already holds this much, so it can't overflow */
+    copy = malloc(max(map_size + (size_t)len * obj_size, (size_t)1));
+    if (unlikely(copy == NULL))
+        return -1;
+
+    memcpy(copy, array->used_map, map_size);
+
+    if (array->page_shift != 0)
+    {
+        const long page_len = 1L << array->page_shift;
+        long i;
+
+        for (i=0; i<len; i+=page_len)
+            memcpy(copy + map_size + (size_t)i * obj_size,
+                   tssparse_item(array, i, obj_size),
+                   (size_t)min(page_len, len - i) * obj_size);
+    }
+    else if (len > 0)
+        memcpy(copy + map_size, array->items, (size_t)len * obj_size);
+
+    compactor->copy = copy;
+    compactor->frozen.len = len;
+    compactor->frozen.items = copy + map_size;
+    compactor->frozen.pages = NULL;
+    compactor->frozen.page_shift = 0;
+    compactor->frozen.used_map = (uint64_t *)copy;
+    compactor->frozen.seqs = compactor->seqs;
+
+    return 0;
+}
+
+
+
+/*
+ * Set up the live view of an array being compacted, from where its
+ * memory is now. Readers may find items up to its capacity, as far as
+ * there are counters for them (the array doesn't grow past those without
+ * a change).
+ */
+static void set_live(struct tscompactor *compactor)
+{
+    const struct _tssparse_abs *array = compactor->array;
+
+    compactor->live.len = min(array->capacity, compactor->seq_count);
+    compactor->live.items = array->items;
+    compactor->live.pages = array->pages;
+    compactor->live.page_shift = array->page_shift;
+    compactor->live.used_map = array->used_map;
+    compactor->live.seqs = compactor->seqs;
+}
+
+
+
+/*
+ * Send the readers of an array being compacted to a view, and wait for
+ * those still reading the one before to leave.
+ */
+static void publish(struct tscompactor *compactor,
+        struct _tscompactor_view *view)
+{
+    __atomic_store_n(&compactor->view, view, __ATOMIC_SEQ_CST);
+    wait_for_readers(compactor);
+}
+
+
+
+/*
+ * Wait for a grace period: for every reader in tscompactor_get when
+ * called to leave. Only called with the array's lock held, so there's a
+ * single writer.
+ *
+ * Each reader counts itself in under the parity of the epoch it saw.
+ * Flipping the epoch before waiting on each count in turn sends new
+ * readers to the other count, so that only those already in hold the
+ * wait back. Both counts are waited on, as a reader may have seen an
+ * epoch from long ago.
+ */
+static void wait_for_readers(struct tscompactor *compactor)
+{
+    int i;
+
+    for (i=0; i<2; i++)
+    {
+        const unsigned long epoch = compactor->epoch;
+
+        __atomic_store_n(&compactor->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+
+        while (__atomic_load_n(&compactor->active[epoch & 1],
+                               __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
+    }
+}
+
+
+
+/*
+ * Mark an item as being written to, before writing to it. Only called
+ * with the array's lock held, so there's a single writer. Not instrumented
+ * by ThreadSanitizer, which doesn't know fences; the readers' side of the
+ * counter isn't either.
+ */
+static void begin_write(struct tscompactor *compactor, long index)
+{
+    unsigned int *seq = &compactor->seqs[index];
+
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+
+    /* the odd counter is seen before anything written to the item */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+
+/*
+ * Mark an item as written to, after begin_write.
+ */
+static void end_write(struct tscompactor *compactor, long index)
+{
+    unsigned int *seq = &compactor->seqs[index];
+
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,192 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tscompactor.h - background compaction of a tssparse, module header
+ */
+
+
+#ifndef _TSCOMPACTOR_H
+#define _TSCOMPACTOR_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get size_t */
+#include <stddef.h>
+
+/* get uint64_t */
+#include <stdint.h>
+
+/* get threads, mutexes and condition variables */
+#include <pthread.h>
+
+
+#include "common.h"
+#include "tssparse.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tscompactor_errno {
+    TSCOMPACTOR_EOK = 0,        /* Success */
+    TSCOMPACTOR_EINVAL = -1,    /* Invalid argument */
+    TSCOMPACTOR_EAGAIN = -2,    /* Couldn't create the thread */
+    TSCOMPACTOR_ENOENT = -3,    /* No such entry */
+    TSCOMPACTOR_ENOMEM = -4,    /* Out of memory */
+};
+
+
+/* What readers of an array being compacted read from; internal */
+struct _tscompactor_view {
+    long len;                   /* items readers may find */
+    char *items;
+    char **pages;               /* as in the tssparse */
+    int page_shift;
+    uint64_t *used_map;
+    unsigned int *seqs;         /* sequence counter of each item */
+};
+
+
+/*
+ * Background compactor for a tssparse.
+ *
+ * Runs tssparse_compact_step in a thread of its own, so that request
+ * threads never pay for compaction. While it runs, objects are added and
+ * removed with tscompactor_add and tscompactor_remove, with lock held.
+ * The compactor holds lock for one step of up to max_moves moves at a
+ * time, and lets go of it between steps; so writers wait for at most
+ * that many moves, however large the array. Any other change to the
+ * array must also be made with lock held, between tscompactor_begin_change
+ * and tscompactor_end_change.
+ *
+ * Objects are read with tscompactor_get, which is wait-free: it never
+ * takes lock, never waits for a writer, and never tries again. Each item
+ * has a sequence counter, which is odd while the item is being written
+ * to; a reader copies the object out, and if the counter was odd or
+ * changed meanwhile, the item was emptied at some point during the read,
+ * so it's reported as empty. (A moved object, in particular, is found at
+ * neither index while being moved.)
+ *
+ * Readers reach the array through view, which writers swap atomically.
+ * Before the array is reallocated (when an add makes it grow, at the end
+ * of each compaction, or between tscompactor_begin_change and
+ * tscompactor_end_change), readers are sent to a copy of it, which is
+ * only freed once the readers inside it have left. Writers wait for that
+ * (a grace period): readers count themselves in active, by the parity of
+ * epoch, and a grace period flips the epoch twice, waiting for each
+ * count to drop to zero in turn, so new readers never hold it back.
+ *
+ * Moved objects are reported through ops->moved, called with lock held,
+ * like any other tssparse_compact_step. Once moved, an object is gone
+ * from its old index, as if removed. Handles to moved objects become
+ * stale, as usual.
+ *
+ * When there's nothing to compact, the compactor sleeps for interval_ms
+ * milliseconds, or until tscompactor_wake is called. The rest of the
+ * members are internal.
+ */
+struct tscompactor {
+    struct _tssparse_abs *array;
+    size_t obj_size;
+    pthread_mutex_t *lock;
+    struct tssparse_compact_ops ops;
+    struct tssparse_compact_ops step_ops;   /* ops, as seen by the array */
+    int max_moves;
+    long interval_ms;
+
+    pthread_t thread;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake_cond;
+    int woken;
+    int stopping;
+
+    struct _tscompactor_view *view;     /* what readers read */
+    struct _tscompactor_view live;      /* the array itself */
+    struct _tscompactor_view frozen;    /* a copy, while it changes */
+    void *copy;                         /* memory of frozen */
+    unsigned int *seqs;                 /* counters of the items */
+    unsigned int *old_seqs;             /* those of frozen, if replaced */
+    long seq_count;                     /* at least the array's length */
+    unsigned long epoch;
+    unsigned long active[2];            /* readers in, by epoch parity */
+};
+
+
+int tscompactor_start(struct tscompactor *compactor,
+        struct _tssparse_abs *p_tssparse, size_t obj_size,
+        pthread_mutex_t *lock, int max_moves, long interval_ms,
+        const struct tssparse_compact_ops *ops)
+    __attribute__((nonnull (1, 2, 4)));
+
+void tscompactor_wake(struct tscompactor *compactor) __NON_NULL;
+
+void tscompactor_stop(struct tscompactor *compactor) __NON_NULL;
+
+int tscompactor_get(struct tscompactor *compactor, long index,
+        void *object) __NON_NULL;
+
+long tscompactor_add(struct tscompactor *compactor, const void *object)
+    __NON_NULL;
+
+int tscompactor_remove(struct tscompactor *compactor, long index)
+    __NON_NULL;
+
+int tscompactor_begin_change(struct tscompactor *compactor, long len)
+    __NON_NULL;
+
+void tscompactor_end_change(struct tscompactor *compactor) __NON_NULL;
+
+
+/*
+ * Start a background compactor for a typed tssparse. Same as
+ * tscompactor_start, but takes the object size from the array's type.
+ *
+ * Example (compact sessions, a tssparse of struct session):
+ *      struct tscompactor compactor;
+ *      TSCOMPACTOR_START(&compactor, &sessions, &sessions_lock, 64, 100,
+ *                        &ops);
+ *      ...
+ *      pthread_mutex_lock(&sessions_lock);
+ *      index = tscompactor_add(&compactor, &session);
+ *      pthread_mutex_unlock(&sessions_lock);
+ *      ...
+ *      if (tscompactor_get(&compactor, index, &session) == 0)
+ *          ...
+ *      tscompactor_stop(&compactor);
+ */
+#define TSCOMPACTOR_START(compactor, array, lock, max_moves, interval_ms, \
+                          ops) \
+    tscompactor_start((compactor), (struct _tssparse_abs *)(array), \
+                      sizeof(*(array)->items), (lock), (max_moves), \
+                      (interval_ms), (ops))
+
+
+#endif      /* not _TSCOMPACTOR_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
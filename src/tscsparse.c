@@ -0,0 +1,411 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tscsparse.c - concurrent sparse array module
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get memcpy and memmove */
+#include <string.h>
+
+#include "tscsparse.h"
+#include "common.h"
+
+
+
+/* a word of a bitmap with every item set */
+#define MAP_WORD_FULL (~(uint64_t)0)
+
+/* bit of an item within its bitmap word */
+#define MAP_MASK(offset) ((uint64_t)1 << ((offset) % TSCSPARSE_MAP_BITS))
+
+
+
+static int refill_cache(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, size_t obj_size) __NON_NULL;
+
+static int claim_word(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, long word) __NON_NULL;
+
+static void release_slots(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, int count) __NON_NULL;
+
+static int grow(struct _tscsparse_abs *p_tscsparse, int segment_count,
+        size_t obj_size) __NON_NULL;
+
+static struct tscsparse_segment *new_segment(int k, size_t obj_size)
+    __ATTR_MALLOC;
+
+static void free_segment(struct tscsparse_segment *segment) __NON_NULL;
+
+
+/*
+ * Add an object to a tscsparse.
+ *
+ * Receives the tscsparse, the calling thread's cache, the object, and the
+ * object size for this array. The object is copied to a free item from the
+ * cache, which is refilled from the array first if it's empty. If there
+ * are no free items left, the array grows by a new segment; existing
+ * objects never move.
+ *
+ * Returns the index of the new object in case of success, or a negative
+ * error value in case of error.
+ */
+long tscsparse_add(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, const void *object, size_t obj_size)
+{
+    struct tscsparse_segment *segment;
+    long index, offset;
+
+    if (cache->count == 0)
+    {
+        const int retval = refill_cache(p_tscsparse, cache, obj_size);
+
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    index = cache->slots[--cache->count];
+    segment = tscsparse_locate(p_tscsparse, index, &offset);
+    assert(segment != NULL);
+
+    memcpy(segment->items + (size_t)offset * obj_size, object, obj_size);
+
+    /* publish the object; pairs with the acquire in tscsparse_get_nth */
+    __atomic_fetch_or(&segment->used_map[offset / TSCSPARSE_MAP_BITS],
+                      MAP_MASK(offset), __ATOMIC_RELEASE);
+
+    return index;
+}
+
+
+
+/*
+ * Remove an object from a tscsparse.
+ *
+ * Receives the tscsparse, the calling thread's cache, and the index of the
+ * object to remove. The item goes to the cache, to be reused by this
+ * thread; if the cache is full, the oldest half of it is given back to
+ * the array first.
+ *
+ * If several threads remove the same object at once, only one of them
+ * succeeds. Returns 0 in case of success, TSCSPARSE_ENOENT if the item was
+ * already empty, or TSCSPARSE_EINVAL if the index is out of range.
+ */
+int tscsparse_remove(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, long index)
+{
+    long offset;
+    struct tscsparse_segment *segment =
+        tscsparse_locate(p_tscsparse, index, &offset);
+    uint64_t mask, old;
+
+    if (unlikely(segment == NULL))
+        return TSCSPARSE_EINVAL;
+
+    mask = MAP_MASK(offset);
+    old = __atomic_fetch_and(&segment->used_map[offset / TSCSPARSE_MAP_BITS],
+                             ~mask, __ATOMIC_ACQ_REL);
+
+    if (unlikely(!(old & mask)))
+        return TSCSPARSE_ENOENT;
+
+    if (cache->count == TSCSPARSE_CACHE_SIZE)
+        release_slots(p_tscsparse, cache, TSCSPARSE_CACHE_SIZE / 2);
+
+    cache->slots[cache->count++] = index;
+
+    return 0;
+}
+
+
+
+/*
+ * Give all the free items in a thread's cache back to a tscsparse.
+ *
+ * Must be called before a thread is done with the array; otherwise its
+ * cached items can never be used again (until the array is cleared). The
+ * cache may be used again afterwards.
+ */
+void tscsparse_flush(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache)
+{
+    release_slots(p_tscsparse, cache, cache->count);
+}
+
+
+
+/*
+ * Clear a tscsparse, freeing all its memory.
+ *
+ * Not thread-safe: no other thread may be using the array. Every cache
+ * must have been flushed first.
+ */
+void tscsparse_clear(struct _tscsparse_abs *p_tscsparse)
+{
+    int k;
+
+    for (k=0; k<p_tscsparse->segment_count; k++)
+    {
+        free_segment(p_tscsparse->segments[k]);
+        p_tscsparse->segments[k] = NULL;
+    }
+
+    p_tscsparse->segment_count = 0;
+}
+
+
+
+/*
+ * Refill a thread's empty cache with free items from a tscsparse.
+ *
+ * Goes through the bitmap words from where the thread last found free
+ * items, wrapping around at the end, and claims the first free ones it
+ * finds. A new cache starts at a word picked from its address, to keep
+ * threads apart. If the array is full, it grows.
+ *
+ * Returns 0 in case of success, non-zero otherwise.
+ */
+static int refill_cache(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, size_t obj_size)
+{
+    assert(cache->count == 0);
+
+    for (;;)
+    {
+        const int segment_count = __atomic_load_n(
+                &p_tscsparse->segment_count, __ATOMIC_ACQUIRE);
+        const long words = TSCSPARSE_SEG_START(segment_count)
+                           / TSCSPARSE_MAP_BITS;
+        long w = cache->cursor;
+        long scanned;
+        int retval;
+
+        if (w < 0 || w >= words)
+        {   /* a multiplicative hash of the address, to spread threads */
+            const uint64_t hash = (uint64_t)(uintptr_t)cache
+                                  * UINT64_C(0x9e3779b97f4a7c15);
+
+            w = words > 0 ? (long)((hash >> 32) % (uint64_t)words) : 0;
+        }
+
+        for (scanned = 0; scanned < words; scanned++)
+        {
+            if (claim_word(p_tscsparse, cache, w))
+            {
+                cache->cursor = w;
+                return 0;
+            }
+
+            if (++w == words)
+                w = 0;
+        }
+
+        /* full; the new segment is all free, start looking there */
+        retval = grow(p_tscsparse, segment_count, obj_size);
+        if (unlikely(retval != 0))
+            return retval;
+
+        cache->cursor = words;
+    }
+    /* UNREACHABLE */
+}
+
+
+
+/*
+ * Claim all the free items in one bitmap word of a tscsparse.
+ *
+ * Receives the tscsparse, a thread's empty cache, and the index of the
+ * word, counting through all the segments. The claimed items are pushed
+ * onto the cache, so that the lowest will be used first.
+ *
+ * Returns true if any items were claimed.
+ */
+static int claim_word(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, long word)
+{
+    const long first = word * TSCSPARSE_MAP_BITS;
+    long offset;
+    struct tscsparse_segment *segment =
+        tscsparse_locate(p_tscsparse, first, &offset);
+    uint64_t *claims;
+    uint64_t old, bits;
+    int count;
+
+    /* a cache holds exactly one word's worth of items */
+    assert(cache->count == 0);
+    assert(segment != NULL);
+
+    claims = &segment->claim_map[offset / TSCSPARSE_MAP_BITS];
+    old = __atomic_load_n(claims, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (old == MAP_WORD_FULL)
+            return 0;
+    } while (!__atomic_compare_exchange_n(claims, &old, MAP_WORD_FULL, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    /* push in reverse, so that the lowest item is on top */
+    count = popcount64(~old);
+    cache->count = count;
+
+    for (bits = ~old; bits != 0; bits &= bits - 1)
+        cache->slots[--count] = first + ctz64(bits);
+
+    return 1;
+}
+
+
+
+/*
+ * Give the oldest count items in a thread's cache back to a tscsparse.
+ *
+ * The rest of the items move to the bottom of the cache.
+ */
+static void release_slots(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, int count)
+{
+    int i;
+
+    assert(count <= cache->count);
+
+    for (i=0; i<count; i++)
+    {
+        long offset;
+        struct tscsparse_segment *segment =
+            tscsparse_locate(p_tscsparse, cache->slots[i], &offset);
+
+        assert(segment != NULL);
+
+        __atomic_fetch_and(&segment->claim_map[offset / TSCSPARSE_MAP_BITS],
+                           ~MAP_MASK(offset), __ATOMIC_RELEASE);
+    }
+
+    cache->count -= count;
+    memmove(cache->slots, cache->slots + count,
+            (size_t)cache->count * sizeof(cache->slots[0]));
+}
+
+
+
+/*
+ * Grow a tscsparse by one segment.
+ *
+ * Receives the tscsparse, the number of segments it had when the caller
+ * found it full, and the object size for this array. Several threads may
+ * try to grow the array at once; only one new segment is kept, and it's
+ * not an error if another thread already added it.
+ *
+ * Returns 0 in case of success, non-zero otherwise.
+ */
+static int grow(struct _tscsparse_abs *p_tscsparse, int segment_count,
+        size_t obj_size)
+{
+    struct tscsparse_segment *segment;
+    struct tscsparse_segment *expected = NULL;
+    int expected_count = segment_count;
+
+    if (unlikely(segment_count == TSCSPARSE_MAX_SEGMENTS))
+        return TSCSPARSE_EOVERFLOW;
+
+    /* don't bother allocating, if some other thread just did */
+    if (__atomic_load_n(&p_tscsparse->segments[segment_count],
+                        __ATOMIC_ACQUIRE) == NULL)
+    {
+        segment = new_segment(segment_count, obj_size);
+        if (unlikely(segment == NULL))
+            return TSCSPARSE_ENOMEM;
+
+        /* on failure, acquire the winner's segment: we may be the one to
+         * publish it below, and readers must then see it built */
+        if (!__atomic_compare_exchange_n(
+                    &p_tscsparse->segments[segment_count], &expected,
+                    segment, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+            free_segment(segment);  /* lost the race */
+    }
+
+    /* publish it, unless the thread that stored it already did */
+    __atomic_compare_exchange_n(&p_tscsparse->segment_count, &expected_count,
+                                segment_count + 1, 0, __ATOMIC_RELEASE,
+                                __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+
+
+/*
+ * Allocate segment k of a tscsparse, with all its items free.
+ *
+ * Returns the new segment, or NULL in case of error.
+ */
+static struct tscsparse_segment *new_segment(int k, size_t obj_size)
+{
+    const size_t len = (size_t)TSCSPARSE_SEG_LEN(k);
+    const size_t words = len / TSCSPARSE_MAP_BITS;
+    struct tscsparse_segment *segment;
+
+    if (unlikely(!can_size_mult(len, obj_size)))
+        return NULL;
+
+    segment = malloc(sizeof(*segment));
+    if (unlikely(segment == NULL))
+        return NULL;
+
+    segment->claim_map = calloc(words, sizeof(uint64_t));
+    segment->used_map = calloc(words, sizeof(uint64_t));
+    segment->items = malloc(len * obj_size);
+
+    if (unlikely(segment->claim_map == NULL || segment->used_map == NULL
+                 || segment->items == NULL))
+    {
+        free_segment(segment);
+        return NULL;
+    }
+
+    return segment;
+}
+
+
+
+/*
+ * Free a segment of a tscsparse.
+ */
+static void free_segment(struct tscsparse_segment *segment)
+{
+    free(segment->claim_map);
+    free(segment->used_map);
+    free(segment->items);
+    free(segment);
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,304 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tscsparse.h - concurrent sparse array module header
+ */
+
+
+#ifndef _TSCSPARSE_H
+#define _TSCSPARSE_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get NULL and size_t */
+#include <stddef.h>
+
+/* get memory allocation */
+#include <stdlib.h>
+
+/* get uint64_t */
+#include <stdint.h>
+
+
+#include "common.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tscsparse_errno {
+    TSCSPARSE_EOK = 0,        /* Success */
+    TSCSPARSE_EINVAL = -1,    /* Invalid argument */
+    TSCSPARSE_ENOENT = -2,    /* No such entry */
+    TSCSPARSE_ENOMEM = -3,    /* Out of memory */
+    TSCSPARSE_EOVERFLOW = -4, /* Operation would overflow */
+};
+
+
+/* Number of items in the first segment; each segment after it is twice as
+ * large as the one before. Must be a multiple of TSCSPARSE_MAP_BITS. */
+#define TSCSPARSE_SEG_BASE 1024
+
+/* Maximum number of segments, i.e. TSCSPARSE_SEG_BASE * (2^48 - 1) items */
+#define TSCSPARSE_MAX_SEGMENTS 48
+
+/* Number of items tracked by each word of the occupancy bitmaps */
+#define TSCSPARSE_MAP_BITS 64
+
+/* Index of the first item in segment k */
+#define TSCSPARSE_SEG_START(k) \
+    ((long)TSCSPARSE_SEG_BASE * (long)((1UL << (k)) - 1))
+
+/* Number of items in segment k */
+#define TSCSPARSE_SEG_LEN(k) ((long)TSCSPARSE_SEG_BASE << (k))
+
+
+/*
+ * A segment of a tscsparse: a fixed number of items, and two bitmaps with
+ * one bit per item, packed into 64-bit words.
+ *
+ * An item is claimed when some thread owns it, whether or not it holds an
+ * object; claim_map is only ever changed by compare-and-swap, so each
+ * item is handed out to a single thread. An item is used when it holds an
+ * object, which other threads may see.
+ */
+struct tscsparse_segment {
+    uint64_t *claim_map;
+    uint64_t *used_map;
+    char *items;
+};
+
+
+/*
+ * Members of a tscsparse. Shared by the abstract version below and the
+ * subclassed versions in TSCSPARSE_TYPEDEF, so that their layouts always
+ * match.
+ *
+ * The items are kept in segments, which are allocated as the array grows,
+ * and never moved or freed until the array is cleared; so a pointer to an
+ * object remains valid for as long as the object is in the array. Indices
+ * run through the segments in order: segment k holds the items from
+ * TSCSPARSE_SEG_START(k), and is TSCSPARSE_SEG_LEN(k) items long.
+ *
+ * segment_count is the number of segments in use. A new segment is first
+ * stored in segments, then published by incrementing segment_count.
+ */
+#define _TSCSPARSE_MEMBERS \
+    int segment_count; \
+    struct tscsparse_segment *segments[TSCSPARSE_MAX_SEGMENTS];
+
+
+/* abstract version; only for internal use */
+struct _tscsparse_abs {
+    _TSCSPARSE_MEMBERS
+};
+
+
+/*
+ * Per-thread cache of free items for a tscsparse.
+ *
+ * Each thread working on a tscsparse must have its own cache. Free items
+ * are claimed from the array a whole bitmap word at a time, and kept here
+ * until they are used; removed items are kept here too, until the cache
+ * is full. So threads rarely touch the same words, and most adds and
+ * removes don't need a compare-and-swap at all.
+ *
+ * slots is a stack of the claimed items' indices, and count how many there
+ * are. cursor is the bitmap word where the thread last found free items,
+ * or -1 if it has yet to look.
+ *
+ * The items in a cache can't be used by any other thread. Before a thread
+ * is done with the array, it must give them back with tscsparse_flush.
+ */
+#define TSCSPARSE_CACHE_SIZE 64
+
+struct tscsparse_cache {
+    long slots[TSCSPARSE_CACHE_SIZE];
+    int count;
+    long cursor;
+};
+
+
+long tscsparse_add(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, const void *object, size_t obj_size)
+    __NON_NULL;
+
+int tscsparse_remove(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache, long index) __NON_NULL;
+
+void tscsparse_flush(struct _tscsparse_abs *p_tscsparse,
+        struct tscsparse_cache *cache) __NON_NULL;
+
+void tscsparse_clear(struct _tscsparse_abs *p_tscsparse) __NON_NULL;
+
+
+/*
+ * Get the number of items in a tscsparse, used or not, i.e. valid indices
+ * go from 0 to the returned value minus one. The array may grow at any
+ * time, but never shrinks until it is cleared.
+ */
+static inline long tscsparse_capacity(const struct _tscsparse_abs *p_tscsparse)
+{
+    const int count = __atomic_load_n(&p_tscsparse->segment_count,
+                                      __ATOMIC_ACQUIRE);
+
+    return TSCSPARSE_SEG_START(count);
+}
+
+
+/*
+ * Find the segment holding an item of a tscsparse.
+ *
+ * Receives the tscsparse and the index of the item, and where to store its
+ * position within the segment. Returns the segment, or NULL if the index
+ * is out of range.
+ */
+static inline struct tscsparse_segment *tscsparse_locate(
+        const struct _tscsparse_abs *p_tscsparse, long index, long *offset)
+{
+    unsigned long first;
+    int k;
+
+    if (unlikely(index < 0))
+        return NULL;
+
+    /* segment k starts at SEG_BASE * (2^k - 1) */
+    first = (unsigned long)index / TSCSPARSE_SEG_BASE + 1;
+    k = 63 - clz64(first);
+
+    if (unlikely(k >= __atomic_load_n(&p_tscsparse->segment_count,
+                                      __ATOMIC_ACQUIRE)))
+        return NULL;
+
+    *offset = index - TSCSPARSE_SEG_START(k);
+
+    /* ordered by the acquire above; atomic only because a thread that lost
+     * the race to add this segment may still be trying to swap it in */
+    return __atomic_load_n(&p_tscsparse->segments[k], __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Get a pointer to an object in a tscsparse.
+ *
+ * Receives the tscsparse, the index of the item, and the object size for
+ * this array. Returns NULL if the item is out of range or empty. The
+ * pointer remains valid until the object is removed; making sure no other
+ * thread removes it meanwhile is up to the caller.
+ */
+static inline void *tscsparse_get_nth(const struct _tscsparse_abs *p_tscsparse,
+        long index, size_t obj_size)
+{
+    long offset;
+    const struct tscsparse_segment *segment =
+        tscsparse_locate(p_tscsparse, index, &offset);
+    uint64_t bits;
+
+    if (unlikely(segment == NULL))
+        return NULL;
+
+    /* pairs with the release in tscsparse_add, so the object is there */
+    bits = __atomic_load_n(&segment->used_map[offset / TSCSPARSE_MAP_BITS],
+                           __ATOMIC_ACQUIRE);
+
+    if (unlikely(!(bits & ((uint64_t)1 << (offset % TSCSPARSE_MAP_BITS)))))
+        return NULL;
+
+    return segment->items + (size_t)offset * obj_size;
+}
+
+
+/*
+ * Declare a new type-specific tscsparse type.
+ *
+ * Defines (typedefs) arraytype to the new tscsparse type, which will store
+ * objects of type objtype. Defines type-specific functions to manipulate
+ * the new array type using the prefix arraytype_*, e.g. conntable_add(),
+ * etc.
+ *
+ * Adding, removing and getting objects may be done by any number of
+ * threads at once, each with its own struct tscsparse_cache. Clearing
+ * must be done by a single thread, with no other thread using the array.
+ *
+ * Example (define conntable as a tscsparse of struct conn):
+ *      TSCSPARSE_TYPEDEF(conntable, struct conn);
+ *      ...
+ *      struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+ *      long index = conntable_add(&table, &cache, &conn);
+ *      ...
+ *      conntable_flush(&table, &cache);
+ */
+#define TSCSPARSE_TYPEDEF(arraytype, objtype) \
+    typedef struct { \
+        _TSCSPARSE_MEMBERS \
+    } arraytype; \
+    static inline long arraytype##_add(arraytype *array, \
+            struct tscsparse_cache *cache, objtype *object) { \
+        return tscsparse_add((struct _tscsparse_abs *)array, cache, object, \
+                             sizeof(objtype)); \
+    } \
+    static inline int arraytype##_remove(arraytype *array, \
+            struct tscsparse_cache *cache, long index) { \
+        return tscsparse_remove((struct _tscsparse_abs *)array, cache, \
+                                index); \
+    } \
+    static inline objtype *arraytype##_get_nth(const arraytype *array, \
+            long index) { \
+        return tscsparse_get_nth((const struct _tscsparse_abs *)array, \
+                                 index, sizeof(objtype)); \
+    } \
+    static inline long arraytype##_capacity(const arraytype *array) { \
+        return tscsparse_capacity((const struct _tscsparse_abs *)array); \
+    } \
+    static inline void arraytype##_flush(arraytype *array, \
+            struct tscsparse_cache *cache) { \
+        tscsparse_flush((struct _tscsparse_abs *)array, cache); \
+    } \
+    static inline void arraytype##_clear(arraytype *array) { \
+        tscsparse_clear((struct _tscsparse_abs *)array); \
+    }
+
+
+
+/* Initializer for an empty tscsparse. May be used directly as initializer
+ * on a declaration, or as rvalue on an assignment expression (for an
+ * already declared identifier). In the latter case, this must be must be
+ * transformed into a compound literal (by prepending the type name in
+ * parenthesis), e.g.:
+ *      t1 = (conntable)TSCSPARSE_INITIALIZER;
+ */
+#define TSCSPARSE_INITIALIZER { 0, { NULL } }
+
+/* Initializer for an empty struct tscsparse_cache. */
+#define TSCSPARSE_CACHE_INITIALIZER { { 0 }, 0, -1 }
+
+
+#endif      /* not _TSCSPARSE_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
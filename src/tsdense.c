@@ -0,0 +1,260 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsdense.c - densely packed sparse set module
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get INT_MAX */
+#include <limits.h>
+
+/* get memcpy */
+#include <string.h>
+
+#include "tsdense.h"
+#include "common.h"
+
+
+
+/* the tsarrays, as seen by the tsarray module */
+#define OBJECTS(p)      ((struct _tsarray_pub *)(p)->objects)
+#define INDICES(p)      ((struct _tsarray_pub *)(p)->indices)
+#define POSITIONS(p)    ((struct _tsarray_pub *)(p)->positions)
+
+
+
+static int create_arrays(struct _tsdense_abs *p_tsdense, size_t obj_size)
+    __NON_NULL;
+
+static int grow_indices(struct _tsdense_abs *p_tsdense) __NON_NULL;
+
+
+/*
+ * Add an object to a tsdense.
+ *
+ * Receives the tsdense, the object, and the object size for this array.
+ * The object is copied to the end of the packed objects. Its index is the
+ * most recently freed one, or a new index if there are none free.
+ *
+ * Returns the index of the new object in case of success, or a negative
+ * error value in case of error. In case of error, the tsdense is left
+ * unchanged (though it may have allocated memory).
+ */
+int tsdense_add(struct _tsdense_abs *p_tsdense, const void *object,
+        size_t obj_size)
+{
+    const int count = p_tsdense->count;
+    int retval;
+
+    assert(count <= p_tsdense->len);
+
+    if (unlikely(p_tsdense->objects == NULL))
+    {
+        retval = create_arrays(p_tsdense, obj_size);
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    if (count == p_tsdense->len)
+    {   /* no free indices left */
+        retval = grow_indices(p_tsdense);
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    if ((unsigned long)count < tsarray_len(OBJECTS(p_tsdense)))
+    {   /* left over from a failed shrink; reuse it */
+        memcpy(p_tsdense->objects->items + (size_t)count * obj_size,
+               object, obj_size);
+    }
+    else
+    {
+        retval = tsarray_append(OBJECTS(p_tsdense), object);
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    p_tsdense->count = count + 1;
+
+    return p_tsdense->indices->items[count];
+}
+
+
+
+/*
+ * Remove an object from a tsdense.
+ *
+ * Receives the tsdense, the index of the object to remove, and the object
+ * size for this array. The last of the packed objects is moved into the
+ * removed one's place. Removing an empty item does nothing.
+ *
+ * Returns 0 in case of success, or TSDENSE_EINVAL if the index is out of
+ * range.
+ */
+int tsdense_remove(struct _tsdense_abs *p_tsdense, int index,
+        size_t obj_size)
+{
+    int *indices, *positions;
+    int position;
+    int last;
+
+    if (unlikely(index < 0 || index >= p_tsdense->len))
+        return TSDENSE_EINVAL;
+
+    indices = p_tsdense->indices->items;
+    positions = p_tsdense->positions->items;
+    position = positions[index];
+    last = p_tsdense->count - 1;
+
+    if (position > last)
+    {   /* already empty */
+        return 0;
+    }
+
+    if (position < last)
+    {   /* move the last object here, and swap the indices' places */
+        const int moved = indices[last];
+        char *items = p_tsdense->objects->items;
+
+        memcpy(items + (size_t)position * obj_size,
+               items + (size_t)last * obj_size, obj_size);
+
+        indices[position] = moved;
+        positions[moved] = position;
+        indices[last] = index;
+        positions[index] = last;
+    }
+
+    /* the removed index is now the first free one */
+    p_tsdense->count = last;
+
+    /* even if this fails, the tsdense is still consistent (objects is
+     * just longer than it needs to be) */
+    tsarray_remove(OBJECTS(p_tsdense), last);
+
+    return 0;
+}
+
+
+
+/*
+ * Remove all objects from a tsdense, and free its memory.
+ *
+ * Afterwards, the tsdense is empty, as though just initialized with
+ * TSDENSE_INITIALIZER, and may be used again.
+ */
+void tsdense_clear(struct _tsdense_abs *p_tsdense)
+{
+    if (p_tsdense->objects != NULL)
+        tsarray_free(OBJECTS(p_tsdense));
+
+    if (p_tsdense->indices != NULL)
+        tsarray_free(INDICES(p_tsdense));
+
+    if (p_tsdense->positions != NULL)
+        tsarray_free(POSITIONS(p_tsdense));
+
+    p_tsdense->count = 0;
+    p_tsdense->len = 0;
+    p_tsdense->objects = NULL;
+    p_tsdense->indices = NULL;
+    p_tsdense->positions = NULL;
+}
+
+
+
+/*
+ * Create the tsarrays of an empty tsdense.
+ *
+ * Receives the tsdense and the object size for this array. Returns 0 in
+ * case of success, non-zero otherwise. In case of error, nothing is
+ * created.
+ */
+static int create_arrays(struct _tsdense_abs *p_tsdense, size_t obj_size)
+{
+    struct _tsarray_pub *objects = tsarray_new(obj_size);
+    struct _tsarray_pub *indices = tsarray_new(sizeof(int));
+    struct _tsarray_pub *positions = tsarray_new(sizeof(int));
+
+    if (unlikely(objects == NULL || indices == NULL || positions == NULL))
+    {
+        if (objects != NULL)
+            tsarray_free(objects);
+
+        if (indices != NULL)
+            tsarray_free(indices);
+
+        if (positions != NULL)
+            tsarray_free(positions);
+
+        return TSDENSE_ENOMEM;
+    }
+
+    p_tsdense->objects = (void *)objects;
+    p_tsdense->indices = (void *)indices;
+    p_tsdense->positions = (void *)positions;
+
+    return 0;
+}
+
+
+
+/*
+ * Add a new free index to a tsdense.
+ *
+ * The new index is len, and it goes at position len, right after all the
+ * others. Returns 0 in case of success, non-zero otherwise. In case of
+ * error, the tsdense is left unchanged.
+ */
+static int grow_indices(struct _tsdense_abs *p_tsdense)
+{
+    int index = p_tsdense->len;
+    int retval;
+
+    if (unlikely(index == INT_MAX))
+        return TSDENSE_EOVERFLOW;
+
+    retval = tsarray_append(INDICES(p_tsdense), &index);
+    if (unlikely(retval != 0))
+        return retval;
+
+    retval = tsarray_append(POSITIONS(p_tsdense), &index);
+    if (unlikely(retval != 0))
+    {
+        tsarray_remove(INDICES(p_tsdense), index);
+        return retval;
+    }
+
+    p_tsdense->len = index + 1;
+
+    return 0;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
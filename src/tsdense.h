@@ -0,0 +1,161 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsdense.h - densely packed sparse set module header
+ */
+
+
+#ifndef _TSDENSE_H
+#define _TSDENSE_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get NULL and size_t */
+#include <stddef.h>
+
+/* get memory allocation */
+#include <stdlib.h>
+
+
+#include "common.h"
+#include "tsarray.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tsdense_errno {
+    TSDENSE_EOK = 0,        /* Success */
+    TSDENSE_EINVAL = -1,    /* Invalid argument */
+    TSDENSE_ENOENT = -2,    /* No such entry */
+    TSDENSE_ENOMEM = -3,    /* Out of memory */
+    TSDENSE_EOVERFLOW = -4, /* Operation would overflow */
+};
+
+
+/*
+ * Members of a tsdense, given the type of its objects. Shared by the
+ * abstract version below and the subclassed versions in TSDENSE_TYPEDEF,
+ * so that their layouts always match.
+ *
+ * Like a tssparse, a tsdense hands out stable indices from 0 to len-1,
+ * reusing those of removed objects. Unlike a tssparse, the objects
+ * themselves are kept packed at the start of a tsarray, in no particular
+ * order: positions 0 to count-1 of objects are all in use. Removing an
+ * object moves the last one into its place.
+ *
+ * indices maps each position to the index of the object there. Its
+ * entries from count to len-1 are the free indices, in the order they
+ * will be reused. positions is the reverse map, from each index (used or
+ * free) to its position in indices; an index is in use if and only if its
+ * position is below count.
+ *
+ * The tsarrays are only created on the first add. objects may be longer
+ * than count; anything beyond that is garbage.
+ */
+#define _TSDENSE_MEMBERS(obj_type) \
+    int count; \
+    int len; \
+    struct { obj_type *items; } *objects; \
+    struct { int *items; } *indices; \
+    struct { int *items; } *positions;
+
+
+/* abstract version; only for internal use */
+struct _tsdense_abs {
+    _TSDENSE_MEMBERS(char)      /* char may alias any other type */
+};
+
+
+int tsdense_add(struct _tsdense_abs *p_tsdense, const void *object,
+        size_t obj_size) __NON_NULL;
+
+int tsdense_remove(struct _tsdense_abs *p_tsdense, int index,
+        size_t obj_size) __NON_NULL;
+
+void tsdense_clear(struct _tsdense_abs *p_tsdense) __NON_NULL;
+
+
+/*
+ * Declare a new type-specific tsdense type.
+ *
+ * Defines (typedefs) arraytype to the new tsdense type, which will store
+ * objects of type objtype. Defines type-specific functions to manipulate
+ * the new array type using the prefix arraytype_*, e.g. intset_add(), etc.
+ *
+ * Use arraytype_get_nth() to access an object by its index, which returns
+ * NULL if the item is empty. To go through all the objects, walk
+ * objects->items from 0 to count-1; indices->items gives the index of
+ * each. When removing objects along the way, walk backwards, since the
+ * last object is moved into the place of the removed one.
+ *
+ * Example (define intset as a tsdense of int, and sum its objects):
+ *      TSDENSE_TYPEDEF(intset, int);
+ *      ...
+ *      for (i=0; i<s1.count; i++)
+ *          sum += s1.objects->items[i];
+ */
+#define TSDENSE_TYPEDEF(arraytype, objtype) \
+    typedef struct { \
+        _TSDENSE_MEMBERS(objtype) \
+    } arraytype; \
+    static inline int arraytype##_add(arraytype *array, objtype *object) { \
+        return tsdense_add((struct _tsdense_abs *)array, object, \
+                           sizeof(objtype)); \
+    } \
+    static inline int arraytype##_remove(arraytype *array, int index) { \
+        return tsdense_remove((struct _tsdense_abs *)array, index, \
+                              sizeof(objtype)); \
+    } \
+    static inline objtype *arraytype##_get_nth(arraytype *array, int index) { \
+        int position; \
+        if (unlikely((unsigned)index >= (unsigned)array->len)) \
+            return NULL; \
+        position = array->positions->items[index]; \
+        return likely(position < array->count) \
+            ? &array->objects->items[position] : NULL; \
+    } \
+    static inline void arraytype##_clear(arraytype *array) { \
+        tsdense_clear((struct _tsdense_abs *)array); \
+    }
+
+
+
+/* Initializer for an empty tsdense. May be used directly as initializer on
+ * a declaration, or as rvalue on an assignment expression (for an already
+ * declared identifier). In the latter case, this must be must be transformed
+ * into a compound literal (by prepending the type name in parenthesis), e.g.:
+ *      s1 = (intset)TSDENSE_INITIALIZER;
+ */
+#define TSDENSE_INITIALIZER { 0, 0, NULL, NULL, NULL }
+
+
+#endif      /* not _TSDENSE_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,809 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsextsort.c - external merge sort through a tsarray
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get errno */
+#include <errno.h>
+
+/* get PATH_MAX */
+#include <limits.h>
+
+/* get mkstemp and getenv */
+#include <stdlib.h>
+
+/* get memcpy and strlen */
+#include <string.h>
+
+/* get close, lseek and unlink */
+#include <unistd.h>
+
+#include "tsextsort.h"
+#include "common.h"
+#include "fileio.h"
+
+
+/*
+ * Most runs to merge at once, however large the memory budget. With more
+ * runs than a sort merges at once, groups of them are merged into longer
+ * runs first, so that neither the number of open files nor the number of
+ * merge buffers grows without bound.
+ */
+#define MERGE_FANOUT 64
+
+/*
+ * Smallest merge buffer worth having, in bytes. Reading runs in smaller
+ * blocks than this would mean seeking between files all the time, so
+ * fewer runs are merged at once (down to two) when the memory budget has
+ * no room for that many buffers this large.
+ */
+#define MIN_MERGE_BUFFER ((size_t)256 << 10)
+
+/* Name of the temporary files, within the temporary directory */
+#define TEMP_NAME "/tsextsort.XXXXXX"
+
+
+
+static int spill_run(struct tsextsort *sort) __NON_NULL;
+
+static int reserve_run(struct tsextsort *sort) __NON_NULL;
+
+static int make_temp(const char *tmpdir) __NON_NULL;
+
+static int merge_pass(struct tsextsort *sort) __NON_NULL;
+
+static int open_merge(struct tsextsort *sort, int first, int count)
+    __NON_NULL;
+
+static void close_merge(struct tsextsort *sort) __NON_NULL;
+
+static int refill(struct _tsextsort_cursor *cursor, size_t buf_size,
+        size_t obj_size) __NON_NULL;
+
+static inline const char *cursor_item(const struct tsextsort *sort,
+        int cursor) __ATTR_PURE __NON_NULL;
+
+static void sift_down(struct tsextsort *sort, int index) __NON_NULL;
+
+static long merge_items(struct tsextsort *sort, char *dest,
+        unsigned long count) __NON_NULL;
+
+
+
+/*
+ * Start an external sort.
+ *
+ * Receives the sort to start, the size of the objects to sort, the most
+ * objects to sort in memory at once, a comparison function and a generic
+ * argument to pass to it (as in tsarray_sort), and the directory for the
+ * temporary files. If tmpdir is NULL, $TMPDIR is used, or /tmp if that
+ * isn't set. tmpdir is not copied; it must stay valid until the sort is
+ * freed.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise. The
+ * sort must be freed with tsextsort_free, unless starting it failed.
+ */
+int tsextsort_init(struct tsextsort *sort, size_t obj_size,
+        unsigned long run_len,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg,
+        const char *tmpdir)
+{
+    if (unlikely(obj_size == 0 || run_len == 0
+                 || !is_valid_index(run_len, obj_size)))
+        return TSEXTSORT_EINVAL;
+
+    if (tmpdir == NULL)
+    {
+        tmpdir = getenv("TMPDIR");
+        if (tmpdir == NULL || *tmpdir == '\0')
+            tmpdir = "/tmp";
+    }
+
+    sort->obj_size = obj_size;
+    sort->run_len = run_len;
+    sort->cmp = cmp;
+    sort->arg = arg;
+    sort->tmpdir = tmpdir;
+    sort->runs = NULL;
+    sort->run_count = 0;
+    sort->run_alloc = 0;
+    sort->finished = 0;
+    sort->next_item = 0;
+    sort->cursors = NULL;
+    sort->cursor_count = 0;
+    sort->heap = NULL;
+    sort->heap_len = 0;
+    sort->buf_size = 0;
+    sort->out = NULL;
+    sort->out_size = 0;
+
+    /* as many runs as leave room for a buffer of MIN_MERGE_BUFFER each,
+     * plus the output buffer, within the budget of run_len objects */
+    sort->fan_in = (int)min(run_len * obj_size / MIN_MERGE_BUFFER,
+                            (size_t)MERGE_FANOUT + 1) - 1;
+    sort->fan_in = max(sort->fan_in, 2);
+
+    sort->run = tsarray_new_hint(obj_size, run_len);
+    if (unlikely(sort->run == NULL))
+        return TSEXTSORT_ENOMEM;
+
+    return 0;
+}
+
+
+
+/*
+ * Add objects to an external sort.
+ *
+ * Receives the sort, and an array of count objects, which are copied.
+ * Every time the run buffer fills up, it is sorted and spilled to disk.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise. In
+ * case of TSEXTSORT_EIO, errno tells what went wrong.
+ */
+int tsextsort_add(struct tsextsort *sort, const void *objects,
+        unsigned long count)
+{
+    const char *object = objects;
+
+    if (unlikely(sort->finished))
+        return TSEXTSORT_EINVAL;
+
+    while (count > 0)
+    {
+        /* spill only once there's more, so a single run stays in memory */
+        if (tsarray_len(sort->run) == sort->run_len)
+        {
+            const int retval = spill_run(sort);
+
+            if (unlikely(retval != 0))
+                return retval;
+        }
+
+        if (unlikely(tsarray_append(sort->run, object) != 0))
+            return TSEXTSORT_ENOMEM;
+
+        object += sort->obj_size;
+        count--;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Add the contents of a file to an external sort.
+ *
+ * Receives the sort, and a file descriptor open for reading. Reads the
+ * file from its current position to its end, which must be at the end of
+ * an object, a run buffer at a time, straight into the run buffer. A full
+ * run buffer is only spilled once a look ahead finds more objects, so a
+ * file that fits in a single run is never written to disk.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise. In
+ * case of TSEXTSORT_EIO, errno tells what went wrong (EIO if the file
+ * ends in the middle of an object).
+ */
+int tsextsort_add_fd(struct tsextsort *sort, int fd)
+{
+    struct _tsarray_pub *peek;      /* the look ahead, of one object */
+    int retval;
+    long got;
+
+    if (unlikely(sort->finished))
+        return TSEXTSORT_EINVAL;
+
+    /* objects added before go in a run of their own */
+    retval = spill_run(sort);
+    if (unlikely(retval != 0))
+        return retval;
+
+    peek = tsarray_new_hint(sort->obj_size, 1);
+    if (unlikely(peek == NULL))
+        return TSEXTSORT_ENOMEM;
+
+    got = tsarray_read(sort->run, fd, sort->run_len);
+
+    /* the last run read stays in the run buffer, for more objects */
+    while (got >= 0 && tsarray_len(sort->run) == sort->run_len
+           && (got = tsarray_read(peek, fd, 1)) == 1)
+    {
+        retval = spill_run(sort);
+        if (unlikely(retval != 0))
+            break;
+
+        got = tsarray_read(sort->run, fd, sort->run_len - 1);
+        if (got >= 0 && unlikely(tsarray_append(sort->run,
+                                                peek->items) != 0))
+            got = TSARRAY_ENOMEM;
+    }
+
+    tsarray_free(peek);
+
+    if (unlikely(retval != 0))
+        return retval;
+
+    if (unlikely(got < 0))
+        return got == TSARRAY_ENOMEM ? TSEXTSORT_ENOMEM : TSEXTSORT_EIO;
+
+    return 0;
+}
+
+
+
+/*
+ * Finish adding objects to an external sort, and get ready to hand out
+ * the result.
+ *
+ * If every object fit in the run buffer, just sorts it. Otherwise spills
+ * the last run, gives back the run buffer, merges groups of runs while
+ * there are too many of them, and sets up the final merge.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise. In
+ * case of TSEXTSORT_EIO, errno tells what went wrong. After an error, the
+ * sort can only be freed.
+ */
+int tsextsort_finish(struct tsextsort *sort)
+{
+    int retval;
+
+    if (unlikely(sort->finished))
+        return TSEXTSORT_EINVAL;
+
+    sort->finished = 1;
+
+    if (sort->run_count == 0)
+        return tsarray_sort(sort->run, sort->cmp, sort->arg) == 0
+            ? 0 : TSEXTSORT_EINVAL;
+
+    retval = spill_run(sort);
+    if (unlikely(retval != 0))
+        return retval;
+
+    tsarray_free(sort->run);
+    sort->run = NULL;
+
+    while (sort->run_count > sort->fan_in)
+    {
+        retval = merge_pass(sort);
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    return open_merge(sort, 0, sort->run_count);
+}
+
+
+
+/*
+ * Get the next chunk of sorted objects from an external sort.
+ *
+ * Receives the finished sort, the tsarray to put the chunk in, which must
+ * be of the sort's object size, and the most objects to get. Replaces the
+ * array's contents with the next objects in order, reusing its memory.
+ *
+ * Returns the number of objects in the chunk, which is count except for
+ * the last one, 0 at the end (the array is left alone), or a negative
+ * error value. In case of TSEXTSORT_EIO, errno tells what went wrong.
+ */
+long tsextsort_next(struct tsextsort *sort, struct _tsarray_pub *p_tsarray,
+        unsigned long count)
+{
+    const size_t obj_size = sort->obj_size;
+    const char *src;
+    long got;
+    int retval;
+
+    if (unlikely(!sort->finished || count == 0
+                 || !is_valid_index(count, obj_size)))
+        return TSEXTSORT_EINVAL;
+
+    if (sort->run != NULL)
+    {   /* everything fit in memory; hand it out from the run buffer */
+        got = (long)min(count, tsarray_len(sort->run) - sort->next_item);
+        src = sort->run->items + sort->next_item * obj_size;
+        sort->next_item += (unsigned long)got;
+    }
+    else
+    {
+        if (count * obj_size > sort->out_size)
+        {
+            char *new_out = realloc(sort->out, count * obj_size);
+
+            if (unlikely(new_out == NULL))
+                return TSEXTSORT_ENOMEM;
+
+            sort->out = new_out;
+            sort->out_size = count * obj_size;
+        }
+
+        got = merge_items(sort, sort->out, count);
+        src = sort->out;
+    }
+
+    if (got <= 0)
+        return got;
+
+    retval = tsarray_assign(p_tsarray, src, (unsigned long)got);
+    if (unlikely(retval != 0))
+        return retval == TSARRAY_ENOMEM ? TSEXTSORT_ENOMEM : TSEXTSORT_EINVAL;
+
+    return got;
+}
+
+
+
+/*
+ * Write the sorted objects of an external sort to a file.
+ *
+ * Receives the finished sort, and a file descriptor open for writing.
+ * Writes every object not yet handed out by tsextsort_next, in order, at
+ * the file's current position, a merge buffer at a time.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise. In
+ * case of TSEXTSORT_EIO, errno tells what went wrong.
+ */
+int tsextsort_write(struct tsextsort *sort, int fd)
+{
+    const size_t obj_size = sort->obj_size;
+    long got;
+
+    if (unlikely(!sort->finished))
+        return TSEXTSORT_EINVAL;
+
+    if (sort->run != NULL)
+    {
+        const unsigned long len = tsarray_len(sort->run);
+
+        if (unlikely(fileio_write_all(fd,
+                sort->run->items + sort->next_item * obj_size,
+                (len - sort->next_item) * obj_size) != 0))
+            return TSEXTSORT_EIO;
+
+        sort->next_item = len;
+
+        return 0;
+    }
+
+    while ((got = merge_items(sort, sort->out, sort->out_size / obj_size)) > 0)
+    {
+        if (unlikely(fileio_write_all(fd, sort->out,
+                                      (size_t)got * obj_size) != 0))
+            return TSEXTSORT_EIO;
+    }
+
+    return (int)got;
+}
+
+
+
+/*
+ * Free an external sort, closing (and so deleting) its temporary files.
+ */
+void tsextsort_free(struct tsextsort *sort)
+{
+    int i;
+
+    close_merge(sort);
+
+    for (i=0; i<sort->run_count; i++)
+        close(sort->runs[i].fd);
+
+    free(sort->runs);
+
+    if (sort->run != NULL)
+        tsarray_free(sort->run);
+}
+
+
+
+/*
+ * Sort the run buffer and spill it to a temporary file, as a new run.
+ * Does nothing if the run buffer is empty.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise.
+ */
+static int spill_run(struct tsextsort *sort)
+{
+    const unsigned long len = tsarray_len(sort->run);
+    int retval;
+    int fd;
+
+    if (len == 0)
+        return 0;
+
+    retval = reserve_run(sort);
+    if (unlikely(retval != 0))
+        return retval;
+
+    if (unlikely(tsarray_sort(sort->run, sort->cmp, sort->arg) != 0))
+        return TSEXTSORT_EINVAL;
+
+    fd = make_temp(sort->tmpdir);
+    if (unlikely(fd < 0))
+        return TSEXTSORT_EIO;
+
+    if (unlikely(fileio_write_all(fd, sort->run->items,
+                                  len * sort->obj_size) != 0))
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+        return TSEXTSORT_EIO;
+    }
+
+    sort->runs[sort->run_count].fd = fd;
+    sort->runs[sort->run_count].len = len;
+    sort->run_count++;
+
+    /* empty the run buffer, for the next run */
+    return tsarray_assign(sort->run, NULL, 0) == 0 ? 0 : TSEXTSORT_ENOMEM;
+}
+
+
+
+/*
+ * Make room for one more run in an external sort's list of runs.
+ *
+ * Returns 0 in case of success, or TSEXTSORT_ENOMEM.
+ */
+static int reserve_run(struct tsextsort *sort)
+{
+    if (sort->run_count == sort->run_alloc)
+    {
+        const int new_alloc = sort->run_alloc > 0 ? 2 * sort->run_alloc : 16;
+        struct _tsextsort_run *new_runs;
+
+        if (unlikely(new_alloc < 0
+                     || (size_t)new_alloc > SIZE_MAX / sizeof(*new_runs)))
+            return TSEXTSORT_ENOMEM;
+
+        new_runs = realloc(sort->runs, (size_t)new_alloc * sizeof(*new_runs));
+        if (unlikely(new_runs == NULL))
+            return TSEXTSORT_ENOMEM;
+
+        sort->runs = new_runs;
+        sort->run_alloc = new_alloc;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Create a temporary file in a directory. The file is unlinked right
+ * away, so it disappears once closed, even if the program crashes.
+ *
+ * Returns the file descriptor, or -1 in case of error (errno tells what
+ * went wrong).
+ */
+static int make_temp(const char *tmpdir)
+{
+    const size_t dir_len = strlen(tmpdir);
+    char path[PATH_MAX];
+    int fd;
+
+    if (unlikely(dir_len + sizeof(TEMP_NAME) > sizeof(path)))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memcpy(path, tmpdir, dir_len);
+    memcpy(path + dir_len, TEMP_NAME, sizeof(TEMP_NAME));
+
+    fd = mkstemp(path);
+    if (likely(fd >= 0))
+        unlink(path);
+
+    return fd;
+}
+
+
+
+/*
+ * Merge the first fan_in runs of an external sort into a single longer
+ * run, which goes to the end of the list.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise.
+ */
+static int merge_pass(struct tsextsort *sort)
+{
+    const size_t obj_size = sort->obj_size;
+    const int fan_in = sort->fan_in;
+    unsigned long total = 0;
+    int retval;
+    long got;
+    int fd;
+    int i;
+
+    retval = reserve_run(sort);
+    if (unlikely(retval != 0))
+        return retval;
+
+    fd = make_temp(sort->tmpdir);
+    if (unlikely(fd < 0))
+        return TSEXTSORT_EIO;
+
+    retval = open_merge(sort, 0, fan_in);
+    if (unlikely(retval != 0))
+        goto fail;
+
+    while ((got = merge_items(sort, sort->out, sort->out_size / obj_size)) > 0)
+    {
+        if (unlikely(fileio_write_all(fd, sort->out,
+                                      (size_t)got * obj_size) != 0))
+        {
+            retval = TSEXTSORT_EIO;
+            goto fail;
+        }
+
+        total += (unsigned long)got;
+    }
+
+    if (unlikely(got < 0))
+    {
+        retval = (int)got;
+        goto fail;
+    }
+
+    close_merge(sort);
+
+    for (i=0; i<fan_in; i++)
+        close(sort->runs[i].fd);
+
+    memmove(sort->runs, sort->runs + fan_in,
+            (size_t)(sort->run_count - fan_in) * sizeof(*sort->runs));
+    sort->run_count -= fan_in;
+
+    sort->runs[sort->run_count].fd = fd;
+    sort->runs[sort->run_count].len = total;
+    sort->run_count++;
+
+    return 0;
+
+fail:
+    close_merge(sort);
+    close(fd);
+
+    return retval;
+}
+
+
+
+/*
+ * Set up a merge of count runs of an external sort, starting at first.
+ *
+ * Splits the memory budget of run_len objects between a read buffer for
+ * each run and an output buffer (never less than an object each), fills
+ * every read buffer from the start of its run, and builds the heap.
+ *
+ * Returns 0 in case of success, or a negative error value otherwise.
+ */
+static int open_merge(struct tsextsort *sort, int first, int count)
+{
+    const size_t obj_size = sort->obj_size;
+    size_t buf_size = sort->run_len * obj_size / (size_t)(count + 1);
+    unsigned long longest = 1;
+    int i;
+
+    for (i=0; i<count; i++)
+        longest = max(longest, sort->runs[first + i].len);
+
+    /* no point in buffers larger than the runs themselves */
+    buf_size = min(buf_size, longest * obj_size);
+    buf_size = max(buf_size - buf_size % obj_size, obj_size);
+
+    sort->buf_size = buf_size;
+    sort->heap_len = 0;
+
+    /* zeroed, so close_merge can tell which buffers were allocated */
+    sort->cursors = calloc((size_t)count, sizeof(*sort->cursors));
+    sort->heap = malloc((size_t)count * sizeof(*sort->heap));
+    sort->out = malloc(buf_size);
+    sort->out_size = buf_size;
+
+    if (unlikely(sort->cursors == NULL || sort->heap == NULL
+                 || sort->out == NULL))
+        return TSEXTSORT_ENOMEM;
+
+    sort->cursor_count = count;
+
+    for (i=0; i<count; i++)
+    {
+        struct _tsextsort_cursor *cursor = &sort->cursors[i];
+
+        cursor->fd = sort->runs[first + i].fd;
+        cursor->left = sort->runs[first + i].len;
+        cursor->buf = malloc(buf_size);
+
+        if (unlikely(cursor->buf == NULL))
+            return TSEXTSORT_ENOMEM;
+
+        if (unlikely(lseek(cursor->fd, 0, SEEK_SET) != 0
+                     || refill(cursor, buf_size, obj_size) != 0))
+            return TSEXTSORT_EIO;
+
+        if (cursor->end > 0)
+            sort->heap[sort->heap_len++] = i;
+    }
+
+    for (i=sort->heap_len/2 - 1; i>=0; i--)
+        sift_down(sort, i);
+
+    return 0;
+}
+
+
+
+/*
+ * Give back the buffers of a merge. The runs' files are left open.
+ */
+static void close_merge(struct tsextsort *sort)
+{
+    int i;
+
+    for (i=0; i<sort->cursor_count; i++)
+        free(sort->cursors[i].buf);
+
+    free(sort->cursors);
+    free(sort->heap);
+    free(sort->out);
+
+    sort->cursors = NULL;
+    sort->cursor_count = 0;
+    sort->heap = NULL;
+    sort->heap_len = 0;
+    sort->out = NULL;
+    sort->out_size = 0;
+}
+
+
+
+/*
+ * Read the next block of a run into its cursor's buffer.
+ *
+ * Leaves the cursor with an empty buffer once the run is over. Returns 0
+ * in case of success, or TSEXTSORT_EIO (errno tells what went wrong).
+ */
+static int refill(struct _tsextsort_cursor *cursor, size_t buf_size,
+        size_t obj_size)
+{
+    const unsigned long n = min(cursor->left, buf_size / obj_size);
+
+    cursor->pos = 0;
+    cursor->end = n * obj_size;
+
+    if (n > 0 && unlikely(fileio_read_all(cursor->fd, cursor->buf,
+                                          cursor->end) != 0))
+    {
+        cursor->end = 0;
+        return TSEXTSORT_EIO;
+    }
+
+    cursor->left -= n;
+
+    return 0;
+}
+
+
+
+/*
+ * Get the current object of a merge cursor.
+ */
+static inline const char *cursor_item(const struct tsextsort *sort,
+        int cursor)
+{
+    return sort->cursors[cursor].buf + sort->cursors[cursor].pos;
+}
+
+
+
+/*
+ * Move a cursor down the heap, from index to where its current object
+ * belongs.
+ */
+static void sift_down(struct tsextsort *sort, int index)
+{
+    int *const heap = sort->heap;
+    const int top = heap[index];
+    const char *const top_item = cursor_item(sort, top);
+
+    for (;;)
+    {
+        int child = 2*index + 1;
+
+        if (child >= sort->heap_len)
+            break;
+
+        if (child + 1 < sort->heap_len
+                && sort->cmp(cursor_item(sort, heap[child+1]),
+                             cursor_item(sort, heap[child]), sort->arg) < 0)
+            child++;
+
+        if (sort->cmp(cursor_item(sort, heap[child]), top_item,
+                      sort->arg) >= 0)
+            break;
+
+        heap[index] = heap[child];
+        index = child;
+    }
+
+    heap[index] = top;
+}
+
+
+
+/*
+ * Merge up to count objects into dest, taking the smallest current object
+ * of all runs each time.
+ *
+ * Returns the number of objects merged, 0 once every run is over, or
+ * TSEXTSORT_EIO (errno tells what went wrong).
+ */
+static long merge_items(struct tsextsort *sort, char *dest,
+        unsigned long count)
+{
+    const size_t obj_size = sort->obj_size;
+    unsigned long got = 0;
+
+    while (got < count && sort->heap_len > 0)
+    {
+        struct _tsextsort_cursor *cursor = &sort->cursors[sort->heap[0]];
+
+        memcpy(dest, cursor->buf + cursor->pos, obj_size);
+        dest += obj_size;
+        got++;
+
+        cursor->pos += obj_size;
+
+        if (cursor->pos == cursor->end)
+        {
+            if (unlikely(refill(cursor, sort->buf_size, obj_size) != 0))
+                return TSEXTSORT_EIO;
+
+            /* run is over; the last cursor takes its place */
+            if (cursor->end == 0)
+                sort->heap[0] = sort->heap[--sort->heap_len];
+        }
+
+        if (sort->heap_len > 1)
+            sift_down(sort, 0);
+    }
+
+    return (long)got;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,166 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsextsort.h - external merge sort through a tsarray, module header
+ */
+
+
+#ifndef _TSEXTSORT_H
+#define _TSEXTSORT_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get size_t */
+#include <stddef.h>
+
+
+#include "common.h"
+#include "tsarray.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tsextsort_errno {
+    TSEXTSORT_EOK = 0,          /* Success */
+    TSEXTSORT_EINVAL = -1,      /* Invalid argument, or out of order call */
+    TSEXTSORT_ENOMEM = -2,      /* Out of memory */
+    TSEXTSORT_EIO = -3,         /* Error reading or writing a file */
+};
+
+
+/* A sorted run spilled to a temporary file; internal */
+struct _tsextsort_run {
+    int fd;
+    unsigned long len;
+};
+
+/* Read position in a run, while merging; internal */
+struct _tsextsort_cursor {
+    int fd;
+    unsigned long left;         /* objects not yet read from the file */
+    char *buf;
+    size_t pos;                 /* next object in buf, in bytes */
+    size_t end;                 /* bytes in buf */
+};
+
+
+/*
+ * External merge sort, for more objects than fit in memory.
+ *
+ * Objects are added into a tsarray of up to run_len objects, the run
+ * buffer. Each time it fills up, it is sorted with tsarray_sort and
+ * spilled to a temporary file of its own. Once every object is in, the
+ * sorted runs are merged k ways, reading each run through a buffer of its
+ * own, so every file is read sequentially and in large blocks. The result
+ * can be written to a file (tsextsort_write) or handed out a chunk at a
+ * time into a tsarray (tsextsort_next).
+ *
+ * Memory use is about run_len objects throughout (but at least three, and
+ * not counting the chunks asked of tsextsort_next): the run buffer is
+ * given back before merging, and the merge buffers split the same budget.
+ * A small budget merges fewer runs at once, in more passes, to keep the
+ * buffers large enough to read efficiently. If everything fits in a
+ * single run, nothing is written to disk at all.
+ *
+ * The members are internal.
+ */
+struct tsextsort {
+    size_t obj_size;
+    unsigned long run_len;
+    int (*cmp)(const void *a, const void *b, void *arg);
+    void *arg;
+    const char *tmpdir;
+
+    struct _tsarray_pub *run;       /* run being filled */
+    struct _tsextsort_run *runs;    /* runs spilled so far */
+    int run_count;
+    int run_alloc;
+
+    int fan_in;                     /* most runs to merge at once */
+    int finished;
+    unsigned long next_item;        /* next item of run, if never spilled */
+
+    struct _tsextsort_cursor *cursors;
+    int cursor_count;
+    int *heap;                      /* cursors, by their current object */
+    int heap_len;
+    size_t buf_size;                /* bytes in each cursor's buffer */
+    char *out;                      /* merge output buffer */
+    size_t out_size;
+};
+
+
+int tsextsort_init(struct tsextsort *sort, size_t obj_size,
+        unsigned long run_len,
+        int (*cmp)(const void *a, const void *b, void *arg), void *arg,
+        const char *tmpdir) __attribute__((nonnull (1, 4)));
+
+int tsextsort_add(struct tsextsort *sort, const void *objects,
+        unsigned long count) __attribute__((nonnull (1)));
+
+int tsextsort_add_fd(struct tsextsort *sort, int fd) __NON_NULL;
+
+int tsextsort_finish(struct tsextsort *sort) __NON_NULL;
+
+long tsextsort_next(struct tsextsort *sort, struct _tsarray_pub *p_tsarray,
+        unsigned long count) __NON_NULL;
+
+int tsextsort_write(struct tsextsort *sort, int fd) __NON_NULL;
+
+void tsextsort_free(struct tsextsort *sort) __NON_NULL;
+
+
+/*
+ * Start an external sort of a typed tsarray's objects. Same as
+ * tsextsort_init, but takes the object size from the array's type, and a
+ * comparison function on the array's objects.
+ *
+ * Example (sort a file of doubles, 16 million at a time):
+ *      struct tsextsort sort;
+ *      doublearray *chunk = doublearray_new();
+ *      TSEXTSORT_INIT(&sort, chunk, 16000000, doublecmp, NULL, NULL);
+ *      tsextsort_add_fd(&sort, in_fd);
+ *      tsextsort_finish(&sort);
+ *      while ((n = TSEXTSORT_NEXT(&sort, chunk, 1000000)) > 0)
+ *          ...
+ *      tsextsort_free(&sort);
+ */
+#define TSEXTSORT_INIT(sort, array, run_len, cmp, arg, tmpdir) \
+    tsextsort_init((sort), sizeof(*(array)->items), (run_len), \
+                   (int (*)(const void *, const void *, void *))(cmp), \
+                   (arg), (tmpdir))
+
+#define TSEXTSORT_NEXT(sort, array, count) \
+    tsextsort_next((sort), (struct _tsarray_pub *)(array), (count))
+
+
+#endif      /* not _TSEXTSORT_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,638 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tspack.c - compressed read-only array of 64-bit integers
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get errno */
+#include <errno.h>
+
+/* get LONG_MAX */
+#include <limits.h>
+
+/* get malloc and free */
+#include <stdlib.h>
+
+/* get memcpy and memset */
+#include <string.h>
+
+#include "tspack.h"
+#include "common.h"
+
+
+/*
+ * A block's place and encoding. The packed values of a block take
+ * 4*width 32-bit words of data (or RAW_WORDS for a BLOCK_RAW block),
+ * starting at its offset.
+ *
+ * The values are packed in four interleaved lanes: value i goes to lane
+ * i % 4, and word k of lane l is at data[offset + 4*k + l]. Each lane is
+ * packed on its own, lowest bits first, a value spilling into the lane's
+ * next word when need be. The four lanes thus line up, and are unpacked
+ * four at a time with the same shifts.
+ */
+struct tspack_block {
+    uint64_t base;              /* smallest value, or first of BLOCK_DELTA */
+    uint64_t delta;             /* smallest difference, for BLOCK_DELTA */
+    uint64_t info;              /* offset << 8 | kind << 6 | width */
+};
+
+enum block_kind {
+    BLOCK_REFERENCE = 0,        /* values minus base */
+    BLOCK_DELTA = 1,            /* differences minus delta; first is 0 */
+    BLOCK_RAW = 2,              /* the values as they are */
+};
+
+#define INFO_WIDTH(info)    ((unsigned int)((info) & 0x3f))
+#define INFO_KIND(info)     ((enum block_kind)(((info) >> 6) & 0x3))
+#define INFO_OFFSET(info)   ((size_t)((info) >> 8))
+#define MAKE_INFO(offset, kind, width) \
+    ((uint64_t)(offset) << 8 | (uint64_t)(kind) << 6 | (uint64_t)(width))
+
+/* Widest values that are packed; wider blocks are left raw */
+#define MAX_WIDTH 32
+
+/* Words of data taken by a BLOCK_RAW block */
+#define RAW_WORDS (TSPACK_BLOCK_LEN * sizeof(uint64_t) / sizeof(uint32_t))
+
+
+#if HAVE_VECTOR_EXT
+/* Four 32-bit lanes, unpacked at once */
+typedef uint32_t lanes_t __attribute__((vector_size(16)));
+#endif
+
+
+
+static unsigned int bit_width(uint64_t x) __ATTR_CONST;
+
+static unsigned int block_len(unsigned long len, unsigned long start)
+    __ATTR_CONST;
+
+static void plan_block(const uint64_t *values, unsigned int n,
+        struct tspack_block *block) __NON_NULL;
+
+static size_t block_words(uint64_t info) __ATTR_CONST;
+
+static void pack_block(const uint64_t *values, unsigned int n,
+        const struct tspack_block *block, uint32_t *out) __NON_NULL;
+
+static inline uint32_t get_packed(const uint32_t *in, unsigned int width,
+        unsigned int i) __ATTR_PURE __NON_NULL;
+
+static void unpack_block(const uint32_t *in, uint32_t *out,
+        unsigned int width) __NON_NULL;
+
+static void decode_block(const struct tspack *pack,
+        const struct tspack_block *block, uint64_t *out) __NON_NULL;
+
+
+
+/*
+ * Compress an array of 64-bit integers.
+ *
+ * Receives the values (which may be NULL if len is 0) and their number.
+ * Signed values may be passed as they are: differences are taken modulo
+ * 2^64, so e.g. timestamps either side of 0 still compress. The values
+ * are copied in; the array is read-only from then on.
+ *
+ * Returns the compressed array, or NULL in case of error (errno tells
+ * what went wrong).
+ */
+struct tspack *tspack_new(const uint64_t *values, unsigned long len)
+{
+    struct tspack *pack;
+    unsigned long b;
+    size_t words = 0;
+
+    if (unlikely(values == NULL && len != 0))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pack = malloc(sizeof(*pack));
+    if (unlikely(pack == NULL))
+        return NULL;
+
+    pack->len = len;
+    pack->block_count = len / TSPACK_BLOCK_LEN
+                        + (len % TSPACK_BLOCK_LEN != 0);
+    pack->blocks = NULL;
+    pack->data = NULL;
+
+    if (len == 0)
+    {
+        pack->data_words = 0;
+        return pack;
+    }
+
+    if (unlikely(!can_size_mult(pack->block_count,
+                                sizeof(struct tspack_block))))
+        goto fail_overflow;
+
+    pack->blocks = malloc(pack->block_count * sizeof(struct tspack_block));
+    if (unlikely(pack->blocks == NULL))
+        goto fail;
+
+    /* plan every block first, to allocate the data just once */
+    for (b=0; b<pack->block_count; b++)
+    {
+        struct tspack_block *block = &pack->blocks[b];
+        const unsigned long start = b * TSPACK_BLOCK_LEN;
+
+        plan_block(values + start, block_len(len, start), block);
+        block->info |= MAKE_INFO(words, 0, 0);
+
+        if (unlikely(!can_size_add(words, block_words(block->info))))
+            goto fail_overflow;
+        words += block_words(block->info);
+    }
+
+    if (unlikely(!can_size_mult(words, sizeof(uint32_t))))
+        goto fail_overflow;
+
+    pack->data_words = words;
+
+    /* at least a word, so that offsets never apply to a NULL pointer */
+    pack->data = malloc(max(words, (size_t)1) * sizeof(uint32_t));
+    if (unlikely(pack->data == NULL))
+        goto fail;
+
+    for (b=0; b<pack->block_count; b++)
+    {
+        const struct tspack_block *block = &pack->blocks[b];
+        const unsigned long start = b * TSPACK_BLOCK_LEN;
+
+        pack_block(values + start, block_len(len, start), block,
+                   pack->data + INFO_OFFSET(block->info));
+    }
+
+    return pack;
+
+fail_overflow:
+    errno = ENOMEM;
+fail:
+    free(pack->blocks);
+    free(pack);
+    return NULL;
+}
+
+
+/*
+ * Get the number of values in a compressed array.
+ */
+unsigned long tspack_len(const struct tspack *pack)
+{
+    return pack->len;
+}
+
+
+/*
+ * Get the memory taken by a compressed array, in bytes.
+ */
+size_t tspack_size(const struct tspack *pack)
+{
+    return sizeof(*pack)
+        + pack->block_count * sizeof(struct tspack_block)
+        + pack->data_words * sizeof(uint32_t);
+}
+
+
+/*
+ * Get a value from a compressed array.
+ *
+ * Receives the array and the value's index, which MUST be less than the
+ * array's length. Finds the value's block directly, then extracts just the
+ * value; a block of differences is unpacked whole, to sum the differences
+ * up to the value.
+ */
+uint64_t tspack_get(const struct tspack *pack, unsigned long index)
+{
+    const struct tspack_block *block;
+    const uint32_t *in;
+    unsigned int width;
+    unsigned int i;
+
+    assert(index < pack->len);
+
+    block = &pack->blocks[index / TSPACK_BLOCK_LEN];
+    i = (unsigned int)(index % TSPACK_BLOCK_LEN);
+    in = pack->data + INFO_OFFSET(block->info);
+    width = INFO_WIDTH(block->info);
+
+    switch (INFO_KIND(block->info))
+    {
+        case BLOCK_REFERENCE:
+            return block->base + get_packed(in, width, i);
+
+        case BLOCK_DELTA:
+        {
+            uint32_t packed[TSPACK_BLOCK_LEN];
+            uint64_t sum = 0;
+            unsigned int k;
+
+            unpack_block(in, packed, width);
+            for (k=1; k<=i; k++)
+                sum += packed[k];
+
+            return block->base + i * block->delta + sum;
+        }
+
+        default:
+        {
+            uint64_t value;
+
+            memcpy(&value, in + i * 2, sizeof(value));
+            return value;
+        }
+    }
+}
+
+
+/*
+ * Decode a run of values from a compressed array.
+ *
+ * Receives the array, the index of the first value, room for count
+ * values, and count. Decodes whole blocks straight into out, and only
+ * goes through a buffer for the blocks at either end of the run.
+ *
+ * Returns the number of values decoded, which is less than count only at
+ * the end of the array, or TSPACK_EINVAL if start is past the end.
+ */
+long tspack_decode(const struct tspack *pack, unsigned long start,
+        uint64_t *out, unsigned long count)
+{
+    unsigned long done = 0;
+
+    if (unlikely(start > pack->len))
+        return TSPACK_EINVAL;
+
+    count = min(min(count, pack->len - start), (unsigned long)LONG_MAX);
+
+    while (done < count)
+    {
+        const unsigned long index = start + done;
+        const struct tspack_block *block =
+            &pack->blocks[index / TSPACK_BLOCK_LEN];
+        const unsigned long skip = index % TSPACK_BLOCK_LEN;
+        const unsigned long n = min(TSPACK_BLOCK_LEN - skip, count - done);
+
+        if (n == TSPACK_BLOCK_LEN)
+            decode_block(pack, block, out + done);
+        else
+        {
+            uint64_t buf[TSPACK_BLOCK_LEN];
+
+            decode_block(pack, block, buf);
+            memcpy(out + done, buf + skip, n * sizeof(uint64_t));
+        }
+
+        done += n;
+    }
+
+    return (long)count;
+}
+
+
+/*
+ * Free a compressed array.
+ */
+void tspack_free(struct tspack *pack)
+{
+    free(pack->data);
+    free(pack->blocks);
+    free(pack);
+}
+
+
+
+/* Internal functions */
+
+
+/*
+ * Get the number of bits needed to hold x.
+ */
+static unsigned int bit_width(uint64_t x)
+{
+    return x == 0 ? 0 : 64 - (unsigned int)clz64(x);
+}
+
+
+/*
+ * Get the number of values in the block starting at start, out of len.
+ */
+static unsigned int block_len(unsigned long len, unsigned long start)
+{
+    return (unsigned int)min(len - start, (unsigned long)TSPACK_BLOCK_LEN);
+}
+
+
+/*
+ * Choose the encoding of a block.
+ *
+ * Receives the block's n values (n >= 1) and fills in its base, delta and
+ * info, save for the offset. Picks differences over frame of reference
+ * only when they take fewer bits, as values are quicker to get from the
+ * latter.
+ */
+static void plan_block(const uint64_t *values, unsigned int n,
+        struct tspack_block *block)
+{
+    uint64_t low = values[0], high = values[0];
+    int64_t low_delta = 0, high_delta = 0;
+    unsigned int ref_width, delta_width;
+    unsigned int i;
+
+    for (i=0; i<n; i++)
+    {
+        low = min(low, values[i]);
+        high = max(high, values[i]);
+    }
+
+    if (n > 1)
+        low_delta = high_delta = (int64_t)(values[1] - values[0]);
+
+    for (i=2; i<n; i++)
+    {
+        const int64_t delta = (int64_t)(values[i] - values[i-1]);
+
+        low_delta = min(low_delta, delta);
+        high_delta = max(high_delta, delta);
+    }
+
+    ref_width = bit_width(high - low);
+    delta_width = bit_width((uint64_t)high_delta - (uint64_t)low_delta);
+
+    if (delta_width < ref_width)
+    {
+        block->base = values[0];
+        block->delta = (uint64_t)low_delta;
+        block->info = MAKE_INFO(0, BLOCK_DELTA, delta_width);
+    }
+    else if (ref_width <= MAX_WIDTH)
+    {
+        block->base = low;
+        block->delta = 0;
+        block->info = MAKE_INFO(0, BLOCK_REFERENCE, ref_width);
+    }
+    else
+    {
+        block->base = 0;
+        block->delta = 0;
+        block->info = MAKE_INFO(0, BLOCK_RAW, 0);
+    }
+
+    /* differences may be too wide as well */
+    if (INFO_WIDTH(block->info) > MAX_WIDTH)
+        block->info = MAKE_INFO(0, BLOCK_RAW, 0);
+}
+
+
+/*
+ * Get the number of words of data a block takes.
+ */
+static size_t block_words(uint64_t info)
+{
+    if (INFO_KIND(info) == BLOCK_RAW)
+        return RAW_WORDS;
+
+    return 4 * (size_t)INFO_WIDTH(info);
+}
+
+
+/*
+ * Pack a block's n values into out, as planned by plan_block. A last,
+ * partial block is padded with zeros (i.e. with base, or with delta).
+ */
+static void pack_block(const uint64_t *values, unsigned int n,
+        const struct tspack_block *block, uint32_t *out)
+{
+    const unsigned int width = INFO_WIDTH(block->info);
+    unsigned int i;
+
+    memset(out, 0, block_words(block->info) * sizeof(uint32_t));
+
+    if (INFO_KIND(block->info) == BLOCK_RAW)
+    {
+        memcpy(out, values, n * sizeof(uint64_t));
+        return;
+    }
+
+    for (i=0; i<n; i++)
+    {
+        const unsigned int bit = (i / 4) * width;
+        uint32_t *word = out + (bit / 32) * 4 + i % 4;
+        const unsigned int shift = bit % 32;
+        uint32_t packed;
+
+        if (INFO_KIND(block->info) == BLOCK_REFERENCE)
+            packed = (uint32_t)(values[i] - block->base);
+        else
+            packed = i == 0 ? 0
+                : (uint32_t)(values[i] - values[i-1] - block->delta);
+
+        if (width == 0)
+            continue;
+
+        word[0] |= packed << shift;
+        if (shift + width > 32)
+            word[4] |= packed >> (32 - shift);
+    }
+}
+
+
+/*
+ * Get the i-th of the packed values of a block.
+ */
+static inline uint32_t get_packed(const uint32_t *in, unsigned int width,
+        unsigned int i)
+{
+    const unsigned int bit = (i / 4) * width;
+    const uint32_t *word = in + (bit / 32) * 4 + i % 4;
+    const unsigned int shift = bit % 32;
+    uint64_t bits;
+
+    if (width == 0)
+        return 0;
+
+    bits = word[0] >> shift;
+    if (shift + width > 32)
+        bits |= (uint64_t)word[4] << (32 - shift);
+
+    return (uint32_t)(bits & (((uint64_t)1 << width) - 1));
+}
+
+
+/*
+ * Unpack the 128 values of a block, packed width bits each, into out.
+ *
+ * Meant to be called with a constant width. The loop is unrolled fully,
+ * so every shift and mask is a constant. Goes through the four lanes at
+ * once: as SIMD vectors where available, otherwise with a loop the
+ * compiler may vectorize.
+ */
+static inline __ALWAYS_INLINE void unpack_lanes(const uint32_t *in,
+        uint32_t *out, const unsigned int width)
+{
+    const uint32_t mask = width == 32 ? UINT32_MAX
+                                      : ((uint32_t)1 << width) - 1;
+    unsigned int shift = 0;
+    unsigned int j;
+#if HAVE_VECTOR_EXT
+    lanes_t word;
+
+    memcpy(&word, in, sizeof(word));
+
+    __UNROLL_FULLY
+    for (j=0; j<TSPACK_BLOCK_LEN/4; j++)
+    {
+        lanes_t value = word >> shift;
+
+        shift += width;
+        if (shift >= 32)
+        {
+            shift -= 32;
+            in += 4;
+
+            /* the last value always ends a word */
+            if (j < TSPACK_BLOCK_LEN/4 - 1)
+            {
+                memcpy(&word, in, sizeof(word));
+                if (shift > 0)
+                    value |= word << (width - shift);
+            }
+        }
+
+        value &= mask;
+        memcpy(out + 4 * j, &value, sizeof(value));
+    }
+#else
+    unsigned int l;
+
+    __UNROLL_FULLY
+    for (j=0; j<TSPACK_BLOCK_LEN/4; j++)
+    {
+        for (l=0; l<4; l++)
+        {
+            uint32_t value = in[l] >> shift;
+
+            if (shift + width > 32)
+                value |= in[4 + l] << (32 - shift);
+
+            out[4 * j + l] = value & mask;
+        }
+
+        shift += width;
+        if (shift >= 32)
+        {
+            shift -= 32;
+            in += 4;
+        }
+    }
+#endif
+}
+
+
+/*
+ * Unpack the 128 values of a block, packed width bits each, into out.
+ * Dispatches to a copy of unpack_lanes specialized for the width.
+ */
+static void unpack_block(const uint32_t *in, uint32_t *out,
+        unsigned int width)
+{
+#define UNPACK_CASE(w)  case w: unpack_lanes(in, out, w); break;
+
+    switch (width)
+    {
+        case 0:
+            memset(out, 0, TSPACK_BLOCK_LEN * sizeof(*out));
+            break;
+        UNPACK_CASE(1)  UNPACK_CASE(2)  UNPACK_CASE(3)  UNPACK_CASE(4)
+        UNPACK_CASE(5)  UNPACK_CASE(6)  UNPACK_CASE(7)  UNPACK_CASE(8)
+        UNPACK_CASE(9)  UNPACK_CASE(10) UNPACK_CASE(11) UNPACK_CASE(12)
+        UNPACK_CASE(13) UNPACK_CASE(14) UNPACK_CASE(15) UNPACK_CASE(16)
+        UNPACK_CASE(17) UNPACK_CASE(18) UNPACK_CASE(19) UNPACK_CASE(20)
+        UNPACK_CASE(21) UNPACK_CASE(22) UNPACK_CASE(23) UNPACK_CASE(24)
+        UNPACK_CASE(25) UNPACK_CASE(26) UNPACK_CASE(27) UNPACK_CASE(28)
+        UNPACK_CASE(29) UNPACK_CASE(30) UNPACK_CASE(31) UNPACK_CASE(32)
+        default:
+            assert(0);
+    }
+
+#undef UNPACK_CASE
+}
+
+
+/*
+ * Decode the 128 values of a block into out, which must have room for
+ * all of them (a last, partial block decodes its padding as well).
+ */
+static void decode_block(const struct tspack *pack,
+        const struct tspack_block *block, uint64_t *out)
+{
+    const uint32_t *in = pack->data + INFO_OFFSET(block->info);
+    uint32_t packed[TSPACK_BLOCK_LEN];
+    unsigned int i;
+
+    switch (INFO_KIND(block->info))
+    {
+        case BLOCK_REFERENCE:
+        {
+            const uint64_t base = block->base;
+
+            unpack_block(in, packed, INFO_WIDTH(block->info));
+            for (i=0; i<TSPACK_BLOCK_LEN; i++)
+                out[i] = base + packed[i];
+            break;
+        }
+
+        case BLOCK_DELTA:
+        {
+            const uint64_t delta = block->delta;
+            uint64_t value = block->base;
+
+            unpack_block(in, packed, INFO_WIDTH(block->info));
+            out[0] = value;
+            for (i=1; i<TSPACK_BLOCK_LEN; i++)
+            {
+                value += delta + packed[i];
+                out[i] = value;
+            }
+            break;
+        }
+
+        default:
+            memcpy(out, in, TSPACK_BLOCK_LEN * sizeof(uint64_t));
+            break;
+    }
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,124 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tspack.h - compressed read-only array of 64-bit integers, module header
+ */
+
+
+#ifndef _TSPACK_H
+#define _TSPACK_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get size_t */
+#include <stddef.h>
+
+/* get uint64_t */
+#include <stdint.h>
+
+
+#include "common.h"
+#include "tsarray.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tspack_errno {
+    TSPACK_EOK = 0,         /* Success */
+    TSPACK_EINVAL = -1,     /* Invalid argument */
+};
+
+
+/* Values per block */
+#define TSPACK_BLOCK_LEN 128
+
+
+/*
+ * Compressed, read-only array of 64-bit integers.
+ *
+ * The values are split in blocks of TSPACK_BLOCK_LEN. Each block is
+ * stored as frame of reference plus bit packing: either the values minus
+ * the block's smallest one, or the differences between consecutive values
+ * minus the smallest difference, whichever needs fewer bits, packed in
+ * just that many bits each. Sorted values, or values that stay close
+ * together (IDs, timestamps), thus shrink to a few bits each. A block
+ * whose values need more than 32 bits either way is stored as is.
+ *
+ * Every block starts at a known place, so a random tspack_get only
+ * decodes within one block: immediately for a frame of reference block,
+ * or up to the value for a differences block. tspack_decode unpacks whole
+ * blocks at a time, four values at once with SIMD where available.
+ *
+ * The members are internal.
+ */
+struct tspack {
+    unsigned long len;
+    unsigned long block_count;
+    struct tspack_block *blocks;
+    uint32_t *data;                 /* packed values of every block */
+    size_t data_words;
+};
+
+
+struct tspack *tspack_new(const uint64_t *values, unsigned long len)
+    __ATTR_MALLOC;
+
+unsigned long tspack_len(const struct tspack *pack) __ATTR_PURE __NON_NULL;
+
+size_t tspack_size(const struct tspack *pack) __ATTR_PURE __NON_NULL;
+
+uint64_t tspack_get(const struct tspack *pack, unsigned long index)
+    __ATTR_PURE __NON_NULL;
+
+long tspack_decode(const struct tspack *pack, unsigned long start,
+        uint64_t *out, unsigned long count) __NON_NULL;
+
+void tspack_free(struct tspack *pack) __NON_NULL;
+
+
+/*
+ * Compress a typed tsarray of 64-bit integers (signed or unsigned). Same
+ * as tspack_new, but takes the values and their number from the array,
+ * which must have 8-byte items (this is checked at compile time).
+ *
+ * Example (compress a table of timestamps):
+ *      TSARRAY_TYPEDEF(stamparray, int64_t);
+ *      struct tspack *pack = TSPACK_NEW(stamps);
+ *      int64_t t = (int64_t)tspack_get(pack, i);
+ */
+#define TSPACK_NEW(array) \
+    ((void)sizeof(char[sizeof(*(array)->items) == sizeof(uint64_t) ? 1 : -1]), \
+     tspack_new((const uint64_t *)(const void *)(array)->items, \
+                tsarray_len((const struct _tsarray_pub *)(array))))
+
+
+#endif      /* not _TSPACK_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,215 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsreader.c - streaming chunked reading into a tsarray
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* get errno */
+#include <errno.h>
+
+#include "tsreader.h"
+#include "common.h"
+
+
+
+static void *reader_main(void *arg) __NON_NULL;
+
+
+
+/*
+ * Start a streaming reader.
+ *
+ * Receives the reader to start, a file descriptor open for reading, the
+ * size of the file's objects, and how many objects to hand out at a time.
+ * The file is read from its current position to its end, which must be
+ * at the end of an object. The first chunk starts being read right away.
+ *
+ * Returns 0 in case of success, non-zero otherwise. The reader must be
+ * stopped with tsreader_stop when no longer needed, even after reaching
+ * the end of the file. The caller keeps ownership of fd.
+ */
+int tsreader_start(struct tsreader *reader, int fd, size_t obj_size,
+        unsigned long chunk_len)
+{
+    if (unlikely(obj_size == 0 || chunk_len == 0
+                 || !is_valid_index(chunk_len, obj_size)))
+        return TSREADER_EINVAL;
+
+    reader->fd = fd;
+    reader->obj_size = obj_size;
+    reader->chunk_len = chunk_len;
+    reader->ahead_count = 0;
+    reader->ahead_errno = 0;
+    reader->ahead_ready = 0;
+    reader->stopping = 0;
+
+    reader->ahead = tsarray_new(obj_size);
+    if (unlikely(reader->ahead == NULL))
+        return TSREADER_ENOMEM;
+
+    if (unlikely(pthread_mutex_init(&reader->lock, NULL) != 0))
+        goto fail_mutex;
+
+    if (unlikely(pthread_cond_init(&reader->cond, NULL) != 0))
+        goto fail_cond;
+
+    if (unlikely(pthread_create(&reader->thread, NULL, reader_main,
+                                reader) != 0))
+        goto fail_thread;
+
+    return 0;
+
+fail_thread:
+    pthread_cond_destroy(&reader->cond);
+fail_cond:
+    pthread_mutex_destroy(&reader->lock);
+fail_mutex:
+    tsarray_free(reader->ahead);
+
+    return TSREADER_EAGAIN;
+}
+
+
+
+/*
+ * Get the next chunk from a streaming reader.
+ *
+ * Receives the reader, and the tsarray to put the chunk in, which must be
+ * of the reader's object size. Waits for the chunk to be read, if it isn't
+ * yet, and swaps it into the array; the array's previous memory is used
+ * to read the following chunk, which starts right away. So anything in
+ * the array is lost, and pointers to its items must not be kept across
+ * calls.
+ *
+ * Returns the number of objects in the chunk, which is chunk_len except
+ * for the last one, 0 at the end of the file (the array is left alone),
+ * or a negative error value. In case of TSREADER_EIO, errno tells what
+ * went wrong. Once the end or an error is reached, every later call
+ * returns the same.
+ */
+long tsreader_next(struct tsreader *reader, struct _tsarray_pub *p_tsarray)
+{
+    long count;
+
+    pthread_mutex_lock(&reader->lock);
+
+    while (!reader->ahead_ready)
+        pthread_cond_wait(&reader->cond, &reader->lock);
+
+    count = reader->ahead_count;
+
+    if (count > 0)
+    {
+        if (unlikely(tsarray_swap(reader->ahead, p_tsarray) != 0))
+            count = TSREADER_EINVAL;
+        else
+        {   /* let the thread read the next one */
+            reader->ahead_ready = 0;
+            pthread_cond_signal(&reader->cond);
+        }
+    }
+    else if (count < 0)
+        errno = reader->ahead_errno;
+
+    pthread_mutex_unlock(&reader->lock);
+
+    return count;
+}
+
+
+
+/*
+ * Stop a streaming reader, and wait for its thread to finish.
+ *
+ * A read in progress is finished first. Frees the reader's own array; the
+ * caller's array is left alone.
+ */
+void tsreader_stop(struct tsreader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    reader->stopping = 1;
+    pthread_cond_signal(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+
+    pthread_join(reader->thread, NULL);
+
+    pthread_cond_destroy(&reader->cond);
+    pthread_mutex_destroy(&reader->lock);
+    tsarray_free(reader->ahead);
+}
+
+
+
+/*
+ * Main loop of a streaming reader's thread.
+ *
+ * Reads a chunk into the reader's own array, without holding the lock,
+ * then waits for tsreader_next to take it. Stops at the end of the file,
+ * or at the first error.
+ */
+static void *reader_main(void *arg)
+{
+    struct tsreader *reader = arg;
+    int stopping;
+    long count;
+
+    do
+    {
+        int saved_errno;
+
+        count = tsarray_read(reader->ahead, reader->fd, reader->chunk_len);
+        saved_errno = errno;
+
+        pthread_mutex_lock(&reader->lock);
+
+        if (likely(count >= 0))
+            reader->ahead_count = count;
+        else
+        {
+            reader->ahead_count = count == TSARRAY_ENOMEM
+                ? TSREADER_ENOMEM : TSREADER_EIO;
+            reader->ahead_errno = saved_errno;
+        }
+
+        reader->ahead_ready = 1;
+        pthread_cond_signal(&reader->cond);
+
+        while (reader->ahead_ready && !reader->stopping && count > 0)
+            pthread_cond_wait(&reader->cond, &reader->lock);
+
+        stopping = reader->stopping;
+        pthread_mutex_unlock(&reader->lock);
+    } while (count > 0 && !stopping);
+
+    return NULL;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
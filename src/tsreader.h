@@ -0,0 +1,124 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsreader.h - streaming chunked reading into a tsarray, module header
+ */
+
+
+#ifndef _TSREADER_H
+#define _TSREADER_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get size_t */
+#include <stddef.h>
+
+/* get threads, mutexes and condition variables */
+#include <pthread.h>
+
+
+#include "common.h"
+#include "tsarray.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tsreader_errno {
+    TSREADER_EOK = 0,           /* Success */
+    TSREADER_EINVAL = -1,       /* Invalid argument */
+    TSREADER_EAGAIN = -2,       /* Couldn't create the thread */
+    TSREADER_ENOMEM = -3,       /* Out of memory */
+    TSREADER_EIO = -4,          /* Error reading the file */
+};
+
+
+/*
+ * Streaming reader of a flat file of objects, for files too large to hold
+ * in memory at once.
+ *
+ * Hands the file out a chunk of up to chunk_len objects at a time, into a
+ * tsarray owned by the caller (see tsreader_next). A thread of its own
+ * reads the following chunk into a second tsarray meanwhile, so reading
+ * overlaps with the caller's work on the current one. Chunks are handed
+ * out by swapping the two arrays, so no object is copied, and once both
+ * arrays have grown to a chunk's size nothing more is allocated.
+ *
+ * The members are internal.
+ */
+struct tsreader {
+    int fd;
+    size_t obj_size;
+    unsigned long chunk_len;
+
+    struct _tsarray_pub *ahead;     /* chunk read ahead by the thread */
+    long ahead_count;               /* result of reading it */
+    int ahead_errno;
+    int ahead_ready;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stopping;
+};
+
+
+int tsreader_start(struct tsreader *reader, int fd, size_t obj_size,
+        unsigned long chunk_len) __NON_NULL;
+
+long tsreader_next(struct tsreader *reader, struct _tsarray_pub *p_tsarray)
+    __NON_NULL;
+
+void tsreader_stop(struct tsreader *reader) __NON_NULL;
+
+
+/*
+ * Start a streaming reader for a typed tsarray. Same as tsreader_start,
+ * but takes the object size from the array's type.
+ *
+ * Example (sum a file of doubles, a million at a time):
+ *      struct tsreader reader;
+ *      doublearray *chunk = doublearray_new();
+ *      long n;
+ *      TSREADER_START(&reader, fd, chunk, 1000000);
+ *      while ((n = TSREADER_NEXT(&reader, chunk)) > 0)
+ *          for (i=0; i<n; i++)
+ *              sum += chunk->items[i];
+ *      tsreader_stop(&reader);
+ */
+#define TSREADER_START(reader, fd, array, chunk_len) \
+    tsreader_start((reader), (fd), sizeof(*(array)->items), (chunk_len))
+
+#define TSREADER_NEXT(reader, array) \
+    tsreader_next((reader), (struct _tsarray_pub *)(array))
+
+
+#endif      /* not _TSREADER_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,717 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsshm.c - type-safe array in shared memory
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+/* memfd_create and mremap are GNU extensions */
+#if (HAVE_MEMFD_CREATE || HAVE_MREMAP) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+
+/* get errno */
+#include <errno.h>
+
+/* get LONG_MAX */
+#include <limits.h>
+
+/* get snprintf, for naming anonymous segments */
+#include <stdio.h>
+
+/* get uint32_t, uint64_t and SIZE_MAX, for the segment header */
+#include <stdint.h>
+
+/* get malloc and free */
+#include <stdlib.h>
+
+/* get memcpy and memcmp */
+#include <string.h>
+
+/* get close, dup, ftruncate, getpid and sysconf */
+#include <unistd.h>
+
+/* get fstat, for the size of a segment */
+#include <sys/stat.h>
+
+/* get shm_open, memfd_create, mmap and mremap */
+#if HAVE_FCNTL_H && HAVE_SYS_MMAN_H && HAVE_MMAP && HAVE_SHM_OPEN
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  define CAN_SHM 1
+#endif
+
+#include "tsshm.h"
+#include "common.h"
+
+
+/*
+ * Header at the start of a shared segment, followed by the items.
+ *
+ * Only the writer changes it. version is stored last when creating the
+ * segment (release), so a reader that finds it set (acquire) finds the
+ * rest of the header filled in; until then, it reads as 0. capacity,
+ * generation and len are accessed atomically: the writer stores capacity
+ * before bumping generation (release), and stores len last (release), so
+ * a reader that loads len and then generation (acquire) finds a
+ * generation whose capacity covers that len.
+ *
+ * The header's size is a multiple of any sane object alignment, so that
+ * the items are as aligned as the mapping itself (i.e. page aligned).
+ */
+struct shm_header {
+    char magic[8];              /* SHM_MAGIC */
+    uint32_t version;           /* SHM_VERSION */
+    uint32_t reserved0;
+    uint64_t obj_size;
+    uint64_t capacity;          /* objects the segment has room for */
+    uint64_t generation;        /* bumped whenever the segment grows */
+    uint64_t len;               /* published length */
+    char reserved[16];          /* zero; pads the header to 64 bytes */
+};
+
+#define SHM_MAGIC "TSSHM"
+#define SHM_VERSION 1
+
+
+/*
+ * Private version of the shared array. The public version must be the
+ * first member (see struct _tsarray_priv in tsarray.c for why).
+ */
+struct _tsshm_priv {
+    struct _tsshm_pub pub;      /* MUST be the first member */
+    struct shm_header *header;  /* start of this process's mapping */
+    size_t map_size;
+    size_t obj_size;
+    unsigned long capacity;     /* objects within the mapping; <= LONG_MAX */
+    unsigned long len;          /* as of the last append or refresh */
+    uint64_t generation;        /* of the segment, when it was mapped */
+    size_t prefaulted;          /* bytes of the mapping prefaulted so far */
+    int fd;
+    bool writer;
+};
+
+
+/* Smallest segment to create, in bytes */
+#define MIN_SEGMENT ((size_t)64 << 10)
+
+/* How far ahead of its items the writer prefaults the segment, in bytes */
+#define PREFAULT_WINDOW ((size_t)1 << 20)
+
+
+
+static int open_segment(const char *name, bool create);
+
+static int map_segment(struct _tsshm_priv *priv, size_t size) __NON_NULL;
+
+static void unmap_segment(struct _tsshm_priv *priv) __NON_NULL;
+
+static struct _tsshm_pub *reader_new(int fd, size_t obj_size);
+
+static int grow(struct _tsshm_priv *priv, unsigned long new_len) __NON_NULL;
+
+static void prefault(struct _tsshm_priv *priv, size_t end) __NON_NULL;
+
+
+
+/*
+ * Create a new shared array, for this process to append to.
+ *
+ * Receives the name of the shared memory segment to create (as for
+ * shm_open; it must not exist yet), or NULL for an anonymous one, the
+ * size of each object, and how many objects to make room for at first
+ * (0 for a default). Readers attach to a named segment with tsshm_open,
+ * and to an anonymous one with tsshm_from_fd on a descriptor passed to
+ * them (inherited across fork, or sent over a Unix socket).
+ *
+ * Returns the new array, or NULL in case of error (errno tells what went
+ * wrong). Only the creating process may append to the array. A named
+ * segment outlives the array; remove it with shm_unlink once done.
+ */
+struct _tsshm_pub *tsshm_create(const char *name, size_t obj_size,
+        unsigned long capacity)
+{
+    struct _tsshm_priv *priv;
+    size_t size;
+
+    if (unlikely(obj_size == 0))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    capacity = max(capacity, (MIN_SEGMENT - sizeof(struct shm_header))
+                                / obj_size);
+    capacity = max(capacity, 1UL);
+
+    if (unlikely(!is_valid_index(capacity, obj_size))
+            || unlikely(!can_size_add(capacity * obj_size,
+                                      sizeof(struct shm_header))))
+    {
+        errno = EOVERFLOW;
+        return NULL;
+    }
+    size = sizeof(struct shm_header) + capacity * obj_size;
+
+    priv = malloc(sizeof(*priv));
+    if (unlikely(priv == NULL))
+        return NULL;
+
+    priv->header = NULL;
+    priv->obj_size = obj_size;
+    priv->len = 0;
+    priv->generation = 0;
+    priv->prefaulted = 0;
+    priv->writer = true;
+
+    priv->fd = open_segment(name, true);
+    if (unlikely(priv->fd < 0))
+        goto fail_open;
+
+    if (unlikely(ftruncate(priv->fd, (off_t)size) != 0)
+            || unlikely(map_segment(priv, size) != 0))
+        goto fail_map;
+
+    /* a new segment reads as zeros, so len and generation are 0 already;
+     * the version goes last, as it tells readers the header is ready */
+    memcpy(priv->header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    priv->header->obj_size = obj_size;
+    __atomic_store_n(&priv->header->capacity, capacity, __ATOMIC_RELAXED);
+    __atomic_store_n(&priv->header->version, SHM_VERSION, __ATOMIC_RELEASE);
+
+    return &priv->pub;
+
+fail_map:
+    {
+        const int saved_errno = errno;
+
+#if CAN_SHM
+        if (name != NULL)
+            shm_unlink(name);
+#endif
+        close(priv->fd);
+        errno = saved_errno;
+    }
+fail_open:
+    free(priv);
+    return NULL;
+}
+
+
+/*
+ * Attach to a named shared array, to read it.
+ *
+ * Receives the segment's name (as given to tsshm_create) and the size of
+ * each object, which must match the array's. Returns the array, or NULL
+ * in case of error (errno tells what went wrong; EINVAL if the segment
+ * isn't a shared array of obj_size objects, EAGAIN if it's still being
+ * created, so try again shortly). Call tsshm_refresh to see the items
+ * appended so far.
+ */
+struct _tsshm_pub *tsshm_open(const char *name, size_t obj_size)
+{
+    struct _tsshm_pub *tsshm;
+    int fd;
+
+    fd = open_segment(name, false);
+    if (unlikely(fd < 0))
+        return NULL;
+
+    tsshm = reader_new(fd, obj_size);
+    if (unlikely(tsshm == NULL))
+    {
+        const int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+    }
+
+    return tsshm;
+}
+
+
+/*
+ * Attach to a shared array through a file descriptor, to read it.
+ *
+ * Same as tsshm_open, but receives a descriptor of the segment (as
+ * returned by tsshm_fd in the writer). The caller keeps ownership of fd.
+ */
+struct _tsshm_pub *tsshm_from_fd(int fd, size_t obj_size)
+{
+    struct _tsshm_pub *tsshm;
+    int own_fd;
+
+    own_fd = dup(fd);
+    if (unlikely(own_fd < 0))
+        return NULL;
+
+    tsshm = reader_new(own_fd, obj_size);
+    if (unlikely(tsshm == NULL))
+    {
+        const int saved_errno = errno;
+
+        close(own_fd);
+        errno = saved_errno;
+    }
+
+    return tsshm;
+}
+
+
+/*
+ * Get the length of a shared array, as this process sees it: in the
+ * writer, every item appended so far; in a reader, the length found by
+ * the last tsshm_refresh.
+ */
+unsigned long tsshm_len(const struct _tsshm_pub *tsshm)
+{
+    const struct _tsshm_priv *priv = (const struct _tsshm_priv *)tsshm;
+
+    return priv->len;
+}
+
+
+/*
+ * Get the file descriptor of a shared array's segment, to pass on to
+ * readers (see tsshm_from_fd). It remains owned by the array.
+ */
+int tsshm_fd(const struct _tsshm_pub *tsshm)
+{
+    const struct _tsshm_priv *priv = (const struct _tsshm_priv *)tsshm;
+
+    return priv->fd;
+}
+
+
+/*
+ * Append an object to the end of a shared array.
+ *
+ * Receives the writer's array and a pointer to the object. The object is
+ * copied in, then published to readers. Returns 0 in case of success, or
+ * a negative error value otherwise: TSSHM_EPERM on a reader's view, or
+ * TSSHM_EIO if the segment couldn't grow (errno tells why).
+ *
+ * The segment may move in the writer's memory when it grows, so pointers
+ * into the array's items are invalid after this.
+ */
+int tsshm_append(struct _tsshm_pub *tsshm, const void *object)
+{
+    return tsshm_extend(tsshm, object, 1);
+}
+
+
+/*
+ * Append several objects to the end of a shared array.
+ *
+ * Same as tsshm_append, but receives a C array of count objects, which
+ * are all published at once. Returns TSSHM_EOVERFLOW if the array would
+ * grow past LONG_MAX objects.
+ */
+int tsshm_extend(struct _tsshm_pub *tsshm, const void *objects,
+        unsigned long count)
+{
+    struct _tsshm_priv *priv = (struct _tsshm_priv *)tsshm;
+    unsigned long new_len;
+    size_t end;
+    int ret;
+
+    if (unlikely(!priv->writer))
+        return TSSHM_EPERM;
+
+    if (unlikely(count == 0))
+        return 0;
+
+    if (unlikely(objects == NULL))
+        return TSSHM_EINVAL;
+
+    if (unlikely(!can_add_within_long(priv->len, count)))
+        return TSSHM_EOVERFLOW;
+
+    new_len = priv->len + count;
+
+    if (unlikely(new_len > priv->capacity)
+            && unlikely((ret = grow(priv, new_len)) != 0))
+        return ret;
+
+    end = sizeof(struct shm_header) + new_len * priv->obj_size;
+    if (unlikely(end > priv->prefaulted))
+        prefault(priv, end);
+
+    memcpy(priv->pub.items + priv->len * priv->obj_size, objects,
+           count * priv->obj_size);
+
+    priv->len = new_len;
+    __atomic_store_n(&priv->header->len, new_len, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+/*
+ * Catch up with the items published by a shared array's writer.
+ *
+ * Receives a reader's view of the array. Loads the published length, and
+ * remaps the segment if it has grown since it was last mapped. Returns
+ * the new length, or a negative error value (TSSHM_EIO if remapping
+ * failed; errno tells why).
+ *
+ * The items may move in this process's memory, so pointers into them are
+ * invalid after this. In the writer, this just returns its length.
+ */
+long tsshm_refresh(struct _tsshm_pub *tsshm)
+{
+    struct _tsshm_priv *priv = (struct _tsshm_priv *)tsshm;
+    uint64_t len;
+    uint64_t generation;
+
+    if (priv->writer)
+        return (long)priv->len;
+
+    /* len first; its generation is then at least the one that covers it */
+    len = __atomic_load_n(&priv->header->len, __ATOMIC_ACQUIRE);
+    generation = __atomic_load_n(&priv->header->generation,
+                                 __ATOMIC_ACQUIRE);
+
+    if (unlikely(generation != priv->generation))
+    {
+        struct stat st;
+
+        if (unlikely(fstat(priv->fd, &st) != 0)
+                || unlikely((uintmax_t)st.st_size > SIZE_MAX))
+            return TSSHM_EIO;
+
+        if (unlikely(map_segment(priv, (size_t)st.st_size) != 0))
+            return TSSHM_EIO;
+
+        priv->generation = generation;
+    }
+
+    /* can only happen if someone else has been writing to the segment */
+    if (unlikely(len > priv->capacity))
+    {
+        errno = EPROTO;
+        return TSSHM_EIO;
+    }
+
+    priv->len = (unsigned long)len;
+
+    return (long)len;
+}
+
+
+/*
+ * Free a shared array: unmaps the segment and closes its descriptor.
+ * Readers' views stay valid after the writer frees its own.
+ */
+void tsshm_free(struct _tsshm_pub *tsshm)
+{
+    struct _tsshm_priv *priv = (struct _tsshm_priv *)tsshm;
+
+    unmap_segment(priv);
+    close(priv->fd);
+    free(priv);
+}
+
+
+
+/* Internal functions */
+
+
+/*
+ * Open a shared memory segment.
+ *
+ * Receives its name, or NULL for an anonymous segment, and whether to
+ * create it for writing (it must not exist yet) or open it for reading.
+ * Anonymous segments come from memfd_create where available; otherwise
+ * from a uniquely named segment, unlinked right away.
+ *
+ * Returns the file descriptor, or -1 in case of error (errno tells why).
+ */
+static int open_segment(const char *name, bool create)
+{
+#if CAN_SHM
+    const int flags = create ? O_RDWR | O_CREAT | O_EXCL : O_RDONLY;
+#  if !HAVE_MEMFD_CREATE
+    static unsigned int counter;
+    char unique[64];
+    int fd;
+#  endif
+
+    if (name != NULL)
+        return shm_open(name, flags, 0600);
+
+#  if HAVE_MEMFD_CREATE
+    return memfd_create("tsshm", 0);
+#  else
+    snprintf(unique, sizeof(unique), "/tsshm-%ld-%u", (long)getpid(),
+             __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+
+    fd = shm_open(unique, flags, 0600);
+    if (likely(fd >= 0))
+        shm_unlink(unique);
+
+    return fd;
+#  endif
+#else
+    (void)name;
+    (void)create;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/*
+ * Map (or remap) a shared array's segment into this process.
+ *
+ * Receives the array and the segment's current size. A mapping is grown
+ * in place with mremap where available; otherwise the new mapping
+ * replaces the old one only once made. Either way, the old one is left
+ * untouched in case of error. Updates the items and capacity.
+ *
+ * Returns 0 in case of success, or -1 otherwise (errno tells why).
+ */
+static int map_segment(struct _tsshm_priv *priv, size_t size)
+{
+#if CAN_SHM
+    const int prot = priv->writer ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *base;
+
+    if (unlikely(size < sizeof(struct shm_header)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+#  if HAVE_MREMAP
+    if (priv->header != NULL)
+        base = mremap(priv->header, priv->map_size, size, MREMAP_MAYMOVE);
+    else
+#  endif
+        base = mmap(NULL, size, prot, MAP_SHARED, priv->fd, 0);
+
+    if (unlikely(base == MAP_FAILED))
+        return -1;
+
+#  if !HAVE_MREMAP
+    if (priv->header != NULL)
+        unmap_segment(priv);
+#  endif
+
+    priv->header = base;
+    priv->map_size = size;
+    priv->capacity = min((size - sizeof(struct shm_header)) / priv->obj_size,
+                         (size_t)LONG_MAX);
+    priv->pub.items = (char *)base + sizeof(struct shm_header);
+
+#  if !HAVE_MREMAP
+    priv->prefaulted = 0;
+#  endif
+
+    return 0;
+#else
+    (void)priv;
+    (void)size;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/*
+ * Unmap a shared array's segment from this process.
+ */
+static void unmap_segment(struct _tsshm_priv *priv)
+{
+#if CAN_SHM
+    munmap(priv->header, priv->map_size);
+#endif
+    priv->header = NULL;
+    priv->pub.items = NULL;
+}
+
+
+/*
+ * Make a reader's view of a shared array.
+ *
+ * Receives a descriptor of the segment, which the view takes ownership of
+ * in case of success, and the expected object size. Returns the new view,
+ * or NULL in case of error (errno tells why; EAGAIN if the writer hasn't
+ * sized the segment or filled in its header yet).
+ */
+static struct _tsshm_pub *reader_new(int fd, size_t obj_size)
+{
+    struct _tsshm_priv *priv;
+    struct stat st;
+    uint64_t generation;
+    uint32_t version;
+
+    priv = malloc(sizeof(*priv));
+    if (unlikely(priv == NULL))
+        return NULL;
+
+    priv->header = NULL;
+    priv->obj_size = obj_size;
+    priv->len = 0;
+    priv->prefaulted = 0;
+    priv->fd = fd;
+    priv->writer = false;
+
+    if (unlikely(obj_size == 0))
+        goto fail_inval;
+
+    /* a segment just created is empty until the writer sizes it, and
+     * touching a mapping past the end of the file raises SIGBUS */
+    if (unlikely(fstat(fd, &st) != 0))
+        goto fail;
+
+    if (unlikely((uintmax_t)st.st_size < sizeof(struct shm_header)))
+        goto fail_again;
+
+    /* map the header alone, to learn the generation and check the rest */
+    if (unlikely(map_segment(priv, sizeof(struct shm_header)) != 0))
+        goto fail;
+
+    version = __atomic_load_n(&priv->header->version, __ATOMIC_ACQUIRE);
+    if (unlikely(version == 0))
+        goto fail_again;
+
+    if (unlikely(version != SHM_VERSION)
+            || unlikely(memcmp(priv->header->magic, SHM_MAGIC,
+                               sizeof(SHM_MAGIC)) != 0)
+            || unlikely(priv->header->obj_size != obj_size))
+        goto fail_inval;
+
+    /*
+     * The generation must be read before the size: the writer grows the
+     * segment before bumping it, so the size is then at least the one
+     * for that generation.
+     */
+    generation = __atomic_load_n(&priv->header->generation,
+                                 __ATOMIC_ACQUIRE);
+
+    if (unlikely(fstat(fd, &st) != 0))
+        goto fail;
+
+    if (unlikely((uintmax_t)st.st_size > SIZE_MAX))
+        goto fail_inval;
+
+    if (unlikely(map_segment(priv, (size_t)st.st_size) != 0))
+        goto fail;
+
+    priv->generation = generation;
+
+    return &priv->pub;
+
+fail_again:
+    errno = EAGAIN;
+    goto fail;
+fail_inval:
+    errno = EINVAL;
+fail:
+    {
+        const int saved_errno = errno;
+
+        if (priv->header != NULL)
+            unmap_segment(priv);
+        free(priv);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+
+/*
+ * Grow the writer's segment to hold at least new_len objects.
+ *
+ * Doubles the capacity (or more, if need be), so that readers seldom
+ * have to remap. Grows the file, remaps the writer's view, then records
+ * the new capacity and bumps the generation, in that order (see struct
+ * shm_header).
+ *
+ * Returns 0 in case of success, or a negative error value otherwise.
+ */
+static int grow(struct _tsshm_priv *priv, unsigned long new_len)
+{
+    const size_t max_capacity = min(
+            (SIZE_MAX - sizeof(struct shm_header)) / priv->obj_size,
+            (size_t)LONG_MAX);
+    unsigned long capacity;
+    size_t size;
+
+    if (unlikely(new_len > max_capacity))
+        return TSSHM_EOVERFLOW;
+
+    capacity = priv->capacity <= max_capacity / 2 ? priv->capacity * 2
+                                                  : max_capacity;
+    capacity = max(capacity, new_len);
+    size = sizeof(struct shm_header) + capacity * priv->obj_size;
+
+    if (unlikely(ftruncate(priv->fd, (off_t)size) != 0)
+            || unlikely(map_segment(priv, size) != 0))
+        return TSSHM_EIO;
+
+    __atomic_store_n(&priv->header->capacity, capacity, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&priv->header->generation, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+/*
+ * Prefault the writer's segment for writing, up to at least end bytes and
+ * PREFAULT_WINDOW past what was prefaulted before. Faulting in the pages
+ * a window at a time costs far less than taking a fault on each page as
+ * the items come in, while committing no more memory than is about to be
+ * written.
+ */
+static void prefault(struct _tsshm_priv *priv, size_t end)
+{
+#if CAN_SHM && defined(MADV_POPULATE_WRITE)
+    const size_t page_mask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+    const size_t start = priv->prefaulted & ~page_mask;
+    const size_t stop = min(max(end, priv->prefaulted + PREFAULT_WINDOW),
+                            priv->map_size);
+
+    /* merely advice; older kernels don't know it */
+    madvise((char *)priv->header + start, stop - start, MADV_POPULATE_WRITE);
+
+    priv->prefaulted = stop;
+#else
+    (void)end;
+
+    /* nothing to do until the segment is remapped */
+    priv->prefaulted = priv->map_size;
+#endif
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -0,0 +1,161 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+/*
+ * tsshm.h - type-safe array in shared memory, module header
+ */
+
+
+#ifndef _TSSHM_H
+#define _TSSHM_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+
+/* get NULL and size_t */
+#include <stddef.h>
+
+
+#include "common.h"
+
+
+/*
+ * Error values returned by API functions. Always negative in case of error.
+ */
+enum tsshm_errno {
+    TSSHM_EOK = 0,          /* Success */
+    TSSHM_EINVAL = -1,      /* Invalid argument */
+    TSSHM_EOVERFLOW = -2,   /* Operation would overflow */
+    TSSHM_EIO = -3,         /* Error growing or mapping the segment */
+    TSSHM_EPERM = -4,       /* Not allowed on a reader's view */
+};
+
+
+/* Abstract version; only for internal use (must match the subclassed
+ * versions in TSSHM_TYPEDEF) */
+struct _tsshm_pub {
+    char *items;    /* char may alias any other type (C99 6.5.2.3) */
+};
+
+
+/*
+ * An array in a shared memory segment, appended to by one process (the
+ * writer) and read, with no copying, by any number of others (readers).
+ *
+ * The segment starts with a header holding the object size, capacity and
+ * length, followed by the items. The writer appends items and then
+ * publishes the new length with an atomic release store; a reader sees
+ * them once it calls tsshm_refresh, which loads the length with acquire
+ * semantics. Items below a published length are never changed.
+ *
+ * Growth protocol: when the segment is full, the writer grows its file
+ * (never shrinking it) and remaps its own view, then records the new
+ * capacity and bumps a generation counter in the header, all before
+ * publishing any item beyond the old capacity. Since the segment only
+ * grows, a reader's old mapping stays valid; tsshm_refresh remaps it
+ * when it finds the generation has changed. So readers never block the
+ * writer, nor each other.
+ */
+
+
+struct _tsshm_pub *tsshm_create(const char *name, size_t obj_size,
+        unsigned long capacity) __ATTR_MALLOC;
+
+struct _tsshm_pub *tsshm_open(const char *name, size_t obj_size)
+    __ATTR_MALLOC __NON_NULL;
+
+struct _tsshm_pub *tsshm_from_fd(int fd, size_t obj_size) __ATTR_MALLOC;
+
+unsigned long tsshm_len(const struct _tsshm_pub *tsshm) __ATTR_PURE __NON_NULL;
+
+int tsshm_fd(const struct _tsshm_pub *tsshm) __ATTR_PURE __NON_NULL;
+
+int tsshm_append(struct _tsshm_pub *tsshm, const void *object) __NON_NULL;
+
+int tsshm_extend(struct _tsshm_pub *tsshm, const void *objects,
+        unsigned long count) __attribute__((nonnull (1)));
+
+long tsshm_refresh(struct _tsshm_pub *tsshm) __NON_NULL;
+
+void tsshm_free(struct _tsshm_pub *tsshm) __NON_NULL;
+
+
+/*
+ * Declare a new type-specific shared array type.
+ *
+ * Defines (typedefs) shmtype to the new shared array type, which will
+ * store objects of type objtype, along with type-specific functions
+ * prefixed with shmtype_, e.g. intshm_append(), etc.
+ *
+ * Example (hand ints from a parent to a forked child):
+ *      TSSHM_TYPEDEF(intshm, int);
+ *
+ *      intshm *out = intshm_create(NULL, 0);
+ *      if (fork() == 0) {
+ *          intshm *in = intshm_from_fd(intshm_fd(out));
+ *          long len = intshm_refresh(in);
+ *          ... in->items[0] to in->items[len-1] ...
+ *      } else
+ *          intshm_append(out, &x);
+ */
+#define TSSHM_TYPEDEF(shmtype, objtype) \
+    typedef struct { objtype *items; } shmtype; \
+    static inline shmtype *shmtype##_create(const char *name, \
+            unsigned long capacity) { \
+        return (shmtype *)tsshm_create(name, sizeof(objtype), capacity); \
+    } \
+    static inline shmtype *shmtype##_open(const char *name) { \
+        return (shmtype *)tsshm_open(name, sizeof(objtype)); \
+    } \
+    static inline shmtype *shmtype##_from_fd(int fd) { \
+        return (shmtype *)tsshm_from_fd(fd, sizeof(objtype)); \
+    } \
+    static inline unsigned long shmtype##_len(const shmtype *shm) { \
+        return tsshm_len((const struct _tsshm_pub *)shm); \
+    } \
+    static inline int shmtype##_fd(const shmtype *shm) { \
+        return tsshm_fd((const struct _tsshm_pub *)shm); \
+    } \
+    static inline int shmtype##_append(shmtype *shm, \
+            objtype const *object) { \
+        return tsshm_append((struct _tsshm_pub *)shm, object); \
+    } \
+    static inline int shmtype##_extend(shmtype *shm, \
+            objtype const *objects, unsigned long count) { \
+        return tsshm_extend((struct _tsshm_pub *)shm, objects, count); \
+    } \
+    static inline long shmtype##_refresh(shmtype *shm) { \
+        return tsshm_refresh((struct _tsshm_pub *)shm); \
+    } \
+    static inline void shmtype##_free(shmtype *shm) { \
+        tsshm_free((struct _tsshm_pub *)shm); \
+    }
+
+
+#endif      /* not _TSSHM_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -31,66 +31,249 @@
 #  include <config.h>
 #endif
 
-/* get INT_MAX */
+/* get LONG_MAX */
 #include <limits.h>
 
-/* get memcpy */
+/* get memcpy and memset */
 #include <string.h>
 
+/* get madvise and sysconf, to give empty regions back to the system */
+#if HAVE_SYS_MMAN_H && HAVE_UNISTD_H && HAVE_MADVISE
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  ifdef MADV_DONTNEED
+#    define CAN_RELEASE 1
+#  endif
+#endif
+
+/* get open, fstat and mmap, to map snapshots */
+#if HAVE_SYS_MMAN_H && HAVE_FCNTL_H && HAVE_SYS_STAT_H && HAVE_MMAP
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define CAN_MAP 1
+#endif
+
 #include "tssparse.h"
 #include "common.h"
+#include "fileio.h"
+
+
+
+/*
+ * The array's capacity is calculated in calc_new_capacity, according to the
+ * following formula (same as tsarray):
+ *      capacity = len*(1 + 1/MARGIN_RATIO) + MIN_MARGIN
+ *
+ * When the array's length drops below capacity/MIN_USAGE_RATIO, the array
+ * is shrunk to save memory.
+ */
+#define MARGIN_RATIO 8
+#define MIN_MARGIN 4
+#define MIN_USAGE_RATIO 2
+
+
+/* a word of the occupancy bitmap with every item used */
+#define MAP_WORD_FULL (~(uint64_t)0)
+
+
+/* maximum number of levels in the free summary; enough for LONG_MAX items,
+ * since each level has 64 times fewer bits than the one below */
+#define SUMMARY_MAX_LEVELS 10
+
+
+/*
+ * Layout of a tssparse's free summary, for a given capacity. Level 0 has a
+ * bit for each word of the occupancy bitmap, and each level above has a bit
+ * for each word of the level below; the top level is a single word. All
+ * levels are kept in the same array, from the bottom up: level l starts at
+ * offset[l], and is words[l] words long.
+ */
+struct summary_layout {
+    int levels;
+    size_t offset[SUMMARY_MAX_LEVELS];
+    size_t words[SUMMARY_MAX_LEVELS];
+};
+
+
+/*
+ * Header of a tssparse snapshot (see tssparse_save), written in the
+ * machine's own byte order. It is followed by the occupancy bitmap, up to
+ * the word holding bit len-1; then zeros, up to the next multiple of
+ * SNAPSHOT_ALIGN bytes from the start of the snapshot; then the len
+ * items, exactly as they are in memory; and finally a 64-bit checksum of
+ * everything before it (see fileio_hash).
+ *
+ * Aligning the items lets a mapped snapshot use them where they are.
+ */
+struct snapshot_header {
+    char magic[8];              /* SNAPSHOT_MAGIC, without the NUL */
+    uint32_t version;           /* SNAPSHOT_VERSION */
+    uint32_t byte_order;        /* FILEIO_BYTE_ORDER, as written */
+    uint64_t obj_size;
+    uint64_t len;
+    uint64_t used_count;
+    char reserved[24];          /* zero; pads the header to 64 bytes */
+};
+
+#define SNAPSHOT_MAGIC "TSSPARSE"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 64
 
+/* size of the buffer tssparse_save gathers small writes in */
+#define SNAPSHOT_BUFFER_SIZE 65536
 
 
-/* Abstract item type definition. Used as a placeholder whenever we need to
- * manipulate items. The item type can be anything. */
-struct _item_abs {
-    int used;
-    int object; /* placeholder */
+/*
+ * Buffered output of a snapshot. Keeps the checksum of everything put so
+ * far. error is set once a write fails, after which nothing more is
+ * written.
+ */
+struct snapshot_writer {
+    int fd;
+    int error;
+    uint64_t hash;
+    size_t used;                /* bytes waiting in buf */
+    char *buf;                  /* SNAPSHOT_BUFFER_SIZE bytes */
 };
 
 
 
-static inline struct _item_abs *get_nth_item(
-        const struct _item_abs *items, int index, size_t item_size)
-    __ATTR_CONST __NON_NULL;
+static inline char *get_nth_item(const struct _tssparse_abs *p_tssparse,
+        long index, size_t obj_size) __ATTR_PURE __NON_NULL;
+
+static void set_item(struct _tssparse_abs *p_tssparse, long index,
+        const void *object, size_t obj_size) __NON_NULL;
+
+static inline size_t map_words(long nbits) __ATTR_CONST;
+
+static long clear_map_range(uint64_t *used_map, long start, long stop)
+    __NON_NULL;
+
+static void fill_map_prefix(uint64_t *used_map, long count, long len)
+    __NON_NULL;
 
-static void set_item(struct _item_abs *items, int index,
-        const void *object, size_t obj_size, size_t item_size) __NON_NULL;
+static void set_map_range(uint64_t *used_map, long start, long stop)
+    __NON_NULL;
 
-static int find_free_item(const struct _tssparse_abs *p_tssparse,
-        size_t item_size) __ATTR_CONST __NON_NULL;
+static long find_map_bit(const uint64_t *used_map, long from, long stop,
+        int used) __ATTR_PURE __NON_NULL;
 
-static int tssparse_append(struct _tssparse_abs *p_tssparse,
-        const void *object, size_t obj_size, size_t item_size);
+static long calc_new_capacity(long old_capacity, long new_len) __ATTR_CONST;
 
-static int tssparse_reuse(struct _tssparse_abs *p_tssparse,
-        const void *object, size_t obj_size, size_t item_size);
+static int resize_capacity(struct _tssparse_abs *p_tssparse, long capacity,
+        size_t obj_size) __NON_NULL;
+
+static int resize_pages(struct _tssparse_abs *p_tssparse, long capacity,
+        size_t obj_size) __NON_NULL;
+
+static void free_items(struct _tssparse_abs *p_tssparse) __NON_NULL;
+
+#if CAN_MAP
+static int copy_mapping(struct _tssparse_abs *p_tssparse, size_t obj_size)
+    __NON_NULL;
+
+static void drop_mapping(struct _tssparse_abs *p_tssparse) __NON_NULL;
+#endif
+
+static int map_range_is_clear(const uint64_t *used_map, long start,
+        long stop) __ATTR_PURE __NON_NULL;
+
+static void release_range(struct _tssparse_abs *p_tssparse, long start,
+        long stop) __NON_NULL;
+
+static void release_block(const struct _tssparse_abs *p_tssparse,
+        const char *base, long first, long count, long start, long stop)
+    __NON_NULL;
+
+static size_t get_system_page_size(void);
+
+static size_t get_summary_layout(long capacity,
+        struct summary_layout *layout) __NON_NULL;
+
+static size_t calc_overhead(long capacity, int page_shift,
+        int has_generations) __ATTR_CONST;
+
+static void update_summary(struct _tssparse_abs *p_tssparse,
+        size_t start, size_t stop) __NON_NULL;
+
+static void mark_used(struct _tssparse_abs *p_tssparse, long index)
+    __NON_NULL;
+
+static void mark_word_full(struct _tssparse_abs *p_tssparse, size_t w)
+    __NON_NULL;
+
+static void mark_free(struct _tssparse_abs *p_tssparse, long index)
+    __NON_NULL;
+
+static long find_free_item(const struct _tssparse_abs *p_tssparse)
+    __NON_NULL;
+
+static int compact(struct _tssparse_abs *p_tssparse, int force,
+        size_t obj_size, struct _tsarray_pub *remap)
+    __attribute__((nonnull (1)));
+
+static int build_remap(const struct _tssparse_abs *p_tssparse,
+        struct _tsarray_pub *remap) __NON_NULL;
+
+static int ensure_generations(struct _tssparse_abs *p_tssparse) __NON_NULL;
+
+static size_t snapshot_items_offset(size_t words) __ATTR_CONST;
+
+static int check_snapshot_header(const struct snapshot_header *header,
+        size_t obj_size) __ATTR_PURE __NON_NULL;
+
+static int snapshot_map_is_valid(const uint64_t *used_map, long len,
+        long used_count) __ATTR_PURE;
+
+static void writer_put(struct snapshot_writer *writer, const void *data,
+        size_t size) __attribute__((nonnull (1)));
+
+static void writer_zero(struct snapshot_writer *writer, size_t size)
+    __NON_NULL;
+
+static void writer_flush(struct snapshot_writer *writer) __NON_NULL;
+
+static void put_items(struct snapshot_writer *writer,
+        const struct _tssparse_abs *p_tssparse, long start, long stop,
+        size_t obj_size) __NON_NULL;
+
+static int read_hashed(int fd, void *buf, size_t size, uint64_t *hash)
+    __attribute__((nonnull (4)));
+
+static void retire_generations(struct _tssparse_abs *p_tssparse,
+        long start, long stop) __NON_NULL;
+
+static long tssparse_append(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size);
+
+static long tssparse_reuse(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size);
 
 
 /*
  * Add an item to a tssparse, growing or reusing free items as required.
  *
- * Receives the tssparse, an optional object, the object size for this
- * array, and the size of items in this array. Will find space for a new
- * item in the array, whether it be by reusing a free item or by growing
- * the array. If object is non-NULL, it will be copied to the new item.
+ * Receives the tssparse, an optional object, and the object size for this
+ * array. Will find space for a new item in the array, whether it be by
+ * reusing a free item or by growing the array. If object is non-NULL, it
+ * will be copied to the new item.
  *
  * Returns the index of the newly added item in case of success, or a
  * negative error value in case of error.
  */
-int tssparse_add(struct _tssparse_abs *p_tssparse, const void *object,
-        size_t obj_size, size_t item_size)
+long tssparse_add(struct _tssparse_abs *p_tssparse, const void *object,
+        size_t obj_size)
 {
     assert(p_tssparse->used_count <= p_tssparse->len);
 
     if (p_tssparse->used_count == p_tssparse->len)
     {   /* array is full, must grow */
-        return tssparse_append(p_tssparse, object, obj_size, item_size);
+        return tssparse_append(p_tssparse, object, obj_size);
     }
     else
     {   /* array has space, find a free item and reuse it */
-        return tssparse_reuse(p_tssparse, object, obj_size, item_size);
+        return tssparse_reuse(p_tssparse, object, obj_size);
     }
 }
 
@@ -99,29 +282,36 @@ int tssparse_add(struct _tssparse_abs *p_tssparse, const void *object,
 /*
  * Remove an item from a tssparse.
  *
- * Receives the tssparse, the index of the item to remove, and the size
- * of items in this array. It is not an error to remove an item which
- * had already been removed. Returns 0 in case of success, non-zero
- * otherwise.
+ * Receives the tssparse and the index of the item to remove. It is not an
+ * error to remove an item which had already been removed. Returns 0 in
+ * case of success, non-zero otherwise.
  */
-int tssparse_remove(struct _tssparse_abs *p_tssparse, int index,
-        size_t item_size)
+int tssparse_remove(struct _tssparse_abs *p_tssparse, long index)
 {
-    struct _item_abs *item;
-
     /* XXX: Do we want to shrink the array? Good because it saves memory;
      * bad because it changes the indexes for objects. Perhaps create a
      * separate operation to explicitly compact the array. */
 
-    if (index >= p_tssparse->len)
+    if (unlikely(index < 0 || index >= p_tssparse->len))
         return TSSPARSE_EINVAL;
 
-    item = get_nth_item(p_tssparse->items, index, item_size);
-
-    if (item->used)
+    if (tssparse_is_used(p_tssparse->used_map, index))
     {
-        item->used = 0;
+        mark_free(p_tssparse, index);
         p_tssparse->used_count--;
+
+        /* invalidate any handles to the removed object */
+        if (p_tssparse->generations != NULL)
+            p_tssparse->generations[index]++;
+
+        /* a bitmap word just emptied; its region may be all empty now */
+        if (unlikely(p_tssparse->release_size != 0)
+                && p_tssparse->used_map[TSSPARSE_MAP_WORD(index)] == 0)
+        {
+            const long start = index & ~(long)(TSSPARSE_MAP_BITS - 1);
+
+            release_range(p_tssparse, start, start + TSSPARSE_MAP_BITS);
+        }
     }
 
     return 0;
@@ -130,335 +320,2560 @@ int tssparse_remove(struct _tssparse_abs *p_tssparse, int index,
 
 
 /*
- * Set a tssparse's minimum length.
+ * Add several objects to a tssparse at once.
  *
- * If the specified minimum length is greater than the current length, the
- * array is grown accordingly. Returns 0 in case of success, non-zero
- * otherwise.
+ * Receives the tssparse, an array of count objects, where to store the
+ * index of each new item (may be NULL), and the object size for this
+ * array. The objects go to the same items that count calls to
+ * tssparse_add would have used, lowest free items first, but the array
+ * grows at most once, and free items are taken a bitmap word at a time.
+ *
+ * Returns 0 in case of success, non-zero otherwise. In case of error,
+ * nothing is added.
  */
-int tssparse_setminlen(struct _tssparse_abs *p_tssparse, int min_len,
-        size_t item_size)
+int tssparse_add_n(struct _tssparse_abs *p_tssparse, const void *objects,
+        long count, long *indices, size_t obj_size)
 {
-    if (unlikely(min_len < 0))
+    const char *object = objects;
+    const long hole_count = p_tssparse->len - p_tssparse->used_count;
+    long added = 0;
+
+    if (unlikely(count < 0))
         return TSSPARSE_EINVAL;
 
-    if (min_len <= p_tssparse->len)
-        p_tssparse->min_len = min_len;
-    else
-    {   /* minimum length greater than current length; we must grow */
-        int retval = tssparse_truncate(p_tssparse, min_len, item_size);
+    if (count > hole_count)
+    {   /* grow just enough for the rest */
+        int retval;
+
+        if (unlikely(!can_long_add(p_tssparse->len, count - hole_count)))
+            return TSSPARSE_EOVERFLOW;
 
+        retval = tssparse_truncate(p_tssparse,
+                                   p_tssparse->len + count - hole_count,
+                                   obj_size);
         if (unlikely(retval != 0))
             return retval;
+    }
 
-        p_tssparse->min_len = min_len;
+    while (added < count)
+    {
+        const long first = find_free_item(p_tssparse);
+        const size_t w = TSSPARSE_MAP_WORD(first);
+        const long base = first - (long)TSSPARSE_MAP_BIT(first);
+        uint64_t bits = ~p_tssparse->used_map[w];
+        uint64_t claimed = 0;
+
+        /* the bitmap is clear beyond len, but those aren't items yet */
+        if (base + TSSPARSE_MAP_BITS > p_tssparse->len)
+            bits &= MAP_WORD_FULL
+                    >> (TSSPARSE_MAP_BITS - (p_tssparse->len - base));
+
+        for (; bits != 0 && added < count; bits &= bits - 1)
+        {
+            const long index = base + ctz64(bits);
+
+            memcpy(get_nth_item(p_tssparse, index, obj_size),
+                   object + (size_t)added * obj_size, obj_size);
+            claimed |= bits & -bits;    /* lowest set bit */
+
+            if (indices != NULL)
+                indices[added] = index;
+
+            added++;
+        }
+
+        p_tssparse->used_map[w] |= claimed;
+        if (p_tssparse->used_map[w] == MAP_WORD_FULL)
+            mark_word_full(p_tssparse, w);
     }
 
+    p_tssparse->used_count += count;
+
     return 0;
 }
 
 
 
 /*
- * Compact a tssparse, removing all empty items.
- *
- * Removes all empty items ("holes") from a tssparse, by rearranging it so
- * all its used items are consecutive, then shrinking it to minimum size.
- * Items are guaranteed to remain in the same order.
+ * Add a group of objects to adjacent items of a tssparse.
  *
- * If the tssparse has too few empty items to be worth the work, nothing is
- * done; unless the force flag is non-zero, in which case will be compacted
- * anyway.
+ * Receives the tssparse, an array of count objects, and the object size
+ * for this array. Looks for the lowest run of count adjacent free items,
+ * going through the occupancy bitmap a word at a time. If there is none,
+ * the free items at the end of the array (if any) are extended with new
+ * ones.
  *
- * Returns 0 in case of success, non-zero otherwise.
+ * Returns the index of the first item in case of success, or a negative
+ * error value in case of error. The rest of the objects are at the
+ * indices that follow it.
  */
-int tssparse_compact(struct _tssparse_abs *p_tssparse, int force,
-        size_t obj_size, size_t item_size)
+long tssparse_add_range(struct _tssparse_abs *p_tssparse, const void *objects,
+        long count, size_t obj_size)
 {
-    int hole_count;
-    int hole_pct;
+    const char *object = objects;
+    const long len = p_tssparse->len;
+    long first = len;
+    long i;
 
-    assert(p_tssparse->len >= 0);
-    assert(p_tssparse->used_count >= 0);
+    if (unlikely(count <= 0))
+        return TSSPARSE_EINVAL;
 
-    /* skip empty arrays (avoid division by zero below) */
-    if (p_tssparse->len == 0)
-        return 0;
+    if (p_tssparse->used_count < len)
+    {   /* look for a run that fits, from the lowest free item */
+        long pos = find_free_item(p_tssparse);
 
-    hole_count = p_tssparse->len - p_tssparse->used_count;
-    hole_pct = (hole_count * 100) / p_tssparse->len;
+        while (pos < len)
+        {
+            const long end = find_map_bit(p_tssparse->used_map, pos, len, 1);
 
-    assert(hole_count >= 0);
-    assert(p_tssparse->items != NULL);
+            if (end - pos >= count || end == len)
+            {   /* it fits, or it's the last run and can be extended */
+                first = pos;
+                break;
+            }
 
-    if (hole_pct < 10 && (!force || hole_count == 0))
-    {   /* less than 10%: very few or no holes */
-        /* DO NOTHING */
-    }
-    else if (p_tssparse->used_count == 0)
-    {   /* all holes, no used items at all */
-        p_tssparse->len = 0;
-        free(p_tssparse->items);
-        p_tssparse->items = NULL;
+            pos = find_map_bit(p_tssparse->used_map, end, len, 0);
+        }
     }
-    else
-    {   /* enough holes to care, but not all holes */
-        struct _item_abs *items = p_tssparse->items;
-        const int len = p_tssparse->len;
-        int first_hole = INT_MAX;
-        int i;
-        int new_len;
 
-        assert(p_tssparse->used_count < len);
+    if (count > len - first)
+    {   /* extend the last run, or start a new one at the end */
+        int retval;
 
-        /*
-         * Walk the array, looking for a hole. Remember its position.
-         * Keep walking until we find a non-empty item. Move it to the
-         * first hole. Now to the right of the first hole there must be a
-         * hole: either there was a previously existing hole, or the
-         * non-empty item which we just moved (turning it into a hole).
-         */
-        for (i = 0; i < len; i++)
-        {
-            struct _item_abs *item = get_nth_item(items, i, item_size);
-
-            if (!item->used)
-                first_hole = min(first_hole, i);
-            else if (first_hole < i)
-            {   /* non-empty item, and there's a previous hole to fill */
-                set_item(items, first_hole, &item->object, obj_size, item_size);
-                item->used = 0;
-                /* there can only be empty items between first_hole and us;
-                 * either there's another hole, or we're now the first hole */
-                first_hole++;
-            }
-        }
+        if (unlikely(!can_long_add(first, count)))
+            return TSSPARSE_EOVERFLOW;
 
-        /* Non-empty items are now contiguous from the start; first_hole
-         * marks the end of the data. We knew there were holes when we
-         * entered, so first_hole can't be INT_MAX. */
-        assert(first_hole == p_tssparse->used_count);
+        retval = tssparse_truncate(p_tssparse, first + count, obj_size);
+        if (unlikely(retval != 0))
+            return retval;
+    }
 
-        /* make sure we don't shrink below configured minimum */
-        new_len = max(first_hole, p_tssparse->min_len);
-        if (new_len != len)
-        {
-            items = realloc(items, item_size * new_len);
-            if (unlikely(items == NULL))
-                return TSSPARSE_ENOMEM;
+    for (i=0; i<count; i++)
+        memcpy(get_nth_item(p_tssparse, first + i, obj_size),
+               object + (size_t)i * obj_size, obj_size);
 
-            p_tssparse->items = items;
-            p_tssparse->len = new_len;
-        }
-    }
+    set_map_range(p_tssparse->used_map, first, first + count);
+    update_summary(p_tssparse, TSSPARSE_MAP_WORD(first),
+                   map_words(first + count));
+    p_tssparse->used_count += count;
 
-    return 0;
+    return first;
 }
 
 
 
 /*
- * Truncate a tssparse to a specific length.
+ * Remove several items from a tssparse at once.
  *
- * Receives the tssparse, the desired length and the size of items in this
- * array. If the tssparse is larger than the specified size, the extra data
- * is lost. If the tssparse is smaller than the specified size, it is
- * extended, and the extra items are all set to empty.
+ * Receives the tssparse, and an array of count indices of the items to
+ * remove. Works like count calls to tssparse_remove, but all the indices
+ * are checked first: if any is out of range, nothing is removed.
  *
  * Returns 0 in case of success, non-zero otherwise.
  */
-int tssparse_truncate(struct _tssparse_abs *p_tssparse, int len,
-        size_t item_size)
+int tssparse_remove_n(struct _tssparse_abs *p_tssparse, const long *indices,
+        long count)
 {
-    assert(p_tssparse->len >= 0);
-    assert(p_tssparse->min_len >= 0);
+    uint64_t *used_map = p_tssparse->used_map;
+    long removed = 0;
+    long i;
 
-    if (unlikely(len < 0 || len < p_tssparse->min_len))
+    if (unlikely(count < 0))
         return TSSPARSE_EINVAL;
 
-    if (len == p_tssparse->len)
-    {
-        /* truncate to same size, do nothing */
-    }
-    else if (len == 0)
-    {   /* clear the array */
-        if (p_tssparse->items != NULL)
-            free(p_tssparse->items);
+    for (i=0; i<count; i++)
+        if (unlikely(indices[i] < 0 || indices[i] >= p_tssparse->len))
+            return TSSPARSE_EINVAL;
 
-        p_tssparse->len = 0;
-        p_tssparse->used_count = 0;
-        p_tssparse->items = NULL;
-    }
-    else
-    {   /* grow or shrink */
-        void *items = realloc(p_tssparse->items, len * item_size);
+    for (i=0; i<count; i++)
+    {
+        const long index = indices[i];
 
-        if (unlikely(items == NULL))
-            return TSSPARSE_ENOMEM;
+        if (!tssparse_is_used(used_map, index))
+            continue;   /* already empty, or listed twice */
 
-        p_tssparse->items = items;
+        mark_free(p_tssparse, index);
+        removed++;
 
-        if (len > p_tssparse->len)
-        {   /* growing; initialize empty items */
-            int i;
+        if (p_tssparse->generations != NULL)
+            p_tssparse->generations[index]++;
 
-            for (i=p_tssparse->len; i<len; i++)
-            {
-                struct _item_abs *item = get_nth_item(items, i, item_size);
+        if (unlikely(p_tssparse->release_size != 0)
+                && used_map[TSSPARSE_MAP_WORD(index)] == 0)
+        {
+            const long start = index & ~(long)(TSSPARSE_MAP_BITS - 1);
 
-                item->used = 0;
-            }
+            release_range(p_tssparse, start, start + TSSPARSE_MAP_BITS);
         }
-        else
-        {   /* shrinking; update used_count in case we eliminated used items */
-            int used_count = 0;
-            int i;
+    }
 
-            for (i=0; i<len; i++)
-            {
-                const struct _item_abs *item = get_nth_item(items, i, item_size);
+    p_tssparse->used_count -= removed;
 
-                if (item->used)
-                    used_count++;
-            }
+    return 0;
+}
 
-            p_tssparse->used_count = used_count;
-        }
 
-        p_tssparse->len = len;
+
+/*
+ * Add an item to a tssparse, and get a handle to it.
+ *
+ * Receives the tssparse, the object, the object size for this array, and
+ * where to store the handle. Works like tssparse_add, but object must not
+ * be NULL.
+ *
+ * Returns the index of the newly added item in case of success, or a
+ * negative error value in case of error.
+ */
+long tssparse_add_handle(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size, tssparse_handle *handle)
+{
+    long index = tssparse_add(p_tssparse, object, obj_size);
+    int retval;
+
+    if (unlikely(index < 0))
+        return index;
+
+    retval = tssparse_get_handle(p_tssparse, index, handle);
+    if (unlikely(retval != 0))
+    {
+        tssparse_remove(p_tssparse, index);
+        return retval;
     }
 
-    return 0;
+    return index;
 }
 
 
 
 /*
- * Grow a tssparse and add a new item at the end.
+ * Get a handle to a used item in a tssparse.
  *
- * Receives the tssparse, an optional object, the object size for this
- * array, and the size of items in this array. Will grow the array to make
- * space for a new item. If object is non-NULL, it will be copied to the
- * new item.
+ * Receives the tssparse, the index of the item, and where to store the
+ * handle. The first time a handle is requested, the array starts keeping
+ * track of item generations, which requires some memory.
  *
- * Returns the index of the newly added item in case of success, or a
- * negative error value in case of error.
+ * Returns 0 in case of success, or a negative error value in case of
+ * error: TSSPARSE_EINVAL for an index out of range, TSSPARSE_ENOENT for an
+ * empty item, TSSPARSE_EOVERFLOW for an index that doesn't fit in a
+ * handle.
  */
-static int tssparse_append(struct _tssparse_abs *p_tssparse,
-        const void *object, size_t obj_size, size_t item_size)
+int tssparse_get_handle(struct _tssparse_abs *p_tssparse, long index,
+        tssparse_handle *handle)
 {
-    int old_len = p_tssparse->len;
     int retval;
 
-    /*
-     * TODO: This should be public. User should be able to add to the end
-     * of the array, instead of at the first available hole. Problem is,
-     * providing this possibility will limit us to only growing by 1 when
-     * appending (otherwise user can't be expected to know exactly where
-     * the end of the array is). This is actually a problem anyway, if we
-     * want the len field to be of any meaning to the user. We have to
-     * think whether we want to provide meaningful ordering or not.
-     */
+    if (unlikely(index < 0 || index >= p_tssparse->len))
+        return TSSPARSE_EINVAL;
 
-    /* protect from overflowing into negative lengths */
-    if (!can_int_add(old_len, 1))
+    if (unlikely(!tssparse_is_used(p_tssparse->used_map, index)))
+        return TSSPARSE_ENOENT;
+
+    /* the handle only has room for 32 bits of index */
+    if (unlikely((unsigned long)index > UINT32_MAX))
         return TSSPARSE_EOVERFLOW;
 
-    /* XXX: Maybe we should grow in chunks, instead of 1 at a time. */
-    retval = tssparse_truncate(p_tssparse, old_len + 1, item_size);
-    if (retval != 0)
+    retval = ensure_generations(p_tssparse);
+    if (unlikely(retval != 0))
         return retval;
 
-    if (object != NULL)
-    {
-        set_item(p_tssparse->items, old_len, object, obj_size, item_size);
-        p_tssparse->used_count++;
-    }
+    *handle = TSSPARSE_HANDLE_MAKE(index, p_tssparse->generations[index]);
 
-    return old_len;
+    return 0;
 }
 
 
 
 /*
- * Reuse a free item in a tssparse.
+ * Remove an item from a tssparse, given a handle to it.
  *
- * Receives the tssparse, an optional object, the object size for this
- * array, and the size of items in this array. Will find a free item which
- * can be reused. At least one free item MUST already exist. If object is
- * non-NULL, it will be copied to the new item.
+ * Receives the tssparse and the handle. Returns 0 in case of success, or
+ * TSSPARSE_ENOENT if the handle is stale (its object was already removed
+ * or moved).
+ */
+int tssparse_remove_handle(struct _tssparse_abs *p_tssparse,
+        tssparse_handle handle)
+{
+    if (!tssparse_handle_is_valid(p_tssparse->len, p_tssparse->used_map,
+                                  p_tssparse->generations, handle))
+        return TSSPARSE_ENOENT;
+
+    return tssparse_remove(p_tssparse, (long)TSSPARSE_HANDLE_INDEX(handle));
+}
+
+
+
+/*
+ * Set a tssparse's minimum length.
  *
- * Returns the index where the item was stored.
+ * If the specified minimum length is greater than the current length, the
+ * array is grown accordingly. Returns 0 in case of success, non-zero
+ * otherwise.
  */
-static int tssparse_reuse(struct _tssparse_abs *p_tssparse,
-        const void *object, size_t obj_size, size_t item_size)
+int tssparse_setminlen(struct _tssparse_abs *p_tssparse, long min_len,
+        size_t obj_size)
 {
-    int first_free = find_free_item(p_tssparse, item_size);
+    if (unlikely(min_len < 0))
+        return TSSPARSE_EINVAL;
 
-    assert(first_free != TSSPARSE_ENOENT);
-    assert(p_tssparse->used_count < p_tssparse->len);
+    if (min_len <= p_tssparse->len)
+        p_tssparse->min_len = min_len;
+    else
+    {   /* minimum length greater than current length; we must grow */
+        int retval = tssparse_truncate(p_tssparse, min_len, obj_size);
 
-    if (object != NULL)
-    {
-        set_item(p_tssparse->items, first_free, object, obj_size, item_size);
-        p_tssparse->used_count++;
+        if (unlikely(retval != 0))
+            return retval;
+
+        p_tssparse->min_len = min_len;
     }
 
-    return first_free;
+    return 0;
 }
 
 
 
 /*
- * Get the Nth item from a tssparse's abstract item array, given its
- * index and the size of the array's items.
+ * Make a tssparse paged, or contiguous again.
+ *
+ * Receives the tssparse and the page size, as a power of 2 from 1 to
+ * TSSPARSE_MAX_PAGE_SHIFT; or 0 to store the objects contiguously, which
+ * is the default. A paged array keeps its objects in fixed size pages,
+ * allocated as it grows. Objects never move when the array grows, so
+ * pointers to them stay valid, and growing only allocates new pages
+ * instead of copying every object. Getting an object costs an extra
+ * memory access, to find its page. Compacting still moves objects.
+ *
+ * Can only be done while the array has no memory allocated (e.g. after
+ * truncating it to 0). Returns 0 in case of success, non-zero otherwise.
  */
-static inline struct _item_abs *get_nth_item(
-        const struct _item_abs *items, int index, size_t item_size)
+int tssparse_set_paged(struct _tssparse_abs *p_tssparse, int page_shift)
 {
-    /* can't use void for pointer arithmetic, it's an incomplete type
-     * (also, char can alias anything; it's meant for this) */
-    return (struct _item_abs *)((char *)items + (index * item_size));
+    if (unlikely(page_shift < 0 || page_shift > TSSPARSE_MAX_PAGE_SHIFT
+                 || p_tssparse->capacity != 0))
+        return TSSPARSE_EINVAL;
+
+    p_tssparse->page_shift = page_shift;
+
+    return 0;
 }
 
 
 
 /*
- * Set the contents of an item in a tssparse.
+ * Choose whether a tssparse gives the memory of its empty regions back to
+ * the system.
  *
- * Receives the tssparse's abstract item array, the index of the item
- * to set, the object and its size.
+ * Receives the tssparse, whether to release empty regions, and the object
+ * size for this array. When enabled, whenever a region of the array the
+ * size of a system memory page has no used items, its memory is given back
+ * to the system, without moving any objects or changing any indices. The
+ * memory comes back by itself when the region is used again. So the memory
+ * in use follows used_count, rather than the largest len the array ever
+ * had. Regions which are already empty are released right away.
+ *
+ * Removing an item costs a little more, when it empties a whole bitmap
+ * word. Returns 0 in case of success, or TSSPARSE_ENOTSUP if the system
+ * can't release memory this way.
  */
-static void set_item(struct _item_abs *items, int index,
-        const void *object, size_t obj_size, size_t item_size)
+int tssparse_set_release(struct _tssparse_abs *p_tssparse, int release,
+        size_t obj_size)
 {
-    struct _item_abs *item = get_nth_item(items, index, item_size);
+#if CAN_RELEASE
+    p_tssparse->release_size = release ? obj_size : 0;
+
+    if (release)
+        release_range(p_tssparse, 0, p_tssparse->capacity);
+
+    return 0;
+#else
+    (void)obj_size;
 
-    item->used = 1;
-    memcpy(&item->object, object, obj_size);
+    if (release)
+        return TSSPARSE_ENOTSUP;
+
+    p_tssparse->release_size = 0;
+
+    return 0;
+#endif
 }
 
 
 
 /*
- * Find the first free item in an array.
+ * Compact a tssparse, removing all empty items.
+ *
+ * Removes all empty items ("holes") from a tssparse, by rearranging it so
+ * all its used items are consecutive, then shrinking it to minimum size.
+ * Items are guaranteed to remain in the same order.
+ *
+ * If the tssparse has too few empty items to be worth the work (according
+ * to tssparse_compact_default_policy), nothing is done; unless the force
+ * flag is non-zero, in which case will be compacted anyway. This finishes
+ * any step-wise compaction in progress.
  *
- * Returns the item's index or TSSPARSE_ENOENT if no free item was found.
+ * Returns 0 in case of success, non-zero otherwise.
  */
-static int find_free_item(const struct _tssparse_abs *p_tssparse,
-        size_t item_size)
+int tssparse_compact(struct _tssparse_abs *p_tssparse, int force,
+        size_t obj_size)
 {
-    int i;
+    return compact(p_tssparse, force, obj_size, NULL);
+}
+
 
-    for (i = 0; i < p_tssparse->len; i++)
-    {
-        const struct _item_abs *item = get_nth_item(p_tssparse->items,
-                                                             i, item_size);
-        if (!item->used)
-            return i;
-    }
 
-    return TSSPARSE_ENOENT;
+/*
+ * Compact a tssparse, and get a map of where each item went.
+ *
+ * Works like tssparse_compact. Receives an additional remap, which MUST be
+ * an empty tsarray of long. If the tssparse is compacted, remap is filled
+ * with one entry for each of the tssparse's old indices: the item's new
+ * index, or -1 for an empty item. References to the items can then be
+ * fixed up in a single pass. If nothing is done, remap is left empty.
+ *
+ * Returns 0 in case of success, non-zero otherwise. In case of error, the
+ * tssparse is left unchanged, but remap may have been partially filled.
+ */
+int tssparse_compact_remap(struct _tssparse_abs *p_tssparse, int force,
+        size_t obj_size, struct _tsarray_pub *remap)
+{
+    if (unlikely(tsarray_len(remap) != 0))
+        return TSSPARSE_EINVAL;
+
+    return compact(p_tssparse, force, obj_size, remap);
+}
+
+
+
+/*
+ * Compact a tssparse, optionally filling in a remap. See
+ * tssparse_compact_remap.
+ */
+static int compact(struct _tssparse_abs *p_tssparse, int force,
+        size_t obj_size, struct _tsarray_pub *remap)
+{
+    long hole_count;
+    int retval;
+
+    assert(p_tssparse->len >= 0);
+    assert(p_tssparse->used_count >= 0);
+
+    /* skip empty arrays (avoid division by zero below) */
+    if (p_tssparse->len == 0)
+        return 0;
+
+    hole_count = p_tssparse->len - p_tssparse->used_count;
+
+    assert(hole_count >= 0);
+    assert(p_tssparse->items != NULL || p_tssparse->pages != NULL);
+
+    /* very few or no holes */
+    if (hole_count == 0 || (!force && !tssparse_compact_default_policy(
+                    p_tssparse->len, p_tssparse->used_count, NULL)))
+        return 0;
+
+    if (remap != NULL)
+    {   /* build the map before moving anything, so a failure leaves the
+         * array as it was */
+        retval = build_remap(p_tssparse, remap);
+        if (unlikely(retval != 0))
+            return retval;
+    }
+
+    /* we'll do all the work here */
+    p_tssparse->compacting = 0;
+
+    if (p_tssparse->used_count == 0)
+    {   /* all holes, no used items at all */
+        retire_generations(p_tssparse, 0, p_tssparse->len);
+        free(p_tssparse->generations);
+        p_tssparse->generations = NULL;
+        p_tssparse->len = 0;
+        free_items(p_tssparse);
+        p_tssparse->capacity = 0;
+        free(p_tssparse->used_map);
+        p_tssparse->used_map = NULL;
+        free(p_tssparse->free_summary);
+        p_tssparse->free_summary = NULL;
+    }
+    else
+    {   /* enough holes to care, but not all holes */
+        const uint64_t *used_map = p_tssparse->used_map;
+        uint32_t *generations = p_tssparse->generations;
+        const long len = p_tssparse->len;
+        const size_t words = map_words(len);
+        long first_hole = 0;
+        size_t w;
+        long new_len;
+
+        assert(p_tssparse->used_count < len);
+
+        /*
+         * Walk the used items, a bitmap word at a time, and move each one
+         * to the first hole. Everything before the first hole is used, so
+         * moving an item there keeps them in the same order. Words that
+         * are full and already in place are skipped as a whole. Handles to
+         * moved items become stale.
+         */
+        for (w = 0; w < words; w++)
+        {
+            uint64_t bits = used_map[w];
+            const long base = (long)(w * TSSPARSE_MAP_BITS);
+
+            if (bits == MAP_WORD_FULL && first_hole == base)
+            {   /* dense region, nothing to move */
+                first_hole += TSSPARSE_MAP_BITS;
+                continue;
+            }
+
+            while (bits != 0)
+            {
+                const long i = base + ctz64(bits);
+
+                if (first_hole < i)
+                {
+                    memcpy(get_nth_item(p_tssparse, first_hole, obj_size),
+                           get_nth_item(p_tssparse, i, obj_size), obj_size);
+
+                    if (generations != NULL)
+                        generations[i]++;
+                }
+
+                first_hole++;
+                bits &= bits - 1;   /* clear lowest set bit */
+            }
+        }
+
+        /* Non-empty items are now contiguous from the start; first_hole
+         * marks the end of the data. */
+        assert(first_hole == p_tssparse->used_count);
+
+        /* the only holes left are at the end, beyond the used items */
+        fill_map_prefix(p_tssparse->used_map, first_hole, len);
+        update_summary(p_tssparse, 0, map_words(p_tssparse->capacity));
+
+        /* make sure we don't shrink below configured minimum */
+        new_len = max(first_hole, p_tssparse->min_len);
+        retire_generations(p_tssparse, new_len, len);
+        p_tssparse->len = new_len;
+
+        /* shrink to minimum size; even if this fails, the array is still
+         * consistent (just larger than it needs to be) */
+        retval = resize_capacity(p_tssparse, new_len, obj_size);
+
+        if (p_tssparse->release_size != 0)
+            release_range(p_tssparse, first_hole, len);
+
+        return retval;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Decide whether a tssparse is worth compacting.
+ *
+ * Receives the tssparse's len and used_count; arg is ignored. Returns true
+ * if at least 10% of the items are empty.
+ */
+int tssparse_compact_default_policy(long len, long used_count, void *arg)
+{
+    const long hole_count = len - used_count;
+
+    (void)arg;
+
+    /* hole_count >= len/10, rounded up, without overflowing */
+    return hole_count > 0 && hole_count > (len - 1) / 10;
+}
+
+
+
+/*
+ * Compact a tssparse a few steps at a time.
+ *
+ * Receives the tssparse, the maximum number of steps to take, optional
+ * hooks (see struct tssparse_compact_ops), and the object size for this
+ * array. Each step moves the last used item to the lowest hole, or cuts
+ * an empty item off the end. This doesn't preserve the order of the items,
+ * but each call does a bounded amount of work, and the array remains
+ * fully usable between calls. Handles to moved items become stale.
+ *
+ * The first call decides whether to start compacting, by asking the
+ * should_compact hook. Later calls carry on from where the previous one
+ * stopped. Compaction stops at the minimum length, and is finished early
+ * by tssparse_compact or by truncating to 0.
+ *
+ * Returns 1 if there is more work to do, 0 if compaction is finished (or
+ * was not needed), or a negative error value in case of error.
+ */
+int tssparse_compact_step(struct _tssparse_abs *p_tssparse, int max_moves,
+        const struct tssparse_compact_ops *ops, size_t obj_size)
+{
+    int (*should_compact)(long, long, void *) = tssparse_compact_default_policy;
+    void (*moved)(long, long, void *) = NULL;
+    void (*will_move)(long, long, void *) = NULL;
+    void *arg = NULL;
+    const long old_len = p_tssparse->len;
+    long moves = 0;
+
+    if (unlikely(max_moves <= 0))
+        return TSSPARSE_EINVAL;
+
+    if (ops != NULL)
+    {
+        if (ops->should_compact != NULL)
+            should_compact = ops->should_compact;
+
+        moved = ops->moved;
+        will_move = ops->will_move;
+        arg = ops->arg;
+    }
+
+    if (!p_tssparse->compacting)
+    {   /* not started yet */
+        if (p_tssparse->used_count == p_tssparse->len
+                || p_tssparse->len <= p_tssparse->min_len
+                || !should_compact(p_tssparse->len, p_tssparse->used_count,
+                                   arg))
+            return 0;
+
+        p_tssparse->compacting = 1;
+    }
+
+    while (moves < max_moves)
+    {
+        const long last = p_tssparse->len - 1;
+
+        if (p_tssparse->used_count == p_tssparse->len
+                || p_tssparse->len <= p_tssparse->min_len)
+            break;
+
+        if (tssparse_is_used(p_tssparse->used_map, last))
+        {   /* there's a hole, and it must be below the last item */
+            const long hole = find_free_item(p_tssparse);
+
+            assert(hole < last);
+
+            if (will_move != NULL)
+                will_move(last, hole, arg);
+
+            memcpy(get_nth_item(p_tssparse, hole, obj_size),
+                   get_nth_item(p_tssparse, last, obj_size), obj_size);
+
+            mark_used(p_tssparse, hole);
+            mark_free(p_tssparse, last);
+
+            if (p_tssparse->generations != NULL)
+                p_tssparse->generations[last]++;
+
+            if (moved != NULL)
+                moved(last, hole, arg);
+        }
+
+        /* the last item is empty now, just cut it off */
+        retire_generations(p_tssparse, last, last + 1);
+        p_tssparse->len = last;
+        moves++;
+    }
+
+    if (p_tssparse->release_size != 0)
+        release_range(p_tssparse, p_tssparse->len, old_len);
+
+    if (moves < max_moves)
+    {   /* nothing left to do */
+        p_tssparse->compacting = 0;
+
+        /* even if this fails, the array is still consistent (just larger
+         * than it needs to be) */
+        resize_capacity(p_tssparse,
+                        calc_new_capacity(p_tssparse->capacity,
+                                          p_tssparse->len), obj_size);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * Truncate a tssparse to a specific length.
+ *
+ * Receives the tssparse, the desired length and the object size for this
+ * array. If the tssparse is larger than the specified size, the extra data
+ * is lost. If the tssparse is smaller than the specified size, it is
+ * extended, and the extra items are all set to empty.
+ *
+ * Returns 0 in case of success, non-zero otherwise.
+ */
+int tssparse_truncate(struct _tssparse_abs *p_tssparse, long len,
+        size_t obj_size)
+{
+    assert(p_tssparse->len >= 0);
+    assert(p_tssparse->min_len >= 0);
+
+    if (unlikely(len < 0 || len < p_tssparse->min_len))
+        return TSSPARSE_EINVAL;
+
+    if (len == p_tssparse->len)
+    {
+        /* truncate to same size, do nothing */
+    }
+    else if (len == 0)
+    {   /* clear the array */
+        p_tssparse->compacting = 0;
+        retire_generations(p_tssparse, 0, p_tssparse->len);
+
+        free_items(p_tssparse);
+
+        if (p_tssparse->generations != NULL)
+            free(p_tssparse->generations);
+
+        if (p_tssparse->used_map != NULL)
+            free(p_tssparse->used_map);
+
+        if (p_tssparse->free_summary != NULL)
+            free(p_tssparse->free_summary);
+
+        p_tssparse->len = 0;
+        p_tssparse->used_count = 0;
+        p_tssparse->capacity = 0;
+        p_tssparse->used_map = NULL;
+        p_tssparse->free_summary = NULL;
+        p_tssparse->generations = NULL;
+    }
+    else if (len > p_tssparse->len)
+    {   /* growing; new items are already marked empty in the bitmap, and
+         * the free summary covers the whole capacity */
+        const long old_len = p_tssparse->len;
+        const long new_capacity = calc_new_capacity(p_tssparse->capacity, len);
+        int retval;
+        long i;
+
+        retval = resize_capacity(p_tssparse, new_capacity, obj_size);
+        if (unlikely(retval != 0))
+            return retval;
+
+        if (p_tssparse->generations != NULL)
+        {
+            for (i=old_len; i<len; i++)
+                p_tssparse->generations[i] = p_tssparse->gen_floor;
+        }
+
+        p_tssparse->len = len;
+    }
+    else
+    {   /* shrinking; keep everything beyond len marked as empty, and
+         * update used_count in case we eliminated used items */
+        const long new_capacity = calc_new_capacity(p_tssparse->capacity, len);
+        const long old_len = p_tssparse->len;
+        int retval;
+
+        p_tssparse->used_count -= clear_map_range(p_tssparse->used_map, len,
+                                                  p_tssparse->len);
+        update_summary(p_tssparse, TSSPARSE_MAP_WORD(len),
+                       map_words(p_tssparse->len));
+        retire_generations(p_tssparse, len, p_tssparse->len);
+        p_tssparse->len = len;
+
+        /* even if this fails, the array is still consistent (just larger
+         * than it needs to be) */
+        retval = resize_capacity(p_tssparse, new_capacity, obj_size);
+
+        if (p_tssparse->release_size != 0)
+            release_range(p_tssparse, len, old_len);
+
+        return retval;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Find where the next object added to a tssparse will go.
+ *
+ * Receives the tssparse, and where to store whether adding it will
+ * reallocate the array (which may be stored as true when it won't, but
+ * never the other way around). Returns the index tssparse_add would give
+ * the object: the lowest empty item, or len if there is none.
+ */
+long tssparse_next_free(const struct _tssparse_abs *p_tssparse, int *resizes)
+{
+    const long len = p_tssparse->len;
+
+    if (p_tssparse->used_count < len)
+    {
+        *resizes = 0;
+        return find_free_item(p_tssparse);
+    }
+
+    *resizes = calc_new_capacity(p_tssparse->capacity, len + 1)
+               != p_tssparse->capacity;
+
+    return len;
+}
+
+
+
+/*
+ * Find the next used item in a tssparse.
+ *
+ * Receives the tssparse, the index from which to start looking, and the
+ * object size for this array. Empty items are skipped a bitmap word at a
+ * time. The following used item, if it's near, is prefetched, so that it
+ * will already be in cache when the caller gets to it.
+ *
+ * Returns the index of the first used item at or after from, or
+ * TSSPARSE_ENOENT if there is none.
+ */
+long tssparse_next(const struct _tssparse_abs *p_tssparse, long from,
+        size_t obj_size)
+{
+    const uint64_t *used_map = p_tssparse->used_map;
+    const size_t words = map_words(p_tssparse->len);
+    size_t w;
+    uint64_t bits;
+
+    if (unlikely(from < 0))
+        from = 0;
+
+    if (from >= p_tssparse->len)
+        return TSSPARSE_ENOENT;
+
+    /* ignore the items before from, in the first word */
+    w = TSSPARSE_MAP_WORD(from);
+    bits = used_map[w] & ~(TSSPARSE_MAP_MASK(from) - 1);
+
+    while (bits == 0)
+    {
+        /* bits beyond len are always clear; no need to check the end of
+         * the last word */
+        if (++w == words)
+            return TSSPARSE_ENOENT;
+
+        bits = used_map[w];
+    }
+
+    {
+        const long index = (long)(w * TSSPARSE_MAP_BITS) + ctz64(bits);
+        const uint64_t rest = bits & (bits - 1);
+
+        if (rest != 0)
+        {
+            const long next = (long)(w * TSSPARSE_MAP_BITS) + ctz64(rest);
+
+            prefetch(get_nth_item(p_tssparse, next, obj_size));
+        }
+
+        return index;
+    }
+}
+
+
+
+/*
+ * Find several used items in a tssparse, at once.
+ *
+ * Receives the tssparse, the index from which to start looking, a buffer
+ * to store indices in, and the buffer's size. Fills the buffer with the
+ * indices of the used items at or after from, in increasing order, until
+ * the buffer is full or the array ends. To continue, call again with from
+ * set to the last returned index + 1.
+ *
+ * Returns the number of indices stored, which is 0 if there are no more
+ * used items, or a negative error value in case of error.
+ */
+int tssparse_next_batch(const struct _tssparse_abs *p_tssparse, long from,
+        long *indices, int count)
+{
+    const uint64_t *used_map = p_tssparse->used_map;
+    const size_t words = map_words(p_tssparse->len);
+    int found = 0;
+    size_t w;
+    uint64_t bits;
+
+    if (unlikely(count < 0))
+        return TSSPARSE_EINVAL;
+
+    if (unlikely(from < 0))
+        from = 0;
+
+    if (from >= p_tssparse->len || count == 0)
+        return 0;
+
+    w = TSSPARSE_MAP_WORD(from);
+    bits = used_map[w] & ~(TSSPARSE_MAP_MASK(from) - 1);
+
+    for (;;)
+    {
+        const long base = (long)(w * TSSPARSE_MAP_BITS);
+
+        for (; bits != 0; bits &= bits - 1)
+        {
+            indices[found++] = base + ctz64(bits);
+
+            if (found == count)
+                return found;
+        }
+
+        if (++w == words)
+            return found;
+
+        bits = used_map[w];
+    }
+    /* UNREACHABLE */
+}
+
+
+
+/*
+ * Get memory and fragmentation statistics of a tssparse.
+ *
+ * Receives the tssparse, where to store the statistics, and the object
+ * size for this array. Goes through the whole occupancy bitmap, a word at
+ * a time, to find the runs of empty items.
+ */
+void tssparse_get_stats(const struct _tssparse_abs *p_tssparse,
+        struct tssparse_stats *stats, size_t obj_size)
+{
+    const uint64_t *used_map = p_tssparse->used_map;
+    const long len = p_tssparse->len;
+    const int has_generations = p_tssparse->generations != NULL;
+    long pos = 0;
+    int k;
+
+    stats->len = len;
+    stats->used_count = p_tssparse->used_count;
+    stats->capacity = p_tssparse->capacity;
+    stats->hole_count = len - p_tssparse->used_count;
+    stats->hole_runs = 0;
+    stats->longest_run = 0;
+
+    for (k=0; k<TSSPARSE_STATS_RUN_BUCKETS; k++)
+        stats->run_histogram[k] = 0;
+
+    while (used_map != NULL
+           && (pos = find_map_bit(used_map, pos, len, 0)) < len)
+    {
+        const long end = find_map_bit(used_map, pos, len, 1);
+        const long run = end - pos;
+
+        k = 63 - clz64((uint64_t)run);
+        stats->run_histogram[min(k, TSSPARSE_STATS_RUN_BUCKETS - 1)]++;
+        stats->longest_run = max(stats->longest_run, run);
+        stats->hole_runs++;
+
+        pos = end;
+    }
+
+    stats->item_bytes = (size_t)p_tssparse->capacity * obj_size;
+    stats->overhead_bytes = calc_overhead(p_tssparse->capacity,
+                                          p_tssparse->page_shift,
+                                          has_generations);
+    stats->reclaimable_bytes = 0;
+
+    if (stats->hole_count != 0)
+    {   /* same as compact(): all the way to 0, or down to used_count */
+        long target = p_tssparse->used_count == 0
+            ? 0 : max(p_tssparse->used_count, p_tssparse->min_len);
+
+        if (p_tssparse->page_shift != 0)
+        {
+            const long page_mask = (1L << p_tssparse->page_shift) - 1;
+
+            target = (target + page_mask) & ~page_mask;
+        }
+
+        if (target < p_tssparse->capacity)
+            stats->reclaimable_bytes =
+                (size_t)(p_tssparse->capacity - target) * obj_size
+                + stats->overhead_bytes
+                - calc_overhead(target, p_tssparse->page_shift,
+                                has_generations && target != 0);
+    }
+}
+
+
+
+/*
+ * Save a snapshot of a tssparse to a file.
+ *
+ * Receives the tssparse, a file descriptor open for writing, flags, and
+ * the object size for this array. Writes a header, the occupancy bitmap
+ * and the items, starting at the file's current position, and ends with a
+ * checksum of it all. Everything is written in a single pass, so fd may be
+ * a pipe or a socket. Several snapshots may follow each other in a file.
+ *
+ * Indices are preserved: tssparse_load or tssparse_map bring back every
+ * object at the index it had. Empty items are saved as zeros. With
+ * TSSPARSE_SAVE_COMPACT in flags, the holes are left out instead, as if
+ * the array had been compacted first (without going below min_len); the
+ * array itself is not changed.
+ *
+ * Objects are saved as they are in memory; pointers inside them won't
+ * mean anything once loaded, and a snapshot can only be loaded on
+ * machines with the same byte order. Handles are not saved.
+ *
+ * Returns 0 in case of success, non-zero otherwise. In case of
+ * TSSPARSE_EIO, errno tells what went wrong; part of the snapshot may have
+ * been written.
+ */
+int tssparse_save(const struct _tssparse_abs *p_tssparse, int fd, int flags,
+        size_t obj_size)
+{
+    const int compact = (flags & TSSPARSE_SAVE_COMPACT) != 0;
+    const long len = p_tssparse->len;
+    const long used_count = p_tssparse->used_count;
+    /* compacting stops at min_len (which len may still be below) */
+    const long saved_len = compact
+        ? min(max(used_count, p_tssparse->min_len), len) : len;
+    const size_t words = map_words(saved_len);
+    struct snapshot_header header;
+    struct snapshot_writer writer;
+    long pos = 0;
+
+    if (unlikely((flags & ~TSSPARSE_SAVE_COMPACT) != 0))
+        return TSSPARSE_EINVAL;
+
+    writer.fd = fd;
+    writer.error = 0;
+    writer.hash = FILEIO_HASH_INIT;
+    writer.used = 0;
+    writer.buf = malloc(SNAPSHOT_BUFFER_SIZE);
+
+    if (unlikely(writer.buf == NULL))
+        return TSSPARSE_ENOMEM;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = FILEIO_BYTE_ORDER;
+    header.obj_size = obj_size;
+    header.len = (uint64_t)saved_len;
+    header.used_count = (uint64_t)used_count;
+
+    writer_put(&writer, &header, sizeof(header));
+
+    if (compact)
+    {   /* the used items all go to the start, and any empty ones kept to
+         * make up min_len after them */
+        const size_t full_words = TSSPARSE_MAP_WORD(used_count);
+        size_t w;
+
+        for (w = 0; w < words; w++)
+        {
+            uint64_t word = 0;
+
+            if (w < full_words)
+                word = MAP_WORD_FULL;
+            else if (w == full_words)
+                word = TSSPARSE_MAP_MASK(used_count) - 1;
+
+            writer_put(&writer, &word, sizeof(word));
+        }
+    }
+    else
+        writer_put(&writer, p_tssparse->used_map, words * sizeof(uint64_t));
+
+    writer_zero(&writer, snapshot_items_offset(words)
+                         - sizeof(header) - words * sizeof(uint64_t));
+
+    /* the items go a run at a time, used ones straight from the array */
+    while (pos < len)
+    {
+        const long used_end = find_map_bit(p_tssparse->used_map, pos, len, 0);
+        const long hole_end = find_map_bit(p_tssparse->used_map, used_end,
+                                           len, 1);
+
+        put_items(&writer, p_tssparse, pos, used_end, obj_size);
+
+        if (!compact)
+            writer_zero(&writer, (size_t)(hole_end - used_end) * obj_size);
+
+        pos = hole_end;
+    }
+
+    if (compact)
+        writer_zero(&writer, (size_t)(saved_len - used_count) * obj_size);
+
+    writer_flush(&writer);
+    free(writer.buf);
+
+    if (unlikely(writer.error)
+            || unlikely(fileio_write_all(fd, &writer.hash,
+                                         sizeof(writer.hash)) != 0))
+        return TSSPARSE_EIO;
+
+    return 0;
+}
+
+
+
+/*
+ * Load a snapshot of a tssparse from a file.
+ *
+ * Receives an empty tssparse with no memory allocated (e.g. just
+ * initialized, or truncated to 0), a file descriptor open for reading and
+ * positioned at a snapshot saved by tssparse_save, and the object size for
+ * this array. Reads the snapshot into the array, leaving every object at
+ * its saved index, and the file positioned right after the snapshot. The
+ * array may be set to be paged or to release memory beforehand; a paged
+ * array is filled a page at a time.
+ *
+ * The whole snapshot is checked against its checksum. Returns 0 in case
+ * of success, non-zero otherwise: TSSPARSE_EIO if the file couldn't be
+ * read (errno tells why), TSSPARSE_EINVAL if it isn't a snapshot of this
+ * object size and byte order, or is corrupt. In case of error, the array
+ * is left empty.
+ */
+int tssparse_load(struct _tssparse_abs *p_tssparse, int fd, size_t obj_size)
+{
+    struct snapshot_header header;
+    uint64_t hash = FILEIO_HASH_INIT;
+    uint64_t checksum;
+    char padding[SNAPSHOT_ALIGN];
+    size_t words;
+    long len, i;
+    int retval;
+
+    if (unlikely(p_tssparse->capacity != 0))
+        return TSSPARSE_EINVAL;
+
+    if (unlikely(read_hashed(fd, &header, sizeof(header), &hash) != 0))
+        return TSSPARSE_EIO;
+
+    retval = check_snapshot_header(&header, obj_size);
+    if (unlikely(retval != 0))
+        return retval;
+
+    len = (long)header.len;
+    words = map_words(len);
+
+    retval = tssparse_truncate(p_tssparse, len, obj_size);
+    if (unlikely(retval != 0))
+        return retval;
+
+    if (unlikely(read_hashed(fd, p_tssparse->used_map,
+                             words * sizeof(uint64_t), &hash) != 0))
+        goto io_error;
+
+    if (unlikely(!snapshot_map_is_valid(p_tssparse->used_map, len,
+                                        (long)header.used_count)))
+        goto bad_snapshot;
+
+    p_tssparse->used_count = (long)header.used_count;
+    update_summary(p_tssparse, 0, words);
+
+    if (unlikely(read_hashed(fd, padding, snapshot_items_offset(words)
+                             - sizeof(header) - words * sizeof(uint64_t),
+                             &hash) != 0))
+        goto io_error;
+
+    if (p_tssparse->page_shift != 0)
+    {
+        const long page_len = 1L << p_tssparse->page_shift;
+
+        for (i = 0; i < len; i += page_len)
+        {
+            if (unlikely(read_hashed(fd, get_nth_item(p_tssparse, i, obj_size),
+                                     (size_t)min(page_len, len - i) * obj_size,
+                                     &hash) != 0))
+                goto io_error;
+        }
+    }
+    else if (unlikely(read_hashed(fd, p_tssparse->items,
+                                  (size_t)len * obj_size, &hash) != 0))
+        goto io_error;
+
+    if (unlikely(fileio_read_all(fd, &checksum, sizeof(checksum)) != 0))
+        goto io_error;
+
+    if (unlikely(checksum != hash))
+        goto bad_snapshot;
+
+    if (p_tssparse->release_size != 0)
+        release_range(p_tssparse, 0, len);
+
+    return 0;
+
+io_error:
+    retval = TSSPARSE_EIO;
+    goto out;
+
+bad_snapshot:
+    retval = TSSPARSE_EINVAL;
+
+out:
+    tssparse_truncate(p_tssparse, 0, obj_size);
+
+    return retval;
+}
+
+
+
+/*
+ * Load a snapshot of a tssparse by mapping its file into memory.
+ *
+ * Receives an empty, non-paged tssparse with no memory allocated, the
+ * path of a file which starts with a snapshot saved by tssparse_save, and
+ * the object size for this array. Maps the file, and uses its occupancy
+ * bitmap and items where they are: nothing is read until it is accessed,
+ * and only the free summary is built (from the bitmap). Processes mapping
+ * the same file share its pages until they change them.
+ *
+ * The mapping is private: changes to the array never reach the file. Items
+ * may be added (into holes) and removed in place, which copies just the
+ * pages they change. Anything that changes the capacity (e.g. growing or
+ * compacting the array) first moves the whole array to ordinary memory.
+ * Truncating the array to 0 unmaps the file.
+ *
+ * Since that would mean reading the whole file, the checksum is NOT
+ * verified; use tssparse_load for files which can't be trusted. The file
+ * must not be truncated while it is mapped.
+ *
+ * Returns 0 in case of success, non-zero otherwise: TSSPARSE_EIO if the
+ * file couldn't be opened or mapped (errno tells why), TSSPARSE_EINVAL if
+ * the array isn't empty or is paged, or the file isn't a snapshot of this
+ * object size and byte order, TSSPARSE_ENOMEM if out of memory, or
+ * TSSPARSE_ENOTSUP on systems without mmap.
+ */
+int tssparse_map(struct _tssparse_abs *p_tssparse, const char *path,
+        size_t obj_size)
+{
+#if CAN_MAP
+    struct summary_layout layout;
+    const struct snapshot_header *header;
+    uint64_t *free_summary = NULL;
+    size_t words, summary_words, offset, size;
+    struct stat st;
+    char *base;
+    long len;
+    int retval;
+    int fd;
+
+    if (unlikely(p_tssparse->capacity != 0 || p_tssparse->page_shift != 0))
+        return TSSPARSE_EINVAL;
+
+    fd = open(path, O_RDONLY);
+    if (unlikely(fd < 0))
+        return TSSPARSE_EIO;
+
+    if (unlikely(fstat(fd, &st) != 0))
+    {
+        close(fd);
+        return TSSPARSE_EIO;
+    }
+
+    if (unlikely((uintmax_t)st.st_size < sizeof(*header)
+                 || (uintmax_t)st.st_size > SIZE_MAX))
+    {
+        close(fd);
+        return TSSPARSE_EINVAL;
+    }
+
+    size = (size_t)st.st_size;
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    /* the mapping holds its own reference to the file */
+    close(fd);
+
+    if (unlikely(base == MAP_FAILED))
+        return TSSPARSE_EIO;
+
+    header = (const struct snapshot_header *)base;
+
+    retval = check_snapshot_header(header, obj_size);
+    if (unlikely(retval != 0))
+        goto out;
+
+    len = (long)header->len;
+    words = map_words(len);
+    offset = snapshot_items_offset(words);
+
+    /* must hold the items and the checksum */
+    if (unlikely(size < offset + sizeof(uint64_t)
+                 || (size - offset - sizeof(uint64_t)) / obj_size
+                    < (size_t)len
+                 || !snapshot_map_is_valid((uint64_t *)(base + sizeof(*header)),
+                                           len, -1)
+                 || header->used_count > header->len))
+    {
+        retval = TSSPARSE_EINVAL;
+        goto out;
+    }
+
+    if (len == 0)
+    {   /* nothing to keep mapped */
+        retval = 0;
+        goto out;
+    }
+
+    summary_words = get_summary_layout(len, &layout);
+
+    if (summary_words > 0)
+    {
+        free_summary = malloc(summary_words * sizeof(uint64_t));
+
+        if (unlikely(free_summary == NULL))
+        {
+            retval = TSSPARSE_ENOMEM;
+            goto out;
+        }
+    }
+
+    p_tssparse->len = len;
+    p_tssparse->used_count = (long)header->used_count;
+    p_tssparse->capacity = len;
+    p_tssparse->items = base + offset;
+    p_tssparse->used_map = (uint64_t *)(base + sizeof(*header));
+    p_tssparse->free_summary = free_summary;
+    p_tssparse->mapping = base;
+    p_tssparse->mapping_size = size;
+
+    update_summary(p_tssparse, 0, words);
+
+    return 0;
+
+out:
+    munmap(base, size);
+
+    return retval;
+#else
+    (void)p_tssparse;
+    (void)path;
+    (void)obj_size;
+
+    return TSSPARSE_ENOTSUP;
+#endif
+}
+
+
+
+/*
+ * Grow a tssparse and add a new item at the end.
+ *
+ * Receives the tssparse, an optional object, and the object size for this
+ * array. Will grow the array to make space for a new item. If object is
+ * non-NULL, it will be copied to the new item.
+ *
+ * Returns the index of the newly added item in case of success, or a
+ * negative error value in case of error.
+ */
+static long tssparse_append(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size)
+{
+    long old_len = p_tssparse->len;
+    int retval;
+
+    /*
+     * TODO: This should be public. User should be able to add to the end
+     * of the array, instead of at the first available hole. Since the
+     * allocated capacity is kept apart from len, which still grows by 1,
+     * the user can know exactly where the end of the array is. We have to
+     * think whether we want to provide meaningful ordering or not.
+     */
+
+    /* protect from overflowing into negative lengths */
+    if (!can_long_add(old_len, 1))
+        return TSSPARSE_EOVERFLOW;
+
+    /* only reallocates when we run out of capacity, which grows by a
+     * ratio of the length; appending is amortized O(1) */
+    retval = tssparse_truncate(p_tssparse, old_len + 1, obj_size);
+    if (retval != 0)
+        return retval;
+
+    /* the item we just created is the only free one; no need to look */
+    assert(p_tssparse->used_count == old_len);
+
+    if (object != NULL)
+    {
+        set_item(p_tssparse, old_len, object, obj_size);
+        p_tssparse->used_count++;
+    }
+
+    return old_len;
+}
+
+
+
+/*
+ * Reuse a free item in a tssparse.
+ *
+ * Receives the tssparse, an optional object, and the object size for this
+ * array. Will take the lowest free item, which keeps the used items packed
+ * towards the start of the array. At least one free item MUST already
+ * exist. If object is non-NULL, it will be copied to the new item;
+ * otherwise, the item is left free.
+ *
+ * Returns the index where the item was stored.
+ */
+static long tssparse_reuse(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size)
+{
+    long free_index;
+
+    assert(p_tssparse->used_count < p_tssparse->len);
+
+    free_index = find_free_item(p_tssparse);
+
+    assert(free_index >= 0 && free_index < p_tssparse->len);
+    assert(!tssparse_is_used(p_tssparse->used_map, free_index));
+
+    if (object != NULL)
+    {
+        set_item(p_tssparse, free_index, object, obj_size);
+        p_tssparse->used_count++;
+    }
+
+    return free_index;
+}
+
+
+
+/*
+ * Get the Nth item from a tssparse's abstract items, given its index and
+ * the size of the array's objects.
+ */
+static inline char *get_nth_item(const struct _tssparse_abs *p_tssparse,
+        long index, size_t obj_size)
+{
+    /* char can alias anything; it's meant for this */
+    return tssparse_item(p_tssparse, index, obj_size);
+}
+
+
+
+/*
+ * Set the contents of an item in a tssparse, and mark it as used.
+ *
+ * Receives the tssparse, the index of the item to set, the object and its
+ * size.
+ */
+static void set_item(struct _tssparse_abs *p_tssparse, long index,
+        const void *object, size_t obj_size)
+{
+    mark_used(p_tssparse, index);
+    memcpy(get_nth_item(p_tssparse, index, obj_size), object, obj_size);
+}
+
+
+
+/*
+ * Get the number of words needed for an occupancy bitmap of nbits items.
+ */
+static inline size_t map_words(long nbits)
+{
+    assert(nbits >= 0);
+
+    return ((size_t)nbits + TSSPARSE_MAP_BITS - 1) / TSSPARSE_MAP_BITS;
+}
+
+
+
+/*
+ * Mark a range of items as empty in an occupancy bitmap.
+ *
+ * The range goes from start (inclusive) to stop (exclusive). Returns the
+ * number of items in the range that were used. The free summary is not
+ * updated.
+ */
+static long clear_map_range(uint64_t *used_map, long start, long stop)
+{
+    long cleared = 0;
+    long i = start;
+
+    /* partial words at the edges are done bit by bit; whole words in the
+     * middle all at once */
+    while (i < stop && TSSPARSE_MAP_BIT(i) != 0)
+    {
+        cleared += tssparse_is_used(used_map, i);
+        used_map[TSSPARSE_MAP_WORD(i)] &= ~TSSPARSE_MAP_MASK(i);
+        i++;
+    }
+
+    for (; i + TSSPARSE_MAP_BITS <= stop; i += TSSPARSE_MAP_BITS)
+    {
+        cleared += popcount64(used_map[TSSPARSE_MAP_WORD(i)]);
+        used_map[TSSPARSE_MAP_WORD(i)] = 0;
+    }
+
+    for (; i < stop; i++)
+    {
+        cleared += tssparse_is_used(used_map, i);
+        used_map[TSSPARSE_MAP_WORD(i)] &= ~TSSPARSE_MAP_MASK(i);
+    }
+
+    return cleared;
+}
+
+
+
+/*
+ * Mark a range of items as used in an occupancy bitmap.
+ *
+ * The range goes from start (inclusive) to stop (exclusive). The free
+ * summary is not updated.
+ */
+static void set_map_range(uint64_t *used_map, long start, long stop)
+{
+    long i = start;
+
+    while (i < stop && TSSPARSE_MAP_BIT(i) != 0)
+    {
+        used_map[TSSPARSE_MAP_WORD(i)] |= TSSPARSE_MAP_MASK(i);
+        i++;
+    }
+
+    for (; i + TSSPARSE_MAP_BITS <= stop; i += TSSPARSE_MAP_BITS)
+        used_map[TSSPARSE_MAP_WORD(i)] = MAP_WORD_FULL;
+
+    for (; i < stop; i++)
+        used_map[TSSPARSE_MAP_WORD(i)] |= TSSPARSE_MAP_MASK(i);
+}
+
+
+
+/*
+ * Find the first item at or after from which is used (or empty, if used is
+ * false) in an occupancy bitmap.
+ *
+ * Looks a word at a time, up to stop (exclusive). Returns the index of the
+ * item found, or stop if there is none.
+ */
+static long find_map_bit(const uint64_t *used_map, long from, long stop,
+        int used)
+{
+    const uint64_t flip = used ? 0 : MAP_WORD_FULL;
+    const size_t words = map_words(stop);
+    size_t w = TSSPARSE_MAP_WORD(from);
+    uint64_t bits;
+
+    if (from >= stop)
+        return stop;
+
+    /* ignore the items before from, in the first word */
+    bits = (used_map[w] ^ flip) & (MAP_WORD_FULL << TSSPARSE_MAP_BIT(from));
+
+    while (bits == 0)
+    {
+        if (++w >= words)
+            return stop;
+
+        bits = used_map[w] ^ flip;
+    }
+
+    return min((long)(w * TSSPARSE_MAP_BITS) + ctz64(bits), stop);
+}
+
+
+
+/*
+ * Set an occupancy bitmap to have only its first count items used.
+ *
+ * Receives the bitmap, the count of used items and the array's length.
+ * Items from count up to len are marked as empty. The free summary is not
+ * updated.
+ */
+static void fill_map_prefix(uint64_t *used_map, long count, long len)
+{
+    const size_t full_words = (size_t)count / TSSPARSE_MAP_BITS;
+    const size_t words = map_words(len);
+    size_t w;
+
+    assert(count <= len);
+
+    for (w = 0; w < full_words; w++)
+        used_map[w] = MAP_WORD_FULL;
+
+    if (full_words < words)
+    {
+        const int rest = TSSPARSE_MAP_BIT(count);
+
+        used_map[full_words] = rest ? TSSPARSE_MAP_MASK(rest) - 1 : 0;
+
+        for (w = full_words + 1; w < words; w++)
+            used_map[w] = 0;
+    }
+}
+
+
+
+/*
+ * Calculate the new capacity for a tssparse of a given new length.
+ *
+ * Receives the old capacity and the desired new length. Returns the
+ * appropriate new capacity, which is always >= new_len.
+ */
+static long calc_new_capacity(long old_capacity, long new_len)
+{
+    long margin;
+
+    assert(new_len >= 0);
+
+    /* Don't change capacity if new_len is within the hysteresis range
+     * (i.e. there is still free space, and not too much). This avoids
+     * overreacting to multiple append/remove patterns. */
+    if (new_len <= old_capacity && new_len >= old_capacity/MIN_USAGE_RATIO)
+        return old_capacity;
+
+    /* can never overflow, new_len is non-negative */
+    margin = new_len/MARGIN_RATIO + MIN_MARGIN;
+
+    /* if the margin makes us overflow, don't use it */
+    if (unlikely(!can_long_add(new_len, margin)))
+        margin = 0;
+
+    return new_len + margin;
+}
+
+
+
+/*
+ * Resize the memory allocated for a tssparse.
+ *
+ * Receives the tssparse, the new capacity, which MUST be enough for the
+ * length the array will have afterwards, and the object size for this
+ * array. Reallocates the items (or pages, rounding the capacity up to whole
+ * pages), and the occupancy bitmap, free summary and generations (if any)
+ * to match. The free summary is rebuilt for the new capacity. Items beyond
+ * the new capacity are lost. Returns 0 in case of success, non-zero
+ * otherwise.
+ *
+ * In case of error, the tssparse is left unchanged. The other arrays may
+ * end up larger than the capacity, which is harmless. The bitmap is always
+ * kept clear beyond len.
+ */
+static int resize_capacity(struct _tssparse_abs *p_tssparse, long capacity,
+        size_t obj_size)
+{
+    struct summary_layout layout;
+    const long old_capacity = p_tssparse->capacity;
+    const size_t old_words = map_words(old_capacity);
+    size_t words, summary_words;
+
+    assert(capacity >= 0);
+
+    if (p_tssparse->page_shift != 0)
+    {
+        const long page_mask = (1L << p_tssparse->page_shift) - 1;
+
+        if (unlikely(capacity > LONG_MAX - page_mask))
+            return TSSPARSE_ENOMEM;
+
+        capacity = (capacity + page_mask) & ~page_mask;
+    }
+
+    if (capacity == old_capacity)
+        return 0;
+
+#if CAN_MAP
+    if (p_tssparse->mapping != NULL)
+    {   /* can't reallocate a mapping; move to ordinary memory first */
+        const int retval = copy_mapping(p_tssparse, obj_size);
+
+        if (unlikely(retval != 0))
+            return retval;
+    }
+#endif
+
+    words = map_words(capacity);
+    summary_words = get_summary_layout(capacity, &layout);
+
+    /* asking for more items than we can address? the generations have the
+     * largest items of all the other arrays */
+    if (unlikely((unsigned long)capacity > SIZE_MAX
+                 || !can_size_mult((size_t)capacity, obj_size)
+                 || !can_size_mult((size_t)capacity, sizeof(uint32_t))))
+        return TSSPARSE_ENOMEM;
+
+    if (capacity > old_capacity)
+    {   /* grow the others first; if the items then fail, they're just
+         * larger than they need to be */
+        uint64_t *used_map;
+
+        if (summary_words > 0)
+        {
+            uint64_t *free_summary = realloc(p_tssparse->free_summary,
+                    summary_words * sizeof(uint64_t));
+            if (unlikely(free_summary == NULL))
+                return TSSPARSE_ENOMEM;
+
+            p_tssparse->free_summary = free_summary;
+        }
+
+        used_map = realloc(p_tssparse->used_map, words * sizeof(uint64_t));
+        if (unlikely(used_map == NULL))
+            return TSSPARSE_ENOMEM;
+
+        memset(used_map + old_words, 0,
+               (words - old_words) * sizeof(uint64_t));
+        p_tssparse->used_map = used_map;
+
+        if (p_tssparse->generations != NULL)
+        {
+            uint32_t *generations = realloc(p_tssparse->generations,
+                    (size_t)capacity * sizeof(uint32_t));
+            if (unlikely(generations == NULL))
+                return TSSPARSE_ENOMEM;
+
+            p_tssparse->generations = generations;
+        }
+    }
+
+    if (p_tssparse->page_shift != 0)
+    {
+        const int retval = resize_pages(p_tssparse, capacity, obj_size);
+
+        if (unlikely(retval != 0))
+            return retval;
+    }
+    else
+    {
+        char *items = realloc(p_tssparse->items, (size_t)capacity * obj_size);
+
+        /* if we asked for 0 bytes, realloc may legitimately return NULL */
+        if (unlikely(items == NULL && capacity != 0))
+            return TSSPARSE_ENOMEM;
+
+        p_tssparse->items = items;
+    }
+
+    p_tssparse->capacity = capacity;
+
+    if (capacity < old_capacity)
+    {   /* shrink the others last; if it fails, they're just larger */
+        uint64_t *used_map = realloc(p_tssparse->used_map,
+                                     words * sizeof(uint64_t));
+        uint64_t *free_summary = realloc(p_tssparse->free_summary,
+                                         summary_words * sizeof(uint64_t));
+
+        if (likely(used_map != NULL || words == 0))
+            p_tssparse->used_map = used_map;
+
+        if (likely(free_summary != NULL || summary_words == 0))
+            p_tssparse->free_summary = free_summary;
+
+        if (p_tssparse->generations != NULL)
+        {
+            uint32_t *generations = realloc(p_tssparse->generations,
+                    (size_t)capacity * sizeof(uint32_t));
+
+            if (likely(generations != NULL || capacity == 0))
+                p_tssparse->generations = generations;
+        }
+    }
+
+    /* the levels have moved around; rebuild them all */
+    update_summary(p_tssparse, 0, words);
+
+    return 0;
+}
+
+
+
+/*
+ * Allocate or free pages of a paged tssparse, to match a new capacity.
+ *
+ * Receives the tssparse, the new capacity, which MUST be a whole number of
+ * pages, and the object size for this array. The pages already in use
+ * stay where they are; only the table of pages may move. Returns 0 in case
+ * of success, non-zero otherwise. In case of error, no pages are added,
+ * but the table may be larger than it needs to be, which is harmless.
+ */
+static int resize_pages(struct _tssparse_abs *p_tssparse, long capacity,
+        size_t obj_size)
+{
+    const int shift = p_tssparse->page_shift;
+    const long old_count = p_tssparse->capacity >> shift;
+    const long count = capacity >> shift;
+    const size_t page_size = ((size_t)1 << shift) * obj_size;
+    char **pages;
+    long i;
+
+    if (count > old_count)
+    {
+        pages = realloc(p_tssparse->pages, (size_t)count * sizeof(char *));
+        if (unlikely(pages == NULL))
+            return TSSPARSE_ENOMEM;
+
+        p_tssparse->pages = pages;
+
+        for (i=old_count; i<count; i++)
+        {
+            pages[i] = malloc(page_size);
+
+            if (unlikely(pages[i] == NULL))
+            {   /* undo, so the pages match the capacity */
+                while (i-- > old_count)
+                    free(pages[i]);
+
+                return TSSPARSE_ENOMEM;
+            }
+        }
+    }
+    else
+    {
+        for (i=count; i<old_count; i++)
+            free(p_tssparse->pages[i]);
+
+        if (count == 0)
+        {
+            free(p_tssparse->pages);
+            p_tssparse->pages = NULL;
+        }
+        else
+        {   /* if it fails, the table is just larger */
+            pages = realloc(p_tssparse->pages, (size_t)count * sizeof(char *));
+
+            if (likely(pages != NULL))
+                p_tssparse->pages = pages;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Free the objects of a tssparse, whether it's paged or not.
+ *
+ * Leaves items and pages NULL. If the array is mapped, unmaps it, which
+ * leaves used_map NULL too. The caller must reset the capacity, and the
+ * rest of the array.
+ */
+static void free_items(struct _tssparse_abs *p_tssparse)
+{
+#if CAN_MAP
+    if (p_tssparse->mapping != NULL)
+    {
+        drop_mapping(p_tssparse);
+        return;
+    }
+#endif
+
+    if (p_tssparse->pages != NULL)
+    {
+        const long count = p_tssparse->capacity >> p_tssparse->page_shift;
+        long i;
+
+        for (i=0; i<count; i++)
+            free(p_tssparse->pages[i]);
+
+        free(p_tssparse->pages);
+        p_tssparse->pages = NULL;
+    }
+
+    free(p_tssparse->items);
+    p_tssparse->items = NULL;
+}
+
+
+
+#if CAN_MAP
+/*
+ * Move a mapped tssparse to ordinary memory.
+ *
+ * Receives the tssparse, which MUST be mapped (see tssparse_map), and the
+ * object size for this array. Copies the items and the occupancy bitmap
+ * out of the mapping, and unmaps it. Returns 0 in case of success, or
+ * TSSPARSE_ENOMEM, in which case the array is still mapped.
+ */
+static int copy_mapping(struct _tssparse_abs *p_tssparse, size_t obj_size)
+{
+    const size_t item_bytes = (size_t)p_tssparse->capacity * obj_size;
+    const size_t map_bytes = map_words(p_tssparse->capacity)
+                             * sizeof(uint64_t);
+    char *items = malloc(item_bytes);
+    uint64_t *used_map = malloc(map_bytes);
+
+    if (unlikely(items == NULL || used_map == NULL))
+    {
+        free(items);
+        free(used_map);
+        return TSSPARSE_ENOMEM;
+    }
+
+    memcpy(items, p_tssparse->items, item_bytes);
+    memcpy(used_map, p_tssparse->used_map, map_bytes);
+
+    drop_mapping(p_tssparse);
+    p_tssparse->items = items;
+    p_tssparse->used_map = used_map;
+
+    return 0;
+}
+
+
+
+/*
+ * Unmap a mapped tssparse, leaving items and used_map NULL.
+ */
+static void drop_mapping(struct _tssparse_abs *p_tssparse)
+{
+    munmap(p_tssparse->mapping, p_tssparse->mapping_size);
+
+    p_tssparse->items = NULL;
+    p_tssparse->used_map = NULL;
+    p_tssparse->mapping = NULL;
+    p_tssparse->mapping_size = 0;
+}
+#endif
+
+
+
+/*
+ * Check whether a range of items is all empty in an occupancy bitmap.
+ *
+ * The range goes from start (inclusive) to stop (exclusive). Returns true
+ * if none of the items are used.
+ */
+static int map_range_is_clear(const uint64_t *used_map, long start,
+        long stop)
+{
+    size_t w = TSSPARSE_MAP_WORD(start);
+    const size_t last = TSSPARSE_MAP_WORD(stop - 1);
+    uint64_t mask = MAP_WORD_FULL << TSSPARSE_MAP_BIT(start);
+
+    assert(start < stop);
+
+    for (; w < last; w++)
+    {
+        if (used_map[w] & mask)
+            return 0;
+
+        mask = MAP_WORD_FULL;
+    }
+
+    /* keep only the bits below stop, in the last word */
+    mask &= MAP_WORD_FULL >> (TSSPARSE_MAP_BITS - 1 - TSSPARSE_MAP_BIT(stop - 1));
+
+    return !(used_map[last] & mask);
+}
+
+
+
+/*
+ * Give the memory of a range of items back to the system, where empty.
+ *
+ * Receives the tssparse, and the range of items, from start (inclusive) to
+ * stop (exclusive). Only whole system pages with no used items are given
+ * back, including items outside the range that share a page with it.
+ */
+static void release_range(struct _tssparse_abs *p_tssparse, long start,
+        long stop)
+{
+    const int shift = p_tssparse->page_shift;
+
+    stop = min(stop, p_tssparse->capacity);
+
+    if (start >= stop)
+        return;
+
+    if (shift != 0)
+    {   /* each page is allocated on its own */
+        const long page_len = 1L << shift;
+        long k;
+
+        for (k = start >> shift; k <= (stop - 1) >> shift; k++)
+        {
+            const long first = k << shift;
+
+            release_block(p_tssparse, p_tssparse->pages[k], first, page_len,
+                          max(start, first), min(stop, first + page_len));
+        }
+    }
+    else
+        release_block(p_tssparse, p_tssparse->items, 0, p_tssparse->capacity,
+                      start, stop);
+}
+
+
+
+/*
+ * Give the memory of a range of items in one allocation back to the
+ * system, where empty.
+ *
+ * Receives the tssparse, the allocation holding count items from index
+ * first, and the range of items within it. The system pages touched by
+ * the range which lie entirely within the allocation, and hold no used
+ * items, are given back. Consecutive pages are given back together.
+ */
+static void release_block(const struct _tssparse_abs *p_tssparse,
+        const char *base, long first, long count, long start, long stop)
+{
+    const size_t obj_size = p_tssparse->release_size;
+    const uintptr_t page_size = get_system_page_size();
+    const uintptr_t page_mask = page_size - 1;
+    const uintptr_t block = (uintptr_t)base;
+    const uintptr_t block_end = block + (size_t)count * obj_size;
+    const uintptr_t lo = max(
+            (block + (size_t)(start - first) * obj_size) & ~page_mask,
+            (block + page_mask) & ~page_mask);
+    const uintptr_t hi = min(
+            (block + (size_t)(stop - first) * obj_size + page_mask)
+            & ~page_mask,
+            block_end & ~page_mask);
+    uintptr_t run = 0;
+    uintptr_t page;
+
+    assert(obj_size != 0);
+
+    for (page = lo; page < hi; page += page_size)
+    {
+        const long page_first = first + (long)((page - block) / obj_size);
+        const long page_stop = first + (long)((page + page_mask - block)
+                                              / obj_size) + 1;
+
+        if (map_range_is_clear(p_tssparse->used_map, page_first, page_stop))
+        {
+            if (run == 0)
+                run = page;
+        }
+        else if (run != 0)
+        {
+#if CAN_RELEASE
+            madvise((void *)run, page - run, MADV_DONTNEED);
+#endif
+            run = 0;
+        }
+    }
+
+#if CAN_RELEASE
+    if (run != 0)
+        madvise((void *)run, page - run, MADV_DONTNEED);
+#endif
+}
+
+
+
+/*
+ * Get the size of the system's memory pages, in bytes.
+ */
+static size_t get_system_page_size(void)
+{
+#if CAN_RELEASE
+    static size_t page_size = 0;
+
+    /* racing threads all store the same value */
+    if (unlikely(page_size == 0))
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    return page_size;
+#else
+    return 4096;
+#endif
+}
+
+
+
+/*
+ * Get the layout of a tssparse's free summary (see struct summary_layout).
+ *
+ * Receives the tssparse's capacity, and where to store the layout. Returns
+ * the total number of words in the summary, which is 0 if the occupancy
+ * bitmap fits in a single word.
+ */
+static size_t get_summary_layout(long capacity, struct summary_layout *layout)
+{
+    size_t words = map_words(capacity);
+    size_t total = 0;
+    int l = 0;
+
+    while (words > 1)
+    {
+        assert(l < SUMMARY_MAX_LEVELS);
+
+        words = (words + TSSPARSE_MAP_BITS - 1) / TSSPARSE_MAP_BITS;
+        layout->offset[l] = total;
+        layout->words[l] = words;
+        total += words;
+        l++;
+    }
+
+    layout->levels = l;
+
+    return total;
+}
+
+
+
+/*
+ * Calculate the memory a tssparse of a given capacity needs besides its
+ * objects: the occupancy bitmap, the free summary, the generations (if
+ * has_generations is true) and, in a paged array, the page table.
+ */
+static size_t calc_overhead(long capacity, int page_shift,
+        int has_generations)
+{
+    struct summary_layout layout;
+    size_t bytes = (map_words(capacity) + get_summary_layout(capacity,
+                                                             &layout))
+                   * sizeof(uint64_t);
+
+    if (has_generations)
+        bytes += (size_t)capacity * sizeof(uint32_t);
+
+    if (page_shift != 0)
+        bytes += (size_t)(capacity >> page_shift) * sizeof(char *);
+
+    return bytes;
+}
+
+
+
+/*
+ * Rebuild part of a tssparse's free summary.
+ *
+ * Receives the tssparse, and a range of words of the occupancy bitmap that
+ * have changed, from start (inclusive) to stop (exclusive). Every summary
+ * word above the range is recomputed from the level below it, up to the
+ * top. This is for bulk changes to the bitmap; single items are kept up to
+ * date by mark_used and mark_free.
+ */
+static void update_summary(struct _tssparse_abs *p_tssparse,
+        size_t start, size_t stop)
+{
+    struct summary_layout layout;
+    const uint64_t *below = p_tssparse->used_map;
+    size_t below_words = map_words(p_tssparse->capacity);
+    /* a word of level 0 tells whether a bitmap word has any empty item;
+     * above that, whether a summary word has any bit set */
+    uint64_t nothing_free = MAP_WORD_FULL;
+    int l;
+
+    get_summary_layout(p_tssparse->capacity, &layout);
+    stop = min(stop, below_words);
+
+    for (l = 0; l < layout.levels && start < stop; l++)
+    {
+        uint64_t *level = p_tssparse->free_summary + layout.offset[l];
+        const size_t first = start / TSSPARSE_MAP_BITS;
+        const size_t last = (stop - 1) / TSSPARSE_MAP_BITS;
+        size_t w;
+
+        for (w = first; w <= last; w++)
+        {
+            const size_t end = min(below_words, (w + 1) * TSSPARSE_MAP_BITS);
+            uint64_t bits = 0;
+            size_t i;
+
+            for (i = w * TSSPARSE_MAP_BITS; i < end; i++)
+                if (below[i] != nothing_free)
+                    bits |= TSSPARSE_MAP_MASK(i);
+
+            level[w] = bits;
+        }
+
+        below = level;
+        below_words = layout.words[l];
+        nothing_free = 0;
+        start = first;
+        stop = last + 1;
+    }
+}
+
+
+
+/*
+ * Mark an item of a tssparse as used, in the occupancy bitmap and the free
+ * summary.
+ *
+ * The summary only changes when a bitmap word becomes full.
+ */
+static void mark_used(struct _tssparse_abs *p_tssparse, long index)
+{
+    const size_t w = TSSPARSE_MAP_WORD(index);
+
+    p_tssparse->used_map[w] |= TSSPARSE_MAP_MASK(index);
+
+    if (unlikely(p_tssparse->used_map[w] == MAP_WORD_FULL))
+        mark_word_full(p_tssparse, w);
+}
+
+
+
+/*
+ * Update the free summary of a tssparse, after word w of the occupancy
+ * bitmap became full.
+ *
+ * Goes up the summary, clearing bits, until it reaches a word that still
+ * has others set.
+ */
+static void mark_word_full(struct _tssparse_abs *p_tssparse, size_t w)
+{
+    struct summary_layout layout;
+    int l;
+
+    get_summary_layout(p_tssparse->capacity, &layout);
+
+    for (l = 0; l < layout.levels; l++)
+    {
+        uint64_t *word = &p_tssparse->free_summary[layout.offset[l]
+                                                   + TSSPARSE_MAP_WORD(w)];
+
+        *word &= ~TSSPARSE_MAP_MASK(w);
+        if (*word != 0)
+            break;
+
+        w = TSSPARSE_MAP_WORD(w);
+    }
+}
+
+
+
+/*
+ * Mark an item of a tssparse as empty, in the occupancy bitmap and the free
+ * summary.
+ *
+ * The summary only changes when a full bitmap word gets a hole; then it
+ * goes up, setting bits, until it reaches a word that already had others
+ * set.
+ */
+static void mark_free(struct _tssparse_abs *p_tssparse, long index)
+{
+    struct summary_layout layout;
+    size_t w = TSSPARSE_MAP_WORD(index);
+    const int was_full = p_tssparse->used_map[w] == MAP_WORD_FULL;
+    int l;
+
+    p_tssparse->used_map[w] &= ~TSSPARSE_MAP_MASK(index);
+
+    if (likely(!was_full))
+        return;
+
+    get_summary_layout(p_tssparse->capacity, &layout);
+
+    for (l = 0; l < layout.levels; l++)
+    {
+        uint64_t *word = &p_tssparse->free_summary[layout.offset[l]
+                                                   + TSSPARSE_MAP_WORD(w)];
+        const int had_bits = *word != 0;
+
+        *word |= TSSPARSE_MAP_MASK(w);
+        if (had_bits)
+            break;
+
+        w = TSSPARSE_MAP_WORD(w);
+    }
+}
+
+
+
+/*
+ * Find the lowest empty item in a tssparse.
+ *
+ * Goes down the free summary from the top, following the lowest set bit
+ * at each level, so it takes one bit scan per level. There MUST be an
+ * empty item below len. Returns its index.
+ */
+static long find_free_item(const struct _tssparse_abs *p_tssparse)
+{
+    struct summary_layout layout;
+    size_t w = 0;
+    int l;
+
+    assert(p_tssparse->used_count < p_tssparse->len);
+
+    get_summary_layout(p_tssparse->capacity, &layout);
+
+    for (l = layout.levels - 1; l >= 0; l--)
+    {
+        const uint64_t bits = p_tssparse->free_summary[layout.offset[l] + w];
+
+        assert(bits != 0);
+        w = w * TSSPARSE_MAP_BITS + (size_t)ctz64(bits);
+    }
+
+    /* bits beyond len are clear too, but there's a lower one */
+    assert(p_tssparse->used_map[w] != MAP_WORD_FULL);
+
+    return (long)(w * TSSPARSE_MAP_BITS)
+        + ctz64(~p_tssparse->used_map[w]);
+}
+
+
+
+/*
+ * Fill in the map of where compacting will move each item of a tssparse.
+ *
+ * Receives the tssparse and an empty tsarray of long. Appends the new index
+ * of each item, in order, or -1 for the empty ones. Returns 0 in case of
+ * success, non-zero otherwise.
+ */
+static int build_remap(const struct _tssparse_abs *p_tssparse,
+        struct _tsarray_pub *remap)
+{
+    const long len = p_tssparse->len;
+    const long hole = -1;
+    long new_index = 0;
+    long i;
+
+    for (i=0; i<len; i++)
+    {
+        const int used = tssparse_is_used(p_tssparse->used_map, i);
+        const int retval = tsarray_append(remap, used ? &new_index : &hole);
+
+        if (unlikely(retval != 0))
+            return retval;
+
+        new_index += used;
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * Start keeping track of item generations in a tssparse, if not already.
+ *
+ * Allocates a generation counter for every item. No handles can exist
+ * before this, so the counters may start anywhere; they start at
+ * gen_floor. Returns 0 in case of success, non-zero otherwise.
+ */
+static int ensure_generations(struct _tssparse_abs *p_tssparse)
+{
+    uint32_t *generations;
+    long i;
+
+    if (likely(p_tssparse->generations != NULL))
+        return 0;
+
+    /* only called for a used item, so there must be some capacity */
+    assert(p_tssparse->capacity > 0);
+
+    generations = malloc((size_t)p_tssparse->capacity * sizeof(uint32_t));
+    if (unlikely(generations == NULL))
+        return TSSPARSE_ENOMEM;
+
+    for (i=0; i<p_tssparse->capacity; i++)
+        generations[i] = p_tssparse->gen_floor;
+
+    p_tssparse->generations = generations;
+
+    return 0;
+}
+
+
+
+/*
+ * Retire the generations of items being cut off the end of a tssparse.
+ *
+ * The range goes from start (inclusive) to stop (exclusive). Raises
+ * gen_floor above the generation of every item in the range, so that if
+ * the array grows back, handles to the old items can't become valid again.
+ */
+static void retire_generations(struct _tssparse_abs *p_tssparse,
+        long start, long stop)
+{
+    const uint32_t *generations = p_tssparse->generations;
+    uint32_t floor = p_tssparse->gen_floor;
+    long i;
+
+    if (generations == NULL)
+        return;
+
+    for (i=start; i<stop; i++)
+        if (generations[i] >= floor)
+            floor = generations[i] + 1;
+
+    p_tssparse->gen_floor = floor;
+}
+
+
+/*
+ * Get the offset of the items in a tssparse snapshot, from its start,
+ * given the number of words in its occupancy bitmap.
+ */
+static size_t snapshot_items_offset(size_t words)
+{
+    const size_t end = sizeof(struct snapshot_header)
+                       + words * sizeof(uint64_t);
+
+    return (end + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+
+
+/*
+ * Check the header of a tssparse snapshot.
+ *
+ * Receives the header and the object size for this array. Returns 0 if
+ * it's a snapshot we can load, i.e. it is from the same version, byte
+ * order and object size, and its len is one the array can have. Returns a
+ * negative error value otherwise.
+ */
+static int check_snapshot_header(const struct snapshot_header *header,
+        size_t obj_size)
+{
+    if (unlikely(memcmp(header->magic, SNAPSHOT_MAGIC,
+                        sizeof(header->magic)) != 0
+                 || header->version != SNAPSHOT_VERSION
+                 || header->byte_order != FILEIO_BYTE_ORDER
+                 || header->obj_size != obj_size
+                 || obj_size == 0))
+        return TSSPARSE_EINVAL;
+
+    /* same limits as resize_capacity */
+    if (unlikely(header->len > LONG_MAX
+                 || header->len > SIZE_MAX
+                 || !can_size_mult((size_t)header->len, obj_size)
+                 || !can_size_mult((size_t)header->len, sizeof(uint32_t))))
+        return TSSPARSE_EOVERFLOW;
+
+    return 0;
+}
+
+
+
+/*
+ * Check the occupancy bitmap of a tssparse snapshot.
+ *
+ * Receives the bitmap, the snapshot's len, and its used_count, or -1 to
+ * skip counting (which reads the whole bitmap). Returns true if the bits
+ * beyond len are clear, as they must be, and the number of bits set
+ * matches used_count.
+ */
+static int snapshot_map_is_valid(const uint64_t *used_map, long len,
+        long used_count)
+{
+    const size_t words = map_words(len);
+    long count = 0;
+    size_t w;
+
+    if (TSSPARSE_MAP_BIT(len) != 0
+            && (used_map[words - 1] & ~(TSSPARSE_MAP_MASK(len) - 1)) != 0)
+        return 0;
+
+    if (used_count < 0)
+        return 1;
+
+    for (w = 0; w < words; w++)
+        count += popcount64(used_map[w]);
+
+    return count == used_count;
+}
+
+
+
+/*
+ * Add data to a snapshot being written.
+ *
+ * Receives the writer, the data and its size. Small pieces are gathered in
+ * the writer's buffer; large ones are written directly, after what's in
+ * the buffer.
+ */
+static void writer_put(struct snapshot_writer *writer, const void *data,
+        size_t size)
+{
+    if (unlikely(writer->error) || size == 0)
+        return;
+
+    writer->hash = fileio_hash(writer->hash, data, size);
+
+    if (writer->used + size > SNAPSHOT_BUFFER_SIZE)
+        writer_flush(writer);
+
+    if (size >= SNAPSHOT_BUFFER_SIZE)
+    {
+        if (likely(!writer->error)
+                && unlikely(fileio_write_all(writer->fd, data, size) != 0))
+            writer->error = 1;
+
+        return;
+    }
+
+    memcpy(writer->buf + writer->used, data, size);
+    writer->used += size;
+}
+
+
+
+/*
+ * Add size zero bytes to a snapshot being written.
+ */
+static void writer_zero(struct snapshot_writer *writer, size_t size)
+{
+    while (size > 0 && likely(!writer->error))
+    {
+        size_t chunk;
+
+        if (writer->used == SNAPSHOT_BUFFER_SIZE)
+            writer_flush(writer);
+
+        chunk = min(size, SNAPSHOT_BUFFER_SIZE - writer->used);
+        memset(writer->buf + writer->used, 0, chunk);
+        writer->hash = fileio_hash(writer->hash, writer->buf + writer->used,
+                                   chunk);
+        writer->used += chunk;
+        size -= chunk;
+    }
+}
+
+
+
+/*
+ * Write out whatever is waiting in a snapshot writer's buffer.
+ */
+static void writer_flush(struct snapshot_writer *writer)
+{
+    if (likely(!writer->error)
+            && unlikely(fileio_write_all(writer->fd, writer->buf,
+                                         writer->used) != 0))
+        writer->error = 1;
+
+    writer->used = 0;
+}
+
+
+
+/*
+ * Add a range of items of a tssparse to a snapshot being written.
+ *
+ * Receives the writer, the tssparse, the range of items, from start
+ * (inclusive) to stop (exclusive), and the object size for this array. In
+ * a paged array, the range is put a page at a time.
+ */
+static void put_items(struct snapshot_writer *writer,
+        const struct _tssparse_abs *p_tssparse, long start, long stop,
+        size_t obj_size)
+{
+    const int shift = p_tssparse->page_shift;
+
+    while (start < stop)
+    {
+        const long end = shift != 0
+            ? min(stop, (start | ((1L << shift) - 1)) + 1) : stop;
+
+        writer_put(writer, get_nth_item(p_tssparse, start, obj_size),
+                   (size_t)(end - start) * obj_size);
+        start = end;
+    }
+}
+
+
+
+/*
+ * Read part of a snapshot, adding it to the checksum.
+ *
+ * Receives a file descriptor, where to read to, how many bytes to read,
+ * and the checksum so far, which is updated. Returns 0 in case of success,
+ * or -1 otherwise (see fileio_read_all).
+ */
+static int read_hashed(int fd, void *buf, size_t size, uint64_t *hash)
+{
+    if (unlikely(fileio_read_all(fd, buf, size) != 0))
+        return -1;
+
+    *hash = fileio_hash(*hash, buf, size);
+
+    return 0;
 }
 
 
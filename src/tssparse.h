@@ -41,8 +41,12 @@
 /* get memory allocation */
 #include <stdlib.h>
 
+/* get uint64_t */
+#include <stdint.h>
+
 
 #include "common.h"
+#include "tsarray.h"
 
 
 /*
@@ -54,33 +58,294 @@ enum tssparse_errno {
     TSSPARSE_ENOENT = -2,    /* No such entry */
     TSSPARSE_ENOMEM = -3,    /* Out of memory */
     TSSPARSE_EOVERFLOW = -4, /* Operation would overflow */
+    TSSPARSE_ENOTSUP = -5,   /* Not supported on this system */
+    TSSPARSE_EIO = -6,       /* Error reading or writing a file */
 };
 
 
-/* abstract versions; only for internal use (must match the subclassed
- * versions in TSSPARSE_TYPEDEF) */
+/*
+ * Members of a tssparse, given the type of its objects. Shared by the
+ * abstract version below and the subclassed versions in TSSPARSE_TYPEDEF,
+ * so that their layouts always match.
+ *
+ * len is the number of items, i.e. valid indices go from 0 to len-1.
+ * capacity is the number of items actually allocated, which grows in
+ * chunks to make appending cheap; it is always >= len.
+ *
+ * Whether each item is used is kept apart from the objects, in used_map:
+ * a bitmap with one bit per item, packed into 64-bit words. Bits at or
+ * beyond len are always clear.
+ *
+ * free_summary makes finding the lowest empty item cheap, however large
+ * the array. It is a hierarchy of bitmaps over used_map: the first level
+ * has a bit for each word of used_map, set if that word has any empty
+ * item; each level above has a bit for each word of the level below, set
+ * if that word has any bit set; the top level is a single word. So the
+ * lowest empty item is found with one bit scan per level. It covers the
+ * whole capacity, and has no levels at all while used_map fits in a
+ * single word.
+ *
+ * compacting is set while a step-wise compaction is in progress (see
+ * tssparse_compact_step).
+ *
+ * If page_shift is non-zero, the array is paged (see tssparse_set_paged):
+ * items is NULL, and the objects are kept in pages of 2^page_shift items
+ * each, which never move once allocated. pages holds a pointer to each
+ * page, and capacity is always a whole number of pages.
+ *
+ * release_size is the object size if the memory of empty regions is given
+ * back to the system (see tssparse_set_release), or 0 if it is not.
+ *
+ * mapping is set if the array was loaded with tssparse_map: items and
+ * used_map then point into a private mapping of the snapshot file, which
+ * is mapping_size bytes long. The array is moved out to ordinary memory
+ * the first time its capacity changes.
+ *
+ * generations holds a counter for each item, which is bumped whenever the
+ * item is emptied. It is only allocated once a handle is requested (see
+ * tssparse_get_handle), so arrays that don't use handles pay nothing.
+ * Items created by growing the array start at gen_floor, which is kept
+ * above the generation of any item that was cut off the end.
+ */
+#define _TSSPARSE_MEMBERS(obj_type) \
+    long len; \
+    long used_count; \
+    long min_len; \
+    long capacity; \
+    obj_type *items; \
+    uint64_t *used_map; \
+    uint64_t *free_summary; \
+    uint32_t *generations; \
+    uint32_t gen_floor; \
+    int compacting; \
+    obj_type **pages; \
+    int page_shift; \
+    size_t release_size; \
+    void *mapping; \
+    size_t mapping_size;
+
+
+/* abstract versions; only for internal use */
 struct _tssparse_abs {
-    int len;
-    int used_count;
-    int min_len;
-    struct _item_abs *items;
+    _TSSPARSE_MEMBERS(char)     /* char may alias any other type */
 };
 
 
-int tssparse_add(struct _tssparse_abs *p_tssparse, const void *object,
-        size_t obj_size, size_t item_size) __attribute__((nonnull (1)));
+/* Number of items tracked by each word of the occupancy bitmap */
+#define TSSPARSE_MAP_BITS 64
+
+/* Word of the occupancy bitmap holding an item's bit, bit position within
+ * that word, and mask to select it */
+#define TSSPARSE_MAP_WORD(index) ((unsigned long)(index) / TSSPARSE_MAP_BITS)
+#define TSSPARSE_MAP_BIT(index) ((unsigned long)(index) % TSSPARSE_MAP_BITS)
+#define TSSPARSE_MAP_MASK(index) ((uint64_t)1 << TSSPARSE_MAP_BIT(index))
 
-int tssparse_remove(struct _tssparse_abs *p_tssparse, int index,
-        size_t item_size) __NON_NULL;
+
+/* Largest page_shift for a paged tssparse */
+#define TSSPARSE_MAX_PAGE_SHIFT 30
+
+
+/*
+ * Get a pointer to an item of a tssparse, used or not.
+ *
+ * Receives the tssparse, the index of the item, which MUST be below the
+ * capacity, and the object size for this array. In a paged array, finds
+ * the page with a shift and the item within it with a mask.
+ */
+static inline void *tssparse_item(const struct _tssparse_abs *p_tssparse,
+        long index, size_t obj_size)
+{
+    const int shift = p_tssparse->page_shift;
+
+    if (shift != 0)
+    {
+        const size_t offset = (size_t)index & (((size_t)1 << shift) - 1);
+
+        return p_tssparse->pages[(unsigned long)index >> shift]
+            + offset * obj_size;
+    }
+
+    return p_tssparse->items + (size_t)index * obj_size;
+}
+
+
+/*
+ * Check whether an item is used, given the occupancy bitmap and its index.
+ */
+static inline int tssparse_is_used(const uint64_t *used_map, long index)
+{
+    return (used_map[TSSPARSE_MAP_WORD(index)] & TSSPARSE_MAP_MASK(index)) != 0;
+}
+
+
+/*
+ * Handle to an item in a tssparse. Unlike a plain index, a handle
+ * identifies one specific object: once the object is removed (or moved,
+ * by compacting the array), the handle becomes stale and will no longer
+ * find anything, even if its index gets reused by another object.
+ *
+ * The index is kept in the low 32 bits, and the item's generation in the
+ * high 32 bits. A generation wraps around after 2^32 removals from the
+ * same item. Items beyond index 2^32-1 can't have handles.
+ */
+typedef uint64_t tssparse_handle;
+
+#define TSSPARSE_HANDLE_INDEX(handle) ((uint32_t)(handle))
+#define TSSPARSE_HANDLE_GEN(handle) ((uint32_t)((handle) >> 32))
+#define TSSPARSE_HANDLE_MAKE(index, gen) \
+    (((tssparse_handle)(gen) << 32) | (uint32_t)(index))
+
+
+/*
+ * Check whether a handle refers to a live object in a tssparse.
+ *
+ * Receives the tssparse's len, occupancy bitmap and generations, and the
+ * handle. Returns true if and only if the handle's item is used and still
+ * of the same generation.
+ */
+static inline int tssparse_handle_is_valid(long len, const uint64_t *used_map,
+        const uint32_t *generations, tssparse_handle handle)
+{
+    const uint32_t index = TSSPARSE_HANDLE_INDEX(handle);
+
+    return generations != NULL
+        && index < (unsigned long)len
+        && tssparse_is_used(used_map, (long)index)
+        && generations[index] == TSSPARSE_HANDLE_GEN(handle);
+}
+
+
+/*
+ * Hooks for step-wise compaction (see tssparse_compact_step). Any of them
+ * may be NULL.
+ *
+ * should_compact decides whether compaction is worth starting, given the
+ * tssparse's len and used_count; the default is
+ * tssparse_compact_default_policy. moved is called for each object that
+ * is moved, with its old and new index. arg is passed to all of them.
+ *
+ * will_move is called just before each object is moved, with the same
+ * indices as moved; the item at to is still empty, and nothing has been
+ * written to it yet.
+ */
+struct tssparse_compact_ops {
+    int (*should_compact)(long len, long used_count, void *arg);
+    void (*moved)(long from, long to, void *arg);
+    void *arg;
+    void (*will_move)(long from, long to, void *arg);
+};
+
+
+/* Flag for tssparse_save: leave the holes out, as if compacted first */
+#define TSSPARSE_SAVE_COMPACT 1
+
+
+/* Number of buckets in the hole run histogram of struct tssparse_stats */
+#define TSSPARSE_STATS_RUN_BUCKETS 16
+
+/*
+ * Memory and fragmentation statistics of a tssparse, filled in by
+ * tssparse_get_stats.
+ *
+ * hole_count is the number of empty items below len, in hole_runs runs of
+ * adjacent empty items, the longest of which is longest_run items long.
+ * run_histogram[k] counts the runs of 2^k to 2^(k+1)-1 items; the last
+ * bucket also counts any longer runs.
+ *
+ * item_bytes is the memory allocated for objects, used or not (including
+ * any regions given back to the system; see tssparse_set_release). Used
+ * flags are kept apart from the objects, and objects are not padded;
+ * overhead_bytes is the memory for the occupancy bitmap, free summary,
+ * generations and page table. reclaimable_bytes is how much of both
+ * tssparse_compact would free.
+ */
+struct tssparse_stats {
+    long len;
+    long used_count;
+    long capacity;
+    long hole_count;
+    long hole_runs;
+    long longest_run;
+    long run_histogram[TSSPARSE_STATS_RUN_BUCKETS];
+    size_t item_bytes;
+    size_t overhead_bytes;
+    size_t reclaimable_bytes;
+};
+
+
+long tssparse_add(struct _tssparse_abs *p_tssparse, const void *object,
+        size_t obj_size) __attribute__((nonnull (1)));
+
+long tssparse_add_handle(struct _tssparse_abs *p_tssparse,
+        const void *object, size_t obj_size, tssparse_handle *handle)
+    __NON_NULL;
+
+int tssparse_get_handle(struct _tssparse_abs *p_tssparse, long index,
+        tssparse_handle *handle) __NON_NULL;
+
+int tssparse_remove_handle(struct _tssparse_abs *p_tssparse,
+        tssparse_handle handle) __NON_NULL;
+
+int tssparse_remove(struct _tssparse_abs *p_tssparse, long index) __NON_NULL;
+
+int tssparse_add_n(struct _tssparse_abs *p_tssparse, const void *objects,
+        long count, long *indices, size_t obj_size)
+    __attribute__((nonnull (1, 2)));
+
+int tssparse_remove_n(struct _tssparse_abs *p_tssparse, const long *indices,
+        long count) __NON_NULL;
+
+long tssparse_add_range(struct _tssparse_abs *p_tssparse, const void *objects,
+        long count, size_t obj_size) __NON_NULL;
 
 int tssparse_compact(struct _tssparse_abs *p_tssparse, int force,
-        size_t obj_size, size_t item_size) __NON_NULL;
+        size_t obj_size) __NON_NULL;
+
+int tssparse_compact_remap(struct _tssparse_abs *p_tssparse, int force,
+        size_t obj_size, struct _tsarray_pub *remap) __NON_NULL;
+
+int tssparse_compact_default_policy(long len, long used_count, void *arg);
+
+int tssparse_compact_step(struct _tssparse_abs *p_tssparse, int max_moves,
+        const struct tssparse_compact_ops *ops, size_t obj_size)
+    __attribute__((nonnull (1)));
+
+int tssparse_truncate(struct _tssparse_abs *p_tssparse, long len,
+        size_t obj_size) __NON_NULL;
+
+int tssparse_setminlen(struct _tssparse_abs *p_tssparse, long min_len,
+        size_t obj_size) __NON_NULL;
+
+int tssparse_set_paged(struct _tssparse_abs *p_tssparse, int page_shift)
+    __NON_NULL;
+
+int tssparse_set_release(struct _tssparse_abs *p_tssparse, int release,
+        size_t obj_size) __NON_NULL;
+
+long tssparse_next(const struct _tssparse_abs *p_tssparse, long from,
+        size_t obj_size) __NON_NULL;
+
+long tssparse_next_free(const struct _tssparse_abs *p_tssparse,
+        int *resizes) __NON_NULL;
+
+int tssparse_next_batch(const struct _tssparse_abs *p_tssparse, long from,
+        long *indices, int count) __NON_NULL;
+
+void tssparse_get_stats(const struct _tssparse_abs *p_tssparse,
+        struct tssparse_stats *stats, size_t obj_size) __NON_NULL;
+
+int tssparse_save(const struct _tssparse_abs *p_tssparse, int fd, int flags,
+        size_t obj_size) __NON_NULL;
+
+int tssparse_load(struct _tssparse_abs *p_tssparse, int fd, size_t obj_size)
+    __NON_NULL;
 
-int tssparse_truncate(struct _tssparse_abs *p_tssparse, int len,
-        size_t item_size) __NON_NULL;
+int tssparse_map(struct _tssparse_abs *p_tssparse, const char *path,
+        size_t obj_size) __NON_NULL;
 
-int tssparse_setminlen(struct _tssparse_abs *p_tssparse, int min_len,
-        size_t item_size) __NON_NULL;
+
+/* Map from old to new indices, filled in by arraytype_compact_remap() */
+TSARRAY_TYPEDEF(tssparse_remap, long);
 
 
 /*
@@ -90,46 +355,151 @@ int tssparse_setminlen(struct _tssparse_abs *p_tssparse, int min_len,
  * objects of type objtype. Defines type-specific functions to manipulate the
  * new array type using the prefix arraytype_*, e.g. intarray_add(), etc.
  *
+ * Objects are stored contiguously in items, with no per-item overhead;
+ * empty items are tracked separately. Use arraytype_get_nth() to access
+ * an item, which returns NULL if the item is empty. A paged array (see
+ * arraytype_set_paged()) has no items, and must always go through
+ * arraytype_get_nth().
+ *
  * Example (define intarray as an array of int):
  *      TSSPARSE_TYPEDEF(intarray, int);
  */
 #define TSSPARSE_TYPEDEF(arraytype, objtype) \
-    struct arraytype##_item { \
-        int used; \
-        objtype object; \
-    }; \
     typedef struct { \
-        int len; \
-        int used_count; \
-        int min_len; \
-        struct arraytype##_item *items; \
+        _TSSPARSE_MEMBERS(objtype) \
     } arraytype; \
-    static inline int arraytype##_add(arraytype *array, objtype *object) { \
+    static inline long arraytype##_add(arraytype *array, objtype *object) { \
         return tssparse_add((struct _tssparse_abs *)array, object, \
-                            sizeof(objtype), sizeof(struct arraytype##_item)); \
+                            sizeof(objtype)); \
+    } \
+    static inline int arraytype##_remove(arraytype *array, long index) { \
+        return tssparse_remove((struct _tssparse_abs *)array, index); \
+    } \
+    static inline int arraytype##_add_n(arraytype *array, \
+            const objtype *objects, long count, long *indices) { \
+        return tssparse_add_n((struct _tssparse_abs *)array, objects, count, \
+                              indices, sizeof(objtype)); \
+    } \
+    static inline long arraytype##_add_range(arraytype *array, \
+            const objtype *objects, long count) { \
+        return tssparse_add_range((struct _tssparse_abs *)array, objects, \
+                                  count, sizeof(objtype)); \
+    } \
+    static inline int arraytype##_remove_n(arraytype *array, \
+            const long *indices, long count) { \
+        return tssparse_remove_n((struct _tssparse_abs *)array, indices, \
+                                 count); \
+    } \
+    static inline objtype *arraytype##_get_nth(arraytype *array, long index) { \
+        return likely(tssparse_is_used(array->used_map, index)) \
+            ? (objtype *)tssparse_item((struct _tssparse_abs *)array, \
+                                       index, sizeof(objtype)) : NULL; \
     } \
-    static inline int arraytype##_remove(arraytype *array, int index) { \
-        return tssparse_remove((struct _tssparse_abs *)array, index, \
-                               sizeof(struct arraytype##_item)); \
+    static inline long arraytype##_add_handle(arraytype *array, \
+            objtype *object, tssparse_handle *handle) { \
+        return tssparse_add_handle((struct _tssparse_abs *)array, object, \
+                                   sizeof(objtype), handle); \
     } \
-    static inline objtype *arraytype##_get_nth(arraytype *array, int index) { \
-        struct arraytype##_item *item = &array->items[index]; \
-        return likely(item->used) ? &item->object : NULL; \
+    static inline int arraytype##_get_handle(arraytype *array, long index, \
+            tssparse_handle *handle) { \
+        return tssparse_get_handle((struct _tssparse_abs *)array, index, \
+                                   handle); \
+    } \
+    static inline objtype *arraytype##_lookup(arraytype *array, \
+            tssparse_handle handle) { \
+        return likely(tssparse_handle_is_valid(array->len, array->used_map, \
+                                               array->generations, handle)) \
+            ? (objtype *)tssparse_item((struct _tssparse_abs *)array, \
+                                       (long)TSSPARSE_HANDLE_INDEX(handle), \
+                                       sizeof(objtype)) : NULL; \
+    } \
+    static inline int arraytype##_remove_handle(arraytype *array, \
+            tssparse_handle handle) { \
+        return tssparse_remove_handle((struct _tssparse_abs *)array, handle); \
     } \
     static inline int arraytype##_compact(arraytype *array, int force) { \
         return tssparse_compact((struct _tssparse_abs *)array, force, \
-                                sizeof(objtype), sizeof(struct arraytype##_item)); \
+                                sizeof(objtype)); \
+    } \
+    static inline int arraytype##_compact_remap(arraytype *array, int force, \
+            tssparse_remap *remap) { \
+        return tssparse_compact_remap((struct _tssparse_abs *)array, force, \
+                sizeof(objtype), (struct _tsarray_pub *)remap); \
     } \
-    static inline int arraytype##_truncate(arraytype *array, int len) { \
+    static inline int arraytype##_compact_step(arraytype *array, \
+            int max_moves, const struct tssparse_compact_ops *ops) { \
+        return tssparse_compact_step((struct _tssparse_abs *)array, \
+                                     max_moves, ops, sizeof(objtype)); \
+    } \
+    static inline int arraytype##_truncate(arraytype *array, long len) { \
         return tssparse_truncate((struct _tssparse_abs *)array, len, \
-                                 sizeof(struct arraytype##_item)); \
+                                 sizeof(objtype)); \
     } \
-    static inline int arraytype##_setminlen(arraytype *array, int len) { \
+    static inline int arraytype##_setminlen(arraytype *array, long len) { \
         return tssparse_setminlen((struct _tssparse_abs *)array, len, \
-                                  sizeof(struct arraytype##_item)); \
+                                  sizeof(objtype)); \
+    } \
+    static inline int arraytype##_set_paged(arraytype *array, \
+            int page_shift) { \
+        return tssparse_set_paged((struct _tssparse_abs *)array, page_shift); \
+    } \
+    static inline int arraytype##_set_release(arraytype *array, \
+            int release) { \
+        return tssparse_set_release((struct _tssparse_abs *)array, release, \
+                                    sizeof(objtype)); \
+    } \
+    static inline void arraytype##_get_stats(const arraytype *array, \
+            struct tssparse_stats *stats) { \
+        tssparse_get_stats((const struct _tssparse_abs *)array, stats, \
+                           sizeof(objtype)); \
+    } \
+    static inline int arraytype##_save(const arraytype *array, int fd, \
+            int flags) { \
+        return tssparse_save((const struct _tssparse_abs *)array, fd, flags, \
+                             sizeof(objtype)); \
+    } \
+    static inline int arraytype##_load(arraytype *array, int fd) { \
+        return tssparse_load((struct _tssparse_abs *)array, fd, \
+                             sizeof(objtype)); \
+    } \
+    static inline int arraytype##_map(arraytype *array, const char *path) { \
+        return tssparse_map((struct _tssparse_abs *)array, path, \
+                            sizeof(objtype)); \
+    } \
+    static inline long arraytype##_next(const arraytype *array, long from) { \
+        return tssparse_next((const struct _tssparse_abs *)array, from, \
+                             sizeof(objtype)); \
+    } \
+    static inline int arraytype##_next_batch(const arraytype *array, \
+            long from, long *indices, int count) { \
+        return tssparse_next_batch((const struct _tssparse_abs *)array, \
+                                   from, indices, count); \
+    } \
+    static inline long arraytype##_next_free(const arraytype *array, \
+            int *resizes) { \
+        return tssparse_next_free((const struct _tssparse_abs *)array, \
+                                  resizes); \
     }
 
 
+/*
+ * Iterate over the used items of a tssparse, skipping the empty ones.
+ *
+ * Receives the tssparse's type, a pointer to the tssparse, and a long
+ * variable that will hold the index of each used item, in increasing
+ * order. Items may be removed while iterating; items added meanwhile may
+ * or may not be visited.
+ *
+ * Example:
+ *      long i;
+ *      TSSPARSE_FOREACH(intarray, &a1, i)
+ *          printf("a1[%ld] = %d\n", i, a1.items[i]);
+ */
+#define TSSPARSE_FOREACH(arraytype, array, index) \
+    for ((index) = arraytype##_next((array), 0); (index) >= 0; \
+         (index) = arraytype##_next((array), (index) + 1))
+
+
 
 /* Initializer for an empty tssparse. May be used directly as initializer on
  * a declaration, or as rvalue on an assignment expression (for an already
@@ -137,7 +507,8 @@ int tssparse_setminlen(struct _tssparse_abs *p_tssparse, int min_len,
  * into a compound literal (by prepending the type name in parenthesis), e.g.:
  *      a1 = (intarray)TSSPARSE_INITIALIZER;
  */
-#define TSSPARSE_INITIALIZER { 0, 0, 0, NULL }
+#define TSSPARSE_INITIALIZER \
+    { 0, 0, 0, 0, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, NULL, 0 }
 
 
 #endif      /* not _TSSPARSE_H */
@@ -0,0 +1,295 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <check.h>
+
+#include <tsarray.h>
+
+#include "setupcheck.h"
+
+
+#define COUNT 100003
+
+/* size of the log's header */
+#define HEADER_SIZE 64
+
+TSARRAY_TYPEDEF(chararray, char);
+
+
+static char path[] = "check-tsarray_log.XXXXXX";
+
+
+/*
+ * Create an empty file for a log, leaving its name in path.
+ */
+static void make_log(void)
+{
+    int fd;
+
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+}
+
+
+/*
+ * Get the size of the log.
+ */
+static off_t log_size(void)
+{
+    struct stat st;
+
+    ck_assert_int_eq(stat(path, &st), 0);
+
+    return st.st_size;
+}
+
+
+/*
+ * Check that an array holds the ints from 0 to len-1.
+ */
+static void check_seq(intarray *a, int len)
+{
+    int i;
+
+    ck_assert_uint_eq(intarray_len(a), len);
+
+    for (i=0; i<len; i++)
+        ck_assert_int_eq(a->items[i], i);
+}
+
+
+/*
+ * Test logging appends and extensions, and recovering them.
+ */
+START_TEST(test_recover)
+{
+    intarray *rest = intarray_new();
+    intarray *again = intarray_new();
+    int i;
+
+    make_log();
+
+    ck_assert_int_eq(intarray_log_open(a1, path, 4096, 0), 0);
+    ck_assert_int_eq(log_size(), HEADER_SIZE);
+
+    append_seq_checked(a1, 0, COUNT / 2);
+
+    for (i=COUNT/2; i<COUNT; i++)
+        ck_assert_int_eq(intarray_append(rest, &i), 0);
+    ck_assert_int_eq(intarray_extend(a1, rest), 0);
+    check_seq(a1, COUNT);
+
+    ck_assert_int_eq(intarray_log_sync(a1), 0);
+    ck_assert_int_eq(log_size(), HEADER_SIZE + COUNT * sizeof(int));
+    ck_assert_int_eq(intarray_log_sync(a1), 0);
+    ck_assert_int_eq(intarray_log_close(a1), 0);
+    ck_assert_int_eq(intarray_log_sync(a1), TSARRAY_EINVAL);
+
+    /* a1 is an ordinary array again */
+    ck_assert_int_eq(intarray_remove(a1, 0), 0);
+
+    ck_assert_int_eq(intarray_log_open(again, path, 0, 10), 0);
+    check_seq(again, COUNT);
+
+    i = COUNT;
+    ck_assert_int_eq(intarray_append(again, &i), 0);
+    intarray_free(again);
+
+    again = intarray_new();
+    ck_assert_int_eq(intarray_log_open(again, path, 0, 0), 0);
+    check_seq(again, COUNT + 1);
+
+    intarray_free(again);
+    intarray_free(rest);
+    unlink(path);
+}
+END_TEST
+
+
+/*
+ * Test recovering a log whose last item was cut short.
+ */
+START_TEST(test_torn)
+{
+    int fd;
+    int i;
+
+    make_log();
+
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, 0), 0);
+    append_seq_checked(a1, 0, 1000);
+    ck_assert_int_eq(intarray_log_close(a1), 0);
+
+    fd = open(path, O_WRONLY | O_APPEND);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(write(fd, "xy", 2), 2);
+    close(fd);
+
+    intarray_free(a1);
+    a1 = intarray_new();
+
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, 0), 0);
+    check_seq(a1, 1000);
+    ck_assert_int_eq(log_size(), HEADER_SIZE + 1000 * sizeof(int));
+
+    i = 1000;
+    ck_assert_int_eq(intarray_append(a1, &i), 0);
+    ck_assert_int_eq(intarray_log_close(a1), 0);
+
+    intarray_free(a1);
+    a1 = intarray_new();
+
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, 0), 0);
+    check_seq(a1, 1001);
+
+    unlink(path);
+}
+END_TEST
+
+
+/*
+ * Test appends that reach the log but can't be synced: they're kept in
+ * the array, while later appends fail and aren't.
+ */
+START_TEST(test_unsynced)
+{
+    struct rlimit old_limit, limit;
+    int x = 1;
+
+    make_log();
+
+    /* sync on every append */
+    ck_assert_int_eq(intarray_log_open(a1, path, 1, 0), 0);
+
+    /* room for the header and a single int */
+    signal(SIGXFSZ, SIG_IGN);
+    ck_assert_int_eq(getrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    limit = old_limit;
+    limit.rlim_cur = HEADER_SIZE + sizeof(int);
+    ck_assert_int_eq(setrlimit(RLIMIT_FSIZE, &limit), 0);
+
+    ck_assert_int_eq(intarray_append(a1, &x), 0);
+    ck_assert_int_eq(intarray_append(a1, &x), TSARRAY_ENOSYNC);
+    ck_assert_uint_eq(intarray_len(a1), 2);
+
+    ck_assert_int_eq(intarray_append(a1, &x), TSARRAY_EIO);
+    ck_assert_int_eq(intarray_extend(a1, a1), TSARRAY_EIO);
+    ck_assert_uint_eq(intarray_len(a1), 2);
+    ck_assert_int_eq(intarray_log_sync(a1), TSARRAY_EIO);
+    ck_assert_int_eq(intarray_log_close(a1), TSARRAY_EIO);
+
+    ck_assert_int_eq(setrlimit(RLIMIT_FSIZE, &old_limit), 0);
+    signal(SIGXFSZ, SIG_DFL);
+
+    ck_assert_int_eq(log_size(), HEADER_SIZE + sizeof(int));
+    unlink(path);
+}
+END_TEST
+
+
+/*
+ * Test what can't be done to or with a logged array.
+ */
+START_TEST(test_errors)
+{
+    chararray *chars = chararray_new();
+    intarray *other = intarray_new();
+    int x = 1;
+
+    make_log();
+
+    /* only empty arrays may start logging */
+    ck_assert_int_eq(intarray_append(other, &x), 0);
+    ck_assert_int_eq(intarray_log_open(other, path, 0, 0), TSARRAY_EINVAL);
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, -1), TSARRAY_EINVAL);
+
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, 0), 0);
+    ck_assert_int_eq(intarray_log_open(a1, path, 0, 0), TSARRAY_EINVAL);
+    ck_assert_int_eq(intarray_append(a1, &x), 0);
+
+    ck_assert_int_eq(intarray_remove(a1, 0), TSARRAY_EPERM);
+    ck_assert_int_eq(intarray_assign(a1, NULL, 0), TSARRAY_EPERM);
+    ck_assert_int_eq(intarray_read(a1, 0, 1), TSARRAY_EPERM);
+    ck_assert_uint_eq(intarray_len(a1), 1);
+
+    /* a log of ints isn't a log of chars */
+    ck_assert_int_eq(intarray_log_close(a1), 0);
+    ck_assert_int_eq(chararray_log_open(chars, path, 0, 0), TSARRAY_EINVAL);
+    ck_assert_uint_eq(chararray_len(chars), 0);
+
+    ck_assert_int_eq(intarray_log_open(other, "/nonexistent/log", 0, 0),
+                     TSARRAY_EINVAL);
+    intarray_free(other);
+    other = intarray_new();
+    ck_assert_int_eq(intarray_log_open(other, "/nonexistent/log", 0, 0),
+                     TSARRAY_EIO);
+
+    chararray_free(chars);
+    intarray_free(other);
+    unlink(path);
+}
+END_TEST
+
+
+Suite *tsarray_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsarray_log");
+
+    tc = tcase_with_a1_create("log");
+
+    tcase_add_test(tc, test_recover);
+    tcase_add_test(tc, test_torn);
+    tcase_add_test(tc, test_unsynced);
+    tcase_add_test(tc, test_errors);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsarray_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
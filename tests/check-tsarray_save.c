@@ -0,0 +1,446 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <check.h>
+
+#include <tsarray.h>
+
+#include "setupcheck.h"
+
+
+TSARRAY_TYPEDEF(chararray, char);
+
+
+static char path[] = "check-tsarray_save.XXXXXX";
+
+
+/*
+ * Create an empty temporary file for a test, and return a descriptor to
+ * it open for reading and writing.
+ */
+static int open_temp(void)
+{
+    int fd;
+
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+
+    return fd;
+}
+
+
+/*
+ * Close and remove a test's temporary file.
+ */
+static void close_temp(int fd)
+{
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(unlink(path), 0);
+}
+
+
+/*
+ * Check that two intarrays have the same items.
+ */
+static void check_same(const intarray *a, const intarray *b)
+{
+    unsigned long i;
+
+    ck_assert_uint_eq(intarray_len(a), intarray_len(b));
+
+    for (i=0; i<intarray_len(a); i++)
+        ck_assert_int_eq(a->items[i], b->items[i]);
+}
+
+
+/*
+ * Test saving several arrays to the same file and loading them back.
+ */
+START_TEST(test_save_load)
+{
+    intarray *empty = intarray_new();
+    intarray *loaded;
+    int fd = open_temp();
+
+    append_seq_checked(a1, -500, 10000);
+
+    ck_assert_int_eq(intarray_save(a1, fd), 0);
+    ck_assert_int_eq(intarray_save(empty, fd), 0);
+    ck_assert_int_eq(intarray_save(a1, fd), 0);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+
+    loaded = intarray_load(fd);
+    ck_assert_ptr_ne(loaded, NULL);
+    check_same(loaded, a1);
+    intarray_free(loaded);
+
+    loaded = intarray_load(fd);
+    ck_assert_ptr_ne(loaded, NULL);
+    ck_assert_uint_eq(intarray_len(loaded), 0);
+    intarray_free(loaded);
+
+    loaded = intarray_load(fd);
+    ck_assert_ptr_ne(loaded, NULL);
+    check_same(loaded, a1);
+
+    /* the loaded array is an ordinary one */
+    append_seq_checked(loaded, 0, 10);
+    intarray_free(loaded);
+
+    /* nothing left to load */
+    ck_assert_ptr_eq(intarray_load(fd), NULL);
+
+    intarray_free(empty);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test that loading refuses a different object size, a corrupt or a
+ * truncated array.
+ */
+START_TEST(test_load_bad)
+{
+    const int bad = 12345;
+    const off_t end = 64 + 100*sizeof(int);
+    intarray *loaded;
+    int fd = open_temp();
+
+    append_seq_checked(a1, 0, 100);
+    ck_assert_int_eq(intarray_save(a1, fd), 0);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_ptr_eq(chararray_load(fd), NULL);
+
+    /* corrupt the last item */
+    ck_assert_int_eq(pwrite(fd, &bad, sizeof(bad), end - sizeof(bad)),
+                     sizeof(bad));
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_ptr_eq(intarray_load(fd), NULL);
+
+    /* put it back, and cut it off instead */
+    ck_assert_int_eq(pwrite(fd, &a1->items[99], sizeof(int),
+                            end - sizeof(int)), sizeof(int));
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    loaded = intarray_load(fd);
+    ck_assert_ptr_ne(loaded, NULL);
+    check_same(loaded, a1);
+    intarray_free(loaded);
+
+    ck_assert_int_eq(ftruncate(fd, end - 1), 0);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_ptr_eq(intarray_load(fd), NULL);
+
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test mapping a saved array. It must have the saved items, and must not
+ * be changed.
+ */
+START_TEST(test_map)
+{
+    intarray *mapped;
+    intarray *copy;
+    int fd = open_temp();
+    int value = 0;
+
+    append_seq_checked(a1, -500, 10000);
+    ck_assert_int_eq(intarray_save(a1, fd), 0);
+
+    ck_assert_ptr_eq(chararray_map(path), NULL);
+
+    mapped = intarray_map(path);
+    ck_assert_ptr_ne(mapped, NULL);
+    check_same(mapped, a1);
+
+    ck_assert_int_eq(intarray_append(mapped, &value), TSARRAY_EROFS);
+    ck_assert_int_eq(intarray_extend(mapped, a1), TSARRAY_EROFS);
+    ck_assert_int_eq(intarray_remove(mapped, 0), TSARRAY_EROFS);
+    check_same(mapped, a1);
+
+    /* copies are ordinary arrays */
+    copy = intarray_copy(mapped);
+    ck_assert_ptr_ne(copy, NULL);
+    check_same(copy, a1);
+    ck_assert_int_eq(intarray_remove(copy, 0), 0);
+    intarray_free(copy);
+
+    intarray_free(mapped);
+
+    /* too short for its items */
+    ck_assert_int_eq(ftruncate(fd, 64 + 10*sizeof(int)), 0);
+    ck_assert_ptr_eq(intarray_map(path), NULL);
+
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test mapping a saved empty array, and a file which isn't one.
+ */
+START_TEST(test_map_empty)
+{
+    intarray *mapped;
+    int fd = open_temp();
+
+    ck_assert_ptr_eq(intarray_map(path), NULL);
+
+    ck_assert_int_eq(intarray_save(a1, fd), 0);
+
+    mapped = intarray_map(path);
+    ck_assert_ptr_ne(mapped, NULL);
+    ck_assert_uint_eq(intarray_len(mapped), 0);
+    ck_assert_ptr_eq(mapped->items, NULL);
+    intarray_free(mapped);
+
+    close_temp(fd);
+
+    ck_assert_ptr_eq(intarray_map(path), NULL);
+}
+END_TEST
+
+
+/*
+ * Test writing several arrays with tsarray_writev, and reading them back
+ * with tsarray_readv, after what the arrays already had.
+ */
+START_TEST(test_writev_readv)
+{
+    chararray *chars = chararray_new();
+    intarray *empty = intarray_new();
+    intarray *ints = intarray_new();
+    chararray *chars2 = chararray_new();
+    const struct _tsarray_pub *out[3];
+    struct _tsarray_pub *in[3];
+    unsigned long counts[3];
+    size_t done = 0;
+    int fd = open_temp();
+    char c;
+
+    append_seq_checked(a1, -500, 10000);
+    append_seq_checked(ints, 0, 3);
+
+    for (c='a'; c<='z'; c++)
+        ck_assert_int_eq(chararray_append(chars, &c), 0);
+
+    out[0] = (const struct _tsarray_pub *)a1;
+    out[1] = (const struct _tsarray_pub *)empty;
+    out[2] = (const struct _tsarray_pub *)chars;
+
+    ck_assert_int_eq(tsarray_writev(fd, out, 3, &done), 0);
+    ck_assert_uint_eq(done, 10500*sizeof(int) + 26);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_CUR), done);
+
+    in[0] = (struct _tsarray_pub *)ints;
+    in[1] = (struct _tsarray_pub *)chars2;
+    in[2] = (struct _tsarray_pub *)empty;
+    counts[0] = 10500;
+    counts[1] = 26;
+    counts[2] = 0;
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(tsarray_readv(fd, in, counts, 3, NULL), 0);
+
+    ck_assert_uint_eq(intarray_len(ints), 3 + 10500);
+    ck_assert_int_eq(ints->items[2], 2);
+    ck_assert_int_eq(ints->items[3], -500);
+    ck_assert_int_eq(ints->items[3 + 10499], 9999);
+    ck_assert_uint_eq(chararray_len(chars2), 26);
+    ck_assert_int_eq(chars2->items[25], 'z');
+    ck_assert_uint_eq(intarray_len(empty), 0);
+
+    /* the file ends early; nothing is appended */
+    counts[0] = 1;
+    ck_assert_int_eq(tsarray_readv(fd, in, counts, 1, NULL), TSARRAY_EIO);
+    ck_assert_uint_eq(intarray_len(ints), 3 + 10500);
+
+    intarray_free(ints);
+    intarray_free(empty);
+    chararray_free(chars);
+    chararray_free(chars2);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test resuming tsarray_writev and tsarray_readv on a non-blocking pipe,
+ * which holds much less than the array.
+ */
+START_TEST(test_writev_resume)
+{
+    intarray *copy = intarray_new();
+    const struct _tsarray_pub *out = (const struct _tsarray_pub *)a1;
+    struct _tsarray_pub *in = (struct _tsarray_pub *)copy;
+    const unsigned long count = 300000;
+    size_t written = 0;
+    size_t got = 0;
+    int write_ret = TSARRAY_EAGAIN;
+    int read_ret = TSARRAY_EAGAIN;
+    int rounds = 0;
+    int fds[2];
+    unsigned long i;
+
+    append_seq_checked(a1, 0, (int)count);
+
+    ck_assert_int_eq(pipe(fds), 0);
+    ck_assert_int_ne(fcntl(fds[0], F_SETFL, O_NONBLOCK), -1);
+    ck_assert_int_ne(fcntl(fds[1], F_SETFL, O_NONBLOCK), -1);
+
+    while (read_ret == TSARRAY_EAGAIN)
+    {
+        if (write_ret == TSARRAY_EAGAIN)
+            write_ret = tsarray_writev(fds[1], &out, 1, &written);
+
+        read_ret = tsarray_readv(fds[0], &in, &count, 1, &got);
+
+        /* nothing appended until it's all there */
+        if (read_ret == TSARRAY_EAGAIN)
+            ck_assert_uint_eq(intarray_len(copy), 0);
+
+        rounds++;
+    }
+
+    ck_assert_int_eq(write_ret, 0);
+    ck_assert_int_eq(read_ret, 0);
+    ck_assert_int_gt(rounds, 1);
+    ck_assert_uint_eq(written, count * sizeof(int));
+    ck_assert_uint_eq(got, written);
+
+    ck_assert_uint_eq(intarray_len(copy), count);
+    for (i=0; i<count; i++)
+        ck_assert_int_eq(copy->items[i], (int)i);
+
+    ck_assert_int_eq(close(fds[0]), 0);
+    ck_assert_int_eq(close(fds[1]), 0);
+    intarray_free(copy);
+}
+END_TEST
+
+
+/*
+ * Test reading a file in chunks with tsarray_read, and swapping arrays.
+ */
+START_TEST(test_read_swap)
+{
+    intarray *chunk = intarray_new();
+    chararray *chars = chararray_new();
+    int *items;
+    int fd = open_temp();
+    int expected = -500;
+    long n;
+
+    append_seq_checked(a1, -500, 10000);
+    ck_assert_int_eq(write(fd, a1->items, 10500*sizeof(int)),
+                     10500*sizeof(int));
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+
+    ck_assert_int_eq(intarray_read(chunk, fd, 4000), 4000);
+    items = chunk->items;
+
+    while ((n = intarray_len(chunk)) > 0)
+    {
+        long i;
+
+        for (i=0; i<n; i++)
+            ck_assert_int_eq(chunk->items[i], expected++);
+
+        /* the memory is reused */
+        ck_assert_ptr_eq(chunk->items, items);
+        ck_assert_int_eq(intarray_read(chunk, fd, 4000),
+                         min(4000, 10000 - expected));
+    }
+
+    ck_assert_int_eq(expected, 10000);
+
+    /* swapping moves the items, without copying them */
+    ck_assert_int_eq(intarray_read(chunk, fd, 10), 0);
+    ck_assert_int_eq(intarray_swap(chunk, a1), 0);
+    ck_assert_uint_eq(intarray_len(chunk), 10500);
+    ck_assert_uint_eq(intarray_len(a1), 0);
+    ck_assert_int_eq(tsarray_swap((struct _tsarray_pub *)chars,
+                                  (struct _tsarray_pub *)a1), TSARRAY_EINVAL);
+
+    /* the file ends in the middle of an item */
+    ck_assert_int_eq(write(fd, "x", 1), 1);
+    ck_assert_int_eq(lseek(fd, -3, SEEK_END), 10500*sizeof(int) - 2);
+    ck_assert_int_eq(chararray_read(chars, fd, 10), 3);
+    ck_assert_int_eq(chars->items[2], 'x');
+    ck_assert_int_eq(lseek(fd, -3, SEEK_END), 10500*sizeof(int) - 2);
+    ck_assert_int_eq(intarray_read(chunk, fd, 10), TSARRAY_EIO);
+    ck_assert_uint_eq(intarray_len(chunk), 0);
+
+    intarray_free(chunk);
+    chararray_free(chars);
+    close_temp(fd);
+}
+END_TEST
+
+
+Suite *tsarray_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsarray_save");
+
+    tc = tcase_with_a1_create("save");
+
+    tcase_add_test(tc, test_save_load);
+    tcase_add_test(tc, test_load_bad);
+    tcase_add_test(tc, test_map);
+    tcase_add_test(tc, test_map_empty);
+    tcase_add_test(tc, test_writev_readv);
+    tcase_add_test(tc, test_writev_resume);
+    tcase_add_test(tc, test_read_swap);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsarray_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
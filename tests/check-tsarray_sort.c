@@ -0,0 +1,242 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include <tsarray.h>
+
+#include "setupcheck.h"
+
+
+#define ARG_PTR ((void *)0x1234)
+
+#define COUNT 100003
+
+
+/* larger than the buffer used for swapping items */
+struct big {
+    int key;
+    char payload[97];
+};
+
+TSARRAY_TYPEDEF(bigarray, struct big);
+
+
+static int intcmp(const int *a, const int *b, void *arg)
+{
+    ck_assert_ptr_eq(arg, ARG_PTR);
+    return *a > *b ? 1 : (*a == *b ? 0 : -1);
+}
+
+
+static int bigcmp(const struct big *a, const struct big *b, void *arg)
+{
+    (void)arg;
+    return a->key > b->key ? 1 : (a->key == b->key ? 0 : -1);
+}
+
+
+/*
+ * Check that a1 holds COUNT items in ascending order, summing to sum.
+ */
+static void check_sorted(long long sum)
+{
+    long long got = 0;
+    long i;
+
+    ck_assert_uint_eq(intarray_len(a1), COUNT);
+
+    for (i=0; i<COUNT; i++)
+    {
+        if (i > 0)
+            ck_assert_int_le(a1->items[i-1], a1->items[i]);
+        got += a1->items[i];
+    }
+
+    ck_assert(got == sum);
+}
+
+
+/*
+ * Test sorting empty and single item arrays.
+ */
+START_TEST(test_trivial)
+{
+    int x = 47;
+
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    ck_assert_uint_eq(intarray_len(a1), 0);
+
+    intarray_append(a1, &x);
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    ck_assert_uint_eq(intarray_len(a1), 1);
+    ck_assert_int_eq(a1->items[0], 47);
+}
+END_TEST
+
+
+/*
+ * Test sorting random items, with many duplicates.
+ */
+START_TEST(test_random)
+{
+    unsigned int seed = 12345;
+    long long sum = 0;
+    int i;
+
+    for (i=0; i<COUNT; i++)
+    {
+        int x;
+
+        seed = seed * 1103515245 + 12345;
+        x = (int)(seed >> 16) % 1000;
+        sum += x;
+        ck_assert_int_eq(intarray_append(a1, &x), 0);
+    }
+
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    check_sorted(sum);
+}
+END_TEST
+
+
+/*
+ * Test sorting items already in order, in reverse order, and all equal.
+ */
+START_TEST(test_ordered)
+{
+    int i;
+
+    append_seq_checked(a1, 0, COUNT);
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    check_sorted((long long)COUNT * (COUNT - 1) / 2);
+
+    for (i=0; i<COUNT; i++)
+        a1->items[i] = COUNT - 1 - i;
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    check_sorted((long long)COUNT * (COUNT - 1) / 2);
+
+    for (i=0; i<COUNT; i++)
+        a1->items[i] = 7;
+    ck_assert_int_eq(intarray_sort(a1, intcmp, ARG_PTR), 0);
+    check_sorted((long long)COUNT * 7);
+}
+END_TEST
+
+
+/*
+ * Test sorting objects larger than the swap buffer; each object's payload
+ * must move along with its key.
+ */
+START_TEST(test_big_objects)
+{
+    bigarray *big = bigarray_new();
+    int i;
+
+    ck_assert_ptr_ne(big, NULL);
+
+    for (i=0; i<1000; i++)
+    {
+        struct big item;
+
+        item.key = (i * 7919) % 1000;
+        memset(item.payload, item.key & 0x7f, sizeof(item.payload));
+        ck_assert_int_eq(bigarray_append(big, &item), 0);
+    }
+
+    ck_assert_int_eq(bigarray_sort(big, bigcmp, NULL), 0);
+
+    for (i=0; i<1000; i++)
+    {
+        ck_assert_int_eq(big->items[i].key, i);
+        ck_assert_int_eq(big->items[i].payload[0], i & 0x7f);
+        ck_assert_int_eq(big->items[i].payload[96], i & 0x7f);
+    }
+
+    bigarray_free(big);
+}
+END_TEST
+
+
+/*
+ * Test replacing an array's contents with a C array, growing, shrinking
+ * and emptying it.
+ */
+START_TEST(test_assign)
+{
+    const int src[] = { 5, 4, 3, 2, 1 };
+    int i;
+
+    append_seq_checked(a1, 0, 100);
+
+    ck_assert_int_eq(intarray_assign(a1, src, 5), 0);
+    ck_assert_uint_eq(intarray_len(a1), 5);
+    for (i=0; i<5; i++)
+        ck_assert_int_eq(a1->items[i], 5 - i);
+
+    ck_assert_int_eq(intarray_assign(a1, src, 2), 0);
+    ck_assert_uint_eq(intarray_len(a1), 2);
+    ck_assert_int_eq(a1->items[1], 4);
+
+    ck_assert_int_eq(intarray_assign(a1, NULL, 0), 0);
+    ck_assert_uint_eq(intarray_len(a1), 0);
+}
+END_TEST
+
+
+Suite *tsarray_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsarray_sort");
+
+    tc = tcase_with_a1_create("sort");
+
+    tcase_add_test(tc, test_trivial);
+    tcase_add_test(tc, test_random);
+    tcase_add_test(tc, test_ordered);
+    tcase_add_test(tc, test_big_objects);
+    tcase_add_test(tc, test_assign);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsarray_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,474 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <check.h>
+
+#include <tscompactor.h>
+
+#include "setupcheck.h"
+#include "setupsparse.h"
+
+
+#define COUNT 20000
+
+static pthread_mutex_t s1_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* value expected at each index of s1, or -1 if empty, and index of each
+ * value; kept up to date with s1_lock held */
+static int owner[2*COUNT];
+static long where[2*COUNT];
+
+
+/*
+ * Follow a move made by the compactor (called with s1_lock held).
+ */
+static void follow_move(long from, long to, void *arg)
+{
+    (void)arg;
+
+    ck_assert_int_eq(owner[to], -1);
+    owner[to] = owner[from];
+    owner[from] = -1;
+    where[owner[to]] = to;
+}
+
+
+/*
+ * Sleep for about a millisecond.
+ */
+static void nap(void)
+{
+    const struct timespec delay = { 0, 1000000 };
+
+    nanosleep(&delay, NULL);
+}
+
+
+/*
+ * Test compacting in the background while another thread keeps adding and
+ * removing. Every move must be reported, and the array must end up
+ * compacted.
+ */
+START_TEST(test_background)
+{
+    const struct tssparse_compact_ops ops = { NULL, follow_move, NULL,
+                                              NULL };
+    struct tscompactor compactor;
+    int done = 0;
+    int tries;
+    long i;
+
+    for (i=0; i<2*COUNT; i++)
+        owner[i] = -1;
+
+    for (i=0; i<COUNT; i++)
+    {
+        int value = (int)i;
+
+        ck_assert_int_eq(intsparse_add(&s1, &value), i);
+        owner[i] = value;
+        where[value] = i;
+    }
+
+    ck_assert_int_eq(TSCOMPACTOR_START(&compactor, &s1, &s1_lock, 16, 1,
+                                       &ops), 0);
+
+    /* remove most objects, and add a few, while the compactor runs */
+    for (i=0; i<COUNT; i++)
+    {
+        pthread_mutex_lock(&s1_lock);
+
+        if (i % 4 != 0)
+        {
+            const long index = where[i];
+
+            ck_assert_int_eq(owner[index], i);
+            ck_assert_int_eq(tscompactor_remove(&compactor, index), 0);
+            owner[index] = -1;
+        }
+        else if (i % 8 == 0)
+        {
+            int value = COUNT + (int)i;
+            const long index = tscompactor_add(&compactor, &value);
+
+            ck_assert_int_ge(index, 0);
+            ck_assert_int_lt(index, 2*COUNT);
+            owner[index] = value;
+            where[value] = index;
+        }
+
+        pthread_mutex_unlock(&s1_lock);
+
+        if (i % 1000 == 0)
+            tscompactor_wake(&compactor);
+    }
+
+    tscompactor_wake(&compactor);
+
+    for (tries=0; tries<10000 && !done; tries++)
+    {
+        nap();
+
+        pthread_mutex_lock(&s1_lock);
+        done = !s1.compacting && !tssparse_compact_default_policy(
+                s1.len, s1.used_count, NULL);
+        pthread_mutex_unlock(&s1_lock);
+    }
+
+    /* reading doesn't take the lock */
+    pthread_mutex_lock(&s1_lock);
+    for (i=0; i<2*COUNT; i++)
+    {
+        int value;
+
+        if (owner[i] < 0)
+            ck_assert_int_eq(tscompactor_get(&compactor, i, &value),
+                             TSCOMPACTOR_ENOENT);
+        else
+        {
+            ck_assert_int_eq(tscompactor_get(&compactor, i, &value), 0);
+            ck_assert_int_eq(value, owner[i]);
+        }
+    }
+    pthread_mutex_unlock(&s1_lock);
+
+    tscompactor_stop(&compactor);
+
+    ck_assert(done);
+    check_sparse(&s1);
+    ck_assert_int_lt(s1.len, COUNT / 2);
+
+    for (i=0; i<s1.len; i++)
+    {
+        if (owner[i] < 0)
+            ck_assert_ptr_eq(intsparse_get_nth(&s1, i), NULL);
+        else
+            ck_assert_int_eq(*intsparse_get_nth(&s1, i), owner[i]);
+    }
+
+    for (; i<2*COUNT; i++)
+        ck_assert_int_eq(owner[i], -1);
+}
+END_TEST
+
+
+#define READERS 3
+#define ROUNDS 6
+#define WIDE_LEN 8
+
+
+/* object for the readers test; all its members are the same, so that a
+ * torn read shows */
+struct wide {
+    long v[WIDE_LEN];
+};
+
+TSSPARSE_TYPEDEF(widesparse, struct wide);
+
+static widesparse wides;
+static pthread_mutex_t wides_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tscompactor wides_compactor;
+static int readers_stopping;
+
+
+/*
+ * Thread for the readers test: reads random items until told to stop,
+ * checking that every object it gets is whole.
+ *
+ * Returns how many objects it got, cast to a pointer.
+ */
+static void *reader_thread(void *arg)
+{
+    unsigned int seed = *(unsigned int *)arg;
+    long found = 0;
+
+    while (!__atomic_load_n(&readers_stopping, __ATOMIC_RELAXED))
+    {
+        struct wide object;
+        int k;
+
+        /* xorshift; rand() isn't thread-safe */
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        if (tscompactor_get(&wides_compactor, (long)(seed % (2*COUNT)),
+                            &object) != 0)
+            continue;
+
+        ck_assert_int_ge(object.v[0], 0);
+        for (k=1; k<WIDE_LEN; k++)
+            ck_assert_int_eq(object.v[k], object.v[0]);
+
+        found++;
+    }
+
+    return (void *)found;
+}
+
+
+/*
+ * Add an object to wides, with every member set to value, through the
+ * compactor if it's running.
+ */
+static void add_wide(long value, int running)
+{
+    struct wide object;
+    int k;
+
+    for (k=0; k<WIDE_LEN; k++)
+        object.v[k] = value;
+
+    if (!running)
+    {
+        ck_assert_int_ge(widesparse_add(&wides, &object), 0);
+        return;
+    }
+
+    pthread_mutex_lock(&wides_lock);
+    ck_assert_int_ge(tscompactor_add(&wides_compactor, &object), 0);
+    pthread_mutex_unlock(&wides_lock);
+}
+
+
+/*
+ * Test reading without the lock, while the array is compacted, grown and
+ * shrunk. No reader may ever get part of one object and part of another.
+ */
+START_TEST(test_readers)
+{
+    pthread_t threads[READERS];
+    unsigned int seeds[READERS];
+    long value = 0;
+    int round;
+    long i;
+
+    wides = (widesparse)TSSPARSE_INITIALIZER;
+
+    for (i=0; i<COUNT; i++)
+        add_wide(value++, 0);
+
+    ck_assert_int_eq(TSCOMPACTOR_START(&wides_compactor, &wides,
+                                       &wides_lock, 16, 1, NULL), 0);
+
+    readers_stopping = 0;
+    for (i=0; i<READERS; i++)
+    {
+        seeds[i] = (unsigned int)i * 2654435761u + 1;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, reader_thread,
+                                        &seeds[i]), 0);
+    }
+
+    for (round=0; round<ROUNDS; round++)
+    {
+        /* leave holes for the compactor to fill, then grow it again */
+        for (i=0; i<2*COUNT; i++)
+        {
+            if (i % 4 == 0)
+                continue;
+
+            pthread_mutex_lock(&wides_lock);
+            if (i < wides.len)
+                ck_assert_int_eq(tscompactor_remove(&wides_compactor, i), 0);
+            pthread_mutex_unlock(&wides_lock);
+        }
+
+        tscompactor_wake(&wides_compactor);
+
+        for (i=0; i<COUNT/2; i++)
+        {
+            add_wide(value++, 1);
+
+            if (i % 256 == 0)
+                sched_yield();
+        }
+    }
+
+    __atomic_store_n(&readers_stopping, 1, __ATOMIC_RELAXED);
+
+    for (i=0; i<READERS; i++)
+    {
+        void *found;
+
+        ck_assert_int_eq(pthread_join(threads[i], &found), 0);
+        ck_assert_int_gt((long)found, 0);
+    }
+
+    tscompactor_stop(&wides_compactor);
+
+    for (i=0; i<wides.len; i++)
+    {
+        const struct wide *object = widesparse_get_nth(&wides, i);
+        int k;
+
+        if (object != NULL)
+            for (k=1; k<WIDE_LEN; k++)
+                ck_assert_int_eq(object->v[k], object->v[0]);
+    }
+
+    ck_assert_int_eq(widesparse_truncate(&wides, 0), 0);
+}
+END_TEST
+
+
+/* results of the reads made while a move is under way */
+static int move_reads[3];
+static int move_read_done;
+
+
+/*
+ * Read the items being moved, and one which isn't, from the compactor's
+ * own thread, in the middle of a move (called with s1_lock held). A
+ * reader that waited for the writer would never come back.
+ */
+static void read_in_move(long from, long to, void *arg)
+{
+    struct tscompactor *compactor = arg;
+    int value;
+
+    if (move_read_done)
+        return;
+
+    move_reads[0] = tscompactor_get(compactor, from, &value);
+    move_reads[1] = tscompactor_get(compactor, to, &value);
+    move_reads[2] = tscompactor_get(compactor, 0, &value);
+    ck_assert_int_eq(value, 0);
+
+    __atomic_store_n(&move_read_done, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Test that readers never wait for writers, even on their own thread:
+ * while an item is being moved, it reads as empty at both ends, and
+ * while the array is being changed, the readers see it as it was.
+ */
+START_TEST(test_wait_free)
+{
+    struct tscompactor compactor;
+    const struct tssparse_compact_ops ops = { NULL, NULL, &compactor,
+                                              read_in_move };
+    int tries;
+    int value;
+    long i;
+
+    for (i=0; i<COUNT; i++)
+    {
+        value = (int)i;
+        ck_assert_int_eq(intsparse_add(&s1, &value), i);
+    }
+
+    for (i=1; i<COUNT; i+=2)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    move_read_done = 0;
+    ck_assert_int_eq(TSCOMPACTOR_START(&compactor, &s1, &s1_lock, 16, 1,
+                                       &ops), 0);
+    tscompactor_wake(&compactor);
+
+    for (tries=0; tries<10000
+                  && !__atomic_load_n(&move_read_done, __ATOMIC_ACQUIRE);
+         tries++)
+        nap();
+
+    ck_assert(move_read_done);
+    ck_assert_int_eq(move_reads[0], TSCOMPACTOR_ENOENT);
+    ck_assert_int_eq(move_reads[1], TSCOMPACTOR_ENOENT);
+    ck_assert_int_eq(move_reads[2], 0);
+
+    pthread_mutex_lock(&s1_lock);
+
+    ck_assert_int_eq(tscompactor_begin_change(&compactor, s1.len), 0);
+    ck_assert_int_eq(intsparse_truncate(&s1, 0), 0);
+
+    ck_assert_int_eq(tscompactor_get(&compactor, 0, &value), 0);
+    ck_assert_int_eq(value, 0);
+
+    tscompactor_end_change(&compactor);
+
+    ck_assert_int_eq(tscompactor_get(&compactor, 0, &value),
+                     TSCOMPACTOR_ENOENT);
+
+    pthread_mutex_unlock(&s1_lock);
+
+    tscompactor_stop(&compactor);
+}
+END_TEST
+
+
+/*
+ * Test starting with bad arguments, and stopping an idle compactor.
+ */
+START_TEST(test_start_stop)
+{
+    struct tscompactor compactor;
+
+    ck_assert_int_eq(TSCOMPACTOR_START(&compactor, &s1, &s1_lock, 0, 1,
+                                       NULL), TSCOMPACTOR_EINVAL);
+    ck_assert_int_eq(TSCOMPACTOR_START(&compactor, &s1, &s1_lock, 1, 0,
+                                       NULL), TSCOMPACTOR_EINVAL);
+
+    ck_assert_int_eq(TSCOMPACTOR_START(&compactor, &s1, &s1_lock, 1, 10000,
+                                       NULL), 0);
+    tscompactor_stop(&compactor);
+}
+END_TEST
+
+
+Suite *tscompactor_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tscompactor");
+
+    tc = tcase_with_s1_create("background");
+
+    tcase_add_test(tc, test_background);
+    tcase_add_test(tc, test_readers);
+    tcase_add_test(tc, test_wait_free);
+    tcase_add_test(tc, test_start_stop);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tscompactor_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
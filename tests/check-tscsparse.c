@@ -0,0 +1,423 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <check.h>
+
+#include <tscsparse.h>
+
+#include "setupcheck.h"
+
+
+TSCSPARSE_TYPEDEF(intcsparse, int);
+
+
+static intcsparse t1;
+
+
+static void new_t1(void)
+{
+    t1 = (intcsparse)TSCSPARSE_INITIALIZER;
+}
+
+
+static void del_t1(void)
+{
+    intcsparse_clear(&t1);
+    ck_assert_int_eq(t1.segment_count, 0);
+    ck_assert_ptr_eq(t1.segments[0], NULL);
+}
+
+
+/*
+ * Check that no item of a tscsparse is claimed, i.e. every cache has been
+ * flushed, and every object removed.
+ */
+static void check_unclaimed(const intcsparse *t)
+{
+    int k;
+    long w;
+
+    for (k=0; k<t->segment_count; k++)
+    {
+        for (w=0; w<TSCSPARSE_SEG_LEN(k)/TSCSPARSE_MAP_BITS; w++)
+        {
+            ck_assert_uint_eq(t->segments[k]->claim_map[w], 0);
+            ck_assert_uint_eq(t->segments[k]->used_map[w], 0);
+        }
+    }
+}
+
+
+/*
+ * Test adding, getting and removing objects from a single thread.
+ */
+START_TEST(test_add_get)
+{
+    struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+    long indices[100];
+    int i;
+
+    for (i=0; i<100; i++)
+    {
+        indices[i] = intcsparse_add(&t1, &cache, &i);
+        ck_assert_int_ge(indices[i], 0);
+        ck_assert_int_lt(indices[i], intcsparse_capacity(&t1));
+    }
+
+    ck_assert_int_eq(intcsparse_capacity(&t1), TSCSPARSE_SEG_BASE);
+
+    for (i=0; i<100; i++)
+        ck_assert_int_eq(*intcsparse_get_nth(&t1, indices[i]), i);
+
+    for (i=0; i<100; i+=2)
+        ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[i]), 0);
+
+    for (i=0; i<100; i++)
+    {
+        if (i % 2 == 0)
+            ck_assert_ptr_eq(intcsparse_get_nth(&t1, indices[i]), NULL);
+        else
+            ck_assert_int_eq(*intcsparse_get_nth(&t1, indices[i]), i);
+    }
+
+    /* only one remove wins */
+    ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[0]),
+                     TSCSPARSE_ENOENT);
+    ck_assert_int_eq(intcsparse_remove(&t1, &cache, -1), TSCSPARSE_EINVAL);
+    ck_assert_int_eq(intcsparse_remove(&t1, &cache, TSCSPARSE_SEG_BASE),
+                     TSCSPARSE_EINVAL);
+    ck_assert_ptr_eq(intcsparse_get_nth(&t1, TSCSPARSE_SEG_BASE), NULL);
+
+    /* the last item removed is the first reused */
+    ck_assert_int_eq(intcsparse_add(&t1, &cache, &i), indices[98]);
+
+    ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[98]), 0);
+    for (i=1; i<100; i+=2)
+        ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[i]), 0);
+
+    intcsparse_flush(&t1, &cache);
+    ck_assert_int_eq(cache.count, 0);
+    check_unclaimed(&t1);
+}
+END_TEST
+
+
+/*
+ * Test that items held by a cache are given back by flushing it, and can
+ * then be used through another cache.
+ */
+START_TEST(test_flush)
+{
+    struct tscsparse_cache a = TSCSPARSE_CACHE_INITIALIZER;
+    struct tscsparse_cache b = TSCSPARSE_CACHE_INITIALIZER;
+    int value = 1;
+    long index;
+    int i;
+
+    index = intcsparse_add(&t1, &a, &value);
+    ck_assert_int_ge(index, 0);
+    ck_assert_int_eq(a.count, TSCSPARSE_MAP_BITS - 1);
+
+    intcsparse_flush(&t1, &a);
+    ck_assert_int_eq(a.count, 0);
+
+    /* everything else fits without growing */
+    for (i=1; i<TSCSPARSE_SEG_BASE; i++)
+        ck_assert_int_ge(intcsparse_add(&t1, &b, &i), 0);
+
+    ck_assert_int_eq(intcsparse_capacity(&t1), TSCSPARSE_SEG_BASE);
+    ck_assert_int_eq(b.count, 0);
+
+    ck_assert_int_ge(intcsparse_add(&t1, &b, &value), TSCSPARSE_SEG_BASE);
+    ck_assert_int_eq(intcsparse_capacity(&t1), TSCSPARSE_SEG_START(2));
+
+    intcsparse_flush(&t1, &b);
+}
+END_TEST
+
+
+/*
+ * Test that growing the array doesn't move the objects already in it.
+ */
+START_TEST(test_growth_stable)
+{
+    struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+    const int count = 10 * TSCSPARSE_SEG_BASE;
+    long *indices = malloc((size_t)count * sizeof(long));
+    int *first;
+    int i;
+
+    ck_assert_ptr_ne(indices, NULL);
+
+    for (i=0; i<count; i++)
+        indices[i] = intcsparse_add(&t1, &cache, &i);
+
+    first = intcsparse_get_nth(&t1, indices[0]);
+    ck_assert_ptr_ne(first, NULL);
+
+    /* grow some more */
+    for (i=0; i<count; i++)
+    {
+        ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[i]), 0);
+        indices[i] = intcsparse_add(&t1, &cache, &i);
+        ck_assert_int_ge(intcsparse_add(&t1, &cache, &i), 0);
+    }
+
+    ck_assert_int_ge(t1.segment_count, 4);
+
+    for (i=0; i<count; i++)
+        ck_assert_int_eq(*intcsparse_get_nth(&t1, indices[i]), i);
+
+    ck_assert_ptr_eq(intcsparse_get_nth(&t1, indices[0]), first);
+
+    intcsparse_flush(&t1, &cache);
+    free(indices);
+}
+END_TEST
+
+
+#define THREADS 4
+#define THREAD_LIVE 300
+#define THREAD_OPS 50000
+
+
+/*
+ * Thread for the churn test: adds and removes objects tagged with its
+ * number, checking that nobody else touched them.
+ */
+static void *churn_thread(void *arg)
+{
+    const int id = *(int *)arg;
+    struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+    long live[THREAD_LIVE];
+    int values[THREAD_LIVE];
+    int live_count = 0;
+    unsigned int seed = (unsigned int)id * 2654435761u + 1;
+    int i;
+
+    for (i=0; i<THREAD_OPS; i++)
+    {
+        /* xorshift; rand() isn't thread-safe */
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        if (live_count < THREAD_LIVE && (live_count == 0 || seed % 2 == 0))
+        {
+            int value = (id << 24) | i;
+            const long index = intcsparse_add(&t1, &cache, &value);
+
+            ck_assert_int_ge(index, 0);
+            live[live_count] = index;
+            values[live_count++] = value;
+        }
+        else
+        {
+            const int pick = (int)((seed >> 1) % (unsigned int)live_count);
+
+            ck_assert_int_eq(*intcsparse_get_nth(&t1, live[pick]),
+                             values[pick]);
+            ck_assert_int_eq(intcsparse_remove(&t1, &cache, live[pick]), 0);
+
+            live[pick] = live[--live_count];
+            values[pick] = values[live_count];
+        }
+    }
+
+    for (i=0; i<live_count; i++)
+    {
+        ck_assert_int_eq(*intcsparse_get_nth(&t1, live[i]), values[i]);
+        ck_assert_int_eq(intcsparse_remove(&t1, &cache, live[i]), 0);
+    }
+
+    intcsparse_flush(&t1, &cache);
+
+    return NULL;
+}
+
+
+/*
+ * Test several threads adding and removing at once. No item may be handed
+ * out to two threads at a time.
+ */
+START_TEST(test_threads)
+{
+    pthread_t threads[THREADS];
+    int ids[THREADS];
+    int i;
+
+    for (i=0; i<THREADS; i++)
+    {
+        ids[i] = i + 1;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, churn_thread,
+                                        &ids[i]), 0);
+    }
+
+    for (i=0; i<THREADS; i++)
+        ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+
+    /* everything was given back */
+    check_unclaimed(&t1);
+    ck_assert_int_le(intcsparse_capacity(&t1),
+                     TSCSPARSE_SEG_START(4));
+}
+END_TEST
+
+
+#define GROW_ROUNDS 20
+#define GROW_COUNT (3 * TSCSPARSE_SEG_BASE)
+
+
+static pthread_barrier_t grow_barrier;
+
+
+/*
+ * Thread for the growth test: waits for the others, so that they all find
+ * the array full at once, then adds objects tagged with its number, and
+ * reads back the ones the others added.
+ */
+static void *grow_thread(void *arg)
+{
+    const int id = *(int *)arg;
+    struct tscsparse_cache cache = TSCSPARSE_CACHE_INITIALIZER;
+    long *indices = malloc(GROW_COUNT * sizeof(long));
+    long capacity;
+    long i;
+
+    ck_assert_ptr_ne(indices, NULL);
+
+    pthread_barrier_wait(&grow_barrier);
+
+    for (i=0; i<GROW_COUNT; i++)
+    {
+        int value = (id << 24) | (int)i;
+
+        indices[i] = intcsparse_add(&t1, &cache, &value);
+        ck_assert_int_ge(indices[i], 0);
+    }
+
+    /* once everyone is done adding, every segment seen through the count
+     * must be there, with whatever the other threads put in it */
+    pthread_barrier_wait(&grow_barrier);
+
+    capacity = intcsparse_capacity(&t1);
+    for (i=0; i<capacity; i++)
+    {
+        const int *object = intcsparse_get_nth(&t1, i);
+
+        if (object != NULL)
+            ck_assert_int_ge(*object >> 24, 1);
+    }
+
+    pthread_barrier_wait(&grow_barrier);
+
+    for (i=0; i<GROW_COUNT; i++)
+    {
+        ck_assert_int_eq(*intcsparse_get_nth(&t1, indices[i]),
+                         (id << 24) | (int)i);
+        ck_assert_int_eq(intcsparse_remove(&t1, &cache, indices[i]), 0);
+    }
+
+    intcsparse_flush(&t1, &cache);
+    free(indices);
+
+    return NULL;
+}
+
+
+/*
+ * Test several threads growing an empty array at once, over and over. Only
+ * one segment may be kept each time, and every thread must see it whole.
+ */
+START_TEST(test_threads_grow)
+{
+    pthread_t threads[THREADS];
+    int ids[THREADS];
+    int round;
+    int i;
+
+    for (round=0; round<GROW_ROUNDS; round++)
+    {
+        ck_assert_int_eq(pthread_barrier_init(&grow_barrier, NULL,
+                                              THREADS), 0);
+
+        for (i=0; i<THREADS; i++)
+        {
+            ids[i] = i + 1;
+            ck_assert_int_eq(pthread_create(&threads[i], NULL, grow_thread,
+                                            &ids[i]), 0);
+        }
+
+        for (i=0; i<THREADS; i++)
+            ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+
+        pthread_barrier_destroy(&grow_barrier);
+
+        check_unclaimed(&t1);
+        for (i=0; i<t1.segment_count; i++)
+            ck_assert_ptr_ne(t1.segments[i], NULL);
+        ck_assert_ptr_eq(t1.segments[t1.segment_count], NULL);
+
+        intcsparse_clear(&t1);
+    }
+}
+END_TEST
+
+
+Suite *tscsparse_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tscsparse");
+
+    tc = tcase_create("concurrent");
+    tcase_add_checked_fixture(tc, new_t1, del_t1);
+
+    tcase_add_test(tc, test_add_get);
+    tcase_add_test(tc, test_flush);
+    tcase_add_test(tc, test_growth_stable);
+    tcase_add_test(tc, test_threads);
+    tcase_add_test(tc, test_threads_grow);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tscsparse_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
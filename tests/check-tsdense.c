@@ -0,0 +1,256 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <check.h>
+
+#include <tsdense.h>
+
+#include "setupcheck.h"
+
+
+TSDENSE_TYPEDEF(intdense, int);
+
+
+static intdense d1;
+
+
+static void new_d1(void)
+{
+    d1 = (intdense)TSDENSE_INITIALIZER;
+}
+
+
+static void del_d1(void)
+{
+    intdense_clear(&d1);
+    ck_assert_int_eq(d1.count, 0);
+    ck_assert_int_eq(d1.len, 0);
+    ck_assert_ptr_eq(d1.objects, NULL);
+}
+
+
+/*
+ * Check the invariants of a tsdense: the maps are the reverse of each
+ * other, and objects holds at least count items.
+ */
+static void check_dense(const intdense *d)
+{
+    int i;
+
+    ck_assert_int_ge(d->count, 0);
+    ck_assert_int_le(d->count, d->len);
+
+    if (d->len == 0)
+        return;
+
+    ck_assert_uint_eq(intarray_len((const intarray *)d->indices), d->len);
+    ck_assert_uint_eq(intarray_len((const intarray *)d->positions), d->len);
+    ck_assert_uint_ge(intarray_len((const intarray *)d->objects), d->count);
+
+    for (i=0; i<d->len; i++)
+    {
+        const int index = d->indices->items[i];
+
+        ck_assert_int_ge(index, 0);
+        ck_assert_int_lt(index, d->len);
+        ck_assert_int_eq(d->positions->items[index], i);
+    }
+}
+
+
+/*
+ * Test adding and getting objects by index.
+ */
+START_TEST(test_add_get)
+{
+    int i;
+
+    ck_assert_ptr_eq(intdense_get_nth(&d1, 0), NULL);
+
+    for (i=0; i<100; i++)
+        ck_assert_int_eq(intdense_add(&d1, &i), i);
+
+    ck_assert_int_eq(d1.count, 100);
+    check_dense(&d1);
+
+    for (i=0; i<100; i++)
+        ck_assert_int_eq(*intdense_get_nth(&d1, i), i);
+
+    ck_assert_ptr_eq(intdense_get_nth(&d1, 100), NULL);
+    ck_assert_ptr_eq(intdense_get_nth(&d1, -1), NULL);
+}
+END_TEST
+
+
+/*
+ * Test that removing an object moves the last one into its place, and
+ * that its index is reused.
+ */
+START_TEST(test_remove_swaps_last)
+{
+    int value = 42;
+    int i;
+
+    for (i=0; i<10; i++)
+        ck_assert_int_eq(intdense_add(&d1, &i), i);
+
+    ck_assert_int_eq(intdense_remove(&d1, 3), 0);
+    ck_assert_int_eq(d1.count, 9);
+    ck_assert_ptr_eq(intdense_get_nth(&d1, 3), NULL);
+    ck_assert_int_eq(d1.objects->items[3], 9);
+    ck_assert_int_eq(d1.indices->items[3], 9);
+    ck_assert_ptr_eq(intdense_get_nth(&d1, 9), &d1.objects->items[3]);
+    check_dense(&d1);
+
+    /* removing twice does nothing; out of range is an error */
+    ck_assert_int_eq(intdense_remove(&d1, 3), 0);
+    ck_assert_int_eq(d1.count, 9);
+    ck_assert_int_eq(intdense_remove(&d1, 10), TSDENSE_EINVAL);
+    ck_assert_int_eq(intdense_remove(&d1, -1), TSDENSE_EINVAL);
+
+    ck_assert_int_eq(intdense_add(&d1, &value), 3);
+    ck_assert_int_eq(d1.len, 10);
+    ck_assert_int_eq(*intdense_get_nth(&d1, 3), value);
+    check_dense(&d1);
+
+    /* removing the last object doesn't move anything */
+    ck_assert_int_eq(intdense_remove(&d1, 3), 0);
+    ck_assert_int_eq(d1.objects->items[3], 9);
+    check_dense(&d1);
+}
+END_TEST
+
+
+/*
+ * Test that removing every object while walking backwards visits each
+ * one once, and leaves all indices free.
+ */
+START_TEST(test_remove_all_backwards)
+{
+    long sum = 0;
+    int i;
+
+    for (i=0; i<1000; i++)
+        ck_assert_int_eq(intdense_add(&d1, &i), i);
+
+    for (i=d1.count-1; i>=0; i--)
+    {
+        sum += d1.objects->items[i];
+        ck_assert_int_eq(intdense_remove(&d1, d1.indices->items[i]), 0);
+    }
+
+    ck_assert_int_eq(sum, 999L*1000/2);
+    ck_assert_int_eq(d1.count, 0);
+    ck_assert_int_eq(d1.len, 1000);
+    check_dense(&d1);
+}
+END_TEST
+
+
+/*
+ * Test many adds and removes, checking against a simple model.
+ */
+START_TEST(test_churn)
+{
+    const int count = 2000;
+    int *model = malloc((size_t)count * sizeof(int));
+    int i;
+
+    ck_assert_ptr_ne(model, NULL);
+    for (i=0; i<count; i++)
+        model[i] = -1;
+
+    srand(1);
+
+    for (i=0; i<20*count; i++)
+    {
+        const int index = rand() % count;
+
+        if (model[index] >= 0)
+        {
+            ck_assert_int_eq(intdense_remove(&d1, index), 0);
+            model[index] = -1;
+        }
+        else if (d1.count < count)
+        {
+            int added = intdense_add(&d1, &i);
+
+            ck_assert_int_ge(added, 0);
+            ck_assert_int_lt(added, count);
+            ck_assert_int_eq(model[added], -1);
+            model[added] = i;
+        }
+    }
+
+    check_dense(&d1);
+
+    for (i=0; i<count; i++)
+    {
+        if (model[i] >= 0)
+            ck_assert_int_eq(*intdense_get_nth(&d1, i), model[i]);
+        else
+            ck_assert_ptr_eq(intdense_get_nth(&d1, i), NULL);
+    }
+
+    free(model);
+}
+END_TEST
+
+
+Suite *tsdense_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsdense");
+
+    tc = tcase_create("dense");
+    tcase_add_checked_fixture(tc, new_d1, del_d1);
+
+    tcase_add_test(tc, test_add_get);
+    tcase_add_test(tc, test_remove_swaps_last);
+    tcase_add_test(tc, test_remove_all_backwards);
+    tcase_add_test(tc, test_churn);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsdense_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,325 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include <tsextsort.h>
+
+#include "setupcheck.h"
+
+
+#define COUNT 100003
+
+
+static char path[] = "check-tsextsort.XXXXXX";
+
+
+static int intcmp(const int *a, const int *b, void *arg)
+{
+    (void)arg;
+    return *a > *b ? 1 : (*a == *b ? 0 : -1);
+}
+
+
+/*
+ * Create an empty temporary file, and return a descriptor to it.
+ */
+static int open_temp(void)
+{
+    int fd;
+
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(unlink(path), 0);
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+
+    return fd;
+}
+
+
+/*
+ * Fill a1 with COUNT pseudo-random ints from 0 to COUNT-1, with
+ * duplicates, and return their sum.
+ */
+static long long fill_random(void)
+{
+    unsigned int seed = 4242;
+    long long sum = 0;
+    int i;
+
+    for (i=0; i<COUNT; i++)
+    {
+        int x;
+
+        seed = seed * 1103515245 + 12345;
+        x = (int)((seed >> 8) % COUNT);
+        sum += x;
+        ck_assert_int_eq(intarray_append(a1, &x), 0);
+    }
+
+    return sum;
+}
+
+
+/*
+ * Take every object out of a finished sort, a chunk at a time, checking
+ * they come in order and add up to sum.
+ */
+static void check_next(struct tsextsort *sort, unsigned long chunk_len,
+        long long sum)
+{
+    intarray *chunk = intarray_new();
+    unsigned long total = 0;
+    long long got_sum = 0;
+    int last = -1;
+    long n;
+    long i;
+
+    ck_assert_ptr_ne(chunk, NULL);
+
+    while ((n = TSEXTSORT_NEXT(sort, chunk, chunk_len)) > 0)
+    {
+        ck_assert_uint_eq(intarray_len(chunk), n);
+        ck_assert_uint_le(n, chunk_len);
+
+        for (i=0; i<n; i++)
+        {
+            ck_assert_int_le(last, chunk->items[i]);
+            last = chunk->items[i];
+            got_sum += last;
+        }
+
+        total += (unsigned long)n;
+    }
+
+    ck_assert_int_eq(n, 0);
+    ck_assert_uint_eq(total, COUNT);
+    ck_assert(got_sum == sum);
+
+    intarray_free(chunk);
+}
+
+
+/*
+ * Test a sort that fits in a single run, and so never touches the disk.
+ */
+START_TEST(test_in_memory)
+{
+    struct tsextsort sort;
+    const long long sum = fill_random();
+
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, COUNT, intcmp, NULL, "."), 0);
+    ck_assert_int_eq(tsextsort_add(&sort, a1->items, COUNT), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), 0);
+    ck_assert_int_eq(sort.run_count, 0);
+
+    check_next(&sort, 1000, sum);
+
+    tsextsort_free(&sort);
+}
+END_TEST
+
+
+/*
+ * Test spilling runs to disk and merging them back, a chunk at a time.
+ */
+START_TEST(test_merge)
+{
+    struct tsextsort sort;
+    const long long sum = fill_random();
+
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 10000, intcmp, NULL, "."), 0);
+
+    /* in pieces, so runs don't line up with the calls */
+    ck_assert_int_eq(tsextsort_add(&sort, a1->items, 12345), 0);
+    ck_assert_int_eq(tsextsort_add(&sort, a1->items + 12345,
+                                   COUNT - 12345), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), 0);
+
+    /* 11 runs, but too small a budget for more than two merge buffers of
+     * MIN_MERGE_BUFFER, so they're merged two at a time */
+    ck_assert_int_eq(sort.fan_in, 2);
+    ck_assert_int_eq(sort.run_count, 2);
+
+    check_next(&sort, 777, sum);
+
+    tsextsort_free(&sort);
+
+    /* a budget of 16 MiB has room for 63 merge buffers of 256 KiB, plus
+     * the output buffer */
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 4 << 20, intcmp, NULL, "."),
+                     0);
+    ck_assert_int_eq(sort.fan_in, 63);
+    tsextsort_free(&sort);
+}
+END_TEST
+
+
+/*
+ * Test reading a file of exactly one run, which must stay in memory.
+ */
+START_TEST(test_file_one_run)
+{
+    struct tsextsort sort;
+    const long long sum = fill_random();
+    const int in_fd = open_temp();
+
+    ck_assert_int_eq(write(in_fd, a1->items, COUNT * sizeof(int)),
+                     COUNT * sizeof(int));
+    ck_assert_int_eq(lseek(in_fd, 0, SEEK_SET), 0);
+
+    /* nowhere to spill to, so any spill would fail */
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, COUNT, intcmp, NULL,
+                                    "/nonexistent"), 0);
+    ck_assert_int_eq(tsextsort_add_fd(&sort, in_fd), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), 0);
+    ck_assert_int_eq(sort.run_count, 0);
+
+    check_next(&sort, 1000, sum);
+
+    tsextsort_free(&sort);
+    close(in_fd);
+}
+END_TEST
+
+
+/*
+ * Test sorting a file into another, with so many runs that they must be
+ * merged in more than one pass.
+ */
+START_TEST(test_file)
+{
+    struct tsextsort sort;
+    const long long sum = fill_random();
+    const int in_fd = open_temp();
+    const int out_fd = open_temp();
+    intarray *result;
+    long long got_sum = 0;
+    long i;
+
+    ck_assert_int_eq(write(in_fd, a1->items, COUNT * sizeof(int)),
+                     COUNT * sizeof(int));
+    ck_assert_int_eq(lseek(in_fd, 0, SEEK_SET), 0);
+
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 500, intcmp, NULL, "."), 0);
+    ck_assert_int_eq(tsextsort_add(&sort, a1->items, 10), 0);
+    ck_assert_int_eq(tsextsort_add_fd(&sort, in_fd), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), 0);
+    ck_assert_int_le(sort.run_count, 64);
+
+    ck_assert_int_eq(tsextsort_write(&sort, out_fd), 0);
+    tsextsort_free(&sort);
+
+    ck_assert_int_eq(lseek(out_fd, 0, SEEK_SET), 0);
+    result = intarray_new();
+    ck_assert_int_eq(intarray_read(result, out_fd, 2*COUNT), COUNT + 10);
+
+    for (i=0; i<COUNT+10; i++)
+    {
+        if (i > 0)
+            ck_assert_int_le(result->items[i-1], result->items[i]);
+        got_sum += result->items[i];
+    }
+
+    for (i=0; i<10; i++)
+        got_sum -= a1->items[i];
+
+    ck_assert(got_sum == sum);
+
+    intarray_free(result);
+    close(in_fd);
+    close(out_fd);
+}
+END_TEST
+
+
+/*
+ * Test bad arguments and calls out of order.
+ */
+START_TEST(test_errors)
+{
+    struct tsextsort sort;
+    int x = 1;
+
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 0, intcmp, NULL, NULL),
+                     TSEXTSORT_EINVAL);
+
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 10, intcmp, NULL,
+                                    "/nonexistent"), 0);
+    ck_assert_int_eq(TSEXTSORT_NEXT(&sort, a1, 1), TSEXTSORT_EINVAL);
+    ck_assert_int_eq(tsextsort_write(&sort, 1), TSEXTSORT_EINVAL);
+
+    /* a single run needs no temporary files */
+    ck_assert_int_eq(tsextsort_add(&sort, &x, 1), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), 0);
+    ck_assert_int_eq(tsextsort_finish(&sort), TSEXTSORT_EINVAL);
+    ck_assert_int_eq(tsextsort_add(&sort, &x, 1), TSEXTSORT_EINVAL);
+    tsextsort_free(&sort);
+
+    /* can't create the temporary files, once the first run is full */
+    ck_assert_int_eq(TSEXTSORT_INIT(&sort, a1, 1, intcmp, NULL,
+                                    "/nonexistent"), 0);
+    ck_assert_int_eq(tsextsort_add(&sort, &x, 1), 0);
+    ck_assert_int_eq(tsextsort_add(&sort, &x, 1), TSEXTSORT_EIO);
+    tsextsort_free(&sort);
+}
+END_TEST
+
+
+Suite *tsextsort_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsextsort");
+
+    tc = tcase_with_a1_create("extsort");
+
+    tcase_add_test(tc, test_in_memory);
+    tcase_add_test(tc, test_merge);
+    tcase_add_test(tc, test_file);
+    tcase_add_test(tc, test_file_one_run);
+    tcase_add_test(tc, test_errors);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsextsort_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,269 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <check.h>
+
+#include <tspack.h>
+
+#include "setupcheck.h"
+
+
+/* not a multiple of the block length */
+#define COUNT 100003
+
+TSARRAY_TYPEDEF(u64array, uint64_t);
+TSARRAY_TYPEDEF(i64array, int64_t);
+
+
+static u64array *values;
+
+
+static void values_setup(void)
+{
+    values = u64array_new();
+    ck_assert_ptr_ne(values, NULL);
+}
+
+
+static void values_teardown(void)
+{
+    u64array_free(values);
+}
+
+
+/*
+ * Get the next pseudo-random 64-bit number.
+ */
+static uint64_t next_random(uint64_t *seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *seed ^ (*seed >> 29);
+}
+
+
+/*
+ * Compress values, and check every way of getting them back.
+ */
+static void check_roundtrip(void)
+{
+    const unsigned long len = u64array_len(values);
+    struct tspack *pack = TSPACK_NEW(values);
+    uint64_t *out;
+    unsigned long start;
+    unsigned long i;
+
+    ck_assert_ptr_ne(pack, NULL);
+    ck_assert_uint_eq(tspack_len(pack), len);
+
+    for (i=0; i<len; i++)
+        ck_assert(tspack_get(pack, i) == values->items[i]);
+
+    out = malloc((len + 1) * sizeof(*out));
+    ck_assert_ptr_ne(out, NULL);
+
+    /* all at once, and asking for more than there is */
+    ck_assert_int_eq(tspack_decode(pack, 0, out, len + 1), len);
+    for (i=0; i<len; i++)
+        ck_assert(out[i] == values->items[i]);
+
+    /* in runs that don't line up with the blocks */
+    for (start=3; start<len; start+=77)
+    {
+        const long n = tspack_decode(pack, start, out, 77);
+
+        ck_assert_int_eq(n, min(77UL, len - start));
+        for (i=0; i<(unsigned long)n; i++)
+            ck_assert(out[i] == values->items[start + i]);
+    }
+
+    ck_assert_int_eq(tspack_decode(pack, len, out, 10), 0);
+    ck_assert_int_eq(tspack_decode(pack, len + 1, out, 10), TSPACK_EINVAL);
+
+    free(out);
+    tspack_free(pack);
+}
+
+
+/*
+ * Test empty and tiny arrays.
+ */
+START_TEST(test_small)
+{
+    uint64_t x = 42;
+
+    check_roundtrip();
+
+    ck_assert_int_eq(u64array_append(values, &x), 0);
+    check_roundtrip();
+
+    x = UINT64_MAX;
+    ck_assert_int_eq(u64array_append(values, &x), 0);
+    check_roundtrip();
+}
+END_TEST
+
+
+/*
+ * Test sorted IDs with small gaps, which compress as differences.
+ */
+START_TEST(test_sorted)
+{
+    uint64_t seed = 1;
+    uint64_t id = 1000000000000ULL;
+    struct tspack *pack;
+    int i;
+
+    for (i=0; i<COUNT; i++)
+    {
+        id += 1 + next_random(&seed) % 16;
+        ck_assert_int_eq(u64array_append(values, &id), 0);
+    }
+
+    check_roundtrip();
+
+    /* 4 bits each, and a little for the blocks */
+    pack = TSPACK_NEW(values);
+    ck_assert_uint_lt(tspack_size(pack), COUNT * sizeof(uint64_t) / 8);
+    tspack_free(pack);
+}
+END_TEST
+
+
+/*
+ * Test values packed at every width, in both kinds of blocks, and values
+ * too wide to pack.
+ */
+START_TEST(test_widths)
+{
+    uint64_t seed = 7;
+    unsigned int width;
+    int i;
+
+    for (width=0; width<=40; width++)
+    {
+        const uint64_t mask = width == 0 ? 0 : UINT64_MAX >> (64 - width);
+        uint64_t value = 5;
+
+        /* frame of reference, making sure the whole width is used */
+        for (i=0; i<TSPACK_BLOCK_LEN; i++)
+        {
+            uint64_t x = (next_random(&seed) & mask) + 123456789;
+
+            if (i == 0)
+                x = 123456789;
+            else if (i == TSPACK_BLOCK_LEN - 1)
+                x = mask + 123456789;
+            ck_assert_int_eq(u64array_append(values, &x), 0);
+        }
+
+        /* increasing, with differences just as wide */
+        for (i=0; i<TSPACK_BLOCK_LEN; i++)
+        {
+            value += next_random(&seed) & mask;
+            ck_assert_int_eq(u64array_append(values, &value), 0);
+        }
+    }
+
+    /* full 64-bit values */
+    for (i=0; i<COUNT; i++)
+    {
+        uint64_t x = next_random(&seed);
+
+        ck_assert_int_eq(u64array_append(values, &x), 0);
+    }
+
+    check_roundtrip();
+}
+END_TEST
+
+
+/*
+ * Test signed timestamps going from negative to positive, decreasing and
+ * increasing, with the differences themselves changing sign.
+ */
+START_TEST(test_signed)
+{
+    i64array *stamps = i64array_new();
+    struct tspack *pack;
+    uint64_t seed = 3;
+    int64_t t = -5000000;
+    int i;
+
+    for (i=0; i<COUNT; i++)
+    {
+        t += (int64_t)(next_random(&seed) % 200) - (i < COUNT/2 ? 50 : 150);
+        ck_assert_int_eq(i64array_append(stamps, &t), 0);
+        ck_assert_int_eq(u64array_append(values, (uint64_t *)&t), 0);
+    }
+
+    check_roundtrip();
+
+    pack = TSPACK_NEW(stamps);
+    ck_assert_ptr_ne(pack, NULL);
+    for (i=0; i<COUNT; i+=101)
+        ck_assert(tspack_get(pack, i) == (uint64_t)stamps->items[i]);
+
+    ck_assert_uint_lt(tspack_size(pack), COUNT * sizeof(int64_t) / 4);
+
+    tspack_free(pack);
+    i64array_free(stamps);
+}
+END_TEST
+
+
+Suite *tspack_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tspack");
+
+    tc = tcase_create("pack");
+    tcase_add_checked_fixture(tc, values_setup, values_teardown);
+
+    tcase_add_test(tc, test_small);
+    tcase_add_test(tc, test_sorted);
+    tcase_add_test(tc, test_widths);
+    tcase_add_test(tc, test_signed);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tspack_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
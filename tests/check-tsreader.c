@@ -0,0 +1,196 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include <tsreader.h>
+
+#include "setupcheck.h"
+
+
+#define COUNT 100003
+
+TSARRAY_TYPEDEF(chararray, char);
+
+
+static char path[] = "check-tsreader.XXXXXX";
+
+
+/*
+ * Create a temporary file holding the ints from 0 to COUNT-1, followed by
+ * extra bytes, and return a descriptor to it, at its start.
+ */
+static int open_temp(size_t extra)
+{
+    int fd;
+    int i;
+
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(unlink(path), 0);
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+
+    append_seq_checked(a1, 0, COUNT);
+    ck_assert_int_eq(write(fd, a1->items, COUNT*sizeof(int)),
+                     COUNT*sizeof(int));
+
+    for (i=0; (size_t)i<extra; i++)
+        ck_assert_int_eq(write(fd, "x", 1), 1);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+
+    return fd;
+}
+
+
+/*
+ * Test reading a whole file in chunks.
+ */
+START_TEST(test_chunks)
+{
+    struct tsreader reader;
+    intarray *chunk = intarray_new();
+    int fd = open_temp(0);
+    int expected = 0;
+    int chunks = 0;
+    long n;
+
+    ck_assert_int_eq(TSREADER_START(&reader, fd, chunk, 1000), 0);
+
+    while ((n = TSREADER_NEXT(&reader, chunk)) > 0)
+    {
+        long i;
+
+        ck_assert_uint_eq(intarray_len(chunk), n);
+        ck_assert_int_eq(n, min(1000, COUNT - expected));
+
+        for (i=0; i<n; i++)
+            ck_assert_int_eq(chunk->items[i], expected++);
+
+        chunks++;
+    }
+
+    ck_assert_int_eq(n, 0);
+    ck_assert_int_eq(expected, COUNT);
+    ck_assert_int_eq(chunks, (COUNT + 999) / 1000);
+
+    /* stays at the end */
+    ck_assert_int_eq(TSREADER_NEXT(&reader, chunk), 0);
+
+    tsreader_stop(&reader);
+    intarray_free(chunk);
+    ck_assert_int_eq(close(fd), 0);
+}
+END_TEST
+
+
+/*
+ * Test a file which ends in the middle of an object, and the wrong array.
+ */
+START_TEST(test_errors)
+{
+    struct tsreader reader;
+    intarray *chunk = intarray_new();
+    chararray *chars = chararray_new();
+    int fd = open_temp(2);
+    long total = 0;
+    long n;
+
+    ck_assert_int_eq(TSREADER_START(&reader, fd, chunk, 0), TSREADER_EINVAL);
+    ck_assert_int_eq(TSREADER_START(&reader, fd, chunk, COUNT - 3), 0);
+
+    ck_assert_int_eq(TSREADER_NEXT(&reader, chars), TSREADER_EINVAL);
+
+    while ((n = TSREADER_NEXT(&reader, chunk)) > 0)
+        total += n;
+
+    ck_assert_int_eq(n, TSREADER_EIO);
+    ck_assert_int_eq(total, COUNT - 3);
+    ck_assert_int_eq(TSREADER_NEXT(&reader, chunk), TSREADER_EIO);
+
+    tsreader_stop(&reader);
+    intarray_free(chunk);
+    chararray_free(chars);
+    ck_assert_int_eq(close(fd), 0);
+}
+END_TEST
+
+
+/*
+ * Test stopping before the end of the file.
+ */
+START_TEST(test_stop_early)
+{
+    struct tsreader reader;
+    intarray *chunk = intarray_new();
+    int fd = open_temp(0);
+
+    ck_assert_int_eq(TSREADER_START(&reader, fd, chunk, 100), 0);
+    ck_assert_int_eq(TSREADER_NEXT(&reader, chunk), 100);
+    ck_assert_int_eq(chunk->items[99], 99);
+    tsreader_stop(&reader);
+
+    /* the caller's array is still there */
+    ck_assert_int_eq(chunk->items[99], 99);
+
+    intarray_free(chunk);
+    ck_assert_int_eq(close(fd), 0);
+}
+END_TEST
+
+
+Suite *tsreader_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsreader");
+
+    tc = tcase_with_a1_create("reader");
+
+    tcase_add_test(tc, test_chunks);
+    tcase_add_test(tc, test_errors);
+    tcase_add_test(tc, test_stop_early);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsreader_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
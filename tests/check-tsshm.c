@@ -0,0 +1,283 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <check.h>
+
+#include <tsshm.h>
+
+#include "setupcheck.h"
+
+
+/* several times the initial capacity, to make the segment grow */
+#define COUNT 100003
+
+TSSHM_TYPEDEF(intshm, int);
+TSSHM_TYPEDEF(longshm, long);
+
+
+/*
+ * Check that a view of a shared array holds the ints from 0 to len-1.
+ */
+static void check_seq(const intshm *shm, long len)
+{
+    long i;
+
+    ck_assert_uint_eq(intshm_len(shm), len);
+
+    for (i=0; i<len; i++)
+        ck_assert_int_eq(shm->items[i], i);
+}
+
+
+/*
+ * Test appending to an anonymous array, with a reader following along
+ * as the segment grows.
+ */
+START_TEST(test_anonymous)
+{
+    intshm *writer = intshm_create(NULL, 0);
+    intshm *reader;
+    int x = 1;
+    int i;
+
+    ck_assert_ptr_ne(writer, NULL);
+    reader = intshm_from_fd(intshm_fd(writer));
+    ck_assert_ptr_ne(reader, NULL);
+
+    ck_assert_int_eq(intshm_refresh(reader), 0);
+    ck_assert_int_eq(intshm_append(reader, &x), TSSHM_EPERM);
+
+    for (i=0; i<COUNT; i++)
+    {
+        ck_assert_int_eq(intshm_append(writer, &i), 0);
+
+        /* nothing is seen until a refresh */
+        if (i % 9973 == 0)
+        {
+            ck_assert_uint_eq(intshm_len(reader), i == 0 ? 0 : i - 9973 + 1);
+            ck_assert_int_eq(intshm_refresh(reader), i + 1);
+            check_seq(reader, i + 1);
+        }
+    }
+
+    check_seq(writer, COUNT);
+    ck_assert_int_eq(intshm_refresh(writer), COUNT);
+
+    /* a reader outlives the writer */
+    intshm_free(writer);
+    ck_assert_int_eq(intshm_refresh(reader), COUNT);
+    check_seq(reader, COUNT);
+
+    intshm_free(reader);
+}
+END_TEST
+
+
+/*
+ * Test appending many objects at once.
+ */
+START_TEST(test_extend)
+{
+    intshm *writer = intshm_create(NULL, 10);
+    intshm *reader;
+
+    ck_assert_ptr_ne(writer, NULL);
+    reader = intshm_from_fd(intshm_fd(writer));
+    ck_assert_ptr_ne(reader, NULL);
+
+    append_seq_checked(a1, 0, COUNT);
+
+    ck_assert_int_eq(intshm_extend(writer, NULL, 0), 0);
+    ck_assert_int_eq(intshm_extend(writer, NULL, 5), TSSHM_EINVAL);
+    ck_assert_int_eq(intshm_extend(writer, a1->items, 10), 0);
+    ck_assert_int_eq(intshm_extend(writer, a1->items + 10, COUNT - 10), 0);
+    ck_assert_int_eq(intshm_extend(reader, a1->items, 1), TSSHM_EPERM);
+
+    ck_assert_int_eq(intshm_refresh(reader), COUNT);
+    check_seq(reader, COUNT);
+
+    intshm_free(writer);
+    intshm_free(reader);
+}
+END_TEST
+
+
+/*
+ * Test a writer in another process, with the reader polling as it goes.
+ */
+START_TEST(test_fork)
+{
+    intshm *writer = intshm_create(NULL, 0);
+    intshm *reader;
+    long last = 0;
+    long len;
+    pid_t pid;
+    int status;
+
+    ck_assert_ptr_ne(writer, NULL);
+    reader = intshm_from_fd(intshm_fd(writer));
+    ck_assert_ptr_ne(reader, NULL);
+
+    pid = fork();
+    ck_assert_int_ge(pid, 0);
+
+    if (pid == 0)
+    {
+        int i;
+
+        for (i=0; i<COUNT; i++)
+            if (intshm_append(writer, &i) != 0)
+                _exit(1);
+
+        _exit(0);
+    }
+
+    do
+    {
+        len = intshm_refresh(reader);
+        ck_assert_int_ge(len, last);
+
+        for (; last<len; last++)
+            ck_assert_int_eq(reader->items[last], last);
+
+        sched_yield();
+    } while (len < COUNT);
+
+    ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+    ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    intshm_free(writer);
+    intshm_free(reader);
+}
+END_TEST
+
+
+/*
+ * Test attaching to a named array, and to the wrong sort of array.
+ */
+START_TEST(test_named)
+{
+    char name[64];
+    intshm *writer;
+    intshm *reader;
+    int x = 42;
+
+    snprintf(name, sizeof(name), "/check-tsshm-%ld", (long)getpid());
+
+    writer = intshm_create(name, 0);
+    ck_assert_ptr_ne(writer, NULL);
+    ck_assert_int_eq(intshm_append(writer, &x), 0);
+
+    ck_assert_ptr_eq(intshm_create(name, 0), NULL);
+    ck_assert_int_eq(errno, EEXIST);
+
+    ck_assert_ptr_eq(longshm_open(name), NULL);
+    ck_assert_int_eq(errno, EINVAL);
+
+    reader = intshm_open(name);
+    ck_assert_ptr_ne(reader, NULL);
+    ck_assert_int_eq(intshm_refresh(reader), 1);
+    ck_assert_int_eq(reader->items[0], 42);
+
+    ck_assert_int_eq(shm_unlink(name), 0);
+    ck_assert_ptr_eq(intshm_open(name), NULL);
+    ck_assert_int_eq(errno, ENOENT);
+
+    ck_assert_ptr_eq(tsshm_create(NULL, 0, 0), NULL);
+    ck_assert_int_eq(errno, EINVAL);
+
+    intshm_free(writer);
+    intshm_free(reader);
+}
+END_TEST
+
+
+/*
+ * Test attaching to a named segment between its creation and its
+ * initialisation: first empty, then sized but with no header yet.
+ */
+START_TEST(test_open_early)
+{
+    char name[64];
+    int fd;
+
+    snprintf(name, sizeof(name), "/check-tsshm-early-%ld", (long)getpid());
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    ck_assert_int_ge(fd, 0);
+
+    ck_assert_ptr_eq(intshm_open(name), NULL);
+    ck_assert_int_eq(errno, EAGAIN);
+
+    ck_assert_int_eq(ftruncate(fd, 4096), 0);
+    ck_assert_ptr_eq(intshm_open(name), NULL);
+    ck_assert_int_eq(errno, EAGAIN);
+
+    ck_assert_int_eq(shm_unlink(name), 0);
+    close(fd);
+}
+END_TEST
+
+
+Suite *tsshm_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tsshm");
+
+    tc = tcase_with_a1_create("shm");
+
+    tcase_add_test(tc, test_anonymous);
+    tcase_add_test(tc, test_extend);
+    tcase_add_test(tc, test_fork);
+    tcase_add_test(tc, test_named);
+    tcase_add_test(tc, test_open_early);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tsshm_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,913 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdlib.h>
+#include <check.h>
+
+#include <tssparse.h>
+
+#include "setupcheck.h"
+#include "setupsparse.h"
+
+
+TSSPARSE_TYPEDEF(charsparse, char);
+
+
+/*
+ * Test that a removed item is reused before the array grows.
+ */
+START_TEST(test_add_reuses_hole)
+{
+    int value = 42;
+    int index;
+
+    add_seq_checked(&s1, 0, 10);
+    ck_assert_int_eq(s1.len, 10);
+
+    ck_assert_int_eq(intsparse_remove(&s1, 4), 0);
+    ck_assert_int_eq(s1.used_count, 9);
+    check_sparse(&s1);
+
+    index = intsparse_add(&s1, &value);
+    ck_assert_int_eq(index, 4);
+    ck_assert_int_eq(s1.len, 10);
+    ck_assert_int_eq(s1.used_count, 10);
+    ck_assert_int_eq(*intsparse_get_nth(&s1, 4), value);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that the lowest hole is always reused first, even when the holes
+ * are far apart.
+ */
+START_TEST(test_add_lowest_hole)
+{
+    const long holes[] = { 70000, 10, 4100, 64, 70001, 263000 };
+    const int hole_count = (int)(sizeof(holes) / sizeof(holes[0]));
+    long lowest = -1;
+    int value = -1;
+    int i, j;
+
+    add_seq_checked(&s1, 0, 270000);
+
+    for (i=0; i<hole_count; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, holes[i]), 0);
+    check_sparse(&s1);
+
+    for (i=0; i<hole_count; i++)
+    {
+        long next = s1.len;
+
+        /* the lowest hole above the one we just filled */
+        for (j=0; j<hole_count; j++)
+            if (holes[j] > lowest && holes[j] < next)
+                next = holes[j];
+
+        ck_assert_int_eq(intsparse_add(&s1, &value), next);
+        lowest = next;
+    }
+
+    ck_assert_int_eq(s1.used_count, s1.len);
+    check_sparse(&s1);
+    ck_assert_int_eq(intsparse_add(&s1, &value), s1.len - 1);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that removing an already removed item doesn't change anything.
+ */
+START_TEST(test_remove_twice)
+{
+    add_seq_checked(&s1, 0, 5);
+
+    ck_assert_int_eq(intsparse_remove(&s1, 2), 0);
+    ck_assert_int_eq(intsparse_remove(&s1, 2), 0);
+    ck_assert_int_eq(s1.used_count, 4);
+    check_sparse(&s1);
+
+    ck_assert_int_eq(intsparse_remove(&s1, 5), TSSPARSE_EINVAL);
+    ck_assert_int_eq(intsparse_remove(&s1, -1), TSSPARSE_EINVAL);
+}
+END_TEST
+
+
+/*
+ * Test that adding without an object leaves the returned item free.
+ */
+START_TEST(test_add_null)
+{
+    int index;
+
+    add_seq_checked(&s1, 0, 3);
+    index = intsparse_add(&s1, NULL);
+
+    ck_assert_int_eq(index, 3);
+    ck_assert_int_eq(s1.used_count, 3);
+    ck_assert_ptr_eq(intsparse_get_nth(&s1, index), NULL);
+    check_sparse(&s1);
+
+    /* the same free item is handed out next */
+    add_seq_checked(&s1, 3, 4);
+    ck_assert_int_eq(s1.len, 4);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that growing the array makes the new items available, lowest
+ * first, and shrinking drops the ones that were cut off.
+ */
+START_TEST(test_truncate_free_slots)
+{
+    add_seq_checked(&s1, 0, 4);
+
+    ck_assert_int_eq(intsparse_truncate(&s1, 8), 0);
+    ck_assert_int_eq(s1.used_count, 4);
+    check_sparse(&s1);
+    ck_assert_int_eq(intsparse_add(&s1, NULL), 4);
+
+    ck_assert_int_eq(intsparse_remove(&s1, 1), 0);
+    ck_assert_int_eq(intsparse_truncate(&s1, 3), 0);
+    ck_assert_int_eq(s1.len, 3);
+    ck_assert_int_eq(s1.used_count, 2);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that compacting leaves only holes at the end, all reusable.
+ */
+START_TEST(test_compact_free_slots)
+{
+    int i;
+
+    ck_assert_int_eq(intsparse_setminlen(&s1, 20), 0);
+    add_seq_checked(&s1, 0, 20);
+
+    for (i=0; i<20; i+=2)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_compact(&s1, 0), 0);
+    ck_assert_int_eq(s1.len, 20);
+    ck_assert_int_eq(s1.used_count, 10);
+    check_sparse(&s1);
+
+    for (i=0; i<10; i++)
+        ck_assert_int_eq(*intsparse_get_nth(&s1, i), 2*i+1);
+
+    ck_assert_int_eq(intsparse_add(&s1, &i), 10);
+}
+END_TEST
+
+
+/*
+ * Test that the remap from compacting points each old index at its
+ * object's new place.
+ */
+START_TEST(test_compact_remap)
+{
+    tssparse_remap *remap = tssparse_remap_new();
+    int i;
+
+    ck_assert_ptr_ne(remap, NULL);
+    add_seq_checked(&s1, 0, 200);
+
+    for (i=0; i<200; i++)
+        if (i % 3 != 0)
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_compact_remap(&s1, 0, remap), 0);
+    ck_assert_uint_eq(tssparse_remap_len(remap), 200);
+    check_sparse(&s1);
+
+    for (i=0; i<200; i++)
+    {
+        if (i % 3 == 0)
+            ck_assert_int_eq(*intsparse_get_nth(&s1, remap->items[i]), i);
+        else
+            ck_assert_int_eq(remap->items[i], -1);
+    }
+
+    /* the remap must start out empty */
+    ck_assert_int_eq(intsparse_compact_remap(&s1, 1, remap),
+                     TSSPARSE_EINVAL);
+    tssparse_remap_free(remap);
+
+    /* nothing to do, nothing in the remap */
+    remap = tssparse_remap_new();
+    ck_assert_ptr_ne(remap, NULL);
+    ck_assert_int_eq(intsparse_compact_remap(&s1, 1, remap), 0);
+    ck_assert_uint_eq(tssparse_remap_len(remap), 0);
+    tssparse_remap_free(remap);
+}
+END_TEST
+
+
+/*
+ * Test compacting an array of 1-byte objects, with holes spanning
+ * several bitmap words.
+ */
+START_TEST(test_compact_bytes)
+{
+    charsparse cs = TSSPARSE_INITIALIZER;
+    const int count = 1000;
+    int expected = 0;
+    int i;
+
+    ck_assert_uint_eq(sizeof(*cs.items), 1);
+
+    for (i=0; i<count; i++)
+    {
+        char c = (char)(i % 128);
+
+        ck_assert_int_eq(charsparse_add(&cs, &c), i);
+    }
+
+    /* leave a dense prefix, then a long hole, then every third item */
+    for (i=100; i<count; i++)
+        if (i < 500 || i % 3 != 0)
+            ck_assert_int_eq(charsparse_remove(&cs, i), 0);
+
+    ck_assert_int_eq(charsparse_compact(&cs, 0), 0);
+    ck_assert_int_eq(cs.len, cs.used_count);
+
+    for (i=0; i<count; i++)
+    {
+        if (i < 100 || (i >= 500 && i % 3 == 0))
+        {
+            ck_assert_ptr_ne(charsparse_get_nth(&cs, expected), NULL);
+            ck_assert_int_eq(*charsparse_get_nth(&cs, expected), i % 128);
+            expected++;
+        }
+    }
+
+    ck_assert_int_eq(expected, cs.len);
+    ck_assert_int_eq(charsparse_truncate(&cs, 0), 0);
+}
+END_TEST
+
+
+/* moved hook for the step-wise compaction tests: keep a model in sync */
+static void move_in_model(long from, long to, void *arg)
+{
+    int *model = arg;
+
+    ck_assert_int_ge(model[from], 0);
+    ck_assert_int_eq(model[to], -1);
+    model[to] = model[from];
+    model[from] = -1;
+}
+
+
+/* will_move hook for the step-wise compaction tests: the object hasn't
+ * moved yet */
+static void check_will_move(long from, long to, void *arg)
+{
+    int *model = arg;
+
+    ck_assert_int_ge(model[from], 0);
+    ck_assert_int_eq(model[to], -1);
+    ck_assert(tssparse_is_used(s1.used_map, from));
+    ck_assert(!tssparse_is_used(s1.used_map, to));
+}
+
+
+/* should_compact hook that never wants to compact */
+static int never_compact(long len, long used_count, void *arg)
+{
+    (void)len;
+    (void)used_count;
+    (void)arg;
+
+    return 0;
+}
+
+
+/*
+ * Test compacting a few steps at a time, with adds and removes in between,
+ * tracking where things go through the moved hook.
+ */
+START_TEST(test_compact_step)
+{
+    const int count = 1000;
+    int *model = malloc((size_t)count * sizeof(int));
+    struct tssparse_compact_ops ops = { NULL, move_in_model, NULL,
+                                        check_will_move };
+    int calls = 0;
+    int resizes;
+    int value;
+    int retval;
+    int i;
+
+    ck_assert_ptr_ne(model, NULL);
+    ops.arg = model;
+
+    add_seq_checked(&s1, 0, count);
+    ck_assert_int_eq(intsparse_next_free(&s1, &resizes), count);
+    for (i=0; i<count; i++)
+        model[i] = i;
+
+    for (i=0; i<count; i++)
+    {
+        if (i % 4 != 0)
+        {
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+            model[i] = -1;
+        }
+    }
+
+    do
+    {
+        retval = intsparse_compact_step(&s1, 16, &ops);
+        ck_assert_int_ge(retval, 0);
+        check_sparse(&s1);
+        calls++;
+
+        if (calls == 5)
+        {   /* make new holes behind and ahead of the compaction */
+            ck_assert_int_eq(intsparse_remove(&s1, 0), 0);
+            model[0] = -1;
+            ck_assert_int_eq(intsparse_remove(&s1, s1.len - 1), 0);
+            model[s1.len - 1] = -1;
+            check_sparse(&s1);
+        }
+        else if (calls == 10)
+        {   /* and fill one, where it was expected to go */
+            const long next = intsparse_next_free(&s1, &resizes);
+
+            ck_assert(!resizes);
+            value = 2 * count;
+            i = intsparse_add(&s1, &value);
+            ck_assert_int_eq(i, next);
+            model[i] = value;
+            check_sparse(&s1);
+        }
+    } while (retval == 1);
+
+    ck_assert(!s1.compacting);
+    ck_assert_int_eq(s1.len, s1.used_count);
+    ck_assert_int_gt(calls, 10);
+
+    for (i=0; i<count; i++)
+    {
+        if (model[i] >= 0)
+        {
+            ck_assert_int_lt(i, s1.len);
+            ck_assert_int_eq(*intsparse_get_nth(&s1, i), model[i]);
+        }
+        else
+            ck_assert(i >= s1.len || intsparse_get_nth(&s1, i) == NULL);
+    }
+
+    free(model);
+}
+END_TEST
+
+
+/*
+ * Test the should_compact hook, and that a full compaction finishes a
+ * step-wise one in progress.
+ */
+START_TEST(test_compact_step_policy)
+{
+    struct tssparse_compact_ops ops = { never_compact, NULL, NULL, NULL };
+    int i;
+
+    add_seq_checked(&s1, 0, 100);
+    for (i=0; i<50; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_compact_step(&s1, 1, &ops), 0);
+    ck_assert_int_eq(s1.len, 100);
+    ck_assert(!s1.compacting);
+
+    ck_assert_int_eq(intsparse_compact_step(&s1, 0, NULL), TSSPARSE_EINVAL);
+
+    /* the default policy wants to; the last item goes to the first hole */
+    ck_assert_int_eq(intsparse_compact_step(&s1, 1, NULL), 1);
+    ck_assert(s1.compacting);
+    ck_assert_int_eq(s1.len, 99);
+    ck_assert_int_eq(*intsparse_get_nth(&s1, 0), 99);
+    check_sparse(&s1);
+
+    ck_assert_int_eq(intsparse_compact(&s1, 0), 0);
+    ck_assert(!s1.compacting);
+    ck_assert_int_eq(s1.len, 50);
+    check_sparse(&s1);
+
+    ck_assert(!tssparse_compact_default_policy(100, 91, NULL));
+    ck_assert(tssparse_compact_default_policy(100, 90, NULL));
+    ck_assert(tssparse_compact_default_policy(11, 9, NULL));
+    ck_assert(!tssparse_compact_default_policy(INT_MAX, INT_MAX - 10, NULL));
+    ck_assert(tssparse_compact_default_policy(INT_MAX, INT_MAX / 2, NULL));
+}
+END_TEST
+
+
+/*
+ * Test that filling an array grows its capacity in chunks, while its
+ * length still grows one item at a time.
+ */
+START_TEST(test_grow_capacity)
+{
+    const int count = 100000;
+    int resizes = 0;
+    int i;
+
+    for (i=0; i<count; i++)
+    {
+        const int old_capacity = s1.capacity;
+
+        ck_assert_int_eq(intsparse_add(&s1, &i), i);
+        ck_assert_int_eq(s1.len, i+1);
+        ck_assert_int_ge(s1.capacity, s1.len);
+
+        if (s1.capacity != old_capacity)
+            resizes++;
+    }
+
+    /* growth is geometric; a linear growth would resize count times */
+    ck_assert_int_lt(resizes, 200);
+
+    /* cutting off most of the array shrinks the capacity back; leave
+     * plenty of holes in the part that gets cut off */
+    for (i=5; i<count; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_truncate(&s1, 10), 0);
+    ck_assert_int_eq(s1.len, 10);
+    ck_assert_int_eq(s1.used_count, 5);
+    ck_assert_int_lt(s1.capacity, count/2);
+    ck_assert_int_ge(s1.capacity, s1.len);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test many adds and removes, checking against a simple model.
+ */
+START_TEST(test_churn)
+{
+    const int count = 2000;
+    int *model = calloc((size_t)count, sizeof(int));
+    int i;
+
+    ck_assert_ptr_ne(model, NULL);
+    srand(1);
+
+    for (i=0; i<20*count; i++)
+    {
+        const int index = rand() % count;
+
+        if (index < s1.len && model[index])
+        {
+            ck_assert_int_eq(intsparse_remove(&s1, index), 0);
+            model[index] = 0;
+        }
+        else if (s1.used_count < count)
+        {
+            int added = intsparse_add(&s1, &i);
+
+            ck_assert_int_ge(added, 0);
+            ck_assert_int_lt(added, count);
+            ck_assert_int_eq(model[added], 0);
+            model[added] = 1;
+        }
+    }
+
+    check_sparse(&s1);
+
+    for (i=0; i<s1.len; i++)
+        ck_assert_int_eq(intsparse_get_nth(&s1, i) != NULL, model[i]);
+
+    free(model);
+}
+END_TEST
+
+
+/*
+ * Test that a paged array never moves its objects as it grows, and
+ * allocates whole pages.
+ */
+START_TEST(test_paged)
+{
+    int count = 10000;
+    int *first;
+    int i;
+
+    ck_assert_int_eq(intsparse_set_paged(&s1, 8), 0);
+
+    ck_assert_int_eq(intsparse_add(&s1, &count), 0);
+    first = intsparse_get_nth(&s1, 0);
+    ck_assert_ptr_ne(first, NULL);
+    ck_assert_ptr_eq(s1.items, NULL);
+    ck_assert_int_eq(s1.capacity, 256);
+
+    for (i=1; i<count; i++)
+    {
+        ck_assert_int_eq(intsparse_add(&s1, &i), i);
+        ck_assert_int_eq(s1.capacity % 256, 0);
+    }
+
+    ck_assert_ptr_eq(intsparse_get_nth(&s1, 0), first);
+    ck_assert_int_eq(*first, count);
+
+    for (i=1; i<count; i++)
+        ck_assert_int_eq(*intsparse_get_nth(&s1, i), i);
+
+    /* compacting moves objects across pages, and frees the empty ones */
+    for (i=1; i<count; i+=2)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_compact(&s1, 1), 0);
+    ck_assert_int_eq(s1.len, count/2);
+    ck_assert_int_lt(s1.capacity, count);
+    check_sparse(&s1);
+
+    ck_assert_ptr_eq(intsparse_get_nth(&s1, 0), first);
+    for (i=1; i<count/2; i++)
+        ck_assert_int_eq(*intsparse_get_nth(&s1, i), 2*i);
+}
+END_TEST
+
+
+/*
+ * Test that an array can only be made paged while it has no memory.
+ */
+START_TEST(test_set_paged)
+{
+    int value = 1;
+
+    ck_assert_int_eq(intsparse_set_paged(&s1, -1), TSSPARSE_EINVAL);
+    ck_assert_int_eq(intsparse_set_paged(&s1, TSSPARSE_MAX_PAGE_SHIFT + 1),
+                     TSSPARSE_EINVAL);
+
+    ck_assert_int_eq(intsparse_add(&s1, &value), 0);
+    ck_assert_int_eq(intsparse_set_paged(&s1, 4), TSSPARSE_EINVAL);
+    ck_assert_int_eq(s1.page_shift, 0);
+
+    ck_assert_int_eq(intsparse_truncate(&s1, 0), 0);
+    ck_assert_int_eq(intsparse_set_paged(&s1, 0), 0);
+    ck_assert_int_eq(intsparse_set_paged(&s1, 4), 0);
+
+    ck_assert_int_eq(intsparse_add(&s1, &value), 0);
+    ck_assert_int_eq(s1.capacity, 16);
+    ck_assert_int_eq(*intsparse_get_nth(&s1, 0), value);
+}
+END_TEST
+
+
+/*
+ * Test that adding several objects at once uses the same items as adding
+ * them one by one, growing the array only as needed.
+ */
+START_TEST(test_add_n)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    const long count = 1000;
+    int *objects = malloc((size_t)count * sizeof(int));
+    long *indices = malloc((size_t)count * sizeof(long));
+    long i;
+
+    ck_assert_ptr_ne(objects, NULL);
+    ck_assert_ptr_ne(indices, NULL);
+
+    for (i=0; i<count; i++)
+        objects[i] = (int)i;
+
+    /* holes scattered over a few words, and some in the last one */
+    ck_assert_int_eq(intsparse_add_n(&s1, objects, 300, NULL), 0);
+    for (i=0; i<300; i++)
+        ck_assert_int_eq(intsparse_add(&s2, &objects[i]), i);
+
+    for (i=0; i<300; i++)
+    {
+        if (i % 7 == 0 || i > 290)
+        {
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+            ck_assert_int_eq(intsparse_remove(&s2, i), 0);
+        }
+    }
+
+    ck_assert_int_eq(intsparse_add_n(&s1, objects, count, indices), 0);
+
+    for (i=0; i<count; i++)
+    {
+        ck_assert_int_eq(intsparse_add(&s2, &objects[i]), indices[i]);
+        ck_assert_int_eq(*intsparse_get_nth(&s1, indices[i]), objects[i]);
+    }
+
+    ck_assert_int_eq(s1.len, s2.len);
+    ck_assert_int_eq(s1.used_count, s2.used_count);
+    ck_assert_int_eq(s1.used_count, s1.len);
+    check_sparse(&s1);
+
+    ck_assert_int_eq(intsparse_add_n(&s1, objects, 0, indices), 0);
+    ck_assert_int_eq(intsparse_add_n(&s1, objects, -1, indices),
+                     TSSPARSE_EINVAL);
+    ck_assert_int_eq(s1.len, s2.len);
+
+    intsparse_truncate(&s2, 0);
+    free(indices);
+    free(objects);
+}
+END_TEST
+
+
+/*
+ * Test removing several items at once.
+ */
+START_TEST(test_remove_n)
+{
+    const long bad[] = { 3, 100 };
+    const long some[] = { 5, 70, 5, 64, 6 };
+    int i;
+
+    for (i=0; i<100; i++)
+        ck_assert_int_eq(intsparse_add(&s1, &i), i);
+
+    /* nothing is removed if any index is out of range */
+    ck_assert_int_eq(intsparse_remove_n(&s1, bad, 2), TSSPARSE_EINVAL);
+    ck_assert_int_eq(s1.used_count, 100);
+    ck_assert_ptr_ne(intsparse_get_nth(&s1, 3), NULL);
+
+    /* listing an item twice is fine */
+    ck_assert_int_eq(intsparse_remove_n(&s1, some, 5), 0);
+    ck_assert_int_eq(s1.used_count, 96);
+    check_sparse(&s1);
+
+    for (i=0; i<5; i++)
+        ck_assert_ptr_eq(intsparse_get_nth(&s1, some[i]), NULL);
+
+    ck_assert_int_eq(intsparse_add(&s1, &i), 5);
+    ck_assert_int_eq(intsparse_add(&s1, &i), 6);
+    ck_assert_int_eq(intsparse_add(&s1, &i), 64);
+}
+END_TEST
+
+
+/*
+ * Test adding groups of objects to adjacent items.
+ */
+START_TEST(test_add_range)
+{
+    int objects[200];
+    int i;
+
+    for (i=0; i<200; i++)
+    {
+        objects[i] = 1000 + i;
+        ck_assert_int_eq(intsparse_add(&s1, &i), i);
+    }
+
+    /* runs of 1, 2 and 5 free items, and 3 at the end */
+    ck_assert_int_eq(intsparse_remove(&s1, 10), 0);
+    ck_assert_int_eq(intsparse_remove(&s1, 20), 0);
+    ck_assert_int_eq(intsparse_remove(&s1, 21), 0);
+    for (i=62; i<67; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+    for (i=197; i<200; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 2), 20);
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 3), 62);
+    check_sparse(&s1);
+
+    /* too long for what's left; extends the run at the end */
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 5), 197);
+    ck_assert_int_eq(s1.len, 202);
+    check_sparse(&s1);
+
+    /* nothing free at the end; starts a new run there */
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 100), 202);
+    ck_assert_int_eq(s1.len, 302);
+    ck_assert_int_eq(s1.used_count, 302 - 3);
+    check_sparse(&s1);
+
+    for (i=0; i<100; i++)
+        ck_assert_int_eq(*intsparse_get_nth(&s1, 202 + i), 1000 + i);
+
+    ck_assert_int_eq(*intsparse_get_nth(&s1, 63), 1001);
+    ck_assert_ptr_eq(intsparse_get_nth(&s1, 65), NULL);
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 1), 10);
+
+    ck_assert_int_eq(intsparse_add_range(&s1, objects, 0), TSSPARSE_EINVAL);
+}
+END_TEST
+
+
+/*
+ * Test the fragmentation statistics.
+ */
+START_TEST(test_stats)
+{
+    struct tssparse_stats stats;
+    size_t before, reclaimable;
+    int i;
+
+    intsparse_get_stats(&s1, &stats);
+    ck_assert_int_eq(stats.len, 0);
+    ck_assert_int_eq(stats.hole_runs, 0);
+    ck_assert_uint_eq(stats.item_bytes, 0);
+    ck_assert_uint_eq(stats.reclaimable_bytes, 0);
+
+    for (i=0; i<1000; i++)
+        ck_assert_int_eq(intsparse_add(&s1, &i), i);
+
+    /* runs of 1, 3, 100 (across bitmap words) and 1 at the end */
+    ck_assert_int_eq(intsparse_remove(&s1, 0), 0);
+    for (i=10; i<13; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+    for (i=100; i<200; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+    ck_assert_int_eq(intsparse_remove(&s1, 999), 0);
+
+    intsparse_get_stats(&s1, &stats);
+    ck_assert_int_eq(stats.len, 1000);
+    ck_assert_int_eq(stats.used_count, 1000 - 105);
+    ck_assert_int_eq(stats.capacity, s1.capacity);
+    ck_assert_int_eq(stats.hole_count, 105);
+    ck_assert_int_eq(stats.hole_runs, 4);
+    ck_assert_int_eq(stats.longest_run, 100);
+    ck_assert_int_eq(stats.run_histogram[0], 2);
+    ck_assert_int_eq(stats.run_histogram[1], 1);
+    ck_assert_int_eq(stats.run_histogram[6], 1);
+    ck_assert_uint_eq(stats.item_bytes, (size_t)s1.capacity * sizeof(int));
+    ck_assert_uint_ge(stats.overhead_bytes, 16 * sizeof(uint64_t));
+
+    /* compaction frees what it says it would */
+    before = stats.item_bytes + stats.overhead_bytes;
+    reclaimable = stats.reclaimable_bytes;
+    ck_assert_uint_ge(reclaimable, 105 * sizeof(int));
+    ck_assert_int_eq(intsparse_compact(&s1, 1), 0);
+
+    intsparse_get_stats(&s1, &stats);
+    ck_assert_int_eq(stats.hole_count, 0);
+    ck_assert_int_eq(stats.hole_runs, 0);
+    ck_assert_uint_eq(stats.reclaimable_bytes, 0);
+    ck_assert_uint_eq(before - (stats.item_bytes + stats.overhead_bytes),
+                      reclaimable);
+}
+END_TEST
+
+
+/*
+ * Fill s1, then remove two large regions, one before and one after
+ * enabling the release of empty regions. Live objects must be untouched,
+ * and (on Linux) the released memory reads back as zeros.
+ */
+static void check_release(int page_shift)
+{
+    int count = 100000;
+    int retval;
+    int i;
+
+    ck_assert_int_eq(intsparse_set_paged(&s1, page_shift), 0);
+
+    for (i=0; i<count; i++)
+    {
+        int value = i + 1;
+
+        ck_assert_int_eq(intsparse_add(&s1, &value), i);
+    }
+
+    for (i=1000; i<50000; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    retval = intsparse_set_release(&s1, 1);
+    if (retval == TSSPARSE_ENOTSUP)
+        return;
+
+    ck_assert_int_eq(retval, 0);
+
+    for (i=50000; i<90000; i++)
+        ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    check_sparse(&s1);
+
+    for (i=0; i<count; i++)
+    {
+        const int *obj = intsparse_get_nth(&s1, i);
+
+        if (i < 1000 || i >= 90000)
+            ck_assert_int_eq(*obj, i + 1);
+        else
+            ck_assert_ptr_eq(obj, NULL);
+    }
+
+#ifdef __linux__
+    /* in the middle of a page of the array, and well inside each region,
+     * so on system pages of their own */
+    ck_assert_int_eq(*(int *)tssparse_item((struct _tssparse_abs *)&s1,
+                                           26624, sizeof(int)), 0);
+    ck_assert_int_eq(*(int *)tssparse_item((struct _tssparse_abs *)&s1,
+                                           71680, sizeof(int)), 0);
+#endif
+
+    /* released regions can be used again, at the same indices */
+    ck_assert_int_eq(intsparse_add(&s1, &count), 1000);
+    ck_assert_int_eq(*intsparse_get_nth(&s1, 1000), count);
+
+    ck_assert_int_eq(intsparse_set_release(&s1, 0), 0);
+    ck_assert_int_eq(s1.release_size, 0);
+}
+
+
+/*
+ * Test releasing the memory of empty regions in a contiguous array.
+ */
+START_TEST(test_release)
+{
+    check_release(0);
+}
+END_TEST
+
+
+/*
+ * Test releasing the memory of empty regions in a paged array.
+ */
+START_TEST(test_release_paged)
+{
+    check_release(12);
+}
+END_TEST
+
+
+Suite *tssparse_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tssparse");
+
+    tc = tcase_with_s1_create("free_slots");
+
+    tcase_add_test(tc, test_add_reuses_hole);
+    tcase_add_test(tc, test_add_lowest_hole);
+    tcase_add_test(tc, test_remove_twice);
+    tcase_add_test(tc, test_add_null);
+    tcase_add_test(tc, test_truncate_free_slots);
+    tcase_add_test(tc, test_compact_free_slots);
+    tcase_add_test(tc, test_compact_remap);
+    tcase_add_test(tc, test_compact_bytes);
+    tcase_add_test(tc, test_compact_step);
+    tcase_add_test(tc, test_compact_step_policy);
+    tcase_add_test(tc, test_grow_capacity);
+    tcase_add_test(tc, test_churn);
+    tcase_add_test(tc, test_paged);
+    tcase_add_test(tc, test_set_paged);
+    tcase_add_test(tc, test_add_n);
+    tcase_add_test(tc, test_remove_n);
+    tcase_add_test(tc, test_add_range);
+    tcase_add_test(tc, test_stats);
+    tcase_add_test(tc, test_release);
+    tcase_add_test(tc, test_release_paged);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tssparse_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
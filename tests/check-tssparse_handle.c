@@ -0,0 +1,196 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <check.h>
+
+#include <tssparse.h>
+
+#include "setupcheck.h"
+#include "setupsparse.h"
+
+
+/*
+ * Test that a handle finds its object, and that no generations are kept
+ * until a handle is requested.
+ */
+START_TEST(test_lookup)
+{
+    tssparse_handle h;
+    int value = 42;
+    int index;
+
+    add_seq_checked(&s1, 0, 10);
+    ck_assert_ptr_eq(s1.generations, NULL);
+
+    index = intsparse_add_handle(&s1, &value, &h);
+    ck_assert_int_eq(index, 10);
+    ck_assert_ptr_ne(s1.generations, NULL);
+    ck_assert_uint_eq(TSSPARSE_HANDLE_INDEX(h), 10);
+
+    ck_assert_ptr_eq(intsparse_lookup(&s1, h), &s1.items[10]);
+    ck_assert_int_eq(*intsparse_lookup(&s1, h), value);
+
+    ck_assert_int_eq(intsparse_get_handle(&s1, 3, &h), 0);
+    ck_assert_int_eq(*intsparse_lookup(&s1, h), 3);
+
+    ck_assert_int_eq(intsparse_get_handle(&s1, 11, &h), TSSPARSE_EINVAL);
+    ck_assert_int_eq(intsparse_remove(&s1, 5), 0);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 5, &h), TSSPARSE_ENOENT);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that a handle goes stale when its object is removed, even after
+ * the item is reused.
+ */
+START_TEST(test_stale_after_reuse)
+{
+    tssparse_handle old, new;
+    int value = 7;
+
+    add_seq_checked(&s1, 0, 5);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 2, &old), 0);
+
+    ck_assert_int_eq(intsparse_remove_handle(&s1, old), 0);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, old), NULL);
+    ck_assert_int_eq(intsparse_remove_handle(&s1, old), TSSPARSE_ENOENT);
+
+    ck_assert_int_eq(intsparse_add_handle(&s1, &value, &new), 2);
+    ck_assert_uint_eq(TSSPARSE_HANDLE_INDEX(new), TSSPARSE_HANDLE_INDEX(old));
+    ck_assert_uint_ne(TSSPARSE_HANDLE_GEN(new), TSSPARSE_HANDLE_GEN(old));
+
+    ck_assert_ptr_eq(intsparse_lookup(&s1, old), NULL);
+    ck_assert_int_eq(intsparse_remove_handle(&s1, old), TSSPARSE_ENOENT);
+    ck_assert_int_eq(*intsparse_lookup(&s1, new), value);
+    ck_assert_int_eq(s1.used_count, 5);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that compacting invalidates handles to the moved objects only.
+ */
+START_TEST(test_stale_after_compact)
+{
+    tssparse_handle before, moved;
+
+    add_seq_checked(&s1, 0, 20);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 0, &before), 0);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 15, &moved), 0);
+
+    ck_assert_int_eq(intsparse_remove(&s1, 10), 0);
+    ck_assert_int_eq(intsparse_compact(&s1, 1), 0);
+    ck_assert_int_eq(s1.len, 19);
+
+    ck_assert_int_eq(*intsparse_lookup(&s1, before), 0);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, moved), NULL);
+
+    /* the object is now one item earlier, under a new handle */
+    ck_assert_int_eq(intsparse_get_handle(&s1, 14, &moved), 0);
+    ck_assert_int_eq(*intsparse_lookup(&s1, moved), 15);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test that handles to items cut off the end stay stale when the array
+ * grows back.
+ */
+START_TEST(test_stale_after_truncate)
+{
+    tssparse_handle h, last;
+    int i;
+
+    add_seq_checked(&s1, 0, 10);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 9, &last), 0);
+
+    /* push the generation of one item well beyond the others */
+    for (i=0; i<5; i++)
+    {
+        ck_assert_int_eq(intsparse_remove(&s1, 8), 0);
+        ck_assert_int_eq(intsparse_add(&s1, &i), 8);
+    }
+    ck_assert_int_eq(intsparse_get_handle(&s1, 8, &h), 0);
+
+    ck_assert_int_eq(intsparse_truncate(&s1, 5), 0);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, h), NULL);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, last), NULL);
+
+    add_seq_checked(&s1, 5, 10);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, h), NULL);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, last), NULL);
+    ck_assert_int_eq(intsparse_remove_handle(&s1, h), TSSPARSE_ENOENT);
+
+    /* same when emptying the array completely */
+    ck_assert_int_eq(intsparse_get_handle(&s1, 9, &last), 0);
+    ck_assert_int_eq(intsparse_truncate(&s1, 0), 0);
+    ck_assert_ptr_eq(s1.generations, NULL);
+
+    add_seq_checked(&s1, 0, 10);
+    ck_assert_int_eq(intsparse_get_handle(&s1, 0, &h), 0);
+    ck_assert_ptr_eq(intsparse_lookup(&s1, last), NULL);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+Suite *tssparse_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tssparse_handle");
+
+    tc = tcase_with_s1_create("handle");
+
+    tcase_add_test(tc, test_lookup);
+    tcase_add_test(tc, test_stale_after_reuse);
+    tcase_add_test(tc, test_stale_after_compact);
+    tcase_add_test(tc, test_stale_after_truncate);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tssparse_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,209 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <check.h>
+
+#include <tssparse.h>
+
+#include "setupcheck.h"
+#include "setupsparse.h"
+
+
+/*
+ * Fill s1 with count items, then remove those for which keep() is false.
+ */
+static void fill_and_remove(int count, int (*keep)(int i))
+{
+    int i;
+
+    add_seq_checked(&s1, 0, count);
+
+    for (i=0; i<count; i++)
+        if (!keep(i))
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    check_sparse(&s1);
+}
+
+
+static int keep_every_tenth(int i) { return i % 10 == 0; }
+static int keep_none(int i) { (void)i; return 0; }
+static int keep_far_apart(int i) { return i == 3 || i == 200 || i == 999; }
+
+
+/*
+ * Test iterating over an empty array.
+ */
+START_TEST(test_next_empty)
+{
+    long i;
+    int visited = 0;
+    long indices[4];
+
+    ck_assert_int_eq(intsparse_next(&s1, 0), TSSPARSE_ENOENT);
+    ck_assert_int_eq(intsparse_next_batch(&s1, 0, indices, 4), 0);
+
+    TSSPARSE_FOREACH(intsparse, &s1, i)
+        visited++;
+
+    ck_assert_int_eq(visited, 0);
+
+    /* an array with only holes is just as empty */
+    fill_and_remove(100, keep_none);
+    ck_assert_int_eq(intsparse_next(&s1, 0), TSSPARSE_ENOENT);
+    ck_assert_int_eq(intsparse_next_batch(&s1, 0, indices, 4), 0);
+}
+END_TEST
+
+
+/*
+ * Test that next skips holes, including ones spanning whole words.
+ */
+START_TEST(test_next_skips_holes)
+{
+    fill_and_remove(1000, keep_far_apart);
+
+    ck_assert_int_eq(intsparse_next(&s1, 0), 3);
+    ck_assert_int_eq(intsparse_next(&s1, 3), 3);
+    ck_assert_int_eq(intsparse_next(&s1, 4), 200);
+    ck_assert_int_eq(intsparse_next(&s1, 201), 999);
+    ck_assert_int_eq(intsparse_next(&s1, 1000), TSSPARSE_ENOENT);
+    ck_assert_int_eq(intsparse_next(&s1, -5), 3);
+}
+END_TEST
+
+
+/*
+ * Test that foreach visits every used item exactly once, in order.
+ */
+START_TEST(test_foreach)
+{
+    int expected = 0;
+    long i;
+
+    fill_and_remove(1000, keep_every_tenth);
+
+    TSSPARSE_FOREACH(intsparse, &s1, i)
+    {
+        ck_assert_int_eq(i, expected);
+        ck_assert_int_eq(*intsparse_get_nth(&s1, i), i);
+        expected += 10;
+    }
+
+    ck_assert_int_eq(expected, 1000);
+}
+END_TEST
+
+
+/*
+ * Test removing items while iterating.
+ */
+START_TEST(test_foreach_remove)
+{
+    long i;
+
+    add_seq_checked(&s1, 0, 300);
+
+    TSSPARSE_FOREACH(intsparse, &s1, i)
+        if (i % 2)
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+
+    ck_assert_int_eq(s1.used_count, 150);
+    check_sparse(&s1);
+}
+END_TEST
+
+
+/*
+ * Test getting used indices in batches, resuming after each one.
+ */
+START_TEST(test_next_batch)
+{
+    long indices[7];
+    int expected = 0;
+    long from = 0;
+    int found;
+
+    fill_and_remove(1000, keep_every_tenth);
+
+    while ((found = intsparse_next_batch(&s1, from, indices, 7)) > 0)
+    {
+        int j;
+
+        ck_assert_int_le(found, 7);
+
+        for (j=0; j<found; j++)
+        {
+            ck_assert_int_eq(indices[j], expected);
+            expected += 10;
+        }
+
+        from = indices[found-1] + 1;
+    }
+
+    ck_assert_int_eq(found, 0);
+    ck_assert_int_eq(expected, 1000);
+
+    ck_assert_int_eq(intsparse_next_batch(&s1, 0, indices, -1),
+                     TSSPARSE_EINVAL);
+}
+END_TEST
+
+
+Suite *tssparse_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tssparse_iter");
+
+    tc = tcase_with_s1_create("iter");
+
+    tcase_add_test(tc, test_next_empty);
+    tcase_add_test(tc, test_next_skips_holes);
+    tcase_add_test(tc, test_foreach);
+    tcase_add_test(tc, test_foreach_remove);
+    tcase_add_test(tc, test_next_batch);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tssparse_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,441 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include <tssparse.h>
+
+#include "setupcheck.h"
+#include "setupsparse.h"
+
+
+#define COUNT 5000
+
+TSSPARSE_TYPEDEF(charsparse, char);
+
+
+static char path[] = "check-tssparse_save.XXXXXX";
+
+
+/*
+ * Create an empty temporary file for a test, and return a descriptor to
+ * it open for reading and writing.
+ */
+static int open_temp(void)
+{
+    int fd;
+
+    strcpy(path + sizeof(path) - 7, "XXXXXX");
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+
+    return fd;
+}
+
+
+/*
+ * Close and remove a test's temporary file.
+ */
+static void close_temp(int fd)
+{
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(unlink(path), 0);
+}
+
+
+/*
+ * Fill s1 with COUNT items, then remove some of them, leaving holes of
+ * several sizes.
+ */
+static void fill_with_holes(void)
+{
+    long i;
+
+    add_seq_checked(&s1, 0, COUNT);
+
+    for (i=0; i<COUNT; i++)
+        if (i % 3 == 0 || (i >= 1000 && i < 1300))
+            ck_assert_int_eq(intsparse_remove(&s1, i), 0);
+}
+
+
+/*
+ * Check that two tssparses have the same items at the same indices.
+ */
+static void check_same(intsparse *a, intsparse *b)
+{
+    long i;
+
+    check_sparse(a);
+    check_sparse(b);
+    ck_assert_int_eq(a->len, b->len);
+    ck_assert_int_eq(a->used_count, b->used_count);
+
+    for (i=0; i<a->len; i++)
+    {
+        if (intsparse_get_nth(a, i) == NULL)
+            ck_assert_ptr_eq(intsparse_get_nth(b, i), NULL);
+        else
+        {
+            ck_assert_ptr_ne(intsparse_get_nth(b, i), NULL);
+            ck_assert_int_eq(*intsparse_get_nth(a, i),
+                             *intsparse_get_nth(b, i));
+        }
+    }
+}
+
+
+/*
+ * Test saving and loading a snapshot. Every object must be back at its
+ * index, and the holes must be reused as before.
+ */
+START_TEST(test_save_load)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    int fd = open_temp();
+    int value = -1;
+
+    fill_with_holes();
+
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+
+    check_same(&s1, &s2);
+    ck_assert_int_eq(intsparse_add(&s2, &value), intsparse_add(&s1, &value));
+    check_same(&s1, &s2);
+
+    /* only loads into an empty array */
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), TSSPARSE_EINVAL);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test saving a snapshot without the holes, and several snapshots to the
+ * same file.
+ */
+START_TEST(test_save_compact)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    intsparse empty = TSSPARSE_INITIALIZER;
+    const long len = COUNT;
+    int fd = open_temp();
+    long i, j = 0;
+
+    fill_with_holes();
+
+    ck_assert_int_eq(intsparse_save(&s1, fd, TSSPARSE_SAVE_COMPACT), 0);
+    ck_assert_int_eq(intsparse_save(&empty, fd, 0), 0);
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+    ck_assert_int_eq(intsparse_save(&s1, fd, 2), TSSPARSE_EINVAL);
+
+    /* saving doesn't change the array */
+    ck_assert_int_eq(s1.len, len);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+
+    check_sparse(&s2);
+    ck_assert_int_eq(s2.len, s1.used_count);
+    ck_assert_int_eq(s2.used_count, s1.used_count);
+
+    /* same order as compacting */
+    for (i=0; i<s1.len; i++)
+        if (intsparse_get_nth(&s1, i) != NULL)
+            ck_assert_int_eq(*intsparse_get_nth(&s2, j++), s1.items[i]);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+    ck_assert_int_eq(s2.len, 0);
+    ck_assert_ptr_eq(s2.used_map, NULL);
+
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+    check_same(&s1, &s2);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test saving a snapshot without the holes, of an array whose minimum
+ * length is above its number of used items. It must load the same as the
+ * array compacted: as long as the minimum, with the extra items empty.
+ */
+START_TEST(test_save_compact_min_len)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    intsparse s3 = TSSPARSE_INITIALIZER;
+    int fd = open_temp();
+    int value = -1;
+    long min_len;
+    long i;
+
+    fill_with_holes();
+    min_len = s1.used_count + 100;
+    ck_assert_int_lt(min_len, s1.len);
+    ck_assert_int_eq(intsparse_setminlen(&s1, min_len), 0);
+
+    ck_assert_int_eq(intsparse_save(&s1, fd, TSSPARSE_SAVE_COMPACT), 0);
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+    ck_assert_int_eq(intsparse_load(&s3, fd), 0);
+
+    /* s3 is s1 as saved in full; compact it for real */
+    ck_assert_int_eq(intsparse_setminlen(&s3, min_len), 0);
+    ck_assert_int_eq(intsparse_compact(&s3, 1), 0);
+    ck_assert_int_eq(s3.len, min_len);
+
+    check_sparse(&s2);
+    ck_assert_int_eq(s2.len, min_len);
+    ck_assert_int_eq(s2.used_count, s1.used_count);
+
+    for (i=0; i<min_len; i++)
+    {
+        if (i < s1.used_count)
+            ck_assert_ptr_ne(intsparse_get_nth(&s2, i), NULL);
+        else
+            ck_assert_ptr_eq(intsparse_get_nth(&s2, i), NULL);
+    }
+
+    check_same(&s2, &s3);
+
+    /* the empty items are reused first */
+    ck_assert_int_eq(intsparse_add(&s2, &value), s1.used_count);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    ck_assert_int_eq(intsparse_setminlen(&s3, 0), 0);
+    ck_assert_int_eq(intsparse_truncate(&s3, 0), 0);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test saving from and loading into paged arrays.
+ */
+START_TEST(test_save_paged)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    intsparse s3 = TSSPARSE_INITIALIZER;
+    int fd = open_temp();
+
+    ck_assert_int_eq(intsparse_set_paged(&s1, 7), 0);
+    fill_with_holes();
+
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), 0);
+    check_same(&s1, &s2);
+
+    ck_assert_int_eq(intsparse_set_paged(&s3, 5), 0);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s3, fd), 0);
+    check_same(&s1, &s3);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    ck_assert_int_eq(intsparse_truncate(&s3, 0), 0);
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test that loading refuses a different object size, a corrupt or a
+ * truncated snapshot, and leaves the array empty.
+ */
+START_TEST(test_load_bad)
+{
+    charsparse cs = TSSPARSE_INITIALIZER;
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    const int bad = 12345;
+    int fd = open_temp();
+    off_t end;
+
+    fill_with_holes();
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+    end = lseek(fd, 0, SEEK_CUR);
+
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(charsparse_load(&cs, fd), TSSPARSE_EINVAL);
+
+    /* corrupt the last item */
+    ck_assert_int_eq(pwrite(fd, &bad, sizeof(bad), end - 8 - sizeof(bad)),
+                     sizeof(bad));
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), TSSPARSE_EINVAL);
+    ck_assert_int_eq(s2.len, 0);
+    ck_assert_ptr_eq(s2.items, NULL);
+
+    /* cut off the checksum */
+    ck_assert_int_eq(ftruncate(fd, end - 1), 0);
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s2, fd), TSSPARSE_EIO);
+    ck_assert_int_eq(s2.len, 0);
+    ck_assert_ptr_eq(s2.items, NULL);
+
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test mapping a snapshot. Changes must stay in memory, and growing must
+ * move the array out of the mapping.
+ */
+START_TEST(test_map)
+{
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    intsparse s3 = TSSPARSE_INITIALIZER;
+    int fd = open_temp();
+    int value = -1;
+    long holes, i;
+
+    fill_with_holes();
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+
+    ck_assert_int_eq(intsparse_map(&s2, path), 0);
+    ck_assert_ptr_ne(s2.mapping, NULL);
+    check_same(&s1, &s2);
+
+    /* changes in place, in the holes */
+    ck_assert_int_eq(intsparse_remove(&s2, 1), 0);
+    ck_assert_int_eq(intsparse_remove(&s1, 1), 0);
+    ck_assert_int_eq(intsparse_add(&s2, &value), 0);
+    ck_assert_int_eq(intsparse_add(&s1, &value), 0);
+    check_same(&s1, &s2);
+    ck_assert_ptr_ne(s2.mapping, NULL);
+
+    /* the file still has the snapshot as saved */
+    ck_assert_int_eq(lseek(fd, 0, SEEK_SET), 0);
+    ck_assert_int_eq(intsparse_load(&s3, fd), 0);
+    ck_assert_ptr_eq(intsparse_get_nth(&s3, 0), NULL);
+    ck_assert_int_eq(*intsparse_get_nth(&s3, 1), 1);
+
+    /* filling every hole makes it grow */
+    holes = s2.len - s2.used_count;
+
+    for (i=0; i<=holes; i++)
+        ck_assert_int_eq(intsparse_add(&s2, &value),
+                         intsparse_add(&s1, &value));
+
+    ck_assert_ptr_eq(s2.mapping, NULL);
+    check_same(&s1, &s2);
+
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    ck_assert_int_eq(intsparse_truncate(&s3, 0), 0);
+
+    /* refuses paged arrays */
+    ck_assert_int_eq(intsparse_set_paged(&s2, 4), 0);
+    ck_assert_int_eq(intsparse_map(&s2, path), TSSPARSE_EINVAL);
+
+    close_temp(fd);
+}
+END_TEST
+
+
+/*
+ * Test that truncating and compacting a mapped array unmap it.
+ */
+START_TEST(test_map_unmap)
+{
+    charsparse cs = TSSPARSE_INITIALIZER;
+    intsparse s2 = TSSPARSE_INITIALIZER;
+    int fd = open_temp();
+    long i;
+
+    fill_with_holes();
+    ck_assert_int_eq(intsparse_save(&s1, fd, 0), 0);
+
+    ck_assert_int_eq(charsparse_map(&cs, path), TSSPARSE_EINVAL);
+
+    ck_assert_int_eq(intsparse_map(&s2, path), 0);
+    ck_assert_int_eq(intsparse_truncate(&s2, 0), 0);
+    ck_assert_ptr_eq(s2.mapping, NULL);
+    ck_assert_ptr_eq(s2.used_map, NULL);
+
+    ck_assert_int_eq(intsparse_map(&s2, path), 0);
+    ck_assert_int_eq(intsparse_compact(&s2, 1), 0);
+    ck_assert_int_eq(intsparse_compact(&s1, 1), 0);
+    ck_assert_ptr_eq(s2.mapping, NULL);
+    check_same(&s1, &s2);
+
+    for (i=0; i<s2.len; i++)
+        ck_assert_int_eq(intsparse_remove(&s2, i), 0);
+
+    ck_assert_int_eq(intsparse_compact(&s2, 1), 0);
+    ck_assert_int_eq(s2.len, 0);
+    ck_assert_ptr_eq(s2.items, NULL);
+
+    close_temp(fd);
+}
+END_TEST
+
+
+Suite *tssparse_suite(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("tssparse_save");
+
+    tc = tcase_with_s1_create("snapshot");
+
+    tcase_add_test(tc, test_save_load);
+    tcase_add_test(tc, test_save_compact);
+    tcase_add_test(tc, test_save_compact_min_len);
+    tcase_add_test(tc, test_save_paged);
+    tcase_add_test(tc, test_load_bad);
+    tcase_add_test(tc, test_map);
+    tcase_add_test(tc, test_map_unmap);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int main(void)
+{
+    Suite *s = tssparse_suite();
+    int number_failed = run_tests(s);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,148 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <check.h>
+
+#include <tssparse.h>
+
+#include "setupsparse.h"
+
+
+intsparse s1;
+
+
+/*
+ * Check a tssparse's bookkeeping against its occupancy bitmap.
+ *
+ * used_count must match the bitmap, and bits beyond len must be clear.
+ * Every level of the free summary must match the level below it.
+ */
+void check_sparse(const intsparse *s)
+{
+    const uint64_t *below = s->used_map;
+    const uint64_t *level = s->free_summary;
+    uint64_t nothing_free = ~(uint64_t)0;
+    long below_words = (s->capacity + TSSPARSE_MAP_BITS - 1)
+                       / TSSPARSE_MAP_BITS;
+    int holes = 0;
+    long i;
+
+    ck_assert_int_ge(s->capacity, s->len);
+
+    for (i=0; i<s->len; i++)
+        if (!tssparse_is_used(s->used_map, i))
+            holes++;
+
+    ck_assert_int_eq(holes, s->len - s->used_count);
+
+    /* the rest of the last bitmap word must be clear */
+    for (i=s->len; i % TSSPARSE_MAP_BITS != 0; i++)
+        ck_assert(!tssparse_is_used(s->used_map, i));
+
+    while (below_words > 1)
+    {
+        const long words = (below_words + TSSPARSE_MAP_BITS - 1)
+                           / TSSPARSE_MAP_BITS;
+
+        for (i=0; i<below_words; i++)
+            ck_assert_int_eq(tssparse_is_used(level, i),
+                             below[i] != nothing_free);
+
+        below = level;
+        level += words;
+        below_words = words;
+        nothing_free = 0;
+    }
+}
+
+
+/*
+ * Add a sequence of ints to the specified tssparse and check the results.
+ *
+ * The sequence of ints ranges from start (inclusive) to stop (exclusive).
+ */
+void add_seq_checked(intsparse *s, int start, int stop)
+{
+    int i;
+
+    for (i=start; i<stop; i++)
+    {
+        const int old_used = s->used_count;
+        int index = intsparse_add(s, &i);
+
+        ck_assert_int_ge(index, 0);
+        ck_assert_int_lt(index, s->len);
+        ck_assert_int_eq(s->used_count, old_used+1);
+        ck_assert_int_eq(*intsparse_get_nth(s, index), i);
+    }
+}
+
+
+/*
+ * Reset s1 to an empty tssparse.
+ *
+ * To be used as the setup for a checked test fixture.
+ */
+static void new_s1(void)
+{
+    s1 = (intsparse)TSSPARSE_INITIALIZER;
+}
+
+
+/*
+ * Clear the s1 tssparse, freeing its memory.
+ *
+ * To be used as the teardown for a checked test fixture.
+ */
+static void del_s1(void)
+{
+    ck_assert_int_eq(intsparse_setminlen(&s1, 0), 0);
+    ck_assert_int_eq(intsparse_truncate(&s1, 0), 0);
+    ck_assert_ptr_eq(s1.items, NULL);
+    ck_assert_ptr_eq(s1.used_map, NULL);
+    ck_assert_ptr_eq(s1.free_summary, NULL);
+    ck_assert_ptr_eq(s1.generations, NULL);
+    ck_assert_ptr_eq(s1.pages, NULL);
+    ck_assert_ptr_eq(s1.mapping, NULL);
+    ck_assert(!s1.compacting);
+}
+
+
+/*
+ * Create a TCase with a tssparse s1 test fixture.
+ */
+TCase *tcase_with_s1_create(const char *name)
+{
+    TCase *tc = tcase_create(name);
+    tcase_add_checked_fixture(tc, new_s1, del_s1);
+
+    return tc;
+}
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=75 : */
@@ -0,0 +1,48 @@
+/*
+ * tsarray - type-safe dynamic array library
+ * Copyright 2012, 2015, 2016, 2017 Israel G. Lugo
+ *
+ * This file is part of tsarray.
+ *
+ * tsarray is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * tsarray is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with tsarray.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * For suggestions, feedback or bug reports: israel.lugo@lugosys.com
+ */
+
+
+#ifndef _SETUPSPARSE_H
+#define _SETUPSPARSE_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <check.h>
+
+#include <tssparse.h>
+
+
+TSSPARSE_TYPEDEF(intsparse, int);
+
+extern intsparse s1;
+
+void add_seq_checked(intsparse *s, int start, int stop);
+void check_sparse(const intsparse *s);
+TCase *tcase_with_s1_create(const char *name);
+
+
+#endif  /* _SETUPSPARSE_H */
+
+
+/* vim: set expandtab smarttab shiftwidth=4 softtabstop=4 tw=78 : */
@@ -10,14 +10,14 @@ intarray a1 = TSSPARSE_INITIALIZER;
 
 void print_array(void)
 {
-    int i;
+    long i;
 
-    printf("\nArray len=%d, used_count=%d, min_len=%d. Used items:\n",
+    printf("\nArray len=%ld, used_count=%ld, min_len=%ld. Used items:\n",
            a1.len, a1.used_count, a1.min_len);
     for (i = 0; i < a1.len; i++)
     {
-        if (a1.items[i].used)
-            printf("a1[%d] = %d\n", i, *intarray_get_nth(&a1, i));
+        if (intarray_get_nth(&a1, i) != NULL)
+            printf("a1[%ld] = %d\n", i, *intarray_get_nth(&a1, i));
     }
 }
 
@@ -35,9 +35,9 @@ int main(void)
     printf("Adding %d ints starting from 50\n", count);
     for (i = 50; i < 50 + count; i++)
     {
-        int idx = intarray_add(&a1, &i);
+        long idx = intarray_add(&a1, &i);
 
-        printf("added idx: %d\n", idx);
+        printf("added idx: %ld\n", idx);
     }
 
     print_array();